@@ -18,17 +18,33 @@ QT += multimedia declarative sql network
 HEADERS += codecs/codecs.h \
     codecs/codec.h \
     codecs/mad/codec_mad.h \
+    codecs/mad/convert_mad.h \
+    codecs/mad/xing_mad.h \
+    codecs/mad/probe_mad.h \
     tag.h \
     codecdevice.h \
     audiodevice.h \
+    frameindex.h \
     audioplayer.h \
     musicmodel.h \
     io.h \
     filereader.h \
     buffer.h \
+    spscqueue.h \
     medialibrary_file.h \
+    mediascanner.h \
+    mediawriter.h \
+    mediawatcher.h \
+    librarysnapshot.h \
+    searchindex.h \
+    searchmodel.h \
     medialibrary.h \
     medialibrary_s3.h \
+    s3lister.h \
+    s3catalog.h \
+    s3cache.h \
+    s3client.h \
+    mappedreader.h \
     s3reader.h \
     awsconfig.h \
     audioreader.h
@@ -37,17 +53,32 @@ SOURCES += main.cpp \
     codecs/codecs.cpp \
     codecs/codec.cpp \
     codecs/mad/codec_mad.cpp \
+    codecs/mad/convert_mad.cpp \
+    codecs/mad/xing_mad.cpp \
+    codecs/mad/probe_mad.cpp \
     tag.cpp \
     codecdevice.cpp \
     audiodevice.cpp \
+    frameindex.cpp \
     audioplayer.cpp \
     musicmodel.cpp \
     io.cpp \
     filereader.cpp \
     buffer.cpp \
     medialibrary_file.cpp \
+    mediascanner.cpp \
+    mediawriter.cpp \
+    mediawatcher.cpp \
+    librarysnapshot.cpp \
+    searchindex.cpp \
+    searchmodel.cpp \
     medialibrary.cpp \
     medialibrary_s3.cpp \
+    s3lister.cpp \
+    s3catalog.cpp \
+    s3cache.cpp \
+    s3client.cpp \
+    mappedreader.cpp \
     s3reader.cpp \
     awsconfig.cpp \
     audioreader.cpp
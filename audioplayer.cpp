@@ -28,13 +28,16 @@
 #include <QDebug>
 
 AudioPlayer::AudioPlayer(QObject *parent) :
-    QObject(parent), m_state(Stopped), m_audio(0), m_codec(0)
+    QObject(parent), m_state(Stopped), m_audio(0), m_codec(0),
+    m_queueDepth(0), m_decodePriority(QThread::HighPriority), m_trackStart(0)
 {
     qRegisterMetaType<State>("State");
 
     AudioImageProvider::setCurrentAudioPlayer(this);
 
     connect(MediaLibrary::instance(), SIGNAL(artwork(QImage)), this, SLOT(artworkReady(QImage)));
+    connect(MediaLibrary::instance(), SIGNAL(frameIndex(QString,FrameIndex)),
+            this, SLOT(frameIndexReady(QString,FrameIndex)));
 
     qDebug() << "constructing audioplayer" << this;
 }
@@ -55,6 +58,22 @@ void AudioPlayer::setFilename(const QString &filename)
     emit filenameChanged();
 }
 
+QString AudioPlayer::nextFilename() const
+{
+    return m_nextFilename;
+}
+
+void AudioPlayer::setNextFilename(const QString &filename)
+{
+    if (m_nextFilename == filename)
+        return;
+
+    m_nextFilename = filename;
+    emit nextFilenameChanged();
+
+    prepareNext();
+}
+
 AudioDevice* AudioPlayer::audioDevice() const
 {
     return m_audio;
@@ -65,6 +84,13 @@ AudioPlayer::State AudioPlayer::state() const
     return m_state;
 }
 
+int AudioPlayer::position() const
+{
+    if (!m_codec || !m_audio || !m_audio->output())
+        return 0;
+    return static_cast<int>((m_audio->output()->processedUSecs() - m_trackStart) / 1000);
+}
+
 void AudioPlayer::setAudioDevice(AudioDevice *device)
 {
     if (m_audio == device)
@@ -79,6 +105,33 @@ QImage AudioPlayer::currentArtwork() const
     return m_artwork;
 }
 
+int AudioPlayer::decodeQueueDepth() const
+{
+    return m_queueDepth;
+}
+
+void AudioPlayer::setDecodeQueueDepth(int blocks)
+{
+    m_queueDepth = blocks;
+}
+
+int AudioPlayer::decodePriority() const
+{
+    return m_decodePriority;
+}
+
+void AudioPlayer::setDecodePriority(int priority)
+{
+    if (priority < QThread::IdlePriority || priority > QThread::TimeCriticalPriority)
+        return;
+    m_decodePriority = priority;
+}
+
+int AudioPlayer::underruns() const
+{
+    return m_codec ? m_codec->underruns() : 0;
+}
+
 QString AudioPlayer::windowTitle() const
 {
     return QApplication::topLevelWidgets().first()->windowTitle();
@@ -126,13 +179,16 @@ void AudioPlayer::outputStateChanged(QAudio::State state)
         m_state = Paused;
         break;
     case QAudio::StoppedState:
-        if (m_codec->isOpen()) {
+        if (m_codec && m_codec->isOpen()) {
             m_state = Stopped;
 
             m_filename.clear();
             emit filenameChanged();
-        } else
+        } else {
+            // Tracks that ended before the next notify
+            advanceTracks(-1);
             m_state = Done;
+        }
         break;
     }
 
@@ -140,67 +196,215 @@ void AudioPlayer::outputStateChanged(QAudio::State state)
         emit stateChanged();
 }
 
+bool AudioPlayer::openSource(const QString &filename, AudioReader **reader, Codec **codec)
+{
+    QByteArray mime = MediaLibrary::instance()->mimeType(filename);
+    if (mime.isEmpty())
+        return false;
+
+    Codec* c = Codecs::instance()->createCodec(mime);
+    if (!c)
+        return false;
+
+    AudioReader* r = MediaLibrary::instance()->readerForFilename(filename);
+    if (!r->open(AudioReader::ReadOnly | AudioReader::Unbuffered)) {
+        delete c;
+        delete r;
+
+        return false;
+    }
+
+    *reader = r;
+    *codec = c;
+    return true;
+}
+
 void AudioPlayer::play()
 {
     if (!m_audio)
         return;
 
-    if (m_state == Playing)
-        stop();
+    if (m_state == Paused && m_codec) {
+        m_codec->resumeReader();
+        m_audio->output()->resume();
+        return;
+    }
+
+    // Restart on the same output if we have one, without reporting the
+    // stop of the previous track
+    if (m_audio->output()) {
+        m_audio->output()->blockSignals(true);
+        m_audio->output()->stop();
+        m_audio->output()->blockSignals(false);
+        m_state = Stopped;
+    }
+
+    delete m_codec;
+    m_codec = 0;
+    m_queuedFilename.clear();
+    m_boundaries.clear();
+
+    // The next track belongs to the old source, it is set again once the
+    // new one is open rather than prepared on a device about to go away
+    if (!m_nextFilename.isEmpty()) {
+        m_nextFilename.clear();
+        emit nextFilenameChanged();
+    }
+    m_indexRequests.clear();
+    m_trackStart = 0;
+
+    m_artwork = QImage();
+    MediaLibrary::instance()->requestArtwork(m_filename);
+
+    AudioReader* reader;
+    Codec* codec;
+    if (!openSource(m_filename, &reader, &codec))
+        return;
+
+    if (!m_audio->output())
+        m_audio->createOutput();
+    if (!m_audio->output()) {
+        delete codec;
+        delete reader;
+
+        return;
+    }
+
+    connect(m_audio->output(), SIGNAL(stateChanged(QAudio::State)),
+            this, SLOT(outputStateChanged(QAudio::State)), Qt::UniqueConnection);
+
+    codec->init(m_audio->output()->format());
+
+    m_codec = new CodecDevice(this);
+    m_codec->setCodec(codec);
+    m_codec->setInputReader(reader);
+    m_codec->setDecoderPriority(static_cast<QThread::Priority>(m_decodePriority));
+    if (m_queueDepth > 0)
+        m_codec->setQueueDepth(m_queueDepth);
+    connect(m_codec, SIGNAL(underrun()), this, SIGNAL(underrunsChanged()));
+    connect(m_codec, SIGNAL(trackBoundary(qint64)), this, SLOT(codecTrackBoundary(qint64)));
 
-    if (m_state == Stopped || m_state == Done || m_state == Playing) {
+    if (!m_codec->open(CodecDevice::ReadOnly | CodecDevice::Unbuffered)) {
         delete m_codec;
         m_codec = 0;
 
-        QByteArray mime = MediaLibrary::instance()->mimeType(m_filename);
-        if (mime.isEmpty())
-            return;
+        return;
+    }
+    emit underrunsChanged();
 
-        m_artwork = QImage();
-        MediaLibrary::instance()->requestArtwork(m_filename);
+    m_audio->output()->setNotifyInterval(100);
+    connect(m_audio->output(), SIGNAL(notify()), this, SLOT(intervalNotified()), Qt::UniqueConnection);
 
-        Codec* codec = Codecs::instance()->createCodec(mime);
-        if (!codec)
-            return;
+    m_audio->output()->start(m_codec);
 
-        AudioReader* reader = MediaLibrary::instance()->readerForFilename(m_filename);
-        if (!reader->open(FileReader::ReadOnly)) {
-            delete codec;
-            delete reader;
+    requestFrameIndex(m_filename, codec);
+}
 
-            return;
-        }
+void AudioPlayer::requestFrameIndex(const QString &filename, Codec *codec)
+{
+    m_indexRequests.insert(filename, codec->serial());
+    MediaLibrary::instance()->requestFrameIndex(filename);
+}
 
-        m_audio->createOutput();
-        connect(m_audio->output(), SIGNAL(stateChanged(QAudio::State)),
-                this, SLOT(outputStateChanged(QAudio::State)));
+void AudioPlayer::frameIndexReady(const QString &filename, const FrameIndex &index)
+{
+    const int serial = m_indexRequests.take(filename);
+    if (!serial || !m_codec || index.isEmpty())
+        return;
 
-        codec->init(m_audio->output()->format());
+    // The device checks that the codec is still around
+    m_codec->setFrameIndex(serial, index);
+}
 
-        m_codec = new CodecDevice(this);
-        m_codec->setCodec(codec);
-        m_codec->setInputReader(reader);
+void AudioPlayer::seek(int position)
+{
+    if (!m_codec || !m_codec->isOpen() || (m_state != Playing && m_state != Paused))
+        return;
 
-        if (!m_codec->open(CodecDevice::ReadOnly)) {
-            delete m_codec;
-            m_codec = 0;
+    // Decoding runs ahead of playback, the track being heard may already
+    // be behind the one being decoded. The seek goes into the one being
+    // heard, the decoder steps back to it and reports the boundary of the
+    // next one again. It only keeps one stream back, past that the seek
+    // goes into the last track spliced on.
+    int back = m_boundaries.size();
+    if (back == 1) {
+        m_queuedFilename = m_boundaries.takeFirst().second;
+    } else {
+        advanceTracks(-1);
+        back = 0;
+    }
 
-            return;
-        }
+    position = qMax(0, position);
+    m_codec->seekPosition(position, back);
 
-        m_audio->output()->setNotifyInterval(100);
-        connect(m_audio->output(), SIGNAL(notify()), this, SLOT(intervalNotified()));
+    m_trackStart = m_audio->output()->processedUSecs() - static_cast<qint64>(position) * 1000;
+    emit positionChanged(position);
+}
 
-        m_audio->output()->start(m_codec);
-    } else if (m_state == Paused) {
-        m_codec->resumeReader();
-        m_audio->output()->resume();
+void AudioPlayer::prepareNext()
+{
+    if (!m_codec || !m_codec->isOpen() || !m_audio || !m_audio->output())
+        return;
+
+    m_queuedFilename.clear();
+    if (m_nextFilename.isEmpty())
+        return;
+
+    AudioReader* reader;
+    Codec* codec;
+    if (!openSource(m_nextFilename, &reader, &codec))
+        return;
+
+    codec->init(m_audio->output()->format());
+
+    if (!m_codec->setNextSource(reader, codec)) {
+        delete codec;
+        delete reader;
+
+        return;
+    }
+
+    m_queuedFilename = m_nextFilename;
+    requestFrameIndex(m_nextFilename, codec);
+}
+
+void AudioPlayer::codecTrackBoundary(qint64 position)
+{
+    // The boundary is read from the device well before it is heard
+    const QAudioFormat format = m_audio->output()->format();
+    const qint64 rate = static_cast<qint64>(format.sampleRate()) * format.channelCount() * (format.sampleSize() / 8);
+    if (rate <= 0)
+        return;
+
+    m_boundaries.append(qMakePair((position * 1000000) / rate, m_queuedFilename));
+    m_queuedFilename.clear();
+}
+
+void AudioPlayer::advanceTracks(qint64 usecs)
+{
+    while (!m_boundaries.isEmpty() && (usecs < 0 || usecs >= m_boundaries.first().first)) {
+        QPair<qint64, QString> boundary = m_boundaries.takeFirst();
+        m_trackStart = boundary.first;
+
+        m_filename = boundary.second;
+        if (m_nextFilename == m_filename)
+            m_nextFilename.clear();
+
+        m_artwork = QImage();
+        MediaLibrary::instance()->requestArtwork(m_filename);
+
+        emit filenameChanged();
+        emit nextFilenameChanged();
+        emit trackChanged();
     }
 }
 
 void AudioPlayer::intervalNotified()
 {
     qint64 time = m_audio->output()->processedUSecs();
+    advanceTracks(time);
+
+    time -= m_trackStart;
     time /= 1000;
     emit positionChanged(time);
 }
@@ -21,19 +21,30 @@
 
 #include <QObject>
 #include <QDeclarativeImageProvider>
+#include <QList>
+#include <QPair>
+#include <QHash>
 #include "audiodevice.h"
 #include "tag.h"
+#include "frameindex.h"
 
 class CodecDevice;
+class AudioReader;
+class Codec;
 
 class AudioPlayer : public QObject
 {
     Q_OBJECT
 
     Q_PROPERTY(QString filename READ filename WRITE setFilename NOTIFY filenameChanged)
+    Q_PROPERTY(QString nextFilename READ nextFilename WRITE setNextFilename NOTIFY nextFilenameChanged)
     Q_PROPERTY(AudioDevice* audioDevice READ audioDevice WRITE setAudioDevice)
     Q_PROPERTY(State state READ state)
+    Q_PROPERTY(int position READ position NOTIFY positionChanged)
     Q_PROPERTY(QString windowTitle READ windowTitle WRITE setWindowTitle)
+    Q_PROPERTY(int decodeQueueDepth READ decodeQueueDepth WRITE setDecodeQueueDepth)
+    Q_PROPERTY(int decodePriority READ decodePriority WRITE setDecodePriority)
+    Q_PROPERTY(int underruns READ underruns NOTIFY underrunsChanged)
     Q_ENUMS(State)
 public:
     enum State { Stopped, Paused, Playing, Done };
@@ -44,40 +55,83 @@ public:
     QString filename() const;
     void setFilename(const QString& filename);
 
+    // Track to continue with when the current one ends. It is opened and
+    // spliced onto the current stream ahead of time so there is no gap.
+    // play() clears it, set it after play() has opened the new source.
+    QString nextFilename() const;
+    void setNextFilename(const QString& filename);
+
     AudioDevice* audioDevice() const;
     void setAudioDevice(AudioDevice* device);
 
     State state() const;
+    // Milliseconds into the current track
+    int position() const;
 
     QString windowTitle() const;
     void setWindowTitle(const QString& title);
 
     QImage currentArtwork() const;
 
+    // Applied to the decoder of the next track that starts playing.
+    // The priority is a QThread::Priority value.
+    int decodeQueueDepth() const;
+    void setDecodeQueueDepth(int blocks);
+    int decodePriority() const;
+    void setDecodePriority(int priority);
+
+    int underruns() const;
+
 signals:
     // ### fix this once QML accepts enums as arguments in signals
     void stateChanged();
     void artworkAvailable();
     void positionChanged(int position);
     void filenameChanged();
+    void nextFilenameChanged();
+    // The next track has started playing without the player stopping
+    void trackChanged();
+    void underrunsChanged();
 
 public slots:
     void play();
     void pause();
     void stop();
+    void seek(int position);
 
 private slots:
     void outputStateChanged(QAudio::State state);
     void artworkReady(const QImage& image);
     void intervalNotified();
+    void codecTrackBoundary(qint64 position);
+    void frameIndexReady(const QString& filename, const FrameIndex& index);
+
+private:
+    bool openSource(const QString& filename, AudioReader** reader, Codec** codec);
+    void prepareNext();
+    void requestFrameIndex(const QString& filename, Codec* codec);
+    void advanceTracks(qint64 usecs);
 
 private:
     State m_state;
 
     QString m_filename;
+    QString m_nextFilename;
     AudioDevice* m_audio;
 
     CodecDevice* m_codec;
+    int m_queueDepth;
+    int m_decodePriority;
+
+    // The filename handed to the decoder, and the ones it has started
+    // decoding along with when they will be heard
+    QString m_queuedFilename;
+    QList<QPair<qint64, QString> > m_boundaries;
+    qint64 m_trackStart;
+
+    // Codecs waiting for the frame index of their file
+    // Codec serials, a codec may be gone by the time its index arrives
+    QHash<QString, int> m_indexRequests;
 
     QImage m_artwork;
     QByteArray m_artworkHash;
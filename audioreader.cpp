@@ -30,3 +30,15 @@ void AudioReader::pause()
 void AudioReader::resume()
 {
 }
+
+bool AudioReader::canRestart() const
+{
+    return false;
+}
+
+bool AudioReader::restartAt(qint64 pos)
+{
+    Q_UNUSED(pos)
+
+    return false;
+}
@@ -29,6 +29,11 @@ public:
 
     virtual void pause();
     virtual void resume();
+
+    // Readers are sequential and leave QIODevice::seek() alone, this
+    // restarts reading at byte offset pos
+    virtual bool canRestart() const;
+    virtual bool restartAt(qint64 pos);
 };
 
 #endif // AUDIOREADER_H
@@ -0,0 +1,16 @@
+######################################################################
+# Benchmark for the media library database writer
+######################################################################
+
+TEMPLATE = app
+TARGET = 
+DEPENDPATH += .
+INCLUDEPATH += . ../..
+CONFIG += console
+CONFIG -= app_bundle
+QT -= gui
+QT += sql
+
+# Input
+SOURCES += main.cpp ../../mediawriter.cpp ../../librarysnapshot.cpp
+HEADERS += ../../mediawriter.h ../../librarysnapshot.h
@@ -0,0 +1,214 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mediawriter.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QVariant>
+#include <QFile>
+#include <QDir>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TRACKS 100000
+#define TRACKS_PER_ALBUM 10
+#define ALBUMS_PER_ARTIST 10
+#define BATCH 64 // matches the scanner batch size
+
+// The writes MediaData did before MediaWriter, kept here as the baseline:
+// autocommit, re-prepared statements and no indices
+
+static int legacyAddArtist(QSqlDatabase& database, const QString &name)
+{
+    QSqlQuery q(database);
+
+    q.prepare("select artists.id from artists where artists.artist = ? collate nocase");
+    q.bindValue(0, name);
+    if (q.exec() && q.next())
+        return q.value(0).toInt();
+
+    q.prepare("insert into artists (artist) values (?)");
+    q.bindValue(0, name);
+    if (!q.exec())
+        return -1;
+    return q.lastInsertId().toInt();
+}
+
+static int legacyAddAlbum(QSqlDatabase& database, int artistid, const QString &name)
+{
+    if (artistid <= 0)
+        return artistid;
+
+    QSqlQuery q(database);
+
+    q.prepare("select albums.id from albums where albums.album = ? and albums.artistid = ? collate nocase");
+    q.bindValue(0, name);
+    q.bindValue(1, artistid);
+    if (q.exec() && q.next())
+        return q.value(0).toInt();
+
+    q.prepare("insert into albums (album, artistid) values (?, ?)");
+    q.bindValue(0, name);
+    q.bindValue(1, artistid);
+    if (!q.exec())
+        return -1;
+    return q.lastInsertId().toInt();
+}
+
+static int legacyAddTrack(QSqlDatabase& database, int artistid, int albumid, const QString &name, const QString &filename, int trackno, int duration)
+{
+    if (artistid <= 0 || albumid <= 0)
+        return qMin(artistid, albumid);
+
+    QSqlQuery q(database);
+
+    q.prepare("select tracks.id from tracks, albums where tracks.track = ? and tracks.albumid = ? and albums.id = tracks.albumid and albums.artistid = ? collate nocase");
+    q.bindValue(0, name);
+    q.bindValue(1, albumid);
+    q.bindValue(2, artistid);
+    if (q.exec() && q.next())
+        return q.value(0).toInt();
+
+    q.prepare("insert into tracks (track, filename, trackno, artistid, albumid, duration) values (?, ?, ?, ?, ?, ?)");
+    q.bindValue(0, name);
+    q.bindValue(1, filename);
+    q.bindValue(2, trackno);
+    q.bindValue(3, artistid);
+    q.bindValue(4, albumid);
+    q.bindValue(5, duration);
+    if (!q.exec())
+        return -1;
+    return q.lastInsertId().toInt();
+}
+
+struct SyntheticTrack
+{
+    QString artist, album, title, filename;
+    int trackno;
+};
+
+static SyntheticTrack syntheticTrack(int i)
+{
+    const int album = i / TRACKS_PER_ALBUM;
+    const int artist = album / ALBUMS_PER_ARTIST;
+
+    SyntheticTrack track;
+    track.artist = QString("Artist %1").arg(artist);
+    track.album = QString("Album %1").arg(album);
+    track.title = QString("Track %1").arg(i);
+    track.trackno = i % TRACKS_PER_ALBUM + 1;
+    track.filename = QString("/music/%1/%2/%3.mp3").arg(track.artist, track.album, track.title);
+    return track;
+}
+
+static QSqlDatabase openDatabase(const QString& name)
+{
+    const QString path = QDir::temp().filePath(name);
+    QFile::remove(path);
+    QFile::remove(path + QLatin1String("-wal"));
+    QFile::remove(path + QLatin1String("-shm"));
+
+    QSqlDatabase database = QSqlDatabase::addDatabase("QSQLITE", name);
+    database.setDatabaseName(path);
+    if (!database.open()) {
+        printf("unable to open %s\n", qPrintable(path));
+        exit(1);
+    }
+    MediaWriter::createTables(database);
+    MediaWriter::createFilesTable(database);
+    return database;
+}
+
+static void report(const char* name, int tracks, qint64 msecs, qint64 baseline)
+{
+    printf("  %-8s %8lld ms %10.0f tracks/sec %8.2fx\n", name, msecs,
+           msecs ? tracks * 1000.0 / msecs : 0.0,
+           (baseline && msecs) ? double(baseline) / msecs : 1.0);
+}
+
+static int count(QSqlDatabase& database)
+{
+    QSqlQuery q(database);
+    if (q.exec(QLatin1String("select count(*) from tracks")) && q.next())
+        return q.value(0).toInt();
+    return -1;
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+
+    const QStringList args = app.arguments();
+    int tracks = TRACKS;
+    bool skipLegacy = false;
+    for (int i = 1; i < args.size(); ++i) {
+        if (args.at(i) == QLatin1String("--no-legacy"))
+            skipLegacy = true;
+        else if (args.at(i).toInt() > 0)
+            tracks = args.at(i).toInt();
+    }
+
+    printf("inserting %d synthetic tracks\n", tracks);
+
+    QElapsedTimer timer;
+    qint64 baseline = 0;
+    bool ok = true;
+
+    if (!skipLegacy) {
+        QSqlDatabase database = openDatabase(QLatin1String("dbinsert-legacy.db"));
+        timer.start();
+        for (int i = 0; i < tracks; ++i) {
+            const SyntheticTrack t = syntheticTrack(i);
+            const int artistid = legacyAddArtist(database, t.artist);
+            const int albumid = legacyAddAlbum(database, artistid, t.album);
+            legacyAddTrack(database, artistid, albumid, t.title, t.filename, t.trackno, 180000);
+        }
+        baseline = timer.elapsed();
+        report("legacy", tracks, baseline, 0);
+        ok = ok && count(database) == tracks;
+    }
+
+    {
+        QSqlDatabase database = openDatabase(QLatin1String("dbinsert-writer.db"));
+        MediaWriter::configure(database);
+        MediaWriter::createIndices(database);
+        MediaWriter writer(database);
+
+        timer.start();
+        for (int i = 0; i < tracks; i += BATCH) {
+            writer.begin();
+            const int end = qMin(tracks, i + BATCH);
+            for (int j = i; j < end; ++j) {
+                const SyntheticTrack t = syntheticTrack(j);
+                const int artistid = writer.addArtist(t.artist);
+                const int albumid = writer.addAlbum(artistid, t.album);
+                writer.addTrack(artistid, albumid, t.title, t.filename, t.trackno, 180000);
+            }
+            writer.commit();
+        }
+        report("writer", tracks, timer.elapsed(), baseline);
+        ok = ok && count(database) == tracks;
+    }
+
+    if (!ok)
+        printf("track count mismatch\n");
+    return ok ? 0 : 1;
+}
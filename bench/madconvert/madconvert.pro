@@ -0,0 +1,22 @@
+######################################################################
+# Micro-benchmark for the mad PCM conversion kernels
+######################################################################
+
+TEMPLATE = app
+TARGET = 
+DEPENDPATH += .
+INCLUDEPATH += . ../..
+CONFIG += console
+CONFIG -= app_bundle
+QT -= gui
+
+mac {
+    INCLUDEPATH += /opt/local/include
+    LIBS += -L/opt/local/lib
+}
+
+# Input
+SOURCES += main.cpp ../../codecs/mad/convert_mad.cpp
+HEADERS += ../../codecs/mad/convert_mad.h
+
+LIBS += -lmad
@@ -0,0 +1,181 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "codecs/mad/convert_mad.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QByteArray>
+#include <QStringList>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BLOCKS 64
+#define ROUNDS 200
+
+// The per sample loop CodecMad used before the kernels, kept here as the baseline
+
+static signed short MadFixedToSshort(mad_fixed_t Fixed)
+{
+    if(Fixed>=MAD_F_ONE)
+        return(SHRT_MAX);
+    if(Fixed<=-MAD_F_ONE)
+        return(-SHRT_MAX);
+
+    Fixed=Fixed>>(MAD_F_FRACBITS-15);
+    return((signed short)Fixed);
+}
+
+static signed int MadFixedToInt(mad_fixed_t Fixed)
+{
+    if(Fixed>=MAD_F_ONE)
+        return(INT_MAX);
+    if(Fixed<=-MAD_F_ONE)
+        return(-INT_MAX);
+
+    Fixed=Fixed>>(MAD_F_FRACBITS-23);
+    return((signed int)Fixed);
+}
+
+static char* legacy16(const mad_pcm* pcm, char* outptr)
+{
+    signed short sample;
+    for (unsigned short i = 0; i < pcm->length; ++i) {
+        sample = MadFixedToSshort(pcm->samples[0][i]);
+        *(outptr++) = sample & 0xff;
+        *(outptr++) = sample >> 8;
+
+        if (pcm->channels > 1)
+            sample = MadFixedToSshort(pcm->samples[1][i]);
+
+        *(outptr++) = sample & 0xff;
+        *(outptr++) = sample >> 8;
+    }
+    return outptr;
+}
+
+static char* legacy24(const mad_pcm* pcm, char* outptr)
+{
+    signed int sample;
+    for (unsigned short i = 0; i < pcm->length; ++i) {
+        sample = MadFixedToInt(pcm->samples[0][i]);
+        *(outptr++) = sample & 0xff;
+        *(outptr++) = (sample >> 8) & 0xff;
+        *(outptr++) = sample >> 16;
+
+        if (pcm->channels > 1)
+            sample = MadFixedToInt(pcm->samples[1][i]);
+
+        *(outptr++) = sample & 0xff;
+        *(outptr++) = (sample >> 8) & 0xff;
+        *(outptr++) = sample >> 16;
+    }
+    return outptr;
+}
+
+static void fillBlocks(QVector<mad_pcm>& blocks)
+{
+    srand(1);
+    for (int b = 0; b < blocks.size(); ++b) {
+        mad_pcm& pcm = blocks[b];
+        pcm.samplerate = 44100;
+        pcm.channels = 2;
+        pcm.length = 1152;
+        for (int ch = 0; ch < 2; ++ch) {
+            for (int i = 0; i < 1152; ++i) {
+                // Mostly in range with the occasional clipped sample
+                mad_fixed_t v = (rand() % (2 * MAD_F_ONE)) - MAD_F_ONE;
+                if (rand() % 64 == 0)
+                    v = (v < 0) ? -MAD_F_ONE - (rand() % 1024) : MAD_F_ONE + (rand() % 1024);
+                pcm.samples[ch][i] = v;
+            }
+        }
+    }
+}
+
+static double report(const char* name, qint64 nsecs, qint64 baseline)
+{
+    const double samples = double(BLOCKS) * ROUNDS * 1152 * 2;
+    const double perSample = double(nsecs) / samples;
+    printf("  %-10s %8.3f ns/sample %6.2fx\n", name, perSample, baseline ? double(baseline) / nsecs : 1.0);
+    return perSample;
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QVector<mad_pcm> blocks(BLOCKS);
+    fillBlocks(blocks);
+
+    const char* formatNames[] = { "int16", "int24", "int32", "float" };
+    QByteArray reference(1152 * 8, '\0'), out(1152 * 8, '\0');
+    QElapsedTimer timer;
+    bool identical = true;
+
+    printf("best kernel: %s\n", MadConvert::kernelName(MadConvert::kernel()));
+
+    for (int f = MadConvert::Int16; f <= MadConvert::Float; ++f) {
+        const MadConvert::Format format = static_cast<MadConvert::Format>(f);
+        printf("%s\n", formatNames[f]);
+
+        qint64 baseline = 0;
+        if (format == MadConvert::Int16 || format == MadConvert::Int24) {
+            timer.start();
+            for (int r = 0; r < ROUNDS; ++r) {
+                for (int b = 0; b < BLOCKS; ++b) {
+                    if (format == MadConvert::Int16)
+                        legacy16(&blocks.at(b), out.data());
+                    else
+                        legacy24(&blocks.at(b), out.data());
+                }
+            }
+            baseline = timer.nsecsElapsed();
+            report("legacy", baseline, 0);
+        }
+
+        const MadConvertFunc scalar = MadConvert::function(format, MadConvert::Scalar);
+        for (int k = MadConvert::Scalar; k <= MadConvert::AVX2; ++k) {
+            const MadConvert::Kernel kernel = static_cast<MadConvert::Kernel>(k);
+            const MadConvertFunc func = MadConvert::function(format, kernel);
+            if (!func)
+                continue;
+
+            timer.start();
+            for (int r = 0; r < ROUNDS; ++r) {
+                for (int b = 0; b < BLOCKS; ++b)
+                    func(blocks.at(b).samples[0], blocks.at(b).samples[1], 1152, out.data());
+            }
+            const qint64 elapsed = timer.nsecsElapsed();
+            report(MadConvert::kernelName(kernel), elapsed, baseline);
+
+            for (int b = 0; b < BLOCKS; ++b) {
+                scalar(blocks.at(b).samples[0], blocks.at(b).samples[1], 1152, reference.data());
+                func(blocks.at(b).samples[0], blocks.at(b).samples[1], 1152, out.data());
+                if (reference != out) {
+                    printf("  %s output differs from scalar\n", MadConvert::kernelName(kernel));
+                    identical = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    return identical ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "searchindex.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QVector>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TRACKS 100000
+#define TRACKS_PER_ALBUM 10
+#define ALBUMS_PER_ARTIST 10
+#define LIMIT 200 // what SearchModel asks for
+#define RUNS 20
+#define TARGET_MS 10
+
+// Names made of syllables so that words share prefixes and trigrams the
+// way real names do, unlike "Track 123"
+static const char* const s_syllables[] = {
+    "a", "an", "ba", "be", "ca", "co", "da", "de", "el", "en", "fa", "go", "ha", "in", "ka",
+    "la", "li", "ma", "mo", "na", "ne", "o", "or", "pa", "ra", "re", "ri", "sa", "so", "ta",
+    "te", "th", "to", "u", "va", "ve", "wa", "ya", "ze", "zu"
+};
+#define SYLLABLES int(sizeof(s_syllables) / sizeof(s_syllables[0]))
+
+static QString syntheticName(int words)
+{
+    QString name;
+    for (int w = 0; w < words; ++w) {
+        if (w)
+            name += QLatin1Char(' ');
+        const int syllables = 1 + qrand() % 4;
+        for (int s = 0; s < syllables; ++s)
+            name += QLatin1String(s_syllables[qrand() % SYLLABLES]);
+    }
+    return name;
+}
+
+// Every prefix of each query, as typed
+static QStringList keystrokes(const QStringList& queries)
+{
+    QStringList typed;
+    foreach(const QString& query, queries) {
+        for (int i = 1; i <= query.size(); ++i)
+            typed.append(query.left(i));
+    }
+    return typed;
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+
+    const QStringList args = app.arguments();
+    int tracks = TRACKS;
+    if (args.size() > 1 && args.at(1).toInt() > 0)
+        tracks = args.at(1).toInt();
+
+    qsrand(1);
+
+    SearchIndex index;
+    index.reserve(tracks);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QString artist, album;
+    for (int i = 0; i < tracks; ++i) {
+        if (i % (TRACKS_PER_ALBUM * ALBUMS_PER_ARTIST) == 0)
+            artist = syntheticName(1 + qrand() % 2);
+        if (i % TRACKS_PER_ALBUM == 0)
+            album = syntheticName(1 + qrand() % 3);
+        index.insert(i + 1, artist, album, syntheticName(1 + qrand() % 4));
+    }
+    printf("indexed %d synthetic tracks in %lld ms\n", tracks, timer.elapsed());
+
+    QStringList queries;
+    queries << QLatin1String("a") << QLatin1String("t") << QLatin1String("ma")
+            << QLatin1String("bela") << QLatin1String("the lira") << QLatin1String("o ra")
+            << QLatin1String("zuzuzu") << QLatin1String("xq");
+    const QStringList typed = keystrokes(queries);
+
+    bool ok = true;
+    printf("  %-10s %8s %8s %8s\n", "query", "matches", "avg ms", "max ms");
+    foreach(const QString& query, typed) {
+        qint64 total = 0, worst = 0;
+        int matches = 0;
+        for (int run = 0; run < RUNS; ++run) {
+            QElapsedTimer t;
+            t.start();
+            matches = index.search(query, LIMIT).size();
+            const qint64 elapsed = t.nsecsElapsed();
+            total += elapsed;
+            worst = qMax(worst, elapsed);
+        }
+
+        const double avg = total / (RUNS * 1000000.0);
+        const double max = worst / 1000000.0;
+        printf("  %-10s %8d %8.2f %8.2f%s\n", qPrintable(query), matches, avg, max,
+               max > TARGET_MS ? "  over target" : "");
+        if (max > TARGET_MS)
+            ok = false;
+    }
+
+    printf(ok ? "every query under %d ms\n" : "some queries over %d ms\n", TARGET_MS);
+    return ok ? 0 : 1;
+}
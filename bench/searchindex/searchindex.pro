@@ -0,0 +1,15 @@
+######################################################################
+# Benchmark for the search index
+######################################################################
+
+TEMPLATE = app
+TARGET = 
+DEPENDPATH += .
+INCLUDEPATH += . ../..
+CONFIG += console
+CONFIG -= app_bundle
+QT -= gui
+
+# Input
+SOURCES += main.cpp ../../searchindex.cpp
+HEADERS += ../../searchindex.h
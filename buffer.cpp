@@ -17,21 +17,112 @@
 */
 
 #include "buffer.h"
+#include <QMutexLocker>
 #include <QtAlgorithms>
+#include <string.h>
 
-Buffer::Buffer()
-    : m_size(0)
+#define BUFFER_RING_MIN 16
+
+BufferPool::BufferPool(int chunkSize, int maxFree)
+    : m_chunkSize(chunkSize), m_maxFree(maxFree)
+{
+}
+
+BufferPool::~BufferPool()
+{
+    qDeleteAll(m_free);
+}
+
+int BufferPool::chunkSize() const
+{
+    return m_chunkSize;
+}
+
+QByteArray* BufferPool::acquire()
+{
+    QByteArray* chunk = 0;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_free.isEmpty()) {
+            chunk = m_free.last();
+            m_free.pop_back();
+        }
+    }
+    if (!chunk)
+        chunk = new QByteArray;
+
+    // Growing back to the chunk size reuses the existing allocation
+    chunk->resize(m_chunkSize);
+    return chunk;
+}
+
+void BufferPool::release(QByteArray *chunk)
+{
+    if (!chunk)
+        return;
+
+    // A chunk that was shrunk far enough for Qt to reallocate it would have
+    // to grow again in acquire(), it is cheaper to let it go
+    if (chunk->capacity() >= m_chunkSize) {
+        QMutexLocker locker(&m_mutex);
+        if (m_free.size() < m_maxFree) {
+            m_free.append(chunk);
+            return;
+        }
+    }
+    delete chunk;
+}
+
+Buffer::Buffer(BufferPool* pool)
+    : m_pool(pool), m_head(0), m_count(0), m_offset(0), m_size(0)
 {
 }
 
 Buffer::~Buffer()
 {
-    qDeleteAll(m_subs);
+    clear();
+}
+
+void Buffer::setPool(BufferPool *pool)
+{
+    m_pool = pool;
+}
+
+BufferPool* Buffer::pool() const
+{
+    return m_pool;
+}
+
+void Buffer::releaseChunk(QByteArray *chunk)
+{
+    if (m_pool)
+        m_pool->release(chunk);
+    else
+        delete chunk;
+}
+
+void Buffer::grow()
+{
+    const int oldcap = m_ring.size();
+    QVector<QByteArray*> ring(qMax(oldcap * 2, BUFFER_RING_MIN));
+    for (int i = 0; i < m_count; ++i)
+        ring[i] = m_ring.at((m_head + i) % oldcap);
+    m_ring = ring;
+    m_head = 0;
 }
 
 void Buffer::add(QByteArray *sub)
 {
-    m_subs.append(sub);
+    if (sub->isEmpty()) {
+        releaseChunk(sub);
+        return;
+    }
+
+    if (m_count == m_ring.size())
+        grow();
+
+    m_ring[(m_head + m_count) % m_ring.size()] = sub;
+    ++m_count;
     m_size += sub->size();
 }
 
@@ -47,29 +138,70 @@ bool Buffer::isEmpty() const
 
 void Buffer::clear()
 {
-    qDeleteAll(m_subs);
-    m_subs.clear();
+    while (m_count > 0) {
+        releaseChunk(m_ring.at(m_head));
+        m_head = (m_head + 1) % m_ring.size();
+        --m_count;
+    }
+    m_head = 0;
+    m_offset = 0;
     m_size = 0;
 }
 
-QByteArray Buffer::read(int size)
-{
-    QByteArray ret;
-    QByteArray* cur;
-    QLinkedList<QByteArray*>::Iterator it = m_subs.begin();
-    while (it != m_subs.end()) {
-        cur = *it;
-        if (ret.size() + cur->size() <= size)
-            ret += *cur;
-        else {
-            int rem = size - ret.size();
-            ret += cur->left(rem);
-            *cur = cur->mid(rem);
-            break;
+int Buffer::readInto(char *data, int size)
+{
+    int done = 0;
+    while (done < size && m_count > 0) {
+        QByteArray* cur = m_ring.at(m_head);
+        const int avail = cur->size() - m_offset;
+        const int n = qMin(avail, size - done);
+        memcpy(data + done, cur->constData() + m_offset, n);
+        done += n;
+
+        if (n == avail) {
+            releaseChunk(cur);
+            m_head = (m_head + 1) % m_ring.size();
+            --m_count;
+            m_offset = 0;
+        } else {
+            m_offset += n;
+        }
+    }
+    m_size -= done;
+    return done;
+}
+
+int Buffer::peek(char *data, int size) const
+{
+    int done = 0;
+    int offset = m_offset;
+    for (int i = 0; i < m_count && done < size; ++i) {
+        const QByteArray* cur = m_ring.at((m_head + i) % m_ring.size());
+        const int n = qMin(cur->size() - offset, size - done);
+        memcpy(data + done, cur->constData() + offset, n);
+        done += n;
+        offset = 0;
+    }
+    return done;
+}
+
+int Buffer::skip(int size)
+{
+    int done = 0;
+    while (done < size && m_count > 0) {
+        QByteArray* cur = m_ring.at(m_head);
+        const int avail = cur->size() - m_offset;
+        if (avail <= size - done) {
+            done += avail;
+            releaseChunk(cur);
+            m_head = (m_head + 1) % m_ring.size();
+            --m_count;
+            m_offset = 0;
+        } else {
+            m_offset += size - done;
+            done = size;
         }
-        delete cur;
-        it = m_subs.erase(it);
     }
-    m_size -= ret.size();
-    return ret;
+    m_size -= done;
+    return done;
 }
@@ -20,23 +20,62 @@
 #define BUFFER_H
 
 #include <QByteArray>
-#include <QLinkedList>
+#include <QVector>
+#include <QMutex>
 
+// Recycles chunk allocations between a producer (typically a job in the IO thread)
+// and the Buffer that consumes them. Chunks keep their capacity while in the pool.
+class BufferPool
+{
+public:
+    BufferPool(int chunkSize, int maxFree);
+    ~BufferPool();
+
+    int chunkSize() const;
+
+    QByteArray* acquire();
+    void release(QByteArray* chunk);
+
+private:
+    QMutex m_mutex;
+    QVector<QByteArray*> m_free;
+    int m_chunkSize;
+    int m_maxFree;
+};
+
+// A ring of chunks with a read offset into the first one. Chunks are never
+// copied or split; consumed chunks go back to the pool (or are deleted if
+// there is no pool).
 class Buffer
 {
 public:
-    Buffer();
+    Buffer(BufferPool* pool = 0);
     ~Buffer();
 
+    void setPool(BufferPool* pool);
+    BufferPool* pool() const;
+
     void add(QByteArray* sub);
     void clear();
 
     bool isEmpty() const;
     int size() const;
-    QByteArray read(int size);
+
+    int readInto(char* data, int size);
+    int peek(char* data, int size) const;
+    int skip(int size);
 
 private:
-    QLinkedList<QByteArray*> m_subs;
+    void grow();
+    void releaseChunk(QByteArray* chunk);
+
+private:
+    BufferPool* m_pool;
+
+    QVector<QByteArray*> m_ring;
+    int m_head;
+    int m_count;
+    int m_offset;
     int m_size;
 };
 
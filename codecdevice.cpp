@@ -20,19 +20,351 @@
 #include "audioreader.h"
 #include "codecs/codec.h"
 #include <QApplication>
+#include <QList>
 #include <QDebug>
 
-#define CODEC_BUFFER_MIN (16384 * 4)
-#define CODEC_BUFFER_MAX (16384 * 50)
+#define CODEC_QUEUE_DEPTH 32
 #define CODEC_INPUT_READ 8192
 
+// Queued between the last block of one stream and the first of the next
+static QByteArray s_trackBoundary;
+// Queued ahead of the first block decoded after a seek
+static QByteArray s_seekDone;
+
+// Lives in the decoder thread together with the reader and the codec. Keeps
+// the device's queue topped up and goes idle when it is full or the reader
+// has nothing to give; the device wakes it up again below the low watermark,
+// the reader through readyRead(). Owns the readers and codecs it is given.
+class CodecDecoder : public QObject
+{
+    Q_OBJECT
+public:
+    CodecDecoder(CodecDevice* device, AudioReader* input, Codec* codec);
+    ~CodecDecoder();
+
+public slots:
+    void decode();
+
+    void pauseInput();
+    void resumeInput();
+
+    void setNext(QObject* input, QObject* codec);
+    void seek(int position, int boundariesRead);
+    void setFrameIndex(int serial, const FrameIndex& index);
+
+private slots:
+    void codecOutput(QByteArray* output);
+
+private:
+    void setSource(AudioReader* input, Codec* codec);
+    void attach();
+    bool stepBack();
+    void enqueue(QByteArray* block);
+    bool flushPending();
+    void finish();
+    void releaseBlock(QByteArray* block);
+
+private:
+    CodecDevice* m_device;
+    BufferPool* m_pool;
+    QByteArray m_inputChunk;
+
+    AudioReader* m_input;
+    Codec* m_codec;
+    AudioReader* m_nextInput;
+    Codec* m_nextCodec;
+    // The stream before the last boundary, kept until the device has read
+    // past it since a seek before that still belongs to this stream
+    AudioReader* m_prevInput;
+    Codec* m_prevCodec;
+    // Boundary markers handed to the device so far
+    int m_boundaries;
+
+    // Blocks that did not fit in the queue
+    QList<QByteArray*> m_pending;
+    bool m_done;
+};
+
+#include "codecdevice.moc"
+
+CodecDecoder::CodecDecoder(CodecDevice *device, AudioReader *input, Codec *codec)
+    : m_device(device), m_pool(codec->outputPool()), m_inputChunk(CODEC_INPUT_READ, '\0'),
+      m_input(0), m_codec(0), m_nextInput(0), m_nextCodec(0),
+      m_prevInput(0), m_prevCodec(0), m_boundaries(0), m_done(false)
+{
+    setSource(input, codec);
+}
+
+CodecDecoder::~CodecDecoder()
+{
+    foreach(QByteArray* block, m_pending) {
+        releaseBlock(block);
+    }
+
+    delete m_input;
+    delete m_codec;
+    delete m_nextInput;
+    delete m_nextCodec;
+    delete m_prevInput;
+    delete m_prevCodec;
+}
+
+void CodecDecoder::setSource(AudioReader *input, Codec *codec)
+{
+    if (m_input) {
+        // We may be inside one of their signals
+        m_input->disconnect(this);
+        m_codec->disconnect(this);
+        if (m_prevInput) {
+            m_prevInput->deleteLater();
+            m_prevCodec->deleteLater();
+        }
+        m_prevInput = m_input;
+        m_prevCodec = m_codec;
+    }
+
+    m_input = input;
+    m_codec = codec;
+    attach();
+}
+
+void CodecDecoder::attach()
+{
+    connect(m_codec, SIGNAL(output(QByteArray*)),
+            this, SLOT(codecOutput(QByteArray*)), Qt::DirectConnection);
+    connect(m_input, SIGNAL(readyRead()),
+            this, SLOT(decode()), Qt::DirectConnection);
+}
+
+void CodecDecoder::setNext(QObject *input, QObject *codec)
+{
+    delete m_nextInput;
+    delete m_nextCodec;
+    m_nextInput = 0;
+    m_nextCodec = 0;
+
+    if (m_done) {
+        // Too late, the device is already draining its last blocks
+        delete input;
+        delete codec;
+        return;
+    }
+
+    m_nextInput = qobject_cast<AudioReader*>(input);
+    m_nextCodec = qobject_cast<Codec*>(codec);
+}
+
+// Goes back to the stream before the last boundary and makes the current one
+// the next stream again, restarted from its beginning
+bool CodecDecoder::stepBack()
+{
+    if (!m_prevInput)
+        return false;
+
+    m_input->disconnect(this);
+    m_codec->disconnect(this);
+
+    delete m_nextInput;
+    delete m_nextCodec;
+    m_nextInput = 0;
+    m_nextCodec = 0;
+
+    qint64 offset;
+    if (m_input->canRestart() && m_codec->seek(0, &offset) && m_input->restartAt(offset)) {
+        m_nextInput = m_input;
+        m_nextCodec = m_codec;
+    } else {
+        qDebug() << "unable to rewind next stream";
+        m_input->deleteLater();
+        m_codec->deleteLater();
+    }
+
+    m_input = m_prevInput;
+    m_codec = m_prevCodec;
+    m_prevInput = 0;
+    m_prevCodec = 0;
+    attach();
+
+    --m_boundaries;
+    return true;
+}
+
+void CodecDecoder::seek(int position, int boundariesRead)
+{
+    // Everything that never made it to the queue is stale, except for the
+    // s_seekDone of earlier seeks that the device counts on. It drops the
+    // boundaries it finds ahead of s_seekDone, those it has not read are
+    // redone from here.
+    QList<QByteArray*> seeks;
+    foreach(QByteArray* block, m_pending) {
+        if (block == &s_seekDone) {
+            seeks.append(block);
+            continue;
+        }
+        if (block != &s_trackBoundary)
+            m_device->m_queuedBytes.fetchAndAddOrdered(-block->size());
+        releaseBlock(block);
+    }
+    m_pending = seeks;
+
+    // The seek is for the stream before the last boundary
+    if (m_boundaries - boundariesRead == 1)
+        stepBack();
+
+    qint64 offset;
+    // The codec is only touched if the input can follow it
+    if (m_input->canRestart() && m_codec->seek(position, &offset) && m_input->restartAt(offset)) {
+        if (m_done) {
+            m_done = false;
+            m_device->m_finished.fetchAndStoreRelease(0);
+        }
+    } else {
+        qDebug() << "unable to seek to" << position;
+    }
+
+    enqueue(&s_seekDone);
+    // Only the previous stream is kept, boundaries further back are
+    // reported right away
+    for (int i = boundariesRead; i < m_boundaries; ++i)
+        enqueue(&s_trackBoundary);
+
+    if (m_done)
+        flushPending();
+    else
+        decode();
+}
+
+void CodecDecoder::setFrameIndex(int serial, const FrameIndex &index)
+{
+    if (serial == m_codec->serial())
+        m_codec->setFrameIndex(index);
+    else if (m_nextCodec && serial == m_nextCodec->serial())
+        m_nextCodec->setFrameIndex(index);
+    else if (m_prevCodec && serial == m_prevCodec->serial())
+        m_prevCodec->setFrameIndex(index);
+}
+
+void CodecDecoder::releaseBlock(QByteArray *block)
+{
+    if (block == &s_trackBoundary || block == &s_seekDone)
+        return;
+
+    if (m_pool)
+        m_pool->release(block);
+    else
+        delete block;
+}
+
+void CodecDecoder::enqueue(QByteArray *block)
+{
+    if (!m_pending.isEmpty() || !m_device->m_queue.push(block))
+        m_pending.append(block);
+}
+
+bool CodecDecoder::flushPending()
+{
+    while (!m_pending.isEmpty()) {
+        if (!m_device->m_queue.push(m_pending.front()))
+            return false;
+        m_pending.pop_front();
+    }
+
+    if (m_done)
+        m_device->m_finished.fetchAndStoreRelease(1);
+    return true;
+}
+
+void CodecDecoder::finish()
+{
+    m_done = true;
+    flushPending();
+}
+
+void CodecDecoder::decode()
+{
+    m_device->m_wakeup.fetchAndStoreOrdered(0);
+
+    if (!flushPending() || m_done)
+        return;
+
+    while (m_device->m_queue.size() < m_device->m_queue.capacity()) {
+        Codec::Status status = m_codec->decode();
+        if (status == Codec::Ok)
+            continue;
+
+        if (status == Codec::NeedInput) {
+            qint64 read = m_input->read(m_inputChunk.data(), CODEC_INPUT_READ);
+            if (read > 0) {
+                m_codec->feed(QByteArray::fromRawData(m_inputChunk.constData(), read), m_input->atEnd());
+                continue;
+            }
+
+            if (!m_input->atEnd() && m_input->isOpen()) {
+                // wait for readyRead()
+                return;
+            }
+        } else {
+            qDebug() << "codec error";
+        }
+
+        m_codec->flush();
+        if (!m_nextInput) {
+            finish();
+            return;
+        }
+
+        // Carry on with the next stream right after the last block of this one
+        enqueue(&s_trackBoundary);
+        ++m_boundaries;
+        setSource(m_nextInput, m_nextCodec);
+        m_nextInput = 0;
+        m_nextCodec = 0;
+    }
+}
+
+void CodecDecoder::codecOutput(QByteArray *output)
+{
+    if (output->isEmpty()) {
+        releaseBlock(output);
+        return;
+    }
+
+    m_device->m_queuedBytes.fetchAndAddOrdered(output->size());
+    enqueue(output);
+}
+
+void CodecDecoder::pauseInput()
+{
+    m_input->pause();
+}
+
+void CodecDecoder::resumeInput()
+{
+    m_input->resume();
+}
+
 CodecDevice::CodecDevice(QObject *parent)
-    : QIODevice(parent), m_input(0), m_codec(0)
+    : QIODevice(parent), m_input(0), m_codec(0), m_decoder(0), m_priority(QThread::HighPriority),
+      m_queue(CODEC_QUEUE_DEPTH), m_queuedBytes(0), m_finished(0), m_wakeup(0),
+      m_bytesRead(0), m_boundariesRead(0), m_underruns(0), m_pendingSeeks(0), m_primed(false), m_starved(false)
 {
+    qRegisterMetaType<FrameIndex>("FrameIndex");
 }
 
 CodecDevice::~CodecDevice()
 {
+    m_thread.quit();
+    m_thread.wait();
+
+    delete m_decoder;
+
+    QByteArray* block;
+    while (m_queue.pop(&block)) {
+        if (block != &s_trackBoundary && block != &s_seekDone)
+            m_decoded.add(block);
+    }
+    m_decoded.clear();
+
     delete m_input;
     delete m_codec;
 }
@@ -49,77 +381,170 @@ void CodecDevice::setInputReader(AudioReader *input)
 
 void CodecDevice::setCodec(Codec *codec)
 {
-    if (m_codec)
-        disconnect(m_codec, SIGNAL(output(QByteArray*)), this, SLOT(codecOutput(QByteArray*)));
     m_codec = codec;
-    connect(m_codec, SIGNAL(output(QByteArray*)), this, SLOT(codecOutput(QByteArray*)));
+
+    // Played PCM blocks go back to the pool the codec borrows them from
+    m_decoded.clear();
+    m_decoded.setPool(m_codec->outputPool());
 }
 
-bool CodecDevice::fillBuffer()
+void CodecDevice::setDecoderPriority(QThread::Priority priority)
 {
-    if (m_input->atEnd() || !m_input->isOpen())
-        return false;
+    m_priority = priority;
+}
 
-    Codec::Status status = m_codec->decode();
-    do {
-        if (status == Codec::NeedInput) {
-            QByteArray input = m_input->read(CODEC_INPUT_READ);
-            if (input.isEmpty())
-                break;
-
-            //qDebug() << "feeding" << input.size();
-            m_codec->feed(input, m_input->atEnd());
-            //qDebug() << "feed complete, decoding";
-        } else if (status == Codec::Error) {
-            qDebug() << "codec error";
-            break;
-        }
+QThread::Priority CodecDevice::decoderPriority() const
+{
+    return m_priority;
+}
+
+void CodecDevice::setQueueDepth(int blocks)
+{
+    if (m_decoder || blocks < 2)
+        return;
+    m_queue.reset(blocks);
+}
 
-        do {
-            status = m_codec->decode();
-            //qDebug() << "decode status" << status;
-        } while (status == Codec::Ok);
-    } while (m_decoded.size() < CODEC_BUFFER_MAX);
+int CodecDevice::queueDepth() const
+{
+    return m_queue.capacity();
+}
 
-    return (status != Codec::Error);
+int CodecDevice::underruns() const
+{
+    return m_underruns;
 }
 
 bool CodecDevice::open(OpenMode mode)
 {
     bool ok = QIODevice::open(mode);
-    if (!ok || !m_input || !m_codec)
+    if (!ok || !m_input || !m_codec || m_decoder)
         return false;
 
-    fillBuffer();
+    m_input->moveToThread(&m_thread);
+    m_codec->moveToThread(&m_thread);
+
+    // The decoder owns them from here on
+    m_decoder = new CodecDecoder(this, m_input, m_codec);
+    m_input = 0;
+    m_codec = 0;
+
+    m_decoder->moveToThread(&m_thread);
+    m_thread.start(m_priority);
+
+    wakeDecoder();
 
     return true;
 }
 
+bool CodecDevice::setNextSource(AudioReader *input, Codec *codec)
+{
+    // Blocks from both streams end up in the same buffer
+    if (!m_decoder || !isOpen() || codec->outputPool() != m_decoded.pool())
+        return false;
+
+    input->moveToThread(&m_thread);
+    codec->moveToThread(&m_thread);
+    QMetaObject::invokeMethod(m_decoder, "setNext", Qt::QueuedConnection,
+                              Q_ARG(QObject*, input), Q_ARG(QObject*, codec));
+    wakeDecoder();
+
+    return true;
+}
+
+void CodecDevice::seekPosition(int position, int back)
+{
+    if (!m_decoder || !isOpen())
+        return;
+
+    // The boundaries stepped back over are reported again
+    m_boundariesRead -= qBound(0, back, m_boundariesRead);
+
+    ++m_pendingSeeks;
+    m_decoded.clear();
+    m_starved = false;
+
+    QMetaObject::invokeMethod(m_decoder, "seek", Qt::QueuedConnection,
+                              Q_ARG(int, position), Q_ARG(int, m_boundariesRead));
+}
+
+void CodecDevice::setFrameIndex(int serial, const FrameIndex &index)
+{
+    if (!m_decoder)
+        return;
+
+    QMetaObject::invokeMethod(m_decoder, "setFrameIndex", Qt::QueuedConnection,
+                              Q_ARG(int, serial), Q_ARG(FrameIndex, index));
+}
+
+void CodecDevice::wakeDecoder()
+{
+    if (m_wakeup.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(m_decoder, "decode", Qt::QueuedConnection);
+}
+
 qint64 CodecDevice::bytesAvailable() const
 {
-    return m_decoded.size();
+    return m_decoded.size() + const_cast<QAtomicInt&>(m_queuedBytes).fetchAndAddAcquire(0);
 }
 
 qint64 CodecDevice::readData(char *data, qint64 maxlen)
 {
-    //qDebug() << "we go?" << m_decoded.size();
-    if (m_decoded.size() < CODEC_BUFFER_MIN) {
-        if (!fillBuffer() && m_decoded.isEmpty()) {
-            qDebug() << "no go :(";
+    // Check for the end before looking at the queue, the decoder only sets
+    // m_finished once its last block has been queued
+    bool finished = m_finished.fetchAndAddAcquire(0);
+
+    QByteArray* block;
+    while ((m_pendingSeeks > 0 || m_decoded.size() < maxlen) && m_queue.pop(&block)) {
+        if (block == &s_seekDone) {
+            // The decoder may have been at the end before seeking
+            --m_pendingSeeks;
+            finished = false;
+            continue;
+        }
+        if (block == &s_trackBoundary) {
+            // Ahead of a seek the decoder redoes it, the stream it ended
+            // may be the one the seek went into
+            if (m_pendingSeeks == 0) {
+                ++m_boundariesRead;
+                emit trackBoundary(m_bytesRead + m_decoded.size());
+            }
+            continue;
+        }
+        m_queuedBytes.fetchAndAddOrdered(-block->size());
+        m_decoded.add(block);
+        if (m_pendingSeeks > 0)
+            m_decoded.clear();
+    }
+
+    if (!finished && m_queue.size() <= m_queue.capacity() / 2)
+        wakeDecoder();
+
+    if (m_decoded.isEmpty()) {
+        if (m_pendingSeeks > 0)
+            return 0;
+
+        if (finished && m_queue.isEmpty()) {
             close();
             return -1;
         }
-    }
 
-    qint64 toread = qMin(maxlen, static_cast<qint64>(m_decoded.size()));
-    //qDebug() << "toread" << toread << m_decoded.size();
-    if (toread == 0)
+        // Don't count the wait for the first block or every pull of one dry spell
+        if (m_primed && !m_starved) {
+            m_starved = true;
+            ++m_underruns;
+            qDebug() << "decoder underrun" << m_underruns;
+            emit underrun();
+        }
         return 0;
+    }
 
-    QByteArray bufferdata = m_decoded.read(toread);
-
-    memcpy(data, bufferdata.constData(), toread);
+    m_primed = true;
+    m_starved = false;
 
+    qint64 toread = qMin(maxlen, static_cast<qint64>(m_decoded.size()));
+    toread = m_decoded.readInto(data, static_cast<int>(toread));
+    m_bytesRead += toread;
     return toread;
 }
 
@@ -131,17 +556,14 @@ qint64 CodecDevice::writeData(const char *data, qint64 len)
     return -1;
 }
 
-void CodecDevice::codecOutput(QByteArray* output)
-{
-    m_decoded.add(output);
-}
-
 void CodecDevice::pauseReader()
 {
-    m_input->pause();
+    if (m_decoder)
+        QMetaObject::invokeMethod(m_decoder, "pauseInput", Qt::QueuedConnection);
 }
 
 void CodecDevice::resumeReader()
 {
-    m_input->resume();
+    if (m_decoder)
+        QMetaObject::invokeMethod(m_decoder, "resumeInput", Qt::QueuedConnection);
 }
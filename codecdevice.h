@@ -20,11 +20,14 @@
 #define CODECDEVICE_H
 
 #include <QIODevice>
-#include <QLinkedList>
+#include <QThread>
 #include "buffer.h"
+#include "frameindex.h"
+#include "spscqueue.h"
 
 class AudioReader;
 class Codec;
+class CodecDecoder;
 
 class CodecDevice : public QIODevice
 {
@@ -44,21 +47,64 @@ public:
     void pauseReader();
     void resumeReader();
 
+    // Decoding runs ahead of playback in a worker thread. These only take
+    // effect if set before the device is opened.
+    void setDecoderPriority(QThread::Priority priority);
+    QThread::Priority decoderPriority() const;
+
+    void setQueueDepth(int blocks);
+    int queueDepth() const;
+
+    // Number of times playback has run dry while the decoder was still going
+    int underruns() const;
+
+    // Decodes input with codec right after the current stream ends, on the
+    // same output. Takes ownership if successful.
+    bool setNextSource(AudioReader* input, Codec* codec);
+
+    // Continues playback at position ms into the stream back boundaries
+    // before the last one read, which is not the one being decoded if its
+    // boundary has not been read yet either. Queued audio is dropped right
+    // away, the rest happens in the decoder.
+    void seekPosition(int position, int back = 0);
+    // Hands seek points to the codec with serial if it is still in use
+    void setFrameIndex(int serial, const FrameIndex& index);
+
+signals:
+    void underrun();
+    // Bytes read from the device before the first sample of the next stream
+    void trackBoundary(qint64 position);
+
 protected:
     qint64 readData(char *data, qint64 maxlen);
     qint64 writeData(const char *data, qint64 len);
 
-private slots:
-    void codecOutput(QByteArray* output);
-
 private:
-    bool fillBuffer();
+    void wakeDecoder();
 
 private:
     AudioReader* m_input;
     Codec* m_codec;
 
+    CodecDecoder* m_decoder;
+    QThread m_thread;
+    QThread::Priority m_priority;
+
+    // Written by the decoder thread, read by whoever pulls from the device
+    SpscQueue<QByteArray*> m_queue;
+    QAtomicInt m_queuedBytes;
+    QAtomicInt m_finished;
+    QAtomicInt m_wakeup;
+
     Buffer m_decoded;
+    qint64 m_bytesRead;
+    int m_boundariesRead;
+    int m_underruns;
+    int m_pendingSeeks;
+    bool m_primed;
+    bool m_starved;
+
+    friend class CodecDecoder;
 };
 
 #endif // CODECDEVICE_H
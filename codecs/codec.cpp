@@ -17,6 +17,9 @@
 */
 
 #include "codecs/codec.h"
+#include <QAtomicInt>
+
+static QAtomicInt s_serial(0);
 
 AudioFileInformation::AudioFileInformation(QObject *parent)
     : QObject(parent)
@@ -33,7 +36,49 @@ QString AudioFileInformation::filename() const
     return m_filename;
 }
 
+FrameIndex AudioFileInformation::frameIndex() const
+{
+    return FrameIndex();
+}
+
 Codec::Codec(QObject *parent)
-    : QObject(parent)
+    : QObject(parent), m_pool(0), m_serial(s_serial.fetchAndAddRelaxed(1) + 1)
+{
+}
+
+int Codec::serial() const
+{
+    return m_serial;
+}
+
+BufferPool* Codec::outputPool() const
+{
+    return m_pool;
+}
+
+void Codec::setOutputPool(BufferPool *pool)
+{
+    m_pool = pool;
+}
+
+void Codec::setFrameIndex(const FrameIndex &index)
+{
+    m_index = index;
+}
+
+FrameIndex Codec::frameIndex() const
+{
+    return m_index;
+}
+
+bool Codec::seek(int position, qint64 *offset)
+{
+    Q_UNUSED(position)
+    Q_UNUSED(offset)
+
+    return false;
+}
+
+void Codec::flush()
 {
 }
@@ -22,8 +22,10 @@
 #include <QObject>
 #include <QAudioFormat>
 #include <QByteArray>
+#include "frameindex.h"
 
 class Codec;
+class BufferPool;
 
 class AudioFileInformation : public QObject
 {
@@ -35,6 +37,8 @@ public:
     QString filename() const;
 
     virtual int length() const = 0;
+    // Seek points for the file, empty if the format can't provide them
+    virtual FrameIndex frameIndex() const;
 
 private:
     QString m_filename;
@@ -51,6 +55,21 @@ public:
     virtual bool init(const QAudioFormat& format) = 0;
     virtual void deinit() = 0;
 
+    // Unique for the life of the process, unlike the address of a codec
+    // that may be reused by the next one
+    int serial() const;
+
+    // Output chunks are borrowed from this pool, consumers hand them back once played
+    BufferPool* outputPool() const;
+
+    // Seek points provided from outside, codecs may fall back to their own
+    void setFrameIndex(const FrameIndex& index);
+    FrameIndex frameIndex() const;
+
+    // Resets the codec to continue at position ms. On success offset is
+    // where in the input the caller has to start feeding again.
+    virtual bool seek(int position, qint64* offset);
+
 signals:
     void output(QByteArray* data);
     void position(int position);
@@ -58,6 +77,15 @@ signals:
 public slots:
     virtual void feed(const QByteArray& data, bool end = false) = 0;
     virtual Status decode() = 0;
+    virtual void flush();
+
+protected:
+    void setOutputPool(BufferPool* pool);
+
+private:
+    BufferPool* m_pool;
+    FrameIndex m_index;
+    int m_serial;
 };
 
 #endif
@@ -17,6 +17,9 @@
 */
 
 #include "codec_mad.h"
+#include "xing_mad.h"
+#include "probe_mad.h"
+#include "buffer.h"
 #include <taglib/id3v2frame.h>
 #include <taglib/id3v2framefactory.h>
 #include <math.h>
@@ -24,33 +27,14 @@
 #include <QDebug>
 
 #define INPUT_BUFFER_SIZE (8196 * 5)
-#define OUTPUT_BUFFER_SIZE 8196 // Should be divisible by both 4 and 6
+#define OUTPUT_BUFFER_SIZE 18432 // Holds at least two frames in every output format
+#define OUTPUT_POOL_SIZE 128
 
-static signed short MadFixedToSshort(mad_fixed_t Fixed)
-{
-    /* Clipping */
-    if(Fixed>=MAD_F_ONE)
-        return(SHRT_MAX);
-    if(Fixed<=-MAD_F_ONE)
-        return(-SHRT_MAX);
-
-    /* Conversion. */
-    Fixed=Fixed>>(MAD_F_FRACBITS-15);
-    return((signed short)Fixed);
-}
+#define SEEK_INDEX_INTERVAL 250 // ms between seek points from a header scan
+#define SEEK_PRIME_MS 100 // decoded ahead of a seek target to refill the bit reservoir
 
-static signed int MadFixedToInt(mad_fixed_t Fixed)
-{
-    /* Clipping */
-    if(Fixed>=MAD_F_ONE)
-        return(INT_MAX);
-    if(Fixed<=-MAD_F_ONE)
-        return(-INT_MAX);
-
-    /* Conversion. */
-    Fixed=Fixed>>(MAD_F_FRACBITS-23);
-    return((signed int)Fixed);
-}
+// Shared by all decoders, the blocks are handed back by the consumer once played
+static BufferPool s_pcmPool(OUTPUT_BUFFER_SIZE, OUTPUT_POOL_SIZE);
 
 static int timerToMs(mad_timer_t* timer)
 {
@@ -68,13 +52,20 @@ AudioFileInformationMad::AudioFileInformationMad(QObject *parent)
 
 int AudioFileInformationMad::length() const
 {
+    return MadProbe::duration(filename());
+}
+
+FrameIndex AudioFileInformationMad::frameIndex() const
+{
+    FrameIndex index;
+
     QString fn = filename();
     if (fn.isEmpty())
-        return 0;
+        return index;
 
     QFile file(fn);
     if (!file.open(QFile::ReadOnly))
-        return 0;
+        return index;
 
     mad_stream infostream;
     mad_header infoheader;
@@ -85,10 +76,12 @@ int AudioFileInformationMad::length() const
 
     qint64 r;
     qint64 l = 0;
+    qint64 bufpos = 0; // file offset of buf
+    bool first = true;
+    bool fromInfo = false;
+    qint64 next = 0;
     unsigned char* buf = new unsigned char[INPUT_BUFFER_SIZE];
 
-    // ### file reading here should possibly be done in the IO thread instead
-
     while (!file.atEnd()) {
         if (l < INPUT_BUFFER_SIZE) {
             r = file.read(reinterpret_cast<char*>(buf) + l, INPUT_BUFFER_SIZE - l);
@@ -111,13 +104,37 @@ int AudioFileInformationMad::length() const
                         }
                     }
                 }
-                qDebug() << "header decode error while getting file info" << infostream.error;
                 continue;
             }
+
+            const qint64 offset = bufpos + (infostream.this_frame - buf);
+            if (first) {
+                first = false;
+
+                // Prefer the table of contents of an info frame over scanning
+                MadXing info;
+                if (info.read(infostream.this_frame, infostream.next_frame - infostream.this_frame, &infoheader)) {
+                    index = info.index(&infoheader, offset, infostream.next_frame - infostream.this_frame);
+                    if (!index.isEmpty()) {
+                        fromInfo = true;
+                        break;
+                    }
+                    continue;
+                }
+            }
+
+            const qint64 ms = timerToMs(&infotimer);
+            if (ms >= next) {
+                index.append(ms, offset);
+                next = ms + SEEK_INDEX_INTERVAL;
+            }
             mad_timer_add(&infotimer, infoheader.duration);
         }
+        if (fromInfo)
+            break;
         if (infostream.error != MAD_ERROR_BUFLEN && infostream.error != MAD_ERROR_BUFPTR)
             break;
+        bufpos += infostream.next_frame - buf;
         memmove(buf, infostream.next_frame, &(buf[l]) - infostream.next_frame);
         l -= (infostream.next_frame - buf);
     }
@@ -126,12 +143,15 @@ int AudioFileInformationMad::length() const
     mad_header_finish(&infoheader);
     delete[] buf;
 
-    return timerToMs(&infotimer);
+    return index;
 }
 
 CodecMad::CodecMad(QObject *parent)
-    : Codec(parent), m_buffer(0)
+    : Codec(parent), m_buffer(0), m_out(0), m_outptr(0), m_outend(0), m_convert(0), m_frameSize(4),
+      m_checkInfo(true), m_skip(0), m_remaining(-1), m_gaplessStart(0), m_gaplessEnd(-1),
+      m_firstFrame(-1), m_bitrate(0), m_sampleRate(0), m_discardUntil(-1)
 {
+    setOutputPool(&s_pcmPool);
 }
 
 CodecMad::~CodecMad()
@@ -154,14 +174,34 @@ bool CodecMad::init(const QAudioFormat& format)
     mad_synth_init(&m_synth);
     mad_timer_reset(&m_timer);
 
+    m_checkInfo = true;
+    m_skip = 0;
+    m_remaining = -1;
+    m_gaplessStart = 0;
+    m_gaplessEnd = -1;
+
+    m_bufferOffset = 0;
+    m_streamIndex.clear();
+    m_firstFrame = -1;
+    m_bitrate = 0;
+    m_sampleRate = 0;
+    m_discardUntil = -1;
+
     if (!m_buffer)
         m_buffer = new unsigned char[INPUT_BUFFER_SIZE + MAD_BUFFER_GUARD];
 
-    // ### need to take m_format more into account here
-    if (format.sampleSize() == 24)
-        decodeFunc = &CodecMad::decode24;
+    MadConvert::Format outformat;
+    if (format.sampleSize() == 32)
+        outformat = (format.sampleType() == QAudioFormat::Float) ? MadConvert::Float : MadConvert::Int32;
+    else if (format.sampleSize() == 24)
+        outformat = MadConvert::Int24;
     else
-        decodeFunc = &CodecMad::decode16;
+        outformat = MadConvert::Int16;
+
+    m_convert = MadConvert::function(outformat);
+    m_frameSize = MadConvert::frameSize(outformat);
+
+    qDebug() << "converting with" << MadConvert::kernelName(MadConvert::kernel());
 
     return true;
 }
@@ -171,66 +211,51 @@ void CodecMad::deinit()
     delete[] m_buffer;
     m_buffer = 0;
 
+    s_pcmPool.release(m_out);
+    m_out = 0;
+    m_outptr = m_outend = 0;
+
     mad_stream_finish(&m_stream);
     mad_frame_finish(&m_frame);
     mad_synth_finish(&m_synth);
     mad_timer_reset(&m_timer);
 }
 
-void CodecMad::decode16(QByteArray** out, char** outptr, char** outend, int* outsize)
+void CodecMad::acquireOutput()
 {
-    signed short sample;
-    for (unsigned short i = 0; i < m_synth.pcm.length; ++i) {
-        sample = MadFixedToSshort(m_synth.pcm.samples[0][i]);
-        *((*outptr)++) = sample & 0xff;
-        *((*outptr)++) = sample >> 8;
-
-        if (MAD_NCHANNELS(&m_frame.header) > 1)
-            sample = MadFixedToSshort(m_synth.pcm.samples[1][i]);
-
-        *((*outptr)++) = sample & 0xff;
-        *((*outptr)++) = sample >> 8;
-
-        *outsize += 4;
-
-        if (*outptr == *outend) {
-            emit output(*out);
-
-            *out = new QByteArray(OUTPUT_BUFFER_SIZE, '\0');
-            *outptr = (*out)->data();
-            *outend = *outptr + OUTPUT_BUFFER_SIZE;
-            *outsize = 0;
-        }
-    }
+    m_out = s_pcmPool.acquire();
+    m_outptr = m_out->data();
+    m_outend = m_outptr + OUTPUT_BUFFER_SIZE;
 }
 
-void CodecMad::decode24(QByteArray** out, char** outptr, char** outend, int* outsize)
+void CodecMad::emitOutput()
 {
-    signed int sample;
-    for (unsigned short i = 0; i < m_synth.pcm.length; ++i) {
-        sample = MadFixedToInt(m_synth.pcm.samples[0][i]);
-        *((*outptr)++) = sample & 0xff;
-        *((*outptr)++) = (sample >> 8) & 0xff;
-        *((*outptr)++) = sample >> 16;
-
-        if (MAD_NCHANNELS(&m_frame.header) > 1)
-            sample = MadFixedToInt(m_synth.pcm.samples[1][i]);
-
-        *((*outptr)++) = sample & 0xff;
-        *((*outptr)++) = (sample >> 8) & 0xff;
-        *((*outptr)++) = sample >> 16;
-
-        *outsize += 6;
+    if (!m_out)
+        return;
+
+    const int outsize = m_outptr - m_out->constData();
+    if (outsize == 0)
+        return;
+
+    // Qt 4 reallocates a QByteArray resized below half of its allocation.
+    // A short block (the end of a track, a flush or a seek) is copied out
+    // instead, so the pooled block goes back with its allocation intact.
+    QByteArray* block = m_out;
+    if (outsize < m_out->capacity() / 2) {
+        block = new QByteArray(m_out->constData(), outsize);
+        s_pcmPool.release(m_out);
+    } else {
+        m_out->resize(outsize);
+    }
+    emit output(block);
 
-        if (*outptr == *outend) {
-            emit output(*out);
+    m_out = 0;
+    m_outptr = m_outend = 0;
+}
 
-            *out = new QByteArray(OUTPUT_BUFFER_SIZE, '\0');
-            *outptr = (*out)->data();
-            *outend = *outptr + OUTPUT_BUFFER_SIZE;
-            *outsize = 0;
-        }
-    }
+void CodecMad::flush()
+{
+    emitOutput();
 }
 
 void CodecMad::feed(const QByteArray& data, bool end)
@@ -240,23 +265,33 @@ void CodecMad::feed(const QByteArray& data, bool end)
     //qDebug() << "total pushed" << totalpushed;
 
     //qDebug() << "had" << m_data.size() << "bytes already before pushing" << data.size();
-    m_data += data;
 
-    size_t rem = 0, copylen;
+    size_t rem = 0, copylen = 0;
+    int used = 0;
 
     if (m_stream.buffer == NULL || m_stream.error == MAD_ERROR_BUFLEN) {
         if (m_stream.next_frame != NULL) {
             rem = m_stream.bufend - m_stream.next_frame;
+            m_bufferOffset += m_stream.next_frame - m_buffer;
             memmove(m_buffer, m_stream.next_frame, rem);
         }
 
         //qDebug() << "rem?" << rem;
 
-        copylen = qMin(INPUT_BUFFER_SIZE - rem, static_cast<long unsigned int>(m_data.size()));
-        memcpy(m_buffer + rem, m_data.constData(), copylen);
-        m_data = m_data.mid(copylen);
+        // Drain input left over from earlier feeds first, then copy the
+        // new data straight into the mad buffer without staging it
+        if (!m_data.isEmpty()) {
+            copylen = qMin(INPUT_BUFFER_SIZE - rem, static_cast<size_t>(m_data.size()));
+            memcpy(m_buffer + rem, m_data.constData(), copylen);
+            m_data.remove(0, copylen);
+        }
+        if (m_data.isEmpty()) {
+            used = static_cast<int>(qMin(INPUT_BUFFER_SIZE - rem - copylen, static_cast<size_t>(data.size())));
+            memcpy(m_buffer + rem + copylen, data.constData(), used);
+            copylen += used;
+        }
 
-        if (end) {
+        if (end && used == data.size() && m_data.isEmpty()) {
             memset(m_buffer + rem + copylen, 0, MAD_BUFFER_GUARD);
             copylen += MAD_BUFFER_GUARD;
         }
@@ -266,6 +301,60 @@ void CodecMad::feed(const QByteArray& data, bool end)
         mad_stream_buffer(&m_stream, m_buffer, copylen + rem);
         m_stream.error = static_cast<mad_error>(0);
     }
+
+    if (used < data.size())
+        m_data.append(data.constData() + used, data.size() - used);
+}
+
+void CodecMad::resetStream()
+{
+    mad_stream_finish(&m_stream);
+    mad_stream_init(&m_stream);
+    mad_frame_mute(&m_frame);
+    mad_synth_mute(&m_synth);
+
+    m_data.clear();
+
+    // Drop whatever was decoded into the current block
+    if (m_out)
+        m_outptr = m_out->data();
+}
+
+bool CodecMad::seek(int position, qint64 *offset)
+{
+    const qint64 target = qMax(0, position);
+    const qint64 from = qMax<qint64>(0, target - SEEK_PRIME_MS);
+
+    FrameIndex::Entry entry;
+    const FrameIndex index = frameIndex();
+    if (!index.isEmpty()) {
+        entry = index.lookup(from);
+    } else if (!m_streamIndex.isEmpty()) {
+        entry = m_streamIndex.lookup(from);
+    } else if (m_bitrate > 0 && m_firstFrame >= 0) {
+        // No table of contents, assume a constant bitrate
+        entry.position = from;
+        entry.offset = m_firstFrame + (from * m_bitrate) / 8000;
+    } else {
+        return false;
+    }
+
+    qDebug() << "mad seeking to" << target << "from" << entry.position << "at" << entry.offset;
+
+    resetStream();
+    mad_timer_set(&m_timer, 0, static_cast<unsigned long>(entry.position), 1000);
+    m_bufferOffset = entry.offset;
+    m_discardUntil = target;
+
+    // Starting over from the first frame has to skip the info frame again
+    m_checkInfo = (m_firstFrame < 0) ? (entry.position == 0) : (entry.offset <= m_firstFrame);
+
+    const qint64 sample = (target * m_sampleRate) / 1000;
+    m_skip = static_cast<int>(qMax<qint64>(0, m_gaplessStart - sample));
+    m_remaining = (m_gaplessEnd >= 0) ? qMax<qint64>(0, m_gaplessEnd - qMax(sample, m_gaplessStart)) : -1;
+
+    *offset = entry.offset;
+    return true;
 }
 
 CodecMad::Status CodecMad::decode()
@@ -303,6 +392,34 @@ CodecMad::Status CodecMad::decode()
         break;
     }
 
+    if (m_checkInfo) {
+        m_checkInfo = false;
+
+        const int framesize = m_stream.next_frame - m_stream.this_frame;
+        m_firstFrame = m_bufferOffset + (m_stream.this_frame - m_buffer);
+        m_bitrate = m_frame.header.bitrate;
+        m_sampleRate = m_frame.header.samplerate;
+
+        // The info frame decodes to silence, skip it and trim the encoder
+        // and decoder delay and padding if the encoder told us about them
+        MadXing info;
+        if (info.read(m_stream.this_frame, framesize, &m_frame.header)) {
+            m_streamIndex = info.index(&m_frame.header, m_firstFrame, framesize);
+            if (info.hasLameTag()) {
+                m_gaplessStart = info.encoderDelay() + MadXing::decoderDelay();
+                if (info.frames() > 0) {
+                    m_gaplessEnd = static_cast<qint64>(info.frames()) * MadXing::samplesPerFrame(&m_frame.header)
+                                   - info.encoderPadding() + MadXing::decoderDelay();
+                }
+                m_skip = m_gaplessStart;
+                m_remaining = (m_gaplessEnd >= 0) ? m_gaplessEnd - m_gaplessStart : -1;
+                qDebug() << "gapless info, delay" << info.encoderDelay() << "padding" << info.encoderPadding();
+            }
+            return Ok;
+        }
+    }
+
+    mad_timer_t start = m_timer;
     mad_timer_add(&m_timer, m_frame.header.duration);
 
     if (mad_frame_decode(&m_frame, &m_stream)) {
@@ -314,23 +431,50 @@ CodecMad::Status CodecMad::decode()
             return Error;
     }
 
-    QByteArray* out = new QByteArray(OUTPUT_BUFFER_SIZE, '\0');
-    char* outptr = out->data();
-    char* outend = outptr + OUTPUT_BUFFER_SIZE;
-    int outsize = 0;
-
     mad_synth_frame(&m_synth, &m_frame);
 
-    (this->*decodeFunc)(&out, &outptr, &outend, &outsize);
+    if (m_synth.pcm.length == 0)
+        return Error;
+
+    const mad_fixed_t* left = m_synth.pcm.samples[0];
+    const mad_fixed_t* right = m_synth.pcm.samples[MAD_NCHANNELS(&m_frame.header) > 1 ? 1 : 0];
+    int length = m_synth.pcm.length;
+
+    int done = qMin(m_skip, length);
+    m_skip -= done;
+    if (m_discardUntil >= 0) {
+        const qint64 drop = ((m_discardUntil - timerToMs(&start)) * m_synth.pcm.samplerate) / 1000;
+        if (drop < length)
+            m_discardUntil = -1;
+        done = qMax(done, static_cast<int>(qBound<qint64>(0, drop, length)));
+    }
+    if (m_remaining >= 0) {
+        const int keep = static_cast<int>(qMin(m_remaining, static_cast<qint64>(length - done)));
+        m_remaining -= keep;
+        length = done + keep;
+    }
+
+    int count;
+    while (done < length) {
+        if (!m_out)
+            acquireOutput();
+
+        count = qMin(length - done, static_cast<int>(m_outend - m_outptr) / m_frameSize);
+        if (count == 0) {
+            emitOutput();
+            continue;
+        }
+
+        m_convert(left + done, right + done, count, m_outptr);
+        m_outptr += count * m_frameSize;
+        done += count;
+    }
 
-    if (outsize > 0) {
-        out->truncate(outsize);
-        emit output(out);
-        emit position(timerToMs(&m_timer));
+    // Frames are packed into the current block until the next one would not fit
+    if (m_outend - m_outptr < static_cast<int>(m_synth.pcm.length) * m_frameSize)
+        emitOutput();
 
-        return Ok;
-    } else
-        delete out;
+    emit position(timerToMs(&m_timer));
 
-    return Error;
+    return Ok;
 }
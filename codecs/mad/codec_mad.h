@@ -20,6 +20,7 @@
 #define PLAYERCODEC_MAD_H
 
 #include "codecs/codec.h"
+#include "codecs/mad/convert_mad.h"
 #include <mad.h>
 
 #include <QHash>
@@ -34,6 +35,7 @@ public:
     Q_INVOKABLE AudioFileInformationMad(QObject* parent = 0);
 
     int length() const;
+    FrameIndex frameIndex() const;
 };
 
 class CodecMad : public Codec
@@ -48,13 +50,17 @@ public:
     bool init(const QAudioFormat &format);
     void deinit();
 
+    bool seek(int position, qint64* offset);
+
 public slots:
     void feed(const QByteArray &data, bool end = false);
     Status decode();
+    void flush();
 
 private:
-    void decode16(QByteArray** out, char** outptr, char** outend, int* outsize);
-    void decode24(QByteArray** out, char** outptr, char** outend, int* outsize);
+    void acquireOutput();
+    void emitOutput();
+    void resetStream();
 
 private:
     QAudioFormat m_format;
@@ -67,8 +73,32 @@ private:
 
     QByteArray m_data;
     unsigned char* m_buffer;
-
-    void (CodecMad::*decodeFunc)(QByteArray** out, char** outptr, char** outend, int* outsize);
+    // Input offset of the start of m_buffer
+    qint64 m_bufferOffset;
+
+    QByteArray* m_out;
+    char* m_outptr;
+    char* m_outend;
+
+    MadConvertFunc m_convert;
+    int m_frameSize;
+
+    // Gapless trimming from the LAME tag, m_remaining is -1 if unknown
+    bool m_checkInfo;
+    int m_skip;
+    qint64 m_remaining;
+    // Decoded samples to play from the start of the stream, end is -1 if unknown
+    qint64 m_gaplessStart;
+    qint64 m_gaplessEnd;
+
+    // Seek points found in the stream itself, used without a frame index
+    FrameIndex m_streamIndex;
+    qint64 m_firstFrame;
+    int m_bitrate;
+    unsigned int m_sampleRate;
+
+    // Output before this position (ms) is dropped after a seek, -1 if none
+    qint64 m_discardUntil;
 };
 
 #endif
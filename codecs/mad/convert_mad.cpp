@@ -0,0 +1,437 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "convert_mad.h"
+#include <limits.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define MADCONVERT_X86
+#  include <emmintrin.h>
+#  include <immintrin.h>
+#endif
+
+// The kernels assume 32 bit samples
+typedef char MadFixedSizeCheck[sizeof(mad_fixed_t) == 4 ? 1 : -1];
+
+#define MAD_CONVERT_MAX24 0x7fffff
+
+// Scalar versions, the vector kernels below must produce the exact same bytes.
+// Clipping is symmetric, a full scale negative sample becomes -max rather than min.
+
+static inline short fixedToInt16(mad_fixed_t fixed)
+{
+    if (fixed >= MAD_F_ONE)
+        return SHRT_MAX;
+    if (fixed <= -MAD_F_ONE)
+        return -SHRT_MAX;
+    return static_cast<short>(fixed >> (MAD_F_FRACBITS - 15));
+}
+
+static inline int fixedToInt24(mad_fixed_t fixed)
+{
+    if (fixed >= MAD_F_ONE)
+        return MAD_CONVERT_MAX24;
+    if (fixed <= -MAD_F_ONE)
+        return -MAD_CONVERT_MAX24;
+    return fixed >> (MAD_F_FRACBITS - 23);
+}
+
+static inline int fixedToInt32(mad_fixed_t fixed)
+{
+    if (fixed >= MAD_F_ONE)
+        return INT_MAX;
+    if (fixed <= -MAD_F_ONE)
+        return -INT_MAX;
+    return fixed * (1 << (31 - MAD_F_FRACBITS));
+}
+
+static inline float fixedToFloat(mad_fixed_t fixed)
+{
+    float f = static_cast<float>(fixed) * (1.0f / MAD_F_ONE);
+    if (f > 1.0f)
+        return 1.0f;
+    if (f < -1.0f)
+        return -1.0f;
+    return f;
+}
+
+static inline void put16(char* out, short sample)
+{
+    out[0] = sample & 0xff;
+    out[1] = (sample >> 8) & 0xff;
+}
+
+static inline void put24(char* out, int sample)
+{
+    out[0] = sample & 0xff;
+    out[1] = (sample >> 8) & 0xff;
+    out[2] = (sample >> 16) & 0xff;
+}
+
+static inline void put32(char* out, int sample)
+{
+    out[0] = sample & 0xff;
+    out[1] = (sample >> 8) & 0xff;
+    out[2] = (sample >> 16) & 0xff;
+    out[3] = (sample >> 24) & 0xff;
+}
+
+static void convert16Scalar(const mad_fixed_t* left, const mad_fixed_t* right, int count, char* out)
+{
+    for (int i = 0; i < count; ++i) {
+        put16(out, fixedToInt16(left[i]));
+        put16(out + 2, fixedToInt16(right[i]));
+        out += 4;
+    }
+}
+
+static void convert24Scalar(const mad_fixed_t* left, const mad_fixed_t* right, int count, char* out)
+{
+    for (int i = 0; i < count; ++i) {
+        put24(out, fixedToInt24(left[i]));
+        put24(out + 3, fixedToInt24(right[i]));
+        out += 6;
+    }
+}
+
+static void convert32Scalar(const mad_fixed_t* left, const mad_fixed_t* right, int count, char* out)
+{
+    for (int i = 0; i < count; ++i) {
+        put32(out, fixedToInt32(left[i]));
+        put32(out + 4, fixedToInt32(right[i]));
+        out += 8;
+    }
+}
+
+static void convertFloatScalar(const mad_fixed_t* left, const mad_fixed_t* right, int count, char* out)
+{
+    float f[2];
+    for (int i = 0; i < count; ++i) {
+        f[0] = fixedToFloat(left[i]);
+        f[1] = fixedToFloat(right[i]);
+        memcpy(out, f, sizeof(f));
+        out += 8;
+    }
+}
+
+#ifdef MADCONVERT_X86
+
+// x86 is little endian so the vector kernels can store samples as they are
+
+#define MADCONVERT_SSE2 __attribute__((target("sse2")))
+
+MADCONVERT_SSE2 static inline __m128i select128(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+MADCONVERT_SSE2 static inline __m128i toInt16Wide128(__m128i x)
+{
+    // Positive overflow saturates in the pack, negative full scale is clipped to -SHRT_MAX here
+    const __m128i low = _mm_cmplt_epi32(x, _mm_set1_epi32(-MAD_F_ONE + 1));
+    return select128(low, _mm_set1_epi32(-SHRT_MAX), _mm_srai_epi32(x, MAD_F_FRACBITS - 15));
+}
+
+MADCONVERT_SSE2 static inline __m128i clip128(__m128i x, __m128i value, int max)
+{
+    const __m128i high = _mm_cmpgt_epi32(x, _mm_set1_epi32(MAD_F_ONE - 1));
+    const __m128i low = _mm_cmplt_epi32(x, _mm_set1_epi32(-MAD_F_ONE + 1));
+    value = select128(high, _mm_set1_epi32(max), value);
+    return select128(low, _mm_set1_epi32(-max), value);
+}
+
+MADCONVERT_SSE2 static inline __m128i toInt24_128(__m128i x)
+{
+    return clip128(x, _mm_srai_epi32(x, MAD_F_FRACBITS - 23), MAD_CONVERT_MAX24);
+}
+
+MADCONVERT_SSE2 static inline __m128i toInt32_128(__m128i x)
+{
+    return clip128(x, _mm_slli_epi32(x, 31 - MAD_F_FRACBITS), INT_MAX);
+}
+
+MADCONVERT_SSE2 static inline __m128 toFloat128(__m128i x)
+{
+    const __m128 f = _mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(1.0f / MAD_F_ONE));
+    return _mm_min_ps(_mm_max_ps(f, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+}
+
+MADCONVERT_SSE2 static inline __m128i load128(const mad_fixed_t* p)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+MADCONVERT_SSE2 static inline void store128(char* p, __m128i v)
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+}
+
+MADCONVERT_SSE2 static void convert16SSE2(const mad_fixed_t* left, const mad_fixed_t* right, int count, char* out)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i l = _mm_packs_epi32(toInt16Wide128(load128(left + i)), toInt16Wide128(load128(left + i + 4)));
+        const __m128i r = _mm_packs_epi32(toInt16Wide128(load128(right + i)), toInt16Wide128(load128(right + i + 4)));
+        store128(out, _mm_unpacklo_epi16(l, r));
+        store128(out + 16, _mm_unpackhi_epi16(l, r));
+        out += 32;
+    }
+    convert16Scalar(left + i, right + i, count - i, out);
+}
+
+MADCONVERT_SSE2 static void convert24SSE2(const mad_fixed_t* left, const mad_fixed_t* right, int count, char* out)
+{
+    // No byte shuffle in SSE2, convert and interleave in registers and pack the bytes from there
+    int tmp[8];
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i l = toInt24_128(load128(left + i));
+        const __m128i r = toInt24_128(load128(right + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(tmp), _mm_unpacklo_epi32(l, r));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(tmp + 4), _mm_unpackhi_epi32(l, r));
+        for (int j = 0; j < 8; ++j) {
+            memcpy(out, tmp + j, 3);
+            out += 3;
+        }
+    }
+    convert24Scalar(left + i, right + i, count - i, out);
+}
+
+MADCONVERT_SSE2 static void convert32SSE2(const mad_fixed_t* left, const mad_fixed_t* right, int count, char* out)
+{
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i l = toInt32_128(load128(left + i));
+        const __m128i r = toInt32_128(load128(right + i));
+        store128(out, _mm_unpacklo_epi32(l, r));
+        store128(out + 16, _mm_unpackhi_epi32(l, r));
+        out += 32;
+    }
+    convert32Scalar(left + i, right + i, count - i, out);
+}
+
+MADCONVERT_SSE2 static void convertFloatSSE2(const mad_fixed_t* left, const mad_fixed_t* right, int count, char* out)
+{
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 l = toFloat128(load128(left + i));
+        const __m128 r = toFloat128(load128(right + i));
+        _mm_storeu_ps(reinterpret_cast<float*>(out), _mm_unpacklo_ps(l, r));
+        _mm_storeu_ps(reinterpret_cast<float*>(out + 16), _mm_unpackhi_ps(l, r));
+        out += 32;
+    }
+    convertFloatScalar(left + i, right + i, count - i, out);
+}
+
+#define MADCONVERT_AVX2 __attribute__((target("avx2")))
+
+MADCONVERT_AVX2 static inline __m256i select256(__m256i mask, __m256i a, __m256i b)
+{
+    return _mm256_blendv_epi8(b, a, mask);
+}
+
+MADCONVERT_AVX2 static inline __m256i clip256(__m256i x, __m256i value, int max)
+{
+    const __m256i high = _mm256_cmpgt_epi32(x, _mm256_set1_epi32(MAD_F_ONE - 1));
+    const __m256i low = _mm256_cmpgt_epi32(_mm256_set1_epi32(-MAD_F_ONE + 1), x);
+    value = select256(high, _mm256_set1_epi32(max), value);
+    return select256(low, _mm256_set1_epi32(-max), value);
+}
+
+MADCONVERT_AVX2 static inline __m256i load256(const mad_fixed_t* p)
+{
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+MADCONVERT_AVX2 static inline void store256(char* p, __m256i v)
+{
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+}
+
+// Interleaves eight left and eight right 32 bit values into sixteen values in order
+MADCONVERT_AVX2 static inline void interleave256(__m256i l, __m256i r, __m256i* first, __m256i* second)
+{
+    const __m256i lo = _mm256_unpacklo_epi32(l, r);
+    const __m256i hi = _mm256_unpackhi_epi32(l, r);
+    *first = _mm256_permute2x128_si256(lo, hi, 0x20);
+    *second = _mm256_permute2x128_si256(lo, hi, 0x31);
+}
+
+MADCONVERT_AVX2 static inline __m256i toInt16Wide256(__m256i x)
+{
+    const __m256i low = _mm256_cmpgt_epi32(_mm256_set1_epi32(-MAD_F_ONE + 1), x);
+    return select256(low, _mm256_set1_epi32(-SHRT_MAX), _mm256_srai_epi32(x, MAD_F_FRACBITS - 15));
+}
+
+MADCONVERT_AVX2 static void convert16AVX2(const mad_fixed_t* left, const mad_fixed_t* right, int count, char* out)
+{
+    // Per 128 bit lane the pack yields four left then four right samples, pair them up
+    const __m256i order = _mm256_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15,
+                                           0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i packed = _mm256_packs_epi32(toInt16Wide256(load256(left + i)), toInt16Wide256(load256(right + i)));
+        store256(out, _mm256_shuffle_epi8(packed, order));
+        out += 32;
+    }
+    convert16Scalar(left + i, right + i, count - i, out);
+}
+
+MADCONVERT_AVX2 static inline void store24x4(char* out, __m128i v)
+{
+    int tail = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out), v);
+    memcpy(out + 8, &tail, 4);
+}
+
+MADCONVERT_AVX2 static void convert24AVX2(const mad_fixed_t* left, const mad_fixed_t* right, int count, char* out)
+{
+    // Drops the top byte of each value, twelve bytes per 128 bit lane
+    const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                          0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    __m256i first, second;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i l = load256(left + i);
+        const __m256i r = load256(right + i);
+        interleave256(clip256(l, _mm256_srai_epi32(l, MAD_F_FRACBITS - 23), MAD_CONVERT_MAX24),
+                      clip256(r, _mm256_srai_epi32(r, MAD_F_FRACBITS - 23), MAD_CONVERT_MAX24),
+                      &first, &second);
+        first = _mm256_shuffle_epi8(first, pack);
+        second = _mm256_shuffle_epi8(second, pack);
+        store24x4(out, _mm256_castsi256_si128(first));
+        store24x4(out + 12, _mm256_extracti128_si256(first, 1));
+        store24x4(out + 24, _mm256_castsi256_si128(second));
+        store24x4(out + 36, _mm256_extracti128_si256(second, 1));
+        out += 48;
+    }
+    convert24Scalar(left + i, right + i, count - i, out);
+}
+
+MADCONVERT_AVX2 static void convert32AVX2(const mad_fixed_t* left, const mad_fixed_t* right, int count, char* out)
+{
+    __m256i first, second;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i l = load256(left + i);
+        const __m256i r = load256(right + i);
+        interleave256(clip256(l, _mm256_slli_epi32(l, 31 - MAD_F_FRACBITS), INT_MAX),
+                      clip256(r, _mm256_slli_epi32(r, 31 - MAD_F_FRACBITS), INT_MAX),
+                      &first, &second);
+        store256(out, first);
+        store256(out + 32, second);
+        out += 64;
+    }
+    convert32Scalar(left + i, right + i, count - i, out);
+}
+
+MADCONVERT_AVX2 static inline __m256 toFloat256(__m256i x)
+{
+    const __m256 f = _mm256_mul_ps(_mm256_cvtepi32_ps(x), _mm256_set1_ps(1.0f / MAD_F_ONE));
+    return _mm256_min_ps(_mm256_max_ps(f, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f));
+}
+
+MADCONVERT_AVX2 static void convertFloatAVX2(const mad_fixed_t* left, const mad_fixed_t* right, int count, char* out)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256 l = toFloat256(load256(left + i));
+        const __m256 r = toFloat256(load256(right + i));
+        const __m256 lo = _mm256_unpacklo_ps(l, r);
+        const __m256 hi = _mm256_unpackhi_ps(l, r);
+        _mm256_storeu_ps(reinterpret_cast<float*>(out), _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(reinterpret_cast<float*>(out + 32), _mm256_permute2f128_ps(lo, hi, 0x31));
+        out += 64;
+    }
+    convertFloatScalar(left + i, right + i, count - i, out);
+}
+
+#endif // MADCONVERT_X86
+
+MadConvert::MadConvert()
+{
+}
+
+MadConvert::Kernel MadConvert::kernel()
+{
+#ifdef MADCONVERT_X86
+    static Kernel best = Scalar;
+    static bool probed = false;
+    if (!probed) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            best = AVX2;
+        else if (__builtin_cpu_supports("sse2"))
+            best = SSE2;
+        probed = true;
+    }
+    return best;
+#else
+    return Scalar;
+#endif
+}
+
+const char* MadConvert::kernelName(Kernel kernel)
+{
+    switch (kernel) {
+    case SSE2:
+        return "sse2";
+    case AVX2:
+        return "avx2";
+    default:
+        break;
+    }
+    return "scalar";
+}
+
+MadConvertFunc MadConvert::function(Format format)
+{
+    return function(format, kernel());
+}
+
+MadConvertFunc MadConvert::function(Format format, Kernel k)
+{
+    if (k > kernel())
+        return 0;
+
+    static const MadConvertFunc scalar[] = { convert16Scalar, convert24Scalar, convert32Scalar, convertFloatScalar };
+#ifdef MADCONVERT_X86
+    static const MadConvertFunc sse2[] = { convert16SSE2, convert24SSE2, convert32SSE2, convertFloatSSE2 };
+    static const MadConvertFunc avx2[] = { convert16AVX2, convert24AVX2, convert32AVX2, convertFloatAVX2 };
+
+    if (k == AVX2)
+        return avx2[format];
+    if (k == SSE2)
+        return sse2[format];
+#endif
+    return scalar[format];
+}
+
+int MadConvert::frameSize(Format format)
+{
+    switch (format) {
+    case Int16:
+        return 4;
+    case Int24:
+        return 6;
+    default:
+        break;
+    }
+    return 8;
+}
@@ -0,0 +1,49 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PLAYERCONVERT_MAD_H
+#define PLAYERCONVERT_MAD_H
+
+#include <mad.h>
+
+// Converts count samples from the left and right channel to interleaved
+// little endian stereo. Mono input is converted by passing the same channel twice.
+typedef void (*MadConvertFunc)(const mad_fixed_t* left, const mad_fixed_t* right, int count, char* out);
+
+class MadConvert
+{
+public:
+    enum Format { Int16, Int24, Int32, Float };
+    enum Kernel { Scalar, SSE2, AVX2 };
+
+    // Best kernel supported by the running CPU
+    static Kernel kernel();
+    static const char* kernelName(Kernel kernel);
+
+    static MadConvertFunc function(Format format);
+    // Returns 0 if the kernel is not available on this CPU
+    static MadConvertFunc function(Format format, Kernel kernel);
+
+    // Bytes per interleaved stereo frame
+    static int frameSize(Format format);
+
+private:
+    MadConvert();
+};
+
+#endif
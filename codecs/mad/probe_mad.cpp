@@ -0,0 +1,253 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "probe_mad.h"
+#include "xing_mad.h"
+#include <mad.h>
+#include <taglib/id3v2frame.h>
+#include <taglib/id3v2framefactory.h>
+#include <math.h>
+#include <string.h>
+#include <QFile>
+#include <QDebug>
+
+#define PROBE_BUFFER_SIZE 16384
+#define PROBE_CBR_FRAMES 8 // frames that have to agree on the bitrate to call it CBR
+#define PROBE_CBR_SAMPLES 4 // places further into the file that have to agree as well
+#define PROBE_SAMPLE_SIZE 4096
+#define SCAN_BUFFER_SIZE (8196 * 5)
+
+static int timerToMs(mad_timer_t* timer)
+{
+    static double res = (double)MAD_TIMER_RESOLUTION / 1000.;
+
+    int msec = timer->seconds * 1000;
+    msec += (int)round((double)timer->fraction / res);
+    return msec;
+}
+
+// Size of the ID3v2 tag at the start of the file, if any
+static qint64 id3v2Size(QFile& file)
+{
+    unsigned char header[10];
+    if (!file.seek(0) || file.read(reinterpret_cast<char*>(header), 10) != 10)
+        return 0;
+    if (memcmp(header, "ID3", 3))
+        return 0;
+
+    qint64 size = ((header[6] & 0x7f) << 21) | ((header[7] & 0x7f) << 14) | ((header[8] & 0x7f) << 7) | (header[9] & 0x7f);
+    size += 10;
+    if (header[5] & 0x10) // footer
+        size += 10;
+    return size;
+}
+
+// Size of the ID3v1 tag at the end of the file, if any
+static qint64 id3v1Size(QFile& file)
+{
+    if (file.size() < 128 || !file.seek(file.size() - 128))
+        return 0;
+    return (file.read(3) == "TAG") ? 128 : 0;
+}
+
+// Bitrate of the first two frames found at pos, 0 if they disagree or
+// there are none. A VBR file can start out with a run of equal frames.
+static unsigned long bitrateAt(QFile& file, qint64 pos, qint64 end)
+{
+    if (!file.seek(pos))
+        return 0;
+    QByteArray data = file.read(qMin<qint64>(PROBE_SAMPLE_SIZE, end - pos));
+    if (data.isEmpty())
+        return 0;
+
+    mad_stream stream;
+    mad_header header;
+    mad_stream_init(&stream);
+    mad_header_init(&header);
+    mad_stream_buffer(&stream, reinterpret_cast<const unsigned char*>(data.constData()), data.size());
+
+    unsigned long bitrate = 0;
+    int frames = 0;
+    while (frames < 2) {
+        if (mad_header_decode(&header, &stream)) {
+            if (MAD_RECOVERABLE(stream.error))
+                continue;
+            break;
+        }
+        if (bitrate && bitrate != header.bitrate) {
+            bitrate = 0;
+            break;
+        }
+        bitrate = header.bitrate;
+        ++frames;
+    }
+
+    mad_stream_finish(&stream);
+    mad_header_finish(&header);
+
+    return (frames == 2) ? bitrate : 0;
+}
+
+MadProbe::MadProbe()
+{
+}
+
+int MadProbe::duration(const QString &filename)
+{
+    if (filename.isEmpty())
+        return 0;
+
+    QFile file(filename);
+    if (!file.open(QFile::ReadOnly))
+        return 0;
+
+    const qint64 start = id3v2Size(file);
+    const qint64 end = file.size() - id3v1Size(file);
+    if (end <= start || !file.seek(start))
+        return 0;
+
+    QByteArray data = file.read(PROBE_BUFFER_SIZE);
+    if (data.isEmpty())
+        return 0;
+    const unsigned char* buf = reinterpret_cast<const unsigned char*>(data.constData());
+
+    mad_stream stream;
+    mad_header header;
+    mad_stream_init(&stream);
+    mad_header_init(&header);
+    mad_stream_buffer(&stream, buf, data.size());
+
+    int result = -1;
+    int frames = 0;
+    unsigned long bitrate = 0;
+    qint64 firstFrame = -1;
+    bool cbr = true;
+
+    while (frames < PROBE_CBR_FRAMES) {
+        if (mad_header_decode(&header, &stream)) {
+            if (MAD_RECOVERABLE(stream.error))
+                continue;
+            break;
+        }
+
+        if (firstFrame < 0) {
+            firstFrame = start + (stream.this_frame - buf);
+
+            MadXing info;
+            if (info.read(stream.this_frame, stream.next_frame - stream.this_frame, &header)) {
+                // Trust the frame count unless the byte count says otherwise
+                const qint64 audio = end - firstFrame;
+                const bool consistent = !info.bytes() || (info.bytes() <= audio * 11 / 10 && info.bytes() >= audio / 2);
+                if (info.frames() > 0 && header.samplerate > 0 && consistent) {
+                    qint64 samples = static_cast<qint64>(info.frames()) * MadXing::samplesPerFrame(&header);
+                    if (info.hasLameTag())
+                        samples -= info.encoderDelay() + info.encoderPadding();
+                    result = static_cast<int>((samples * 1000) / header.samplerate);
+                }
+                break;
+            }
+        }
+
+        if (!bitrate)
+            bitrate = header.bitrate;
+        else if (bitrate != header.bitrate)
+            cbr = false;
+        ++frames;
+
+        if (!cbr)
+            break;
+    }
+
+    mad_stream_finish(&stream);
+    mad_header_finish(&header);
+
+    if (result >= 0)
+        return result;
+
+    if (cbr && frames == PROBE_CBR_FRAMES && bitrate > 0) {
+        // Spread out over the rest of the file, the last one close to the end
+        const qint64 audio = end - firstFrame;
+        for (int i = 1; cbr && i <= PROBE_CBR_SAMPLES; ++i) {
+            const qint64 pos = (i < PROBE_CBR_SAMPLES)
+                               ? firstFrame + (audio * i) / PROBE_CBR_SAMPLES
+                               : end - PROBE_SAMPLE_SIZE;
+            if (pos > firstFrame && bitrateAt(file, pos, end) != bitrate)
+                cbr = false;
+        }
+        if (cbr)
+            return static_cast<int>((audio * 8000) / bitrate);
+    }
+
+    return scanDuration(file, start);
+}
+
+int MadProbe::scanDuration(QFile &file, qint64 start)
+{
+    if (!file.seek(start))
+        return 0;
+
+    mad_stream infostream;
+    mad_header infoheader;
+    mad_timer_t infotimer;
+    mad_stream_init(&infostream);
+    mad_header_init(&infoheader);
+    mad_timer_reset(&infotimer);
+
+    qint64 r;
+    qint64 l = 0;
+    unsigned char* buf = new unsigned char[SCAN_BUFFER_SIZE];
+
+    while (!file.atEnd()) {
+        if (l < SCAN_BUFFER_SIZE) {
+            r = file.read(reinterpret_cast<char*>(buf) + l, SCAN_BUFFER_SIZE - l);
+            l += r;
+        }
+        mad_stream_buffer(&infostream, buf, l);
+        for (;;) {
+            if (mad_header_decode(&infoheader, &infostream)) {
+                if (!MAD_RECOVERABLE(infostream.error))
+                    break;
+                if (infostream.error == MAD_ERROR_LOSTSYNC) {
+                    TagLib::ID3v2::Header header;
+                    uint size = (uint)(infostream.bufend - infostream.this_frame);
+                    if (size >= header.size()) {
+                        header.setData(TagLib::ByteVector(reinterpret_cast<const char*>(infostream.this_frame), size));
+                        uint tagsize = header.tagSize();
+                        if (tagsize > 0) {
+                            mad_stream_skip(&infostream, qMin(tagsize, size));
+                            continue;
+                        }
+                    }
+                }
+                qDebug() << "header decode error while getting file info" << infostream.error;
+                continue;
+            }
+            mad_timer_add(&infotimer, infoheader.duration);
+        }
+        if (infostream.error != MAD_ERROR_BUFLEN && infostream.error != MAD_ERROR_BUFPTR)
+            break;
+        memmove(buf, infostream.next_frame, &(buf[l]) - infostream.next_frame);
+        l -= (infostream.next_frame - buf);
+    }
+
+    mad_stream_finish(&infostream);
+    mad_header_finish(&infoheader);
+    delete[] buf;
+
+    return timerToMs(&infotimer);
+}
@@ -0,0 +1,43 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PLAYERPROBE_MAD_H
+#define PLAYERPROBE_MAD_H
+
+#include <QString>
+
+class QFile;
+
+// Works out the duration of an MP3 file from its first frames when it can:
+// the frame count of a Xing/Info or VBRI header, or the bitrate of a
+// constant bitrate stream, checked at a few places throughout the file.
+// Scans every frame header otherwise.
+class MadProbe
+{
+public:
+    // Duration in ms, 0 if the file can't be read
+    static int duration(const QString& filename);
+
+    // The full scan, for when the headers can't be trusted
+    static int scanDuration(QFile& file, qint64 start);
+
+private:
+    MadProbe();
+};
+
+#endif
@@ -0,0 +1,230 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "xing_mad.h"
+#include <string.h>
+
+#define XING_FRAMES 0x1
+#define XING_BYTES 0x2
+#define XING_TOC 0x4
+#define XING_QUALITY 0x8
+
+#define LAME_TAG_SIZE 36
+#define LAME_DELAY_OFFSET 21
+
+#define VBRI_OFFSET 36
+#define VBRI_HEADER_SIZE 26
+#define MAD_DECODER_DELAY 529
+
+static inline quint32 readBE32(const unsigned char* data)
+{
+    return (quint32(data[0]) << 24) | (quint32(data[1]) << 16) | (quint32(data[2]) << 8) | quint32(data[3]);
+}
+
+static inline quint32 readBE(const unsigned char* data, int bytes)
+{
+    quint32 value = 0;
+    for (int i = 0; i < bytes; ++i)
+        value = (value << 8) | data[i];
+    return value;
+}
+
+MadXing::MadXing()
+    : m_valid(false), m_frames(0), m_bytes(0), m_hasToc(false), m_hasLame(false), m_delay(0), m_padding(0),
+      m_vbriFrames(0)
+{
+}
+
+bool MadXing::read(const unsigned char *frame, int size, const struct mad_header *header)
+{
+    m_valid = m_hasToc = m_hasLame = false;
+    m_frames = m_bytes = 0;
+    m_delay = m_padding = 0;
+    m_vbriToc.clear();
+    m_vbriFrames = 0;
+
+    if (header->layer != MAD_LAYER_III)
+        return false;
+
+    if (readVbri(frame, size))
+        return true;
+
+    // The tag follows the side information
+    const bool mono = (header->mode == MAD_MODE_SINGLE_CHANNEL);
+    int pos;
+    if (header->flags & MAD_FLAG_LSF_EXT)
+        pos = 4 + (mono ? 9 : 17);
+    else
+        pos = 4 + (mono ? 17 : 32);
+
+    if (pos + 8 > size)
+        return false;
+    if (memcmp(frame + pos, "Xing", 4) && memcmp(frame + pos, "Info", 4))
+        return false;
+    pos += 4;
+
+    const quint32 flags = readBE32(frame + pos);
+    pos += 4;
+
+    if (flags & XING_FRAMES) {
+        if (pos + 4 > size)
+            return false;
+        m_frames = readBE32(frame + pos);
+        pos += 4;
+    }
+    if (flags & XING_BYTES) {
+        if (pos + 4 > size)
+            return false;
+        m_bytes = readBE32(frame + pos);
+        pos += 4;
+    }
+    if (flags & XING_TOC) {
+        if (pos + 100 > size)
+            return false;
+        memcpy(m_toc, frame + pos, 100);
+        m_hasToc = true;
+        pos += 100;
+    }
+    if (flags & XING_QUALITY)
+        pos += 4;
+
+    m_valid = true;
+
+    // LAME and compatible encoders identify themselves in the first bytes
+    if (pos + LAME_TAG_SIZE <= size
+        && (!memcmp(frame + pos, "LAME", 4) || !memcmp(frame + pos, "Lavf", 4) || !memcmp(frame + pos, "Lavc", 4))) {
+        const unsigned char* dp = frame + pos + LAME_DELAY_OFFSET;
+        m_delay = (dp[0] << 4) | (dp[1] >> 4);
+        m_padding = ((dp[1] & 0x0f) << 8) | dp[2];
+        m_hasLame = true;
+    }
+
+    return true;
+}
+
+bool MadXing::readVbri(const unsigned char *frame, int size)
+{
+    // Fraunhofer's header is always at the same place
+    if (VBRI_OFFSET + VBRI_HEADER_SIZE > size || memcmp(frame + VBRI_OFFSET, "VBRI", 4))
+        return false;
+
+    const unsigned char* data = frame + VBRI_OFFSET + 10;
+    m_bytes = readBE32(data);
+    m_frames = readBE32(data + 4);
+    const int entries = readBE(data + 8, 2);
+    const quint32 scale = readBE(data + 10, 2);
+    const int entrySize = readBE(data + 12, 2);
+    m_vbriFrames = readBE(data + 14, 2);
+    m_valid = true;
+
+    if (entrySize < 1 || entrySize > 4 || VBRI_OFFSET + VBRI_HEADER_SIZE + entries * entrySize > size)
+        return true;
+
+    data = frame + VBRI_OFFSET + VBRI_HEADER_SIZE;
+    m_vbriToc.resize(entries);
+    for (int i = 0; i < entries; ++i) {
+        m_vbriToc[i] = readBE(data, entrySize) * scale;
+        data += entrySize;
+    }
+
+    return true;
+}
+
+bool MadXing::isValid() const
+{
+    return m_valid;
+}
+
+quint32 MadXing::frames() const
+{
+    return m_frames;
+}
+
+quint32 MadXing::bytes() const
+{
+    return m_bytes;
+}
+
+bool MadXing::hasToc() const
+{
+    return m_hasToc;
+}
+
+int MadXing::toc(int percent) const
+{
+    if (!m_hasToc)
+        return (percent * 256) / 100;
+    return m_toc[qBound(0, percent, 99)];
+}
+
+FrameIndex MadXing::index(const struct mad_header *header, qint64 offset, int frameSize) const
+{
+    FrameIndex index;
+    if (!m_valid || !m_frames || !header->samplerate)
+        return index;
+
+    const qint64 spf = samplesPerFrame(header);
+    const qint64 rate = header->samplerate;
+
+    if (m_hasToc && m_bytes) {
+        const qint64 duration = (m_frames * spf * 1000) / rate;
+        for (int i = 0; i < 100; ++i)
+            index.append((duration * i) / 100, offset + (static_cast<qint64>(m_toc[i]) * m_bytes) / 256);
+    } else if (!m_vbriToc.isEmpty() && m_vbriFrames > 0) {
+        qint64 pos = offset + frameSize;
+        index.append(0, pos);
+        for (int i = 0; i < m_vbriToc.size(); ++i) {
+            pos += m_vbriToc.at(i);
+            index.append(((i + 1) * m_vbriFrames * spf * 1000) / rate, pos);
+        }
+    }
+
+    return index;
+}
+
+bool MadXing::hasLameTag() const
+{
+    return m_hasLame;
+}
+
+int MadXing::encoderDelay() const
+{
+    return m_delay;
+}
+
+int MadXing::encoderPadding() const
+{
+    return m_padding;
+}
+
+int MadXing::decoderDelay()
+{
+    return MAD_DECODER_DELAY;
+}
+
+int MadXing::samplesPerFrame(const struct mad_header *header)
+{
+    switch (header->layer) {
+    case MAD_LAYER_I:
+        return 384;
+    case MAD_LAYER_II:
+        return 1152;
+    default:
+        return (header->flags & MAD_FLAG_LSF_EXT) ? 576 : 1152;
+    }
+}
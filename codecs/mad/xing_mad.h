@@ -0,0 +1,80 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PLAYERXING_MAD_H
+#define PLAYERXING_MAD_H
+
+#include "frameindex.h"
+#include <mad.h>
+#include <QtGlobal>
+#include <QVector>
+
+// The Xing/Info or VBRI header some encoders put in the first frame of a
+// stream instead of audio, along with the LAME extension when present.
+class MadXing
+{
+public:
+    MadXing();
+
+    // frame points to the start of a complete frame of size bytes whose
+    // header has been decoded into header
+    bool read(const unsigned char* frame, int size, const struct mad_header* header);
+
+    bool isValid() const;
+
+    // Number of audio frames following the info frame, 0 if unknown
+    quint32 frames() const;
+    // Size of the stream in bytes including the info frame, 0 if unknown
+    quint32 bytes() const;
+
+    bool hasToc() const;
+    // Byte position of percent% into the stream as a fraction of 256
+    int toc(int percent) const;
+
+    // Seek points from the Xing or VBRI table of contents, offset being the
+    // position of the info frame in the file and frameSize its size
+    FrameIndex index(const struct mad_header* header, qint64 offset, int frameSize) const;
+
+    bool hasLameTag() const;
+    // Samples added at the start and end of the stream by the encoder
+    int encoderDelay() const;
+    int encoderPadding() const;
+
+    // Samples libmad outputs before the first encoded sample
+    static int decoderDelay();
+    static int samplesPerFrame(const struct mad_header* header);
+
+private:
+    bool readVbri(const unsigned char* frame, int size);
+
+private:
+    bool m_valid;
+    quint32 m_frames;
+    quint32 m_bytes;
+    bool m_hasToc;
+    unsigned char m_toc[100];
+    bool m_hasLame;
+    int m_delay;
+    int m_padding;
+
+    // Byte sizes of each group of m_vbriFrames frames
+    QVector<quint32> m_vbriToc;
+    int m_vbriFrames;
+};
+
+#endif
@@ -22,6 +22,9 @@
 #define FILEREADERDEVICE_READ 8192
 #define FILEREADERDEVICE_MIN (8192 * 4)
 #define FILEREADERDEVICE_MAX (8192 * 10)
+#define FILEREADERDEVICE_POOL 32
+
+static BufferPool s_readPool(FILEREADERDEVICE_READ, FILEREADERDEVICE_POOL);
 
 class FileJob : public IOJob
 {
@@ -31,11 +34,16 @@ class FileJob : public IOJob
 public:
     Q_INVOKABLE FileJob(QObject *parent = 0);
 
+    Lane lane() const;
+
     void read(int size);
 
     QString filename() const;
     void setFilename(const QString& filename);
 
+    // Where to start reading, set before the job is started
+    void setOffset(qint64 offset);
+
     void start();
 
 signals:
@@ -49,14 +57,20 @@ private:
 
 private:
     QString m_filename;
+    qint64 m_offset;
     QFile m_file;
 };
 
 #include "filereader.moc"
 
 FileJob::FileJob(QObject *parent)
-    : IOJob(parent)
+    : IOJob(parent), m_offset(0)
+{
+}
+
+IOJob::Lane FileJob::lane() const
 {
+    return Playback;
 }
 
 void FileJob::start()
@@ -69,6 +83,8 @@ void FileJob::startJob()
     m_file.setFileName(filename());
     if (!m_file.open(QFile::ReadOnly))
         emit error(QLatin1String("Unable to open file: ") + filename());
+    else if (m_offset > 0 && !m_file.seek(m_offset))
+        emit error(QLatin1String("Unable to seek in file: ") + filename());
 
     emit readerStarted();
 }
@@ -85,7 +101,11 @@ void FileJob::readData(int size)
         return;
     }
 
-    QByteArray* dt = new QByteArray(m_file.read(size));
+    QByteArray* dt = s_readPool.acquire();
+    if (dt->size() != size)
+        dt->resize(size);
+    qint64 r = m_file.read(dt->data(), size);
+    dt->resize(qMax<qint64>(r, 0));
     emit data(dt);
 
     if (m_file.atEnd()) {
@@ -106,14 +126,19 @@ void FileJob::setFilename(const QString &filename)
     m_filename = filename;
 }
 
+void FileJob::setOffset(qint64 offset)
+{
+    m_offset = offset;
+}
+
 FileReader::FileReader(QObject *parent)
-    : AudioReader(parent), m_atend(false), m_reader(0), m_started(false), m_pendingTotal(0)
+    : AudioReader(parent), m_buffer(&s_readPool), m_atend(false), m_reader(0), m_started(false), m_pendingTotal(0)
 {
     connect(IO::instance(), SIGNAL(error(QString)), this, SLOT(ioError(QString)));
 }
 
 FileReader::FileReader(const QString &filename, QObject *parent)
-    : AudioReader(parent), m_filename(filename), m_atend(false), m_reader(0), m_started(false), m_pendingTotal(0)
+    : AudioReader(parent), m_filename(filename), m_buffer(&s_readPool), m_atend(false), m_reader(0), m_started(false), m_pendingTotal(0)
 {
     connect(IO::instance(), SIGNAL(error(QString)), this, SLOT(ioError(QString)));
 }
@@ -170,6 +195,29 @@ bool FileReader::open(OpenMode mode)
     if (!ok)
         return false;
 
+    startReader(0);
+
+    return true;
+}
+
+bool FileReader::canRestart() const
+{
+    return isOpen();
+}
+
+bool FileReader::restartAt(qint64 pos)
+{
+    if (!isOpen() || pos < 0)
+        return false;
+
+    // Anything still on its way from the old job is dropped as it is no longer m_reader
+    startReader(pos);
+
+    return true;
+}
+
+void FileReader::startReader(qint64 offset)
+{
     m_atend = false;
 
     m_buffer.clear();
@@ -183,18 +231,22 @@ bool FileReader::open(OpenMode mode)
 
     FileJob* job = new FileJob;
     job->setFilename(m_filename);
+    job->setOffset(offset);
+    job->setPriority(IOJob::CriticalPriority);
 
     connect(job, SIGNAL(started()), this, SLOT(jobStarted()));
     connect(job, SIGNAL(finished()), this, SLOT(jobFinished()));
 
     IO::instance()->startJob(job);
     m_reader = job;
-
-    return true;
 }
 
 void FileReader::jobStarted()
 {
+    // A job replaced by a seek before it got going
+    if (sender() != m_reader)
+        return;
+
     connect(m_reader, SIGNAL(readerStarted()), this, SLOT(readerStarted()));
     connect(m_reader, SIGNAL(data(QByteArray*)), this, SLOT(readerData(QByteArray*)));
     connect(m_reader, SIGNAL(atEnd()), this, SLOT(readerAtEnd()));
@@ -254,13 +306,14 @@ void FileReader::readerError(const QString &message)
     qDebug() << "readerError" << message;
 
     m_atend = true;
+    emit readyRead();
 }
 
 void FileReader::readerData(QByteArray *data)
 {
     QObject* from = sender();
     if (from && from != m_reader) {
-        delete data;
+        s_readPool.release(data);
         return;
     }
 
@@ -273,6 +326,7 @@ void FileReader::readerData(QByteArray *data)
     qDebug() << "readerData, m_p is now" << m_pendingTotal;
 
     m_buffer.add(data);
+    emit readyRead();
 }
 
 void FileReader::readerAtEnd()
@@ -282,6 +336,7 @@ void FileReader::readerAtEnd()
         return;
 
     m_atend = true;
+    emit readyRead();
 }
 
 bool FileReader::atEnd() const
@@ -299,18 +354,14 @@ qint64 FileReader::writeData(const char *data, qint64 len)
 
 qint64 FileReader::readData(char *data, qint64 maxlen)
 {
-    if (m_atend && m_buffer.isEmpty()) {
-        close();
+    // Stays open at the end so that it can be restarted
+    if (m_atend && m_buffer.isEmpty())
         return 0;
-    }
-
-    QByteArray dt = m_buffer.read(maxlen);
 
-    if (!dt.isEmpty())
-        memcpy(data, dt.constData(), dt.size());
+    int read = m_buffer.readInto(data, static_cast<int>(qMin<qint64>(maxlen, m_buffer.size())));
 
     if (m_atend || !m_started)
-        return dt.size();
+        return read;
 
     int bsz = m_buffer.size();
     if (bsz + m_pendingTotal < FILEREADERDEVICE_MIN) {
@@ -321,5 +372,5 @@ qint64 FileReader::readData(char *data, qint64 maxlen)
         } while (bsz + m_pendingTotal < FILEREADERDEVICE_MAX);
     }
 
-    return dt.size();
+    return read;
 }
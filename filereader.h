@@ -45,6 +45,9 @@ public:
     void close();
     bool open(OpenMode mode);
 
+    bool canRestart() const;
+    bool restartAt(qint64 pos);
+
 protected:
     qint64 readData(char *data, qint64 maxlen);
     qint64 writeData(const char *data, qint64 len);
@@ -59,6 +62,9 @@ private slots:
     void readerAtEnd();
     void readerError(const QString& message);
 
+private:
+    void startReader(qint64 offset);
+
 private:
     QString m_filename;
     Buffer m_buffer;
@@ -0,0 +1,104 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "frameindex.h"
+#include <QDataStream>
+#include <QtAlgorithms>
+
+#define FRAMEINDEX_VERSION 1
+
+static bool positionLessThan(qint64 position, const FrameIndex::Entry& entry)
+{
+    return position < entry.position;
+}
+
+FrameIndex::FrameIndex()
+{
+}
+
+bool FrameIndex::isEmpty() const
+{
+    return m_entries.isEmpty();
+}
+
+int FrameIndex::size() const
+{
+    return m_entries.size();
+}
+
+void FrameIndex::append(qint64 position, qint64 offset)
+{
+    if (!m_entries.isEmpty() && position < m_entries.last().position)
+        return;
+
+    Entry entry;
+    entry.position = position;
+    entry.offset = offset;
+    m_entries.append(entry);
+}
+
+void FrameIndex::clear()
+{
+    m_entries.clear();
+}
+
+FrameIndex::Entry FrameIndex::lookup(qint64 position) const
+{
+    Q_ASSERT(!m_entries.isEmpty());
+
+    QVector<Entry>::const_iterator it = qUpperBound(m_entries.constBegin(), m_entries.constEnd(),
+                                                    position, positionLessThan);
+    if (it == m_entries.constBegin())
+        return m_entries.first();
+    return *(it - 1);
+}
+
+QByteArray FrameIndex::toByteArray() const
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << static_cast<qint32>(FRAMEINDEX_VERSION) << static_cast<qint32>(m_entries.size());
+    foreach(const Entry& entry, m_entries) {
+        stream << entry.position << entry.offset;
+    }
+    return data;
+}
+
+FrameIndex FrameIndex::fromByteArray(const QByteArray &data)
+{
+    FrameIndex index;
+
+    QDataStream stream(data);
+    qint32 version, count;
+    stream >> version >> count;
+    if (stream.status() != QDataStream::Ok || version != FRAMEINDEX_VERSION || count < 0)
+        return index;
+
+    index.m_entries.reserve(count);
+    Entry entry;
+    for (qint32 i = 0; i < count; ++i) {
+        stream >> entry.position >> entry.offset;
+        if (stream.status() != QDataStream::Ok) {
+            index.clear();
+            break;
+        }
+        index.m_entries.append(entry);
+    }
+
+    return index;
+}
@@ -0,0 +1,58 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAMEINDEX_H
+#define FRAMEINDEX_H
+
+#include <QByteArray>
+#include <QMetaType>
+#include <QVector>
+
+// Maps playback positions to byte offsets in an encoded stream so that a
+// decoder can start close to any position without decoding up to it.
+class FrameIndex
+{
+public:
+    struct Entry
+    {
+        qint64 position; // ms
+        qint64 offset; // bytes from the start of the file
+    };
+
+    FrameIndex();
+
+    bool isEmpty() const;
+    int size() const;
+
+    // Entries have to be appended in increasing order of position
+    void append(qint64 position, qint64 offset);
+    void clear();
+
+    // The last entry at or before position, or the first entry
+    Entry lookup(qint64 position) const;
+
+    QByteArray toByteArray() const;
+    static FrameIndex fromByteArray(const QByteArray& data);
+
+private:
+    QVector<Entry> m_entries;
+};
+
+Q_DECLARE_METATYPE(FrameIndex)
+
+#endif // FRAMEINDEX_H
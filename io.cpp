@@ -19,8 +19,27 @@
 #include "io.h"
 #include <QDebug>
 
+#define IO_HEARTBEAT_INTERVAL 100
+#define IO_BUSY_LAG 50 // ms behind schedule before a thread counts as busy
+
+struct LaneConfig
+{
+    int minimum;
+    int maximum;
+    QThread::Priority priority;
+};
+
+// Playback reads get a thread the scans never run on, at a priority above
+// the network and bulk lanes so that a slow disk shows up there first
+static const LaneConfig s_laneConfig[IOJob::LaneCount] = {
+    { 1, 2, QThread::HighPriority },  // Playback
+    { 1, 2, QThread::LowPriority },   // Bulk
+    { 1, 2, QThread::NormalPriority } // Network
+};
+
 IOJob::IOJob(QObject *parent)
-    : QObject(parent), m_origin(QThread::currentThread()), m_io(0)
+    : QObject(parent), m_origin(QThread::currentThread()), m_io(0), m_queue(0),
+      m_priority(NormalPriority), m_deadline(0), m_cancelled(0)
 {
 }
 
@@ -28,6 +47,66 @@ IOJob::~IOJob()
 {
 }
 
+IOJob::Lane IOJob::lane() const
+{
+    return Bulk;
+}
+
+QByteArray IOJob::affinity() const
+{
+    return QByteArray();
+}
+
+QByteArray IOJob::typeName() const
+{
+    return QByteArray(metaObject()->className());
+}
+
+void IOJob::setPriority(int priority)
+{
+    m_priority = priority;
+}
+
+int IOJob::priority() const
+{
+    return m_priority;
+}
+
+void IOJob::setDeadline(int msecs)
+{
+    m_deadline = msecs;
+}
+
+int IOJob::deadline() const
+{
+    return m_deadline;
+}
+
+void IOJob::setKey(const QByteArray &key)
+{
+    m_key = key;
+}
+
+QByteArray IOJob::key() const
+{
+    return m_key;
+}
+
+void IOJob::setGroup(const QByteArray &group)
+{
+    m_group = group;
+}
+
+QByteArray IOJob::group() const
+{
+    return m_group;
+}
+
+bool IOJob::isCancelled() const
+{
+    return m_cancelled;
+}
+
 void IOJob::stop()
 {
     QMetaObject::invokeMethod(this, "stopJob");
@@ -35,69 +114,154 @@ void IOJob::stop()
 
 void IOJob::stopJob()
 {
+    // Stopped while waiting to start, the dispatch drops it and emits
+    // finished() for it
+    if (!m_io && m_queue) {
+        cancel();
+        return;
+    }
+
     Q_ASSERT(m_io == thread());
 
-    if (m_io)
+    if (m_io) {
+        stopping();
         m_io->jobStopped(this);
+    }
     emit finished();
 }
 
+void IOJob::cancel()
+{
+    if (!m_cancelled.testAndSetOrdered(0, 1))
+        return;
+
+    if (IO::instance())
+        IO::instance()->cancel(this);
+    QMetaObject::invokeMethod(this, "cancelJob", Qt::QueuedConnection);
+}
+
+void IOJob::cancelJob()
+{
+    // Only while running, the job is back on its origin thread once stopped
+    if (m_io && m_io == thread())
+        cancelled();
+}
+
+void IOJob::cancelled()
+{
+}
+
+void IOJob::stopping()
+{
+}
+
 void IOJob::moveToOrigin()
 {
     moveToThread(m_origin);
 }
 
-IO* IO::s_inst = 0;
-
-IO::IO(QObject *parent)
-    : QThread(parent)
+IOThread::IOThread(IOJob::Lane lane, QObject *parent)
+    : QThread(parent), m_lane(lane), m_jobCount(0), m_lag(0), m_dispatchPosted(false)
 {
     moveToThread(this);
 }
 
-IO::~IO()
+IOThread::~IOThread()
 {
 }
 
-IO* IO::instance()
+IOJob::Lane IOThread::lane() const
 {
-    return s_inst;
+    return m_lane;
 }
 
-void IO::init()
+int IOThread::jobCount() const
 {
-    if (!s_inst) {
-        s_inst = new IO;
-        s_inst->start();
+    return m_jobCount;
+}
 
-        qRegisterMetaType<IOJob*>("IOJob*");
+int IOThread::lag() const
+{
+    return m_lag;
+}
+
+void IOThread::stop()
+{
+    QMetaObject::invokeMethod(this, "stopIO");
+}
+
+void IOThread::queueJob(IOJob *job)
+{
+    m_jobCount.ref();
+    job->m_queue = this;
+    job->moveToThread(this);
+    m_queue.append(job);
+    postDispatch();
+}
+
+void IOThread::postDispatch()
+{
+    if (m_dispatchPosted)
+        return;
+    m_dispatchPosted = true;
+    QMetaObject::invokeMethod(this, "dispatch", Qt::QueuedConnection);
+}
+
+void IOThread::dispatch()
+{
+    // One job per pass so that the jobs already running get their events
+    // in between, the next pass is posted while the queue is not empty
+    QList<IOJob*> dropped;
+    IOJob* job = IO::instance()->takeNext(this, dropped);
+
+    foreach(IOJob* d, dropped) {
+        m_jobCount.deref();
+        d->moveToOrigin();
+        emit d->finished();
     }
+
+    if (job)
+        startJobIO(job);
 }
 
-void IO::startJobIO(IOJob *job)
+void IOThread::startJobIO(IOJob *job)
 {
     m_jobs.insert(job);
     job->m_io = this;
 
-    qDebug() << "=== new job ready!" << job;
+    qDebug() << "=== new job ready!" << job << "on lane" << m_lane;
 
     emit job->started();
 }
 
-void IO::stopIO()
+void IOThread::stopIO()
 {
     exit();
 }
 
-void IO::run()
+void IOThread::heartbeat()
+{
+    // A job blocking the thread, a database transaction for instance,
+    // delays the timer by as much as it blocks
+    m_lag = qMax(0, static_cast<int>(m_beat.restart()) - IO_HEARTBEAT_INTERVAL);
+}
+
+void IOThread::run()
 {
+    QTimer heartbeat;
+    connect(&heartbeat, SIGNAL(timeout()), this, SLOT(heartbeat()));
+    heartbeat.start(IO_HEARTBEAT_INTERVAL);
+    m_beat.start();
+
     exec();
 
     qDeleteAll(m_jobs);
     m_jobs.clear();
+    qDeleteAll(m_queue);
+    m_queue.clear();
 }
 
-void IO::jobStopped(IOJob *job)
+void IOThread::jobStopped(IOJob *job)
 {
     if (!m_jobs.contains(job)) {
         emit error(QLatin1String("Job finished but not in the list of jobs: ") + QLatin1String(job->metaObject()->className()));
@@ -105,12 +269,307 @@ void IO::jobStopped(IOJob *job)
         return;
     }
 
+    IO::instance()->jobStopped(job);
+
     m_jobs.remove(job);
+    m_jobCount.deref();
     job->moveToOrigin();
 }
 
+IO* IO::s_inst = 0;
+
+IO::IO(QObject *parent)
+    : QObject(parent), m_statsTimer(this)
+{
+    for (int i = 0; i < IOJob::LaneCount; ++i) {
+        m_lanes[i].minimum = s_laneConfig[i].minimum;
+        m_lanes[i].maximum = s_laneConfig[i].maximum;
+        m_lanes[i].priority = s_laneConfig[i].priority;
+        for (int t = 0; t < m_lanes[i].minimum; ++t)
+            addThread(static_cast<IOJob::Lane>(i));
+    }
+
+    connect(&m_statsTimer, SIGNAL(timeout()), this, SLOT(logStats()));
+}
+
+IO::~IO()
+{
+    stop();
+}
+
+IO* IO::instance()
+{
+    return s_inst;
+}
+
+void IO::init()
+{
+    if (!s_inst) {
+        qRegisterMetaType<IOJob*>("IOJob*");
+
+        s_inst = new IO;
+    }
+}
+
+void IO::stop()
+{
+    // The threads take the lock to dispatch, so they are waited for without it
+    QList<IOThread*> threads;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (int i = 0; i < IOJob::LaneCount; ++i) {
+            threads += m_lanes[i].threads;
+            m_lanes[i].threads.clear();
+        }
+        m_affinity.clear();
+        m_keys.clear();
+        m_groups.clear();
+    }
+
+    foreach(IOThread* thread, threads) {
+        thread->stop();
+        thread->wait();
+        delete thread;
+    }
+}
+
+IOThread* IO::addThread(IOJob::Lane lane)
+{
+    IOThread* thread = new IOThread(lane);
+    connect(thread, SIGNAL(error(QString)), this, SIGNAL(error(QString)));
+    thread->start(m_lanes[lane].priority);
+    m_lanes[lane].threads.append(thread);
+    return thread;
+}
+
+IOThread* IO::threadFor(IOJob *job)
+{
+    const QByteArray affinity = job->affinity();
+    if (!affinity.isEmpty()) {
+        IOThread* thread = m_affinity.value(affinity);
+        if (thread)
+            return thread;
+    }
+
+    Lane& lane = m_lanes[job->lane()];
+
+    // Fewest jobs wins, a thread that is behind counts as carrying one
+    // more job for every IO_BUSY_LAG ms it is late
+    IOThread* best = 0;
+    int bestLoad = 0;
+    foreach(IOThread* thread, lane.threads) {
+        const int load = thread->jobCount() + thread->lag() / IO_BUSY_LAG;
+        if (!best || load < bestLoad) {
+            best = thread;
+            bestLoad = load;
+        }
+    }
+
+    if (!best || (best->lag() >= IO_BUSY_LAG && lane.threads.size() < lane.maximum)) {
+        best = addThread(job->lane());
+        qDebug() << "io lane" << job->lane() << "grew to" << lane.threads.size() << "threads";
+    }
+
+    if (!affinity.isEmpty())
+        m_affinity.insert(affinity, best);
+    return best;
+}
+
 void IO::startJob(IOJob *job)
 {
-    job->moveToThread(this);
-    QMetaObject::invokeMethod(this, "startJobIO", Q_ARG(IOJob*, job));
+    QMutexLocker locker(&m_mutex);
+
+    job->m_queued.start();
+
+    if (!job->m_key.isEmpty()) {
+        IOJob* waiting = m_keys.value(job->m_key);
+        if (waiting) {
+            waiting->m_priority = qMax(waiting->m_priority, job->m_priority);
+            if (!waiting->m_deadline || !job->m_deadline)
+                waiting->m_deadline = 0;
+            else
+                waiting->m_deadline = qMax(waiting->m_deadline, static_cast<int>(waiting->m_queued.elapsed()) + job->m_deadline);
+            // Only superseded when every request it stands for would be
+            if (waiting->m_group != job->m_group && !waiting->m_group.isEmpty()) {
+                m_groups.remove(waiting->m_group, waiting);
+                waiting->m_group.clear();
+            }
+
+            ++m_stats[job->typeName()].coalesced;
+            QMetaObject::invokeMethod(job, "finished", Qt::QueuedConnection);
+            return;
+        }
+        m_keys.insert(job->m_key, job);
+    }
+
+    if (!job->m_group.isEmpty()) {
+        foreach(IOJob* earlier, m_groups.values(job->m_group)) {
+            if (earlier->m_cancelled.testAndSetOrdered(0, 1)) {
+                if (earlier->m_queue && earlier->m_queue->m_queue.contains(earlier))
+                    earlier->m_queue->postDispatch();
+                else
+                    QMetaObject::invokeMethod(earlier, "cancelJob", Qt::QueuedConnection);
+            }
+        }
+        m_groups.insert(job->m_group, job);
+    }
+
+    ++m_stats[job->typeName()].queued;
+    threadFor(job)->queueJob(job);
+}
+
+IOJob* IO::takeNext(IOThread *thread, QList<IOJob*> &dropped)
+{
+    QMutexLocker locker(&m_mutex);
+
+    QList<IOJob*>& queue = thread->m_queue;
+    IOJob* next = 0;
+    int at = -1;
+    int i = 0;
+    while (i < queue.size()) {
+        IOJob* job = queue.at(i);
+        if (job->m_cancelled || (job->m_deadline && job->m_queued.elapsed() > job->m_deadline)) {
+            queue.removeAt(i);
+            forget(job);
+
+            Stats& stats = m_stats[job->typeName()];
+            --stats.queued;
+            ++stats.dropped;
+            dropped.append(job);
+            continue;
+        }
+        // Ties go to the job queued first
+        if (!next || job->m_priority > next->m_priority) {
+            next = job;
+            at = i;
+        }
+        ++i;
+    }
+
+    if (next) {
+        queue.removeAt(at);
+        if (m_keys.value(next->m_key) == next)
+            m_keys.remove(next->m_key);
+
+        const int wait = static_cast<int>(next->m_queued.elapsed());
+        Stats& stats = m_stats[next->typeName()];
+        --stats.queued;
+        ++stats.running;
+        ++stats.started;
+        stats.totalWait += wait;
+        stats.maxWait = qMax(stats.maxWait, wait);
+
+        next->m_started.start();
+    }
+
+    thread->m_dispatchPosted = false;
+    if (!queue.isEmpty())
+        thread->postDispatch();
+
+    return next;
+}
+
+void IO::cancel(IOJob *job)
+{
+    QMutexLocker locker(&m_mutex);
+
+    // A waiting job is dropped by the next dispatch
+    if (job->m_queue && job->m_queue->m_queue.contains(job))
+        job->m_queue->postDispatch();
+}
+
+void IO::jobStopped(IOJob *job)
+{
+    QMutexLocker locker(&m_mutex);
+
+    forget(job);
+
+    const int run = static_cast<int>(job->m_started.elapsed());
+    Stats& stats = m_stats[job->typeName()];
+    --stats.running;
+    ++stats.finished;
+    stats.totalRun += run;
+    stats.maxRun = qMax(stats.maxRun, run);
+}
+
+void IO::forget(IOJob *job)
+{
+    if (!job->m_key.isEmpty() && m_keys.value(job->m_key) == job)
+        m_keys.remove(job->m_key);
+    if (!job->m_group.isEmpty())
+        m_groups.remove(job->m_group, job);
+}
+
+QHash<QByteArray, IO::Stats> IO::stats() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_stats;
+}
+
+int IO::queueDepth() const
+{
+    QMutexLocker locker(&m_mutex);
+
+    int depth = 0;
+    for (int i = 0; i < IOJob::LaneCount; ++i) {
+        foreach(IOThread* thread, m_lanes[i].threads)
+            depth += thread->m_queue.size();
+    }
+    return depth;
+}
+
+QVariantMap IO::statistics() const
+{
+    QVariantMap result;
+
+    const QHash<QByteArray, Stats> all = stats();
+    QHash<QByteArray, Stats>::ConstIterator it = all.begin();
+    const QHash<QByteArray, Stats>::ConstIterator end = all.end();
+    while (it != end) {
+        const Stats& s = it.value();
+        QVariantMap type;
+        type.insert(QLatin1String("queued"), s.queued);
+        type.insert(QLatin1String("running"), s.running);
+        type.insert(QLatin1String("started"), s.started);
+        type.insert(QLatin1String("finished"), s.finished);
+        type.insert(QLatin1String("dropped"), s.dropped);
+        type.insert(QLatin1String("coalesced"), s.coalesced);
+        type.insert(QLatin1String("averageWait"), s.started ? static_cast<int>(s.totalWait / s.started) : 0);
+        type.insert(QLatin1String("maxWait"), s.maxWait);
+        type.insert(QLatin1String("averageRun"), s.finished ? static_cast<int>(s.totalRun / s.finished) : 0);
+        type.insert(QLatin1String("maxRun"), s.maxRun);
+        result.insert(QString::fromLatin1(it.key()), type);
+        ++it;
+    }
+
+    return result;
+}
+
+void IO::setStatsInterval(int msecs)
+{
+    if (msecs > 0)
+        m_statsTimer.start(msecs);
+    else
+        m_statsTimer.stop();
+}
+
+void IO::logStats()
+{
+    qDebug() << "io queue depth" << queueDepth();
+
+    const QVariantMap all = statistics();
+    QVariantMap::ConstIterator it = all.begin();
+    const QVariantMap::ConstIterator end = all.end();
+    while (it != end) {
+        const QVariantMap s = it.value().toMap();
+        qDebug() << " " << it.key()
+                 << "queued" << s.value(QLatin1String("queued")).toInt()
+                 << "running" << s.value(QLatin1String("running")).toInt()
+                 << "done" << s.value(QLatin1String("finished")).toInt()
+                 << "dropped" << s.value(QLatin1String("dropped")).toInt()
+                 << "coalesced" << s.value(QLatin1String("coalesced")).toInt()
+                 << "wait" << s.value(QLatin1String("averageWait")).toInt() << "/" << s.value(QLatin1String("maxWait")).toInt() << "ms"
+                 << "run" << s.value(QLatin1String("averageRun")).toInt() << "/" << s.value(QLatin1String("maxRun")).toInt() << "ms";
+        ++it;
+    }
 }
@@ -21,6 +21,8 @@
 
 #include <QThread>
 #include <QSet>
+#include <QHash>
+#include <QList>
 #include <QMutex>
 #include <QMutexLocker>
 #include <QObject>
@@ -28,41 +30,172 @@
 #include <QVariant>
 #include <QAtomicInt>
 #include <QEvent>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QVariantMap>
 
 class IO;
+class IOThread;
 
 class IOJob : public QObject
 {
     Q_OBJECT
 public:
+    // Playback is for reads the audio output waits on, Bulk for scans,
+    // tags and database work, Network for jobs that mostly wait on sockets
+    enum Lane { Playback, Bulk, Network, LaneCount };
+    enum Priority { LowPriority = -10, NormalPriority = 0, HighPriority = 10, CriticalPriority = 20 };
+
     IOJob(QObject* parent = 0);
     ~IOJob();
 
+    virtual Lane lane() const;
+
+    // Jobs that share state bound to a thread, such as a database
+    // connection, return the same non-empty key and run on one thread
+    virtual QByteArray affinity() const;
+
+    // What the statistics are kept under, the class name by default
+    virtual QByteArray typeName() const;
+
+    // The scheduling below is set before the job is passed to IO::startJob.
+    // Jobs queued on a thread start in priority order.
+    void setPriority(int priority);
+    int priority() const;
+
+    // A job that has not started within msecs of being queued is dropped,
+    // 0 waits for as long as it takes
+    void setDeadline(int msecs);
+    int deadline() const;
+
+    // A job queued while another one with the same key is waiting to start
+    // is dropped in favour of it, the waiting job takes the higher priority
+    void setKey(const QByteArray& key);
+    QByteArray key() const;
+
+    // Queueing a job cancels the earlier jobs of its group
+    void setGroup(const QByteArray& group);
+    QByteArray group() const;
+
+    bool isCancelled() const;
+
 public slots:
     void stop();
+    // A waiting job is dropped, a running one is told through cancelled()
+    void cancel();
 
 signals:
     void error(const QString& message);
     void started();
+    // Also emitted without started() when the job is dropped before it runs
     void finished();
 
 protected:
     void moveToOrigin();
 
+    // Called on the job's thread when a running job is cancelled, the
+    // job should wind down and stop() as soon as it safely can
+    virtual void cancelled();
+    // Called on the job's thread as a running job stops, before it goes
+    // back to its origin thread. Objects that belong to the IO thread,
+    // such as network replies, have to be let go of here.
+    virtual void stopping();
+
 private:
     Q_INVOKABLE void stopJob();
+    Q_INVOKABLE void cancelJob();
 
 private:
     QThread* m_origin;
-    IO* m_io;
+    IOThread* m_io;
+    IOThread* m_queue;
 
+    int m_priority;
+    int m_deadline;
+    QByteArray m_key;
+    QByteArray m_group;
+    QAtomicInt m_cancelled;
+    // Monotonic, a wall clock change must not expire or stall jobs
+    QElapsedTimer m_queued;
+    QElapsedTimer m_started;
+
+    friend class IOThread;
     friend class IO;
 };
 
-class IO : public QThread
+class IOThread : public QThread
 {
     Q_OBJECT
 public:
+    IOThread(IOJob::Lane lane, QObject* parent = 0);
+    ~IOThread();
+
+    IOJob::Lane lane() const;
+
+    int jobCount() const;
+    // How late the event loop last ran a timer, in ms
+    int lag() const;
+
+    void stop();
+
+protected:
+    void run();
+
+signals:
+    void error(const QString& message);
+
+private slots:
+    void heartbeat();
+
+private:
+    Q_INVOKABLE void stopIO();
+    Q_INVOKABLE void dispatch();
+
+    void queueJob(IOJob* job);
+    void postDispatch();
+    void startJobIO(IOJob* job);
+    void jobStopped(IOJob* job);
+
+private:
+    IOJob::Lane m_lane;
+    QSet<IOJob*> m_jobs;
+    QAtomicInt m_jobCount;
+    QAtomicInt m_lag;
+    QElapsedTimer m_beat;
+
+    // Guarded by the IO mutex
+    QList<IOJob*> m_queue;
+    bool m_dispatchPosted;
+
+    friend class IOJob;
+    friend class IO;
+};
+
+// Runs jobs on a set of threads per lane. A job goes to the least loaded
+// thread of its lane, and a lane grows up to its maximum when all of its
+// threads are lagging behind. Each thread starts its queued jobs one per
+// pass of its event loop, highest priority first.
+class IO : public QObject
+{
+    Q_OBJECT
+public:
+    struct Stats
+    {
+        Stats() : queued(0), running(0), started(0), finished(0), dropped(0), coalesced(0),
+                  totalWait(0), maxWait(0), totalRun(0), maxRun(0) {}
+
+        int queued;
+        int running;
+        int started;
+        int finished;
+        int dropped;
+        int coalesced;
+        qint64 totalWait;
+        int maxWait;
+        qint64 totalRun;
+        int maxRun;
+    };
+
     static IO* instance();
 
     ~IO();
@@ -72,27 +205,53 @@ public:
     void stop();
     void startJob(IOJob* job);
 
-protected:
-    void run();
+    // Per job type, see IOJob::typeName()
+    QHash<QByteArray, Stats> stats() const;
+    int queueDepth() const;
+    Q_INVOKABLE QVariantMap statistics() const;
+
+    // Logs the statistics every msecs, 0 turns it off
+    void setStatsInterval(int msecs);
 
 signals:
     void error(const QString& message);
 
+private slots:
+    void logStats();
+
 private:
     IO(QObject *parent = 0);
 
-    Q_INVOKABLE void stopIO();
-    Q_INVOKABLE void startJobIO(IOJob* job);
+    IOThread* threadFor(IOJob* job);
+    IOThread* addThread(IOJob::Lane lane);
 
+    IOJob* takeNext(IOThread* thread, QList<IOJob*>& dropped);
+    void cancel(IOJob* job);
     void jobStopped(IOJob* job);
+    void forget(IOJob* job);
 
 private:
+    struct Lane
+    {
+        QList<IOThread*> threads;
+        int minimum;
+        int maximum;
+        QThread::Priority priority;
+    };
+
     static IO* s_inst;
 
-    QMutex m_mutex;
-    QSet<IOJob*> m_jobs;
+    mutable QMutex m_mutex;
+    Lane m_lanes[IOJob::LaneCount];
+    QHash<QByteArray, IOThread*> m_affinity;
+
+    QHash<QByteArray, IOJob*> m_keys;
+    QMultiHash<QByteArray, IOJob*> m_groups;
+    QHash<QByteArray, Stats> m_stats;
+    QTimer m_statsTimer;
 
     friend class IOJob;
+    friend class IOThread;
 };
 
 #endif // IO_H
@@ -0,0 +1,341 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "librarysnapshot.h"
+#include <QFile>
+#include <QDebug>
+#include <string.h>
+
+#define SNAPSHOT_MAGIC 0x4c4e524f // "ORNL"
+#define SNAPSHOT_VERSION 1
+
+struct SnapshotHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint64 revision;
+    quint32 artists;
+    quint32 albums;
+    quint32 tracks;
+    quint32 strings;
+};
+
+class LibrarySnapshotData : public QSharedData
+{
+public:
+    LibrarySnapshotData() : file(0), base(0), size(0) {}
+    ~LibrarySnapshotData() { delete file; }
+
+    bool setBase(const uchar* data, qint64 length);
+    // Every row and string a record points at is within the file
+    bool isValid() const;
+
+    // Either owns the bytes or keeps the file they are mapped from
+    QByteArray buffer;
+    QFile* file;
+
+    const uchar* base;
+    qint64 size;
+
+    const SnapshotHeader* header;
+    const LibrarySnapshot::ArtistRecord* artists;
+    const LibrarySnapshot::AlbumRecord* albums;
+    const LibrarySnapshot::TrackRecord* tracks;
+    const QChar* strings;
+};
+
+static qint64 snapshotSize(quint32 artists, quint32 albums, quint32 tracks, quint32 strings)
+{
+    return sizeof(SnapshotHeader)
+            + qint64(artists) * sizeof(LibrarySnapshot::ArtistRecord)
+            + qint64(albums) * sizeof(LibrarySnapshot::AlbumRecord)
+            + qint64(tracks) * sizeof(LibrarySnapshot::TrackRecord)
+            + qint64(strings) * sizeof(QChar);
+}
+
+bool LibrarySnapshotData::setBase(const uchar *data, qint64 length)
+{
+    if (length < static_cast<qint64>(sizeof(SnapshotHeader)))
+        return false;
+
+    header = reinterpret_cast<const SnapshotHeader*>(data);
+    if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION)
+        return false;
+    if (snapshotSize(header->artists, header->albums, header->tracks, header->strings) != length)
+        return false;
+
+    base = data;
+    size = length;
+
+    const uchar* pos = data + sizeof(SnapshotHeader);
+    artists = reinterpret_cast<const LibrarySnapshot::ArtistRecord*>(pos);
+    pos += header->artists * sizeof(LibrarySnapshot::ArtistRecord);
+    albums = reinterpret_cast<const LibrarySnapshot::AlbumRecord*>(pos);
+    pos += header->albums * sizeof(LibrarySnapshot::AlbumRecord);
+    tracks = reinterpret_cast<const LibrarySnapshot::TrackRecord*>(pos);
+    pos += header->tracks * sizeof(LibrarySnapshot::TrackRecord);
+    strings = reinterpret_cast<const QChar*>(pos);
+    return true;
+}
+
+static inline bool validString(const LibrarySnapshot::StringRef& ref, quint32 strings)
+{
+    return ref.offset <= strings && ref.length <= strings - ref.offset;
+}
+
+static inline bool validRow(qint32 row, quint32 rows)
+{
+    return row >= 0 && static_cast<quint32>(row) < rows;
+}
+
+bool LibrarySnapshotData::isValid() const
+{
+    const quint32 strs = header->strings;
+
+    for (quint32 i = 0; i < header->artists; ++i) {
+        if (!validString(artists[i].name, strs))
+            return false;
+    }
+    for (quint32 i = 0; i < header->albums; ++i) {
+        if (!validRow(albums[i].artist, header->artists) || !validString(albums[i].name, strs))
+            return false;
+    }
+    for (quint32 i = 0; i < header->tracks; ++i) {
+        const LibrarySnapshot::TrackRecord& track = tracks[i];
+        if (!validRow(track.artist, header->artists) || !validRow(track.album, header->albums)
+            || !validString(track.name, strs) || !validString(track.filename, strs))
+            return false;
+    }
+    return true;
+}
+
+LibrarySnapshot::Builder::Builder(quint64 revision)
+    : m_revision(revision)
+{
+}
+
+void LibrarySnapshot::Builder::reserve(int artists, int albums, int tracks)
+{
+    m_artists.reserve(artists);
+    m_albums.reserve(albums);
+    m_tracks.reserve(tracks);
+    // A guess at the average name and path lengths
+    m_strings.reserve(artists * 16 + albums * 16 + tracks * 96);
+}
+
+LibrarySnapshot::StringRef LibrarySnapshot::Builder::addString(const QString &str)
+{
+    StringRef ref;
+    ref.offset = m_strings.size();
+    ref.length = str.size();
+
+    m_strings.resize(m_strings.size() + str.size());
+    memcpy(m_strings.data() + ref.offset, str.constData(), str.size() * sizeof(QChar));
+    return ref;
+}
+
+int LibrarySnapshot::Builder::addArtist(int id, const QString &name)
+{
+    ArtistRecord record;
+    record.id = id;
+    record.name = addString(name);
+    m_artists.append(record);
+    return m_artists.size() - 1;
+}
+
+int LibrarySnapshot::Builder::addAlbum(int id, int artist, const QString &name)
+{
+    AlbumRecord record;
+    record.id = id;
+    record.artist = artist;
+    record.name = addString(name);
+    m_albums.append(record);
+    return m_albums.size() - 1;
+}
+
+void LibrarySnapshot::Builder::addTrack(int id, int artist, int album, const QString &name, const QString &filename, int trackno, int duration)
+{
+    TrackRecord record;
+    record.id = id;
+    record.artist = artist;
+    record.album = album;
+    record.trackno = trackno;
+    record.duration = duration;
+    record.name = addString(name);
+    record.filename = addString(filename);
+    m_tracks.append(record);
+}
+
+LibrarySnapshot LibrarySnapshot::Builder::finish()
+{
+    SnapshotHeader header;
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.revision = m_revision;
+    header.artists = m_artists.size();
+    header.albums = m_albums.size();
+    header.tracks = m_tracks.size();
+    header.strings = m_strings.size();
+
+    const qint64 size = snapshotSize(header.artists, header.albums, header.tracks, header.strings);
+
+    LibrarySnapshotData* data = new LibrarySnapshotData;
+    data->buffer.resize(size);
+
+    char* pos = data->buffer.data();
+    memcpy(pos, &header, sizeof(header));
+    pos += sizeof(header);
+    memcpy(pos, m_artists.constData(), m_artists.size() * sizeof(ArtistRecord));
+    pos += m_artists.size() * sizeof(ArtistRecord);
+    memcpy(pos, m_albums.constData(), m_albums.size() * sizeof(AlbumRecord));
+    pos += m_albums.size() * sizeof(AlbumRecord);
+    memcpy(pos, m_tracks.constData(), m_tracks.size() * sizeof(TrackRecord));
+    pos += m_tracks.size() * sizeof(TrackRecord);
+    memcpy(pos, m_strings.constData(), m_strings.size() * sizeof(QChar));
+
+    data->setBase(reinterpret_cast<const uchar*>(data->buffer.constData()), size);
+    return LibrarySnapshot(data);
+}
+
+LibrarySnapshot::LibrarySnapshot()
+{
+}
+
+LibrarySnapshot::LibrarySnapshot(LibrarySnapshotData *data)
+    : m_data(data)
+{
+}
+
+LibrarySnapshot::LibrarySnapshot(const LibrarySnapshot &other)
+    : m_data(other.m_data)
+{
+}
+
+LibrarySnapshot::~LibrarySnapshot()
+{
+}
+
+LibrarySnapshot& LibrarySnapshot::operator=(const LibrarySnapshot &other)
+{
+    m_data = other.m_data;
+    return *this;
+}
+
+bool LibrarySnapshot::isNull() const
+{
+    return !m_data;
+}
+
+quint64 LibrarySnapshot::revision() const
+{
+    return m_data ? m_data->header->revision : 0;
+}
+
+int LibrarySnapshot::artistCount() const
+{
+    return m_data ? m_data->header->artists : 0;
+}
+
+int LibrarySnapshot::albumCount() const
+{
+    return m_data ? m_data->header->albums : 0;
+}
+
+int LibrarySnapshot::trackCount() const
+{
+    return m_data ? m_data->header->tracks : 0;
+}
+
+const LibrarySnapshot::ArtistRecord& LibrarySnapshot::artist(int row) const
+{
+    return m_data->artists[row];
+}
+
+const LibrarySnapshot::AlbumRecord& LibrarySnapshot::album(int row) const
+{
+    return m_data->albums[row];
+}
+
+const LibrarySnapshot::TrackRecord& LibrarySnapshot::track(int row) const
+{
+    return m_data->tracks[row];
+}
+
+QString LibrarySnapshot::string(const StringRef &ref) const
+{
+    if (!m_data || !validString(ref, m_data->header->strings))
+        return QString();
+    return QString(m_data->strings + ref.offset, ref.length);
+}
+
+LibrarySnapshot LibrarySnapshot::load(const QString &filename, quint64 revision)
+{
+    QFile* file = new QFile(filename);
+    if (!file->open(QFile::ReadOnly)) {
+        delete file;
+        return LibrarySnapshot();
+    }
+
+    const qint64 size = file->size();
+    const uchar* mapped = size > 0 ? file->map(0, size) : 0;
+    if (!mapped) {
+        delete file;
+        return LibrarySnapshot();
+    }
+
+    LibrarySnapshotData* data = new LibrarySnapshotData;
+    data->file = file;
+    // The models index with the rows as they are, a damaged file is
+    // rebuilt from the database rather than trusted
+    if (!data->setBase(mapped, size) || data->header->revision != revision) {
+        delete data;
+        return LibrarySnapshot();
+    }
+    if (!data->isValid()) {
+        qDebug() << "library snapshot is damaged" << filename;
+        delete data;
+        return LibrarySnapshot();
+    }
+
+    return LibrarySnapshot(data);
+}
+
+bool LibrarySnapshot::save(const QString &filename) const
+{
+    if (!m_data)
+        return false;
+
+    // Written aside and renamed so a mapped older snapshot stays intact
+    const QString tmp = filename + QLatin1String(".tmp");
+    QFile file(tmp);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate))
+        return false;
+    if (file.write(reinterpret_cast<const char*>(m_data->base), m_data->size) != m_data->size) {
+        file.close();
+        QFile::remove(tmp);
+        return false;
+    }
+    file.close();
+
+    QFile::remove(filename);
+    if (!QFile::rename(tmp, filename)) {
+        qDebug() << "unable to write library snapshot" << filename;
+        return false;
+    }
+    return true;
+}
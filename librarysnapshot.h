@@ -0,0 +1,123 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIBRARYSNAPSHOT_H
+#define LIBRARYSNAPSHOT_H
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QSharedData>
+#include <QExplicitlySharedDataPointer>
+#include <QMetaType>
+
+class QFile;
+class LibrarySnapshotData;
+
+// The whole library as flat arrays of fixed size records followed by one
+// UTF-16 string table. The in-memory layout is the file layout, so a
+// snapshot saved next to the database can be mapped back in as is.
+class LibrarySnapshot
+{
+public:
+    struct StringRef
+    {
+        quint32 offset; // in QChars into the string table
+        quint32 length;
+    };
+
+    struct ArtistRecord
+    {
+        qint32 id;
+        StringRef name;
+    };
+
+    struct AlbumRecord
+    {
+        qint32 id;
+        qint32 artist; // row in the artist records
+        StringRef name;
+    };
+
+    struct TrackRecord
+    {
+        qint32 id;
+        qint32 artist; // row in the artist records
+        qint32 album; // row in the album records
+        qint32 trackno;
+        qint32 duration;
+        StringRef name;
+        StringRef filename;
+    };
+
+    class Builder
+    {
+    public:
+        Builder(quint64 revision);
+
+        void reserve(int artists, int albums, int tracks);
+
+        int addArtist(int id, const QString& name);
+        int addAlbum(int id, int artist, const QString& name);
+        void addTrack(int id, int artist, int album, const QString& name, const QString& filename, int trackno, int duration);
+
+        LibrarySnapshot finish();
+
+    private:
+        StringRef addString(const QString& str);
+
+    private:
+        quint64 m_revision;
+        QVector<ArtistRecord> m_artists;
+        QVector<AlbumRecord> m_albums;
+        QVector<TrackRecord> m_tracks;
+        QVector<QChar> m_strings;
+    };
+
+    LibrarySnapshot();
+    LibrarySnapshot(const LibrarySnapshot& other);
+    ~LibrarySnapshot();
+
+    LibrarySnapshot& operator=(const LibrarySnapshot& other);
+
+    bool isNull() const;
+    quint64 revision() const;
+
+    int artistCount() const;
+    int albumCount() const;
+    int trackCount() const;
+
+    const ArtistRecord& artist(int row) const;
+    const AlbumRecord& album(int row) const;
+    const TrackRecord& track(int row) const;
+
+    QString string(const StringRef& ref) const;
+
+    // Returns a null snapshot unless the file is intact and at revision
+    static LibrarySnapshot load(const QString& filename, quint64 revision);
+    bool save(const QString& filename) const;
+
+private:
+    LibrarySnapshot(LibrarySnapshotData* data);
+
+    QExplicitlySharedDataPointer<LibrarySnapshotData> m_data;
+};
+
+Q_DECLARE_METATYPE(LibrarySnapshot)
+
+#endif // LIBRARYSNAPSHOT_H
@@ -19,6 +19,7 @@
 #include "audiodevice.h"
 #include "audioplayer.h"
 #include "musicmodel.h"
+#include "searchmodel.h"
 #include "io.h"
 #include "codecs/codecs.h"
 #include "medialibrary_file.h"
@@ -55,10 +56,12 @@ int main(int argc, char** argv)
 {
     QApplication app(argc, argv);
 
-    bool s3 = false;
+    bool s3 = false, iostats = false;
     for (int i = 1; i < argc; ++i) {
         if (qstrcmp(argv[i], "-s3") == 0)
             s3 = true;
+        else if (qstrcmp(argv[i], "-iostats") == 0)
+            iostats = true;
     }
 
     if (s3 && !AwsConfig::init()) {
@@ -67,6 +70,8 @@ int main(int argc, char** argv)
     }
 
     IO::init();
+    if (iostats)
+        IO::instance()->setStatsInterval(10000);
     Codecs::init();
     if (s3)
         MediaLibraryS3::init();
@@ -79,6 +84,7 @@ int main(int argc, char** argv)
     qmlRegisterType<AudioDevice>("AudioDevice", 1, 0, "AudioDevice");
     qmlRegisterType<AudioPlayer>("AudioPlayer", 1, 0, "AudioPlayer");
     qmlRegisterType<MusicModel>("MusicModel", 1, 0, "MusicModel");
+    qmlRegisterType<SearchModel>("SearchModel", 1, 0, "SearchModel");
     qmlRegisterType<MediaModel>("MediaModel", 1, 0, "MediaModel");
 
     MainView view(QUrl::fromLocalFile("player.qml"));
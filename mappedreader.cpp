@@ -0,0 +1,120 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mappedreader.h"
+#include <QTimer>
+#include <QDebug>
+
+MappedReader::MappedReader(const QString &filename, QObject *parent)
+    : AudioReader(parent), m_file(filename), m_data(0), m_size(0), m_offset(0)
+{
+}
+
+MappedReader::~MappedReader()
+{
+    close();
+}
+
+bool MappedReader::isSequential() const
+{
+    return true;
+}
+
+qint64 MappedReader::bytesAvailable() const
+{
+    return m_size - m_offset;
+}
+
+bool MappedReader::atEnd() const
+{
+    return m_offset >= m_size;
+}
+
+void MappedReader::close()
+{
+    if (!isOpen())
+        return;
+
+    AudioReader::close();
+
+    if (m_data)
+        m_file.unmap(m_data);
+    m_file.close();
+    m_data = 0;
+    m_size = 0;
+    m_offset = 0;
+}
+
+bool MappedReader::open(OpenMode mode)
+{
+    if (isOpen())
+        close();
+
+    if (!m_file.open(QFile::ReadOnly))
+        return false;
+
+    m_size = m_file.size();
+    m_data = m_size > 0 ? m_file.map(0, m_size) : 0;
+    if (!m_data && m_size > 0) {
+        qDebug() << "unable to map" << m_file.fileName();
+        m_file.close();
+        return false;
+    }
+    m_offset = 0;
+
+    if (!AudioReader::open(mode))
+        return false;
+
+    QTimer::singleShot(0, this, SIGNAL(readyRead()));
+    return true;
+}
+
+bool MappedReader::canRestart() const
+{
+    return isOpen();
+}
+
+bool MappedReader::restartAt(qint64 pos)
+{
+    if (!isOpen() || pos < 0)
+        return false;
+
+    m_offset = qMin(pos, m_size);
+
+    QTimer::singleShot(0, this, SIGNAL(readyRead()));
+    return true;
+}
+
+qint64 MappedReader::readData(char *data, qint64 maxlen)
+{
+    const qint64 read = qMin(maxlen, m_size - m_offset);
+    if (read <= 0)
+        return 0;
+
+    memcpy(data, m_data + m_offset, read);
+    m_offset += read;
+    return read;
+}
+
+qint64 MappedReader::writeData(const char *data, qint64 len)
+{
+    Q_UNUSED(data)
+    Q_UNUSED(len)
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPPEDREADER_H
+#define MAPPEDREADER_H
+
+#include "audioreader.h"
+#include <QFile>
+
+// Reads a local file through a memory mapping, everything is available
+// as soon as it is open so no IO job is involved
+class MappedReader : public AudioReader
+{
+    Q_OBJECT
+public:
+    MappedReader(const QString& filename, QObject* parent = 0);
+    ~MappedReader();
+
+    bool isSequential() const;
+    qint64 bytesAvailable() const;
+
+    bool atEnd() const;
+
+    void close();
+    bool open(OpenMode mode);
+
+    bool canRestart() const;
+    bool restartAt(qint64 pos);
+
+protected:
+    qint64 readData(char *data, qint64 maxlen);
+    qint64 writeData(const char *data, qint64 len);
+
+private:
+    QFile m_file;
+    uchar* m_data;
+    qint64 m_size;
+    qint64 m_offset;
+};
+
+#endif // MAPPEDREADER_H
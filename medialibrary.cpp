@@ -21,8 +21,19 @@
 MediaLibrary* MediaLibrary::s_inst = 0;
 
 MediaLibrary::MediaLibrary(QObject *parent)
-    : QObject(parent), m_settings(0)
+    : QObject(parent), m_settings(0), m_libraryState(LibraryNone)
 {
+    qRegisterMetaType<FrameIndex>("FrameIndex");
+    qRegisterMetaType<QList<int> >("QList<int>");
+    qRegisterMetaType<LibrarySnapshot>("LibrarySnapshot");
+    qRegisterMetaType<Artist>("Artist");
+
+    // Any change after the last library makes it stale
+    connect(this, SIGNAL(library(LibrarySnapshot)), this, SLOT(cacheLibrary(LibrarySnapshot)));
+    connect(this, SIGNAL(artist(Artist)), this, SLOT(dropLibrary()));
+    connect(this, SIGNAL(trackRemoved(int)), this, SLOT(dropLibrary()));
+    connect(this, SIGNAL(tracksRemoved(QList<int>)), this, SLOT(dropLibrary()));
+    connect(this, SIGNAL(cleared()), this, SLOT(dropLibrary()));
 }
 
 MediaLibrary* MediaLibrary::instance()
@@ -30,6 +41,42 @@ MediaLibrary* MediaLibrary::instance()
     return s_inst;
 }
 
+bool MediaLibrary::requestLibrary(LibrarySnapshot *library)
+{
+    switch (m_libraryState) {
+    case LibraryRead:
+        *library = m_library;
+        return true;
+    case LibraryNone:
+        m_libraryState = LibraryReading;
+        readLibrary();
+        break;
+    case LibraryReading:
+        break;
+    }
+    return false;
+}
+
+void MediaLibrary::cacheLibrary(const LibrarySnapshot &library)
+{
+    m_library = library;
+    m_libraryState = LibraryRead;
+}
+
+void MediaLibrary::dropLibrary()
+{
+    // A read under way still arrives
+    if (m_libraryState == LibraryRead) {
+        m_library = LibrarySnapshot();
+        m_libraryState = LibraryNone;
+    }
+}
+
+void MediaLibrary::requestFrameIndex(const QString &filename)
+{
+    emit frameIndex(filename, FrameIndex());
+}
+
 void MediaLibrary::setSettings(QSettings *settings)
 {
     m_settings = settings;
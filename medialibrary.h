@@ -24,6 +24,8 @@
 #include <QHash>
 #include <QImage>
 #include "tag.h"
+#include "frameindex.h"
+#include "librarysnapshot.h"
 
 class AudioReader;
 class QSettings;
@@ -63,9 +65,15 @@ public:
     static MediaLibrary* instance();
 
     virtual void readLibrary() = 0;
+    // For a new subscriber of library(). Returns true with the last library
+    // read if nothing changed since, otherwise it arrives through library()
+    // and is only read if no read is under way already.
+    bool requestLibrary(LibrarySnapshot* library);
 
     virtual void requestArtwork(const QString& filename) = 0;
     virtual void requestMetaData(const QString& filename) = 0;
+    // Answered with frameIndex(), possibly with an empty index
+    virtual void requestFrameIndex(const QString& filename);
 
     virtual AudioReader* readerForFilename(const QString& filename) = 0;
     virtual QByteArray mimeType(const QString& filename) const = 0;
@@ -74,10 +82,14 @@ public:
 
 signals:
     void artist(const Artist& artist);
+    // The whole library at once, an alternative to a series of artist()
+    void library(const LibrarySnapshot& library);
     void artwork(const QImage& image);
     void metaData(const Tag& tag);
+    void frameIndex(const QString& filename, const FrameIndex& index);
 
     void trackRemoved(int trackid);
+    void tracksRemoved(const QList<int>& trackids);
     void cleared();
 
 protected:
@@ -86,6 +98,18 @@ protected:
     static MediaLibrary* s_inst;
 
     QSettings* m_settings;
+
+private slots:
+    void cacheLibrary(const LibrarySnapshot& library);
+    void dropLibrary();
+
+private:
+    enum LibraryState { LibraryNone, LibraryReading, LibraryRead };
+
+    LibrarySnapshot m_library;
+    LibraryState m_libraryState;
 };
 
+Q_DECLARE_METATYPE(Artist)
+
 #endif // MEDIALIBRARY_H
@@ -21,46 +21,48 @@
 #include "filereader.h"
 #include "codecs/codecs.h"
 #include "codecs/codec.h"
+#include "mediascanner.h"
+#include "mediawriter.h"
+#include "mediawatcher.h"
+#include "librarysnapshot.h"
 #include <QDebug>
 #include <QDir>
-#include <QTimer>
-#include <QStack>
+#include <QFile>
+#include <QElapsedTimer>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QFileDialog>
+#include <QMetaEnum>
+
+#define MEDIA_REQUEST_DEADLINE 10000 // ms a tag request may wait before it is stale
 
 Q_DECLARE_METATYPE(PathSet)
-Q_DECLARE_METATYPE(Artist)
 
 class MediaJob;
 
-struct MediaState
-{
-    QString path;
-    PathSet files;
-    PathSet dirs;
-};
-
 struct MediaData
 {
     MediaData();
+    ~MediaData();
 
-    bool updatePaths(MediaJob* job);
+    void addTracks(const ScanResults& results, MediaJob* job);
     void readLibrary(MediaJob* job);
+    QString snapshotPath() const;
 
-    void removeNonExistingFiles(MediaJob* job);
+    void createTempTables();
+    void addSeen(int scan, const QStringList& paths);
+    void reconcile(int scan, const QStringList& roots, MediaJob* job);
+    void dropSeen(int scan);
+    void removeFiles(const QStringList& paths, MediaJob* job);
+    void removeOrphans(MediaJob* job);
 
-    void createTables();
-    void clearDatabase();
-    int addArtist(const QString& name, bool* added = 0);
-    int addAlbum(int artistid, const QString& name, bool* added = 0);
-    int addTrack(int artistid, int albumid, const QString& name, const QString& filename, int trackno, int duration, bool* added = 0);
+    void createIndexTable();
+    FileStamps knownFiles();
 
-    bool pushState(PathSet& paths, const QString& prefix);
+    FrameIndex frameIndex(const QString& filename);
 
     QSqlDatabase database;
-    PathSet paths;
-    QStack<MediaState> states;
+    MediaWriter* writer;
 };
 
 class MediaJob : public IOJob
@@ -72,10 +74,13 @@ class MediaJob : public IOJob
 
     Q_ENUMS(Type)
 public:
-    enum Type { None, UpdatePaths, RequestTag, SetTag, ReadLibrary, Refresh };
+    enum Type { None, UpdatePaths, RequestTag, SetTag, ReadLibrary, Refresh, RequestFrameIndex, UpdateFiles };
 
     Q_INVOKABLE MediaJob(QObject* parent = 0);
 
+    QByteArray affinity() const;
+    QByteArray typeName() const;
+
     Type type() const;
     void setType(Type type);
 
@@ -89,34 +94,47 @@ public:
 signals:
     void tag(const Tag& tag);
     void tagWritten(const QString& filename);
+    void frameIndex(const QString& filename, const FrameIndex& index);
 
     void artist(const Artist& artist);
+    void library(const LibrarySnapshot& library);
     void trackRemoved(int trackid);
+    void tracksRemoved(const QList<int>& trackids);
     void updateStarted();
+    void updateProgress(int files, int filesPerSecond);
     void updateFinished();
-    void databaseCleared();
 
 private:
     Q_INVOKABLE void startJob();
 
-    void readTag(const QString& path, Tag& tag);
-
     void updatePaths(const PathSet& paths);
+    void updateFiles(const QStringList& updated, const QStringList& removed);
+    void startScan(const QStringList& paths, bool skipKnown);
     void requestTag(const QString& filename);
     void setTag(const QString& filename, const Tag& tag);
     void readLibrary();
+    void requestFrameIndex(const QString& filename);
 
     void createData();
 
+    void cancelled();
+
     friend class MediaData;
 
 private slots:
-    void updatePaths();
+    void scanResults(const ScanResults& results);
+    void scanSeen(const QStringList& files);
+    void scanFinished();
 
 private:
     Type m_type;
     QVariant m_arg;
+    MediaScanner* m_scanner;
+    int m_scan;
+    QStringList m_roots;
+    QStringList m_removed;
 
+    static int s_scans;
     static MediaData* s_data;
 };
 
@@ -130,299 +148,287 @@ MediaData::MediaData()
     if (!tables.contains(QLatin1String("artists"))
         || !tables.contains(QLatin1String("albums"))
         || !tables.contains(QLatin1String("tracks")))
-        createTables();
-}
+        MediaWriter::createTables(database);
+    if (!tables.contains(QLatin1String("frameindex")))
+        createIndexTable();
+    if (!tables.contains(QLatin1String("files")))
+        MediaWriter::createFilesTable(database);
+    if (!tables.contains(QLatin1String("meta"))) {
+        // A snapshot from before the revision started counting cannot be trusted
+        MediaWriter::createRevisionTable(database);
+        QFile::remove(snapshotPath());
+    }
 
-void MediaData::createTables()
-{
-    QSqlQuery q(database);
-    q.exec(QLatin1String("create table artists (id integer primary key autoincrement, artist text not null)"));
-    q.exec(QLatin1String("create table albums (id integer primary key autoincrement, album text not null, artistid integer, foreign key(artistid) references artist(id))"));
-    q.exec(QLatin1String("create table tracks (id integer primary key autoincrement, track text not null, filename text not null, trackno integer, duration integer, artistid integer, albumid integer, foreign key(artistid) references artist(id), foreign key(albumid) references album(id))"));
+    MediaWriter::configure(database);
+    MediaWriter::createIndices(database);
+    createTempTables();
+
+    writer = new MediaWriter(database);
 }
 
-void MediaData::clearDatabase()
+MediaData::~MediaData()
 {
-    QSqlQuery q(database);
-    q.exec(QLatin1String("delete from artists"));
-    q.exec(QLatin1String("delete from albums"));
-    q.exec(QLatin1String("delete from tracks"));
+    delete writer;
 }
 
-int MediaData::addArtist(const QString &name, bool* added)
+void MediaData::createIndexTable()
 {
     QSqlQuery q(database);
-
-    q.prepare("select artists.id from artists where artists.artist = ? collate nocase");
-    q.bindValue(0, name);
-    if (q.exec() && q.next()) {
-        if (added)
-            *added = false;
-        return q.value(0).toInt();
-    }
-
-    q.prepare("insert into artists (artist) values (?)");
-    q.bindValue(0, name);
-    if (!q.exec()) {
-        if (added)
-            *added = false;
-        return -1;
-    }
-
-    if (added)
-        *added = true;
-    return q.lastInsertId().toInt();
+    q.exec(QLatin1String("create table frameindex (filename text primary key, modified integer, data blob)"));
 }
 
-int MediaData::addAlbum(int artistid, const QString &name, bool* added)
+FrameIndex MediaData::frameIndex(const QString &filename)
 {
-    if (artistid <= 0)
-        return artistid;
+    QFileInfo file(filename);
+    if (!file.exists())
+        return FrameIndex();
+    const uint modified = file.lastModified().toTime_t();
 
     QSqlQuery q(database);
+    q.prepare("select frameindex.modified, frameindex.data from frameindex where frameindex.filename = ?");
+    q.bindValue(0, filename);
+    if (q.exec() && q.next() && q.value(0).toUInt() == modified) {
+        FrameIndex index = FrameIndex::fromByteArray(q.value(1).toByteArray());
+        if (!index.isEmpty())
+            return index;
+    }
 
-    q.prepare("select albums.id from albums where albums.album = ? and albums.artistid = ? collate nocase");
-    q.bindValue(0, name);
-    q.bindValue(1, artistid);
-    if (q.exec() && q.next()) {
-        if (added)
-            *added = false;
-        return q.value(0).toInt();
+    FrameIndex index;
+    AudioFileInformation* info = Codecs::instance()->createAudioFileInformation(MediaLibraryFile::instance()->mimeType(filename));
+    if (info) {
+        info->setFilename(filename);
+        index = info->frameIndex();
+        delete info;
     }
 
-    q.prepare("insert into albums (album, artistid) values (?, ?)");
-    q.bindValue(0, name);
-    q.bindValue(1, artistid);
-    if (!q.exec()) {
-        if (added)
-            *added = false;
-        return -1;
+    if (!index.isEmpty()) {
+        q.prepare("insert or replace into frameindex (filename, modified, data) values (?, ?, ?)");
+        q.bindValue(0, filename);
+        q.bindValue(1, modified);
+        q.bindValue(2, index.toByteArray());
+        q.exec();
     }
 
-    if (added)
-        *added = true;
-    return q.lastInsertId().toInt();
+    return index;
 }
 
-int MediaData::addTrack(int artistid, int albumid, const QString &name, const QString &filename, int trackno, int duration, bool* added)
+FileStamps MediaData::knownFiles()
 {
-    if (artistid <= 0 || albumid <= 0)
-        return qMin(artistid, albumid);
+    FileStamps files;
 
     QSqlQuery q(database);
-
-    q.prepare("select tracks.id from tracks, albums where tracks.track = ? and tracks.albumid = ? and albums.id = tracks.albumid and albums.artistid = ? collate nocase");
-    q.bindValue(0, name);
-    q.bindValue(1, albumid);
-    q.bindValue(2, artistid);
-    if (q.exec() && q.next()) {
-        if (added)
-            *added = false;
-        return q.value(0).toInt();
-    }
-
-    q.prepare("insert into tracks (track, filename, trackno, artistid, albumid, duration) values (?, ?, ?, ?, ?, ?)");
-    q.bindValue(0, name);
-    q.bindValue(1, filename);
-    q.bindValue(2, trackno);
-    q.bindValue(3, artistid);
-    q.bindValue(4, albumid);
-    q.bindValue(5, duration);
-    if (!q.exec()) {
-        if (added)
-            *added = false;
-        return -1;
+    q.setForwardOnly(true);
+    if (q.exec(QLatin1String("select files.path, files.size, files.mtime, files.inode from files"))) {
+        while (q.next()) {
+            FileStamp stamp;
+            stamp.size = q.value(1).toLongLong();
+            stamp.mtime = q.value(2).toUInt();
+            stamp.inode = q.value(3).toULongLong();
+            files.insert(q.value(0).toString(), stamp);
+        }
     }
 
-    if (added)
-        *added = true;
-    return q.lastInsertId().toInt();
+    return files;
 }
 
-static QString takeFirst(PathSet& paths)
+void MediaData::addTracks(const ScanResults &results, MediaJob *job)
 {
-    PathSet::Iterator it = paths.begin();
-    if (it == paths.end())
-        return QString();
-    QString path = *it;
-    paths.erase(it);
-    return path;
-}
-
-bool MediaData::pushState(PathSet &paths, const QString& prefix)
-{
-    QString path = takeFirst(paths);
-    if (path.isEmpty())
-        return false;
+    writer->begin();
 
-    if (!prefix.isEmpty())
-        path = QDir::cleanPath(prefix + QLatin1String("/") + path);
+    foreach(const ScanResult& result, results) {
+        // A new path with the contents of a file that is gone is a rename,
+        // moving the old rows over keeps the track id
+        if (!result.known) {
+            foreach(const QString& path, writer->filesWithHash(result.hash)) {
+                if (path != result.filename && !QFile::exists(path)) {
+                    writer->renameFile(path, result.filename);
+                    break;
+                }
+            }
+        }
 
-    QDir dir(path);
-    QStringList files = dir.entryList(QDir::Files | QDir::NoDotAndDotDot | QDir::Readable);
-    QStringList dirs = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+        bool added = false;
+        int artistid = writer->addArtist(result.artist);
+        int albumid = writer->addAlbum(artistid, result.album);
+
+        int oldalbumid;
+        int trackid = writer->trackForFile(result.filename, &oldalbumid);
+        if (trackid > 0) {
+            if (writer->updateTrack(trackid, artistid, albumid, result.title, result.trackno, result.duration)) {
+                if (oldalbumid != albumid)
+                    emit job->trackRemoved(trackid);
+                added = true;
+            }
+        } else {
+            trackid = writer->addTrack(artistid, albumid, result.title, result.filename, result.trackno, result.duration, &added);
+        }
 
-    MediaState state;
-    state.path = path;
-    state.files = PathSet::fromList(files);
-    state.dirs = PathSet::fromList(dirs);
-    states.push(state);
+        writer->setFile(result.filename, result.stamp.size, result.stamp.mtime, result.stamp.inode, result.hash);
 
-    return true;
-}
+        if (added) {
+            Artist artist;
+            artist.id = artistid;
+            artist.name = result.artist;
 
-bool MediaData::updatePaths(MediaJob* job)
-{
-    if (states.isEmpty())
-        if (!pushState(paths, QString()))
-            return false;
+            Album album;
+            album.id = albumid;
+            album.name = result.album;
 
-    MediaState& state = states.top();
-    if (!state.files.isEmpty()) {
-        QString file = QDir::cleanPath(state.path + QLatin1String("/") + takeFirst(state.files));
+            Track track;
+            track.id = trackid;
+            track.name = result.title;
+            track.trackno = result.trackno;
+            track.duration = result.duration;
+            track.filename = result.filename;
 
-        QByteArray mimetype = MediaLibraryFile::instance()->mimeType(file);
-        if (mimetype.isEmpty())
-            return true;
+            album.tracks[trackid] = track;
+            artist.albums[albumid] = album;
 
-        Tag tag;
-        job->readTag(file, tag);
-        if (tag.isValid()) {
-            int duration = 0;
-            AudioFileInformation* info = Codecs::instance()->createAudioFileInformation(mimetype);
-            if (info) {
-                info->setFilename(file);
-                duration = info->length();
-                delete info;
-            }
+            emit job->artist(artist);
+        }
+    }
 
-            bool added;
-            int artistid = addArtist(tag.data(QLatin1String("artist")).toString());
-            int albumid = addAlbum(artistid, tag.data(QLatin1String("album")).toString());
-            int trackid = addTrack(artistid, albumid, tag.data(QLatin1String("title")).toString(), file, tag.data(QLatin1String("track")).toInt(), duration, &added);
+    writer->commit();
+}
 
-            if (added) {
-                Artist artist;
-                artist.id = artistid;
-                artist.name = tag.data(QLatin1String("artist")).toString();
+void MediaData::createTempTables()
+{
+    // Scans can overlap, so the paths each one saw are kept apart
+    QSqlQuery query(database);
+    query.exec(QLatin1String("create temp table seen (scan integer, path text, primary key(scan, path))"));
+    query.exec(QLatin1String("create temp table orphans (id integer primary key, albumid integer, artistid integer)"));
+}
 
-                Album album;
-                album.id = albumid;
-                album.name = tag.data(QLatin1String("album")).toString();
+void MediaData::addSeen(int scan, const QStringList &paths)
+{
+    QSqlQuery query(database);
+    query.prepare("insert or ignore into seen (scan, path) values (?, ?)");
 
-                Track track;
-                track.id = trackid;
-                track.name = tag.data(QLatin1String("title")).toString();
-                track.trackno = tag.data(QLatin1String("track")).toInt();
-                track.duration = duration;
-                track.filename = file;
+    writer->begin();
+    foreach(const QString& path, paths) {
+        query.bindValue(0, scan);
+        query.bindValue(1, path);
+        query.exec();
+    }
+    writer->commit();
+}
 
-                album.tracks[trackid] = track;
-                artist.albums[albumid] = album;
+// Paths below dir sort from "dir/" up to "dir0", '0' comes right after '/',
+// which lets tracks_filename find them. A root such as "/" already ends in
+// the separator.
+static void bindBelow(QSqlQuery& query, int index, const QString& dir)
+{
+    const QString prefix = dir.endsWith(QLatin1Char('/')) ? dir : dir + QLatin1Char('/');
+    query.bindValue(index, prefix);
+    query.bindValue(index + 1, prefix.left(prefix.size() - 1) + QLatin1Char('0'));
+}
 
-                emit job->artist(artist);
-            }
-        }
+void MediaData::reconcile(int scan, const QStringList &roots, MediaJob *job)
+{
+    QSqlQuery query(database);
 
-        return true;
-    } else if (!state.dirs.isEmpty()) {
-        pushState(state.dirs, state.path);
-        return true;
-    } else {
-        states.pop();
+    // Tracks below a scanned root that the scan did not see are gone
+    query.prepare("insert or ignore into orphans (id, albumid, artistid) select tracks.id, tracks.albumid, tracks.artistid from tracks where tracks.filename >= ? and tracks.filename < ? and not exists (select 1 from seen where seen.scan = ? and seen.path = tracks.filename)");
+    foreach(const QString& root, roots) {
+        bindBelow(query, 0, QDir::cleanPath(root));
+        query.bindValue(2, scan);
+        query.exec();
     }
 
-    removeNonExistingFiles(job);
-
-    return true;
+    dropSeen(scan);
+    removeOrphans(job);
 }
 
-void MediaData::removeNonExistingFiles(MediaJob* job)
+void MediaData::dropSeen(int scan)
 {
-    QSqlQuery query;
-    QFileInfo file;
-    QSet<int> trackpending, albumpending, artistpending;
+    QSqlQuery query(database);
+    query.prepare("delete from seen where seen.scan = ?");
+    query.bindValue(0, scan);
+    query.exec();
+}
 
-    query.exec("select tracks.id, tracks.filename, tracks.albumid, tracks.artistid from tracks");
-    while (query.next()) {
-        file.setFile(query.value(1).toString());
-        if (!file.exists()) {
-            qDebug() << "want to remove" << query.value(1).toString() << "which has an id of" << query.value(0).toInt();
-            // remove from database
-            trackpending.insert(query.value(0).toInt());
-            albumpending.insert(query.value(2).toInt());
-            artistpending.insert(query.value(3).toInt());
+void MediaData::removeFiles(const QStringList &paths, MediaJob *job)
+{
+    QSqlQuery query(database);
+    QSqlQuery insert(database);
+    insert.prepare("insert or ignore into orphans (id, albumid, artistid) values (?, ?, ?)");
+
+    // A path is either a file or a directory that went away, the file check
+    // keeps tracks that were replaced before the event got here
+    query.prepare("select tracks.id, tracks.filename, tracks.albumid, tracks.artistid from tracks where tracks.filename = ? or (tracks.filename >= ? and tracks.filename < ?)");
+    foreach(const QString& removed, paths) {
+        const QString path = QDir::cleanPath(removed);
+        query.bindValue(0, path);
+        bindBelow(query, 1, path);
+        if (!query.exec())
+            continue;
+        while (query.next()) {
+            if (QFile::exists(query.value(1).toString()))
+                continue;
+            insert.bindValue(0, query.value(0));
+            insert.bindValue(1, query.value(2));
+            insert.bindValue(2, query.value(3));
+            insert.exec();
         }
     }
-    if (trackpending.isEmpty())
-        return;
 
-    foreach(int trackid, trackpending) {
-        query.exec("delete from tracks where tracks.id=" + QString::number(trackid));
-        emit job->trackRemoved(trackid);
-    }
-    foreach(int albumid, albumpending) {
-        query.exec("select tracks.albumid from tracks where tracks.albumid=" + QString::number(albumid));
-        if (!query.next())
-            query.exec("delete from albums where albums.id=" + QString::number(albumid));
-    }
-    foreach(int artistid, artistpending) {
-        query.exec("select albums.artistid from albums where albums.artistid=" + QString::number(artistid));
-        if (!query.next())
-            query.exec("delete from artists where artists.id=" + QString::number(artistid));
-    }
+    removeOrphans(job);
 }
 
-void MediaData::readLibrary(MediaJob* job)
+void MediaData::removeOrphans(MediaJob *job)
 {
-    QSqlQuery artistQuery, albumQuery, trackQuery;
-
-    artistQuery.exec("select artists.id, artists.artist from artists");
-    while (artistQuery.next()) {
-        Artist artistData;
-
-        int artistid = artistQuery.value(0).toInt();
-
-        artistData.id = artistid;
-        artistData.name = artistQuery.value(1).toString();
-
-        albumQuery.prepare("select albums.id, albums.album from albums where albums.artistid = ?");
-        albumQuery.bindValue(0, artistid);
-        albumQuery.exec();
-        while (albumQuery.next()) {
-            Album albumData;
+    QList<int> removed;
 
-            int albumid = albumQuery.value(0).toInt();
+    QSqlQuery query(database);
+    query.setForwardOnly(true);
+    if (query.exec(QLatin1String("select orphans.id from orphans"))) {
+        while (query.next())
+            removed.append(query.value(0).toInt());
+    }
+    if (removed.isEmpty())
+        return;
 
-            albumData.id = albumid;
-            albumData.name = albumQuery.value(1).toString();
+    qDebug() << "removing" << removed.size() << "tracks";
 
-            trackQuery.prepare("select tracks.id, tracks.track, tracks.filename, tracks.trackno, tracks.duration from tracks where tracks.artistid = ? and tracks.albumid = ? order by tracks.trackno");
-            trackQuery.bindValue(0, artistid);
-            trackQuery.bindValue(1, albumid);
-            trackQuery.exec();
+    writer->begin();
+    query.exec(QLatin1String("delete from files where files.path in (select tracks.filename from tracks where tracks.id in (select orphans.id from orphans))"));
+    query.exec(QLatin1String("delete from tracks where tracks.id in (select orphans.id from orphans)"));
+    query.exec(QLatin1String("delete from albums where albums.id in (select orphans.albumid from orphans) and not exists (select 1 from tracks where tracks.albumid = albums.id)"));
+    query.exec(QLatin1String("delete from artists where artists.id in (select orphans.artistid from orphans) and not exists (select 1 from albums where albums.artistid = artists.id)"));
+    query.exec(QLatin1String("delete from orphans"));
+    writer->commit();
 
-            while (trackQuery.next()) {
-                Track trackData;
+    emit job->tracksRemoved(removed);
+}
 
-                trackData.id = trackQuery.value(0).toInt();
-                trackData.name = trackQuery.value(1).toString();
-                trackData.trackno = trackQuery.value(3).toInt();
-                trackData.duration = trackQuery.value(4).toInt();
-                trackData.filename = trackQuery.value(2).toString();
+QString MediaData::snapshotPath() const
+{
+    QFileInfo info(database.databaseName());
+    return info.absoluteDir().filePath(info.completeBaseName() + QLatin1String(".library"));
+}
 
-                albumData.tracks[trackData.id] = trackData;
-            }
+void MediaData::readLibrary(MediaJob* job)
+{
+    const quint64 revision = MediaWriter::revision(database);
+    const QString path = snapshotPath();
 
-            artistData.albums[albumData.id] = albumData;
-        }
+    QElapsedTimer timer;
+    timer.start();
 
-        emit job->artist(artistData);
-        QThread::yieldCurrentThread();
+    LibrarySnapshot snapshot = LibrarySnapshot::load(path, revision);
+    if (snapshot.isNull()) {
+        snapshot = MediaWriter::buildSnapshot(database, revision);
+        snapshot.save(path);
+        qDebug() << "built library snapshot of" << snapshot.trackCount() << "tracks in" << timer.elapsed() << "ms";
+    } else {
+        qDebug() << "loaded library snapshot of" << snapshot.trackCount() << "tracks in" << timer.elapsed() << "ms";
     }
+
+    emit job->library(snapshot);
 }
 
 MediaData* MediaJob::s_data = 0;
+int MediaJob::s_scans = 0;
 
 void MediaJob::deinit()
 {
@@ -430,8 +436,29 @@ void MediaJob::deinit()
 }
 
 MediaJob::MediaJob(QObject* parent)
-    : IOJob(parent), m_type(None)
+    : IOJob(parent), m_type(None), m_scanner(0), m_scan(0)
+{
+}
+
+QByteArray MediaJob::affinity() const
+{
+    // s_data and its database connection belong to the thread that created them
+    if (m_type == RequestTag || m_type == SetTag)
+        return QByteArray();
+    return QByteArray("mediadata");
+}
+
+QByteArray MediaJob::typeName() const
 {
+    const QMetaEnum types = staticMetaObject.enumerator(staticMetaObject.indexOfEnumerator("Type"));
+    return QByteArray("MediaJob::") + types.valueToKey(m_type);
+}
+
+void MediaJob::cancelled()
+{
+    // The scanner stops handing out results and finishes, see scanFinished()
+    if (m_scanner)
+        m_scanner->cancel();
 }
 
 void MediaJob::createData()
@@ -449,9 +476,8 @@ void MediaJob::startJob()
 {
     switch (m_type) {
     case Refresh:
-        s_data->clearDatabase();
-        emit databaseCleared();
-        // fall through
+        // Unchanged files are recognized by their fingerprints, so a
+        // refresh is a rescan of every path rather than a rebuild
     case UpdatePaths:
         updatePaths(m_arg.value<PathSet>());
         break;
@@ -468,6 +494,18 @@ void MediaJob::startJob()
     case ReadLibrary:
         readLibrary();
         break;
+    case RequestFrameIndex:
+        requestFrameIndex(m_arg.toString());
+        break;
+    case UpdateFiles:
+    {
+        QList<QVariant> args = m_arg.toList();
+        if (args.size() == 2)
+            updateFiles(args.at(0).toStringList(), args.at(1).toStringList());
+        else
+            stop();
+        break;
+    }
     default:
         break;
     }
@@ -499,25 +537,87 @@ void MediaJob::updatePaths(const PathSet &paths)
 
     createData();
 
-    bool shouldUpdate = s_data->paths.isEmpty();
-    s_data->paths += paths;
-
-    if (shouldUpdate && !s_data->paths.isEmpty()) {
-        QTimer::singleShot(50, this, SLOT(updatePaths()));
-    } else {
+    if (paths.isEmpty()) {
         emit updateFinished();
         stop();
+        return;
+    }
+
+    startScan(paths.toList(), true);
+}
+
+void MediaJob::updateFiles(const QStringList &updated, const QStringList &removed)
+{
+    createData();
+
+    m_removed = removed;
+    if (updated.isEmpty()) {
+        scanFinished();
+        return;
     }
+
+    // Single files from the watcher have changed by definition, only
+    // directories are worth checking against the known fingerprints
+    bool dirs = false;
+    foreach(const QString& path, updated) {
+        if (QFileInfo(path).isDir()) {
+            dirs = true;
+            break;
+        }
+    }
+    startScan(updated, dirs);
+}
+
+void MediaJob::startScan(const QStringList &paths, bool skipKnown)
+{
+    // Tags and durations are read on the scanner threads, the database
+    // is only ever touched from this one
+    m_scan = ++s_scans;
+    m_roots = paths;
+
+    m_scanner = new MediaScanner(this);
+    if (skipKnown)
+        m_scanner->setKnownFiles(s_data->knownFiles());
+    connect(m_scanner, SIGNAL(tracks(ScanResults)), this, SLOT(scanResults(ScanResults)));
+    connect(m_scanner, SIGNAL(seen(QStringList)), this, SLOT(scanSeen(QStringList)));
+    connect(m_scanner, SIGNAL(progress(int,int)), this, SIGNAL(updateProgress(int,int)));
+    connect(m_scanner, SIGNAL(finished()), this, SLOT(scanFinished()));
+    m_scanner->start(paths);
 }
 
-void MediaJob::updatePaths()
+void MediaJob::scanResults(const ScanResults &results)
 {
-    if (s_data->updatePaths(this))
-        QTimer::singleShot(50, this, SLOT(updatePaths()));
-    else {
+    s_data->addTracks(results, this);
+}
+
+void MediaJob::scanSeen(const QStringList &files)
+{
+    // Only a full scan can tell what is missing
+    if (m_type != UpdateFiles)
+        s_data->addSeen(m_scan, files);
+}
+
+void MediaJob::scanFinished()
+{
+    // Removals go last so that a moved file is picked up as a rename first.
+    // A cancelled scan has not seen everything, so nothing is reconciled,
+    // the scan that superseded it does that. What it did see goes.
+    if (m_type == UpdateFiles) {
+        s_data->removeFiles(m_removed, this);
+    } else {
+        if (isCancelled())
+            s_data->dropSeen(m_scan);
+        else
+            s_data->reconcile(m_scan, m_roots, this);
         emit updateFinished();
-        stop();
     }
+
+    if (m_scanner) {
+        m_scanner->deleteLater();
+        m_scanner = 0;
+    }
+
+    stop();
 }
 
 void MediaJob::requestTag(const QString &filename)
@@ -542,19 +642,20 @@ void MediaJob::readLibrary()
     stop();
 }
 
-void MediaJob::readTag(const QString &path, Tag& tag)
+void MediaJob::requestFrameIndex(const QString &filename)
 {
-    tag = Tag(path);
+    createData();
+    emit frameIndex(filename, s_data->frameIndex(filename));
+    stop();
 }
 
 #include "medialibrary_file.moc"
 
 MediaLibraryFile::MediaLibraryFile(QObject *parent) :
-    MediaLibrary(parent)
+    MediaLibrary(parent), m_watcher(0)
 {
     qRegisterMetaType<PathSet>("PathSet");
     qRegisterMetaType<Tag>("Tag");
-    qRegisterMetaType<Artist>("Artist");
 }
 
 MediaLibraryFile::~MediaLibraryFile()
@@ -568,6 +669,28 @@ void MediaLibraryFile::setSettings(QSettings *settings)
 
     if (m_settings)
         m_paths = m_settings->value(QLatin1String("mediaPaths")).toStringList();
+
+    watchPaths();
+}
+
+void MediaLibraryFile::watchPaths()
+{
+    if (!m_watcher) {
+        m_watcher = new MediaWatcher;
+        connect(m_watcher, SIGNAL(changed(QStringList,QStringList)), this, SLOT(filesChanged(QStringList,QStringList)));
+        IO::instance()->startJob(m_watcher);
+    }
+
+    QMetaObject::invokeMethod(m_watcher, "watchPaths", Q_ARG(QStringList, m_paths));
+}
+
+void MediaLibraryFile::filesChanged(const QStringList &updated, const QStringList &removed)
+{
+    MediaJob* job = new MediaJob;
+    job->setType(MediaJob::UpdateFiles);
+    job->setArg(QVariantList() << updated << removed);
+    job->setPriority(IOJob::LowPriority);
+    startJob(job);
 }
 
 void MediaLibraryFile::syncSettings()
@@ -601,12 +724,14 @@ void MediaLibraryFile::setPaths(const QStringList &paths)
 {
     m_paths = paths;
     syncSettings();
+    watchPaths();
 }
 
 void MediaLibraryFile::addPath(const QString &path)
 {
     m_paths.append(path);
     syncSettings();
+    watchPaths();
 }
 
 void MediaLibraryFile::incrementalUpdate()
@@ -624,6 +749,7 @@ void MediaLibraryFile::incrementalUpdate()
     MediaJob* job = new MediaJob;
     job->setType(MediaJob::UpdatePaths);
     job->setArg(QVariant::fromValue<PathSet>(toupdate));
+    job->setPriority(IOJob::LowPriority);
     startJob(job);
 
     m_updatedPaths += toupdate;
@@ -636,6 +762,8 @@ void MediaLibraryFile::fullUpdate()
     MediaJob* job = new MediaJob;
     job->setType(MediaJob::UpdatePaths);
     job->setArg(QVariant::fromValue<PathSet>(m_updatedPaths));
+    job->setPriority(IOJob::LowPriority);
+    job->setGroup("fullscan");
     startJob(job);
 }
 
@@ -651,13 +779,38 @@ void MediaLibraryFile::requestMetaData(const QString &filename)
     MediaJob* job = new MediaJob;
     job->setType(MediaJob::RequestTag);
     job->setArg(filename);
+    job->setPriority(IOJob::HighPriority);
+    job->setDeadline(MEDIA_REQUEST_DEADLINE);
+    job->setKey("tag:" + filename.toUtf8());
+    startJob(job);
+}
+
+void MediaLibraryFile::requestFrameIndex(const QString &filename)
+{
+    // Playback is waiting for this one
+    MediaJob* job = new MediaJob;
+    job->setType(MediaJob::RequestFrameIndex);
+    job->setArg(filename);
+    job->setPriority(IOJob::CriticalPriority);
+    job->setKey("frameindex:" + filename.toUtf8());
     startJob(job);
 }
 
 void MediaLibraryFile::requestArtwork(const QString &filename)
 {
+    // Only the artwork of the latest request is wanted, skipping through
+    // tracks cancels the requests for the ones skipped past
+    m_pendingArtwork.clear();
     m_pendingArtwork.insert(filename);
-    requestMetaData(filename);
+
+    MediaJob* job = new MediaJob;
+    job->setType(MediaJob::RequestTag);
+    job->setArg(filename);
+    job->setPriority(IOJob::HighPriority);
+    job->setDeadline(MEDIA_REQUEST_DEADLINE);
+    job->setKey("tag:" + filename.toUtf8());
+    job->setGroup("artwork");
+    startJob(job);
 }
 
 void MediaLibraryFile::refresh()
@@ -667,6 +820,8 @@ void MediaLibraryFile::refresh()
     MediaJob* job = new MediaJob;
     job->setType(MediaJob::Refresh);
     job->setArg(QVariant::fromValue<PathSet>(m_updatedPaths));
+    job->setPriority(IOJob::LowPriority);
+    job->setGroup("fullscan");
     startJob(job);
 }
 
@@ -729,11 +884,14 @@ void MediaLibraryFile::jobStarted()
 
     connect(media, SIGNAL(tag(Tag)), this, SLOT(tagReceived(Tag)));
     connect(media, SIGNAL(artist(Artist)), this, SIGNAL(artist(Artist)));
+    connect(media, SIGNAL(library(LibrarySnapshot)), this, SIGNAL(library(LibrarySnapshot)));
     connect(media, SIGNAL(trackRemoved(int)), this, SIGNAL(trackRemoved(int)));
+    connect(media, SIGNAL(tracksRemoved(QList<int>)), this, SIGNAL(tracksRemoved(QList<int>)));
     connect(media, SIGNAL(tagWritten(QString)), this, SIGNAL(tagWritten(QString)));
+    connect(media, SIGNAL(frameIndex(QString,FrameIndex)), this, SIGNAL(frameIndex(QString,FrameIndex)));
     connect(media, SIGNAL(updateStarted()), this, SIGNAL(updateStarted()));
+    connect(media, SIGNAL(updateProgress(int,int)), this, SIGNAL(updateProgress(int,int)));
     connect(media, SIGNAL(updateFinished()), this, SIGNAL(updateFinished()));
-    connect(media, SIGNAL(databaseCleared()), this, SIGNAL(cleared()));
 
     media->start();
 }
@@ -34,6 +34,7 @@ typedef QSet<QString> PathSet;
 
 class IOJob;
 class MediaJob;
+class MediaWatcher;
 
 class MediaLibraryFile : public MediaLibrary
 {
@@ -54,6 +55,7 @@ public:
 
     void requestArtwork(const QString& filename);
     void requestMetaData(const QString& filename);
+    void requestFrameIndex(const QString& filename);
 
     AudioReader* readerForFilename(const QString &filename);
 
@@ -67,16 +69,19 @@ signals:
     void tagWritten(const QString& filename);
 
     void updateStarted();
+    void updateProgress(int files, int filesPerSecond);
     void updateFinished();
 
 private slots:
     void jobStarted();
     void jobFinished();
     void tagReceived(const Tag& tag);
+    void filesChanged(const QStringList& updated, const QStringList& removed);
 
 private:
     void processArtwork(const Tag& tag);
     void syncSettings();
+    void watchPaths();
     void startJob(IOJob* job);
 
 private:
@@ -86,6 +91,8 @@ private:
     PathSet m_updatedPaths;
 
     QSet<QString> m_pendingArtwork;
+
+    MediaWatcher* m_watcher;
 };
 
 class MediaModel : public QAbstractListModel
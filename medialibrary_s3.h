@@ -41,12 +41,6 @@ public:
 
     void setSettings(QSettings *settings);
 
-private slots:
-    void S3complete();
-
-private:
-    void readS3();
-
 private:
     friend class MediaLibraryS3Private;
 
@@ -0,0 +1,405 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mediascanner.h"
+#include "medialibrary.h"
+#include "codecs/codecs.h"
+#include "codecs/codec.h"
+#include "tag.h"
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QCryptographicHash>
+#include <QDebug>
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#define SCAN_BATCH 64
+#define SCAN_SEEN_BATCH 1024
+#define SCAN_PROGRESS_INTERVAL 1000 // files between progress reports
+#define SCAN_HASH_CHUNK (64 * 1024) // bytes hashed from each end of a file
+
+class ScanWorker : public QThread
+{
+public:
+    ScanWorker(MediaScanner* scanner, int id);
+
+    void push(const QString& path, bool dir);
+    bool pop(QString* path, bool* dir);
+    bool steal(QString* path, bool* dir);
+
+protected:
+    void run();
+
+private:
+    void process(const QString& path, bool dir, ScanResults& results, QStringList& seen);
+
+private:
+    struct Item
+    {
+        QString path;
+        bool dir;
+    };
+
+    MediaScanner* m_scanner;
+    int m_id;
+
+    // The owner works on the back, thieves take from the front
+    QMutex m_mutex;
+    QList<Item> m_items;
+};
+
+ScanWorker::ScanWorker(MediaScanner *scanner, int id)
+    : m_scanner(scanner), m_id(id)
+{
+}
+
+void ScanWorker::push(const QString &path, bool dir)
+{
+    Item item;
+    item.path = path;
+    item.dir = dir;
+
+    m_scanner->m_pending.ref();
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_items.append(item);
+    }
+    m_scanner->postWork();
+}
+
+bool ScanWorker::pop(QString *path, bool *dir)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_items.isEmpty())
+        return false;
+
+    Item item = m_items.takeLast();
+    *path = item.path;
+    *dir = item.dir;
+    return true;
+}
+
+bool ScanWorker::steal(QString *path, bool *dir)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_items.isEmpty())
+        return false;
+
+    Item item = m_items.takeFirst();
+    *path = item.path;
+    *dir = item.dir;
+    return true;
+}
+
+void ScanWorker::run()
+{
+    ScanResults results;
+    QStringList seen;
+    QString path;
+    bool dir;
+
+    while (!m_scanner->m_cancel) {
+        const int posted = m_scanner->m_posted;
+        if (pop(&path, &dir) || m_scanner->steal(m_id, &path, &dir)) {
+            process(path, dir, results, seen);
+            if (!m_scanner->m_pending.deref())
+                m_scanner->postWork(true);
+
+            if (results.size() >= SCAN_BATCH || seen.size() >= SCAN_SEEN_BATCH)
+                m_scanner->submit(results, seen);
+            continue;
+        }
+
+        if (m_scanner->m_pending == 0)
+            break;
+
+        // Others are still expanding directories, hand over what we have meanwhile
+        if (!results.isEmpty() || !seen.isEmpty())
+            m_scanner->submit(results, seen);
+        m_scanner->waitForWork(posted);
+    }
+
+    if (!results.isEmpty() || !seen.isEmpty())
+        m_scanner->submit(results, seen);
+}
+
+void ScanWorker::process(const QString &path, bool dir, ScanResults &results, QStringList &seen)
+{
+    if (dir) {
+        QDir d(path);
+        const QStringList files = d.entryList(QDir::Files | QDir::NoDotAndDotDot | QDir::Readable);
+        // A link back up the tree would never end
+        const QStringList dirs = d.entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+
+        foreach(const QString& file, files) {
+            push(QDir::cleanPath(path + QLatin1String("/") + file), false);
+        }
+        foreach(const QString& sub, dirs) {
+            push(QDir::cleanPath(path + QLatin1String("/") + sub), true);
+        }
+        return;
+    }
+
+    ScanResult result;
+    switch (m_scanner->scanFile(path, &result)) {
+    case MediaScanner::Changed:
+        results.append(result);
+        // fall through
+    case MediaScanner::Unchanged:
+        seen.append(path);
+        break;
+    case MediaScanner::Ignored:
+        break;
+    }
+
+    const int files = m_scanner->m_files.fetchAndAddRelaxed(1) + 1;
+    if (files % SCAN_PROGRESS_INTERVAL == 0)
+        emit m_scanner->progress(files, m_scanner->filesPerSecond());
+}
+
+MediaScanner::MediaScanner(QObject *parent)
+    : QObject(parent), m_workerCount(0), m_running(0), m_pending(0), m_files(0), m_skipped(0), m_cancel(0),
+      m_posted(0)
+{
+    qRegisterMetaType<ScanResults>("ScanResults");
+}
+
+MediaScanner::~MediaScanner()
+{
+    cancel();
+    foreach(ScanWorker* worker, m_workers) {
+        worker->wait();
+    }
+    qDeleteAll(m_workers);
+}
+
+void MediaScanner::setWorkerCount(int count)
+{
+    m_workerCount = count;
+}
+
+void MediaScanner::setKnownFiles(const FileStamps &files)
+{
+    if (!isRunning())
+        m_known = files;
+}
+
+void MediaScanner::start(const QStringList &paths)
+{
+    if (isRunning())
+        return;
+
+    qDeleteAll(m_workers);
+    m_workers.clear();
+
+    int count = m_workerCount;
+    if (count <= 0)
+        count = qMax(1, QThread::idealThreadCount());
+
+    for (int i = 0; i < count; ++i) {
+        ScanWorker* worker = new ScanWorker(this, i);
+        connect(worker, SIGNAL(finished()), this, SLOT(workerFinished()));
+        m_workers.append(worker);
+    }
+
+    // Roots are spread out, stealing takes care of the rest
+    int i = 0;
+    foreach(const QString& path, paths) {
+        m_workers.at(i++ % count)->push(path, QFileInfo(path).isDir());
+    }
+
+    m_files = 0;
+    m_skipped = 0;
+    m_cancel = 0;
+    m_running = count;
+    m_timer.start();
+
+    foreach(ScanWorker* worker, m_workers) {
+        worker->start(QThread::LowPriority);
+    }
+}
+
+void MediaScanner::cancel()
+{
+    m_cancel = 1;
+    postWork(true);
+}
+
+void MediaScanner::postWork(bool all)
+{
+    QMutexLocker locker(&m_idleMutex);
+    m_posted.ref();
+    if (all)
+        m_work.wakeAll();
+    else
+        m_work.wakeOne();
+}
+
+void MediaScanner::waitForWork(int posted)
+{
+    QMutexLocker locker(&m_idleMutex);
+    while (m_posted == posted && m_pending != 0 && !m_cancel)
+        m_work.wait(&m_idleMutex);
+}
+
+bool MediaScanner::isRunning() const
+{
+    return m_running > 0;
+}
+
+int MediaScanner::filesScanned() const
+{
+    return m_files;
+}
+
+int MediaScanner::filesSkipped() const
+{
+    return m_skipped;
+}
+
+int MediaScanner::filesPerSecond() const
+{
+    const qint64 elapsed = m_timer.isValid() ? m_timer.elapsed() : 0;
+    if (elapsed <= 0)
+        return 0;
+    return static_cast<int>((static_cast<qint64>(m_files) * 1000) / elapsed);
+}
+
+bool MediaScanner::steal(int thief, QString *path, bool *dir)
+{
+    const int count = m_workers.size();
+    for (int i = 1; i < count; ++i) {
+        if (m_workers.at((thief + i) % count)->steal(path, dir))
+            return true;
+    }
+    return false;
+}
+
+void MediaScanner::submit(ScanResults &results, QStringList &seen)
+{
+    if (!results.isEmpty()) {
+        emit tracks(results);
+        results.clear();
+    }
+    if (!seen.isEmpty()) {
+        emit this->seen(seen);
+        seen.clear();
+    }
+}
+
+bool MediaScanner::stat(const QString &filename, FileStamp *stamp)
+{
+#ifdef Q_OS_UNIX
+    struct ::stat st;
+    if (::stat(QFile::encodeName(filename).constData(), &st) != 0)
+        return false;
+    stamp->size = st.st_size;
+    stamp->mtime = st.st_mtime;
+    stamp->inode = st.st_ino;
+#else
+    QFileInfo info(filename);
+    if (!info.exists())
+        return false;
+    stamp->size = info.size();
+    stamp->mtime = info.lastModified().toTime_t();
+    stamp->inode = 0;
+#endif
+    return true;
+}
+
+QByteArray MediaScanner::contentHash(const QString &filename, qint64 size)
+{
+    QFile file(filename);
+    if (!file.open(QFile::ReadOnly))
+        return QByteArray();
+
+    // The ends hold the ID3 tags and enough audio to tell files apart
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QByteArray::number(size));
+    hash.addData(file.read(SCAN_HASH_CHUNK));
+    if (size > SCAN_HASH_CHUNK) {
+        file.seek(qMax<qint64>(SCAN_HASH_CHUNK, size - SCAN_HASH_CHUNK));
+        hash.addData(file.read(SCAN_HASH_CHUNK));
+    }
+    return hash.result();
+}
+
+MediaScanner::FileState MediaScanner::scanFile(const QString &filename, ScanResult *result)
+{
+    if (MediaLibrary::instance()->mimeType(filename).isEmpty())
+        return Ignored;
+
+    if (!stat(filename, &result->stamp))
+        return Ignored;
+
+    FileStamps::ConstIterator known = m_known.find(filename);
+    result->known = (known != m_known.end());
+    if (result->known && known.value() == result->stamp) {
+        m_skipped.ref();
+        return Unchanged;
+    }
+
+    result->hash = contentHash(filename, result->stamp.size);
+    return readFile(filename, result) ? Changed : Ignored;
+}
+
+bool MediaScanner::readFile(const QString &filename, ScanResult *result)
+{
+    QByteArray mimetype = MediaLibrary::instance()->mimeType(filename);
+    if (mimetype.isEmpty())
+        return false;
+
+    Tag tag(filename);
+    if (!tag.isValid())
+        return false;
+
+    int duration = 0;
+    AudioFileInformation* info = Codecs::instance()->createAudioFileInformation(mimetype);
+    if (info) {
+        info->setFilename(filename);
+        duration = info->length();
+        delete info;
+    }
+
+    result->filename = filename;
+    result->artist = tag.data(QLatin1String("artist")).toString();
+    result->album = tag.data(QLatin1String("album")).toString();
+    result->title = tag.data(QLatin1String("title")).toString();
+    result->trackno = tag.data(QLatin1String("track")).toInt();
+    result->duration = duration;
+    return true;
+}
+
+void MediaScanner::workerFinished()
+{
+    if (--m_running > 0)
+        return;
+
+    qDebug() << "scanned" << m_files << "files (" << m_skipped << "unchanged ) in" << m_timer.elapsed() << "ms," << filesPerSecond() << "files/sec";
+
+    emit progress(m_files, filesPerSecond());
+    emit finished();
+}
@@ -0,0 +1,145 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEDIASCANNER_H
+#define MEDIASCANNER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QVector>
+#include <QHash>
+#include <QByteArray>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QMetaType>
+
+class ScanWorker;
+
+struct FileStamp
+{
+    FileStamp() : size(0), mtime(0), inode(0) {}
+
+    bool operator==(const FileStamp& other) const
+    { return size == other.size && mtime == other.mtime && inode == other.inode; }
+    bool operator!=(const FileStamp& other) const { return !operator==(other); }
+
+    qint64 size;
+    uint mtime;
+    quint64 inode;
+};
+
+typedef QHash<QString, FileStamp> FileStamps;
+
+struct ScanResult
+{
+    // Whether the path was among the known files, a new path may be a rename
+    bool known;
+    FileStamp stamp;
+    QByteArray hash;
+
+    QString filename;
+    QString artist;
+    QString album;
+    QString title;
+    int trackno;
+    int duration;
+};
+
+typedef QList<ScanResult> ScanResults;
+
+// Walks directory trees and reads tags and durations on a pool of worker
+// threads. Each worker works depth first on its own queue and steals the
+// oldest items (usually whole directories) from the others when it runs
+// dry. Results are handed out in batches through tracks().
+class MediaScanner : public QObject
+{
+    Q_OBJECT
+public:
+    MediaScanner(QObject* parent = 0);
+    ~MediaScanner();
+
+    // 0 picks one worker per core
+    void setWorkerCount(int count);
+
+    // Files whose stamp still matches are skipped without opening them
+    void setKnownFiles(const FileStamps& files);
+
+    void start(const QStringList& paths);
+    void cancel();
+
+    bool isRunning() const;
+
+    int filesScanned() const;
+    int filesSkipped() const;
+    int filesPerSecond() const;
+
+    static bool stat(const QString& filename, FileStamp* stamp);
+    static QByteArray contentHash(const QString& filename, qint64 size);
+
+signals:
+    // Emitted from the worker threads
+    void tracks(const ScanResults& results);
+    // Every media file found, changed or not
+    void seen(const QStringList& files);
+    void progress(int files, int filesPerSecond);
+
+    void finished();
+
+private slots:
+    void workerFinished();
+
+private:
+    enum FileState { Ignored, Unchanged, Changed };
+
+    bool steal(int thief, QString* path, bool* dir);
+    void submit(ScanResults& results, QStringList& seen);
+    // Idle workers sleep until there is something to steal or the scan is over
+    void postWork(bool all = false);
+    void waitForWork(int posted);
+    FileState scanFile(const QString& filename, ScanResult* result);
+    static bool readFile(const QString& filename, ScanResult* result);
+
+private:
+    QVector<ScanWorker*> m_workers;
+    FileStamps m_known;
+    int m_workerCount;
+    int m_running;
+
+    // Items queued or being processed, the scan is done when this drops to 0
+    QAtomicInt m_pending;
+    QAtomicInt m_files;
+    QAtomicInt m_skipped;
+    QAtomicInt m_cancel;
+    QElapsedTimer m_timer;
+
+    // Bumped under m_idleMutex for every wakeup, a worker that saw it
+    // change since it last looked for work does not go to sleep
+    QAtomicInt m_posted;
+    QMutex m_idleMutex;
+    QWaitCondition m_work;
+
+    friend class ScanWorker;
+};
+
+Q_DECLARE_METATYPE(ScanResults)
+
+#endif // MEDIASCANNER_H
@@ -0,0 +1,296 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mediawatcher.h"
+#include <QSocketNotifier>
+#include <QFileSystemWatcher>
+#include <QFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QDebug>
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#define WATCH_COALESCE 500 // ms events are collected before they are reported
+#define WATCH_WALK_BATCH 64 // directories added per event loop pass
+#define WATCH_EVENT_BUFFER 16384
+
+#ifdef Q_OS_LINUX
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+#endif
+
+MediaWatcher::MediaWatcher(QObject *parent)
+    : IOJob(parent), m_fd(-1), m_notifier(0), m_fallback(0), m_flush(this)
+{
+    m_flush.setSingleShot(true);
+    m_flush.setInterval(WATCH_COALESCE);
+    connect(&m_flush, SIGNAL(timeout()), this, SLOT(flush()));
+}
+
+MediaWatcher::~MediaWatcher()
+{
+    clearWatches();
+#ifdef Q_OS_LINUX
+    if (m_fd != -1)
+        ::close(m_fd);
+#endif
+}
+
+void MediaWatcher::watchPaths(const QStringList &paths)
+{
+    clearWatches();
+
+#ifdef Q_OS_LINUX
+    if (m_fd == -1) {
+        m_fd = inotify_init();
+        if (m_fd != -1) {
+            fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+            fcntl(m_fd, F_SETFD, FD_CLOEXEC);
+
+            m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+            connect(m_notifier, SIGNAL(activated(int)), this, SLOT(readEvents()));
+        } else {
+            qDebug() << "inotify unavailable, falling back to QFileSystemWatcher";
+        }
+    }
+#endif
+    if (m_fd == -1 && !m_fallback) {
+        m_fallback = new QFileSystemWatcher(this);
+        connect(m_fallback, SIGNAL(directoryChanged(QString)), this, SLOT(directoryChanged(QString)));
+    }
+
+    m_roots.clear();
+    foreach(const QString& path, paths) {
+        const QString root = QDir::cleanPath(path);
+        m_roots.append(root);
+        queueDirectory(root);
+    }
+}
+
+void MediaWatcher::clearWatches()
+{
+#ifdef Q_OS_LINUX
+    if (m_fd != -1) {
+        QHash<int, QString>::ConstIterator it = m_watches.begin();
+        QHash<int, QString>::ConstIterator itend = m_watches.end();
+        while (it != itend) {
+            inotify_rm_watch(m_fd, it.key());
+            ++it;
+        }
+    }
+#endif
+    m_watches.clear();
+    m_walk.clear();
+
+    if (m_fallback && !m_fallback->directories().isEmpty())
+        m_fallback->removePaths(m_fallback->directories());
+}
+
+void MediaWatcher::addWatch(const QString &path)
+{
+#ifdef Q_OS_LINUX
+    if (m_fd != -1) {
+        const int wd = inotify_add_watch(m_fd, QFile::encodeName(path).constData(), WATCH_MASK);
+        if (wd == -1)
+            qDebug() << "unable to watch" << path;
+        else
+            m_watches[wd] = path;
+        return;
+    }
+#endif
+    if (m_fallback)
+        m_fallback->addPath(path);
+}
+
+void MediaWatcher::removeWatches(const QString &path)
+{
+    const QString prefix = path + QLatin1Char('/');
+
+    for (int i = m_walk.size() - 1; i >= 0; --i) {
+        if (m_walk.at(i) == path || m_walk.at(i).startsWith(prefix))
+            m_walk.removeAt(i);
+    }
+
+#ifdef Q_OS_LINUX
+    if (m_fd != -1) {
+        QHash<int, QString>::Iterator it = m_watches.begin();
+        while (it != m_watches.end()) {
+            if (it.value() == path || it.value().startsWith(prefix)) {
+                inotify_rm_watch(m_fd, it.key());
+                it = m_watches.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return;
+    }
+#endif
+    if (m_fallback) {
+        foreach(const QString& dir, m_fallback->directories()) {
+            if (dir == path || dir.startsWith(prefix))
+                m_fallback->removePath(dir);
+        }
+    }
+}
+
+void MediaWatcher::queueDirectory(const QString &path)
+{
+    if (m_walk.isEmpty())
+        QTimer::singleShot(0, this, SLOT(walkDirectories()));
+    m_walk.append(path);
+}
+
+void MediaWatcher::walkDirectories()
+{
+    // Large trees are added a slice at a time so that the other jobs on
+    // the IO thread keep running meanwhile
+    for (int i = 0; i < WATCH_WALK_BATCH && !m_walk.isEmpty(); ++i) {
+        const QString path = m_walk.takeLast();
+        addWatch(path);
+
+        // Linked directories are left out like the scanner does, a link
+        // back up the tree would never end
+        const QStringList dirs = QDir(path).entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+        foreach(const QString& dir, dirs) {
+            m_walk.append(path + QLatin1String("/") + dir);
+        }
+    }
+
+    if (!m_walk.isEmpty())
+        QTimer::singleShot(0, this, SLOT(walkDirectories()));
+}
+
+void MediaWatcher::update(const QString &path)
+{
+    m_removed.remove(path);
+    m_updated.insert(path);
+    if (!m_flush.isActive())
+        m_flush.start();
+}
+
+void MediaWatcher::remove(const QString &path)
+{
+    m_updated.remove(path);
+    m_removed.insert(path);
+    if (!m_flush.isActive())
+        m_flush.start();
+}
+
+void MediaWatcher::readEvents()
+{
+#ifdef Q_OS_LINUX
+    char buffer[WATCH_EVENT_BUFFER];
+
+    forever {
+        const ssize_t len = ::read(m_fd, buffer, sizeof(buffer));
+        if (len <= 0)
+            break;
+
+        ssize_t pos = 0;
+        while (pos + static_cast<ssize_t>(sizeof(inotify_event)) <= len) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + pos);
+            pos += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were lost, the fingerprints make a rescan cheap
+                foreach(const QString& root, m_roots) {
+                    update(root);
+                }
+                continue;
+            }
+
+            if (event->mask & IN_IGNORED) {
+                m_watches.remove(event->wd);
+                continue;
+            }
+
+            QHash<int, QString>::ConstIterator watch = m_watches.find(event->wd);
+            if (watch == m_watches.end())
+                continue;
+
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                // The watches below a moved directory still carry its old
+                // path, the new one is walked again if it is in the tree.
+                // A walk that got there first has already pointed the
+                // watch at a path that exists.
+                const QString path = watch.value();
+                if (QFileInfo(path).exists())
+                    continue;
+                if (event->mask & IN_MOVE_SELF)
+                    removeWatches(path);
+                remove(path);
+                continue;
+            }
+
+            if (!event->len)
+                continue;
+
+            const QString path = watch.value() + QLatin1String("/") + QFile::decodeName(event->name);
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    queueDirectory(path);
+                    update(path);
+                } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    removeWatches(path);
+                    remove(path);
+                }
+            } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                update(path);
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                remove(path);
+            }
+        }
+    }
+#endif
+}
+
+void MediaWatcher::directoryChanged(const QString &path)
+{
+    // All we know is that something in here changed, rescan the directory
+    // and let the removal pass check which of its tracks are gone
+    m_removed.insert(path);
+    m_updated.insert(path);
+    if (!m_flush.isActive())
+        m_flush.start();
+
+    if (QFileInfo(path).isDir()) {
+        const QStringList dirs = QDir(path).entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+        const QStringList watched = m_fallback->directories();
+        foreach(const QString& dir, dirs) {
+            const QString sub = path + QLatin1String("/") + dir;
+            if (!watched.contains(sub))
+                queueDirectory(sub);
+        }
+    }
+}
+
+void MediaWatcher::flush()
+{
+    if (m_updated.isEmpty() && m_removed.isEmpty())
+        return;
+
+    const QStringList updated = m_updated.toList();
+    const QStringList removed = m_removed.toList();
+    m_updated.clear();
+    m_removed.clear();
+
+    emit changed(updated, removed);
+}
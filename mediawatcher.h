@@ -0,0 +1,77 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEDIAWATCHER_H
+#define MEDIAWATCHER_H
+
+#include "io.h"
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
+
+class QSocketNotifier;
+class QFileSystemWatcher;
+
+// Watches the media paths for changes and reports them in coalesced
+// batches. Uses inotify where available and QFileSystemWatcher elsewhere,
+// in which case only the changed directories are known.
+class MediaWatcher : public IOJob
+{
+    Q_OBJECT
+public:
+    Q_INVOKABLE MediaWatcher(QObject* parent = 0);
+    ~MediaWatcher();
+
+    Q_INVOKABLE void watchPaths(const QStringList& paths);
+
+signals:
+    // updated holds files and directories to rescan, removed holds paths
+    // whose tracks should go unless the file turns out to still exist
+    void changed(const QStringList& updated, const QStringList& removed);
+
+private slots:
+    void readEvents();
+    void directoryChanged(const QString& path);
+    void walkDirectories();
+    void flush();
+
+private:
+    void clearWatches();
+    void addWatch(const QString& path);
+    // Drops the watches on path and every directory below it
+    void removeWatches(const QString& path);
+    void queueDirectory(const QString& path);
+    void update(const QString& path);
+    void remove(const QString& path);
+
+private:
+    QStringList m_roots;
+    QStringList m_walk;
+
+    int m_fd;
+    QSocketNotifier* m_notifier;
+    QHash<int, QString> m_watches;
+    QFileSystemWatcher* m_fallback;
+
+    QSet<QString> m_updated;
+    QSet<QString> m_removed;
+    QTimer m_flush;
+};
+
+#endif // MEDIAWATCHER_H
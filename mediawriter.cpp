@@ -0,0 +1,313 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mediawriter.h"
+#include <QVariant>
+#include <QDebug>
+
+MediaWriter::MediaWriter(const QSqlDatabase &database)
+    : m_database(database), m_transaction(false),
+      m_selectArtist(m_database), m_insertArtist(m_database),
+      m_selectAlbum(m_database), m_insertAlbum(m_database),
+      m_selectTrack(m_database), m_insertTrack(m_database),
+      m_selectTrackFile(m_database), m_updateTrack(m_database),
+      m_setFile(m_database), m_selectFileHash(m_database),
+      m_deleteFile(m_database), m_renameFile(m_database), m_renameTrack(m_database)
+{
+    m_selectArtist.prepare("select artists.id from artists where artists.artist = ? collate nocase");
+    m_insertArtist.prepare("insert into artists (artist) values (?)");
+    m_selectAlbum.prepare("select albums.id from albums where albums.artistid = ? and albums.album = ?");
+    m_insertAlbum.prepare("insert into albums (album, artistid) values (?, ?)");
+    m_selectTrack.prepare("select tracks.id from tracks where tracks.albumid = ? and tracks.track = ? and tracks.artistid = ?");
+    m_insertTrack.prepare("insert into tracks (track, filename, trackno, artistid, albumid, duration) values (?, ?, ?, ?, ?, ?)");
+    m_selectTrackFile.prepare("select tracks.id, tracks.albumid from tracks where tracks.filename = ?");
+    m_updateTrack.prepare("update tracks set track = ?, trackno = ?, artistid = ?, albumid = ?, duration = ? where tracks.id = ?");
+    m_setFile.prepare("insert or replace into files (path, size, mtime, inode, hash) values (?, ?, ?, ?, ?)");
+    m_selectFileHash.prepare("select files.path from files where files.hash = ?");
+    m_deleteFile.prepare("delete from files where files.path = ?");
+    m_renameFile.prepare("update files set path = ? where files.path = ?");
+    m_renameTrack.prepare("update tracks set filename = ? where tracks.filename = ?");
+}
+
+void MediaWriter::configure(QSqlDatabase &database)
+{
+    // WAL lets readLibrary() read while a scan is writing, and with WAL a
+    // commit only has to reach the log so NORMAL is still crash safe
+    QSqlQuery q(database);
+    q.exec(QLatin1String("pragma journal_mode = wal"));
+    q.exec(QLatin1String("pragma synchronous = normal"));
+}
+
+void MediaWriter::createTables(QSqlDatabase &database)
+{
+    QSqlQuery q(database);
+    q.exec(QLatin1String("create table artists (id integer primary key autoincrement, artist text not null)"));
+    q.exec(QLatin1String("create table albums (id integer primary key autoincrement, album text not null, artistid integer, foreign key(artistid) references artist(id))"));
+    q.exec(QLatin1String("create table tracks (id integer primary key autoincrement, track text not null, filename text not null, trackno integer, duration integer, artistid integer, albumid integer, foreign key(artistid) references artist(id), foreign key(albumid) references album(id))"));
+}
+
+void MediaWriter::createFilesTable(QSqlDatabase &database)
+{
+    QSqlQuery q(database);
+    q.exec(QLatin1String("create table files (path text primary key, size integer, mtime integer, inode integer, hash blob)"));
+}
+
+void MediaWriter::createRevisionTable(QSqlDatabase &database)
+{
+    QSqlQuery q(database);
+    q.exec(QLatin1String("create table meta (key text primary key, value integer)"));
+    q.exec(QLatin1String("insert into meta (key, value) values ('revision', 0)"));
+
+    // Any change to the library bumps the revision, which is what a
+    // library snapshot is checked against
+    const char* tables[] = { "artists", "albums", "tracks" };
+    const char* events[] = { "insert", "update", "delete" };
+    for (int t = 0; t < 3; ++t) {
+        for (int e = 0; e < 3; ++e) {
+            q.exec(QString("create trigger %1_%2_revision after %2 on %1 begin update meta set value = value + 1 where key = 'revision'; end")
+                   .arg(QLatin1String(tables[t])).arg(QLatin1String(events[e])));
+        }
+    }
+}
+
+quint64 MediaWriter::revision(QSqlDatabase &database)
+{
+    QSqlQuery q(database);
+    if (q.exec(QLatin1String("select meta.value from meta where meta.key = 'revision'")) && q.next())
+        return q.value(0).toULongLong();
+    return 0;
+}
+
+void MediaWriter::createIndices(QSqlDatabase &database)
+{
+    QSqlQuery q(database);
+    q.exec(QLatin1String("create index if not exists artists_artist on artists (artist collate nocase)"));
+    q.exec(QLatin1String("create index if not exists albums_artistid_album on albums (artistid, album)"));
+    q.exec(QLatin1String("create index if not exists tracks_albumid_track on tracks (albumid, track)"));
+    q.exec(QLatin1String("create index if not exists tracks_filename on tracks (filename)"));
+    q.exec(QLatin1String("create index if not exists files_hash on files (hash)"));
+}
+
+LibrarySnapshot MediaWriter::buildSnapshot(QSqlDatabase &database, quint64 revision)
+{
+    LibrarySnapshot::Builder builder(revision);
+
+    QSqlQuery query(database);
+    query.setForwardOnly(true);
+    if (query.exec(QLatin1String("select (select count(*) from artists), (select count(*) from albums), (select count(*) from tracks)")) && query.next())
+        builder.reserve(query.value(0).toInt(), query.value(1).toInt(), query.value(2).toInt());
+
+    if (!query.exec(QLatin1String("select artists.id, artists.artist, albums.id, albums.album, tracks.id, tracks.track, tracks.filename, tracks.trackno, tracks.duration "
+                                  "from tracks join albums on albums.id = tracks.albumid join artists on artists.id = albums.artistid "
+                                  "order by artists.id, albums.id, tracks.trackno")))
+        return builder.finish();
+
+    // Rows come grouped by artist and album, so a change of id starts a new record
+    int artistid = -1, albumid = -1;
+    int artistrow = -1, albumrow = -1;
+    while (query.next()) {
+        if (query.value(0).toInt() != artistid) {
+            artistid = query.value(0).toInt();
+            artistrow = builder.addArtist(artistid, query.value(1).toString());
+            albumid = -1;
+        }
+        if (query.value(2).toInt() != albumid) {
+            albumid = query.value(2).toInt();
+            albumrow = builder.addAlbum(albumid, artistrow, query.value(3).toString());
+        }
+        builder.addTrack(query.value(4).toInt(), artistrow, albumrow,
+                         query.value(5).toString(), query.value(6).toString(),
+                         query.value(7).toInt(), query.value(8).toInt());
+    }
+
+    return builder.finish();
+}
+
+bool MediaWriter::begin()
+{
+    if (m_transaction)
+        return true;
+    m_transaction = m_database.transaction();
+    return m_transaction;
+}
+
+bool MediaWriter::commit()
+{
+    if (!m_transaction)
+        return false;
+    m_transaction = false;
+    if (m_database.commit())
+        return true;
+
+    qDebug() << "unable to commit media batch, rolling back";
+    m_database.rollback();
+    return false;
+}
+
+int MediaWriter::addArtist(const QString &name, bool* added)
+{
+    if (added)
+        *added = false;
+
+    m_selectArtist.bindValue(0, name);
+    if (m_selectArtist.exec() && m_selectArtist.next()) {
+        const int id = m_selectArtist.value(0).toInt();
+        m_selectArtist.finish();
+        return id;
+    }
+    m_selectArtist.finish();
+
+    m_insertArtist.bindValue(0, name);
+    if (!m_insertArtist.exec())
+        return -1;
+
+    if (added)
+        *added = true;
+    return m_insertArtist.lastInsertId().toInt();
+}
+
+int MediaWriter::addAlbum(int artistid, const QString &name, bool* added)
+{
+    if (added)
+        *added = false;
+    if (artistid <= 0)
+        return artistid;
+
+    m_selectAlbum.bindValue(0, artistid);
+    m_selectAlbum.bindValue(1, name);
+    if (m_selectAlbum.exec() && m_selectAlbum.next()) {
+        const int id = m_selectAlbum.value(0).toInt();
+        m_selectAlbum.finish();
+        return id;
+    }
+    m_selectAlbum.finish();
+
+    m_insertAlbum.bindValue(0, name);
+    m_insertAlbum.bindValue(1, artistid);
+    if (!m_insertAlbum.exec())
+        return -1;
+
+    if (added)
+        *added = true;
+    return m_insertAlbum.lastInsertId().toInt();
+}
+
+int MediaWriter::addTrack(int artistid, int albumid, const QString &name, const QString &filename, int trackno, int duration, bool* added)
+{
+    if (added)
+        *added = false;
+    if (artistid <= 0 || albumid <= 0)
+        return qMin(artistid, albumid);
+
+    m_selectTrack.bindValue(0, albumid);
+    m_selectTrack.bindValue(1, name);
+    m_selectTrack.bindValue(2, artistid);
+    if (m_selectTrack.exec() && m_selectTrack.next()) {
+        const int id = m_selectTrack.value(0).toInt();
+        m_selectTrack.finish();
+        return id;
+    }
+    m_selectTrack.finish();
+
+    m_insertTrack.bindValue(0, name);
+    m_insertTrack.bindValue(1, filename);
+    m_insertTrack.bindValue(2, trackno);
+    m_insertTrack.bindValue(3, artistid);
+    m_insertTrack.bindValue(4, albumid);
+    m_insertTrack.bindValue(5, duration);
+    if (!m_insertTrack.exec())
+        return -1;
+
+    if (added)
+        *added = true;
+    return m_insertTrack.lastInsertId().toInt();
+}
+
+int MediaWriter::trackForFile(const QString &filename, int* albumid)
+{
+    int trackid = -1;
+    m_selectTrackFile.bindValue(0, filename);
+    if (m_selectTrackFile.exec() && m_selectTrackFile.next()) {
+        trackid = m_selectTrackFile.value(0).toInt();
+        if (albumid)
+            *albumid = m_selectTrackFile.value(1).toInt();
+    }
+    m_selectTrackFile.finish();
+    return trackid;
+}
+
+bool MediaWriter::updateTrack(int trackid, int artistid, int albumid, const QString &name, int trackno, int duration)
+{
+    if (artistid <= 0 || albumid <= 0)
+        return false;
+
+    m_updateTrack.bindValue(0, name);
+    m_updateTrack.bindValue(1, trackno);
+    m_updateTrack.bindValue(2, artistid);
+    m_updateTrack.bindValue(3, albumid);
+    m_updateTrack.bindValue(4, duration);
+    m_updateTrack.bindValue(5, trackid);
+    return m_updateTrack.exec();
+}
+
+void MediaWriter::setFile(const QString &path, qint64 size, uint mtime, quint64 inode, const QByteArray &hash)
+{
+    m_setFile.bindValue(0, path);
+    m_setFile.bindValue(1, size);
+    m_setFile.bindValue(2, mtime);
+    m_setFile.bindValue(3, inode);
+    m_setFile.bindValue(4, hash);
+    m_setFile.exec();
+}
+
+QStringList MediaWriter::filesWithHash(const QByteArray &hash)
+{
+    QStringList paths;
+    if (hash.isEmpty())
+        return paths;
+
+    m_selectFileHash.bindValue(0, hash);
+    if (m_selectFileHash.exec()) {
+        while (m_selectFileHash.next())
+            paths.append(m_selectFileHash.value(0).toString());
+    }
+    m_selectFileHash.finish();
+    return paths;
+}
+
+bool MediaWriter::renameFile(const QString &from, const QString &to)
+{
+    // The new path may have been fingerprinted already, path is the key
+    m_deleteFile.bindValue(0, to);
+    if (!m_deleteFile.exec())
+        return false;
+
+    m_renameFile.bindValue(0, to);
+    m_renameFile.bindValue(1, from);
+    if (!m_renameFile.exec())
+        return false;
+
+    // A track that is already there keeps its id, the old one is left to
+    // the removal pass
+    if (trackForFile(to) > 0)
+        return true;
+
+    m_renameTrack.bindValue(0, to);
+    m_renameTrack.bindValue(1, from);
+    return m_renameTrack.exec();
+}
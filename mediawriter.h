@@ -0,0 +1,73 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEDIAWRITER_H
+#define MEDIAWRITER_H
+
+#include "librarysnapshot.h"
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+
+// Writes artists, albums and tracks to the library database. The statements
+// are prepared once and kept for the lifetime of the writer, callers group
+// their inserts between begin() and commit() so a batch costs one sync.
+class MediaWriter
+{
+public:
+    MediaWriter(const QSqlDatabase& database);
+
+    static void configure(QSqlDatabase& database);
+    static void createTables(QSqlDatabase& database);
+    static void createFilesTable(QSqlDatabase& database);
+    static void createRevisionTable(QSqlDatabase& database);
+    static quint64 revision(QSqlDatabase& database);
+    static void createIndices(QSqlDatabase& database);
+    // The library in one ordered join, see LibrarySnapshot
+    static LibrarySnapshot buildSnapshot(QSqlDatabase& database, quint64 revision);
+
+    bool begin();
+    bool commit();
+
+    int addArtist(const QString& name, bool* added = 0);
+    int addAlbum(int artistid, const QString& name, bool* added = 0);
+    int addTrack(int artistid, int albumid, const QString& name, const QString& filename, int trackno, int duration, bool* added = 0);
+
+    int trackForFile(const QString& filename, int* albumid = 0);
+    bool updateTrack(int trackid, int artistid, int albumid, const QString& name, int trackno, int duration);
+
+    // Fingerprints of scanned files, see MediaScanner
+    void setFile(const QString& path, qint64 size, uint mtime, quint64 inode, const QByteArray& hash);
+    QStringList filesWithHash(const QByteArray& hash);
+    bool renameFile(const QString& from, const QString& to);
+
+private:
+    QSqlDatabase m_database;
+    bool m_transaction;
+
+    QSqlQuery m_selectArtist, m_insertArtist;
+    QSqlQuery m_selectAlbum, m_insertAlbum;
+    QSqlQuery m_selectTrack, m_insertTrack;
+    QSqlQuery m_selectTrackFile, m_updateTrack;
+    QSqlQuery m_setFile, m_selectFileHash;
+    QSqlQuery m_deleteFile, m_renameFile, m_renameTrack;
+};
+
+#endif // MEDIAWRITER_H
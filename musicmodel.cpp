@@ -28,14 +28,13 @@ class MusicModelArtist : public QObject
     Q_PROPERTY(QString name READ artistName)
 
 public:
+    MusicModelArtist(QObject* parent = 0) : QObject(parent), id(-1) {}
+
     int identifier() const { return id; }
     QString artistName() const { return artist; }
 
     int id;
     QString artist;
-
-    QHash<int, MusicModelAlbum*> albums;
-    QHash<int, MusicModelTrack*> tracks;
 };
 
 class MusicModelAlbum : public QObject
@@ -46,55 +45,97 @@ class MusicModelAlbum : public QObject
     Q_PROPERTY(QString name READ albumName)
 
 public:
+    MusicModelAlbum(QObject* parent = 0) : QObject(parent), id(-1) {}
+
     int identifier() const { return id; }
     QString albumName() const { return album; }
 
     int id;
     QString album;
-
-    MusicModelArtist* artist;
-    QHash<int, MusicModelTrack*> tracks;
 };
 
-class MusicModelTrack
+#include "musicmodel.moc"
+
+struct MusicModel::ArtistLess
 {
-public:
-    int pos;
+    ArtistLess(const MusicModel* m) : model(m) {}
+    bool operator()(int a, int b) const { return model->artistLessThan(a, b); }
+    const MusicModel* model;
+};
 
-    int id;
-    QString track;
-    QString filename;
-    int trackno;
-    int duration;
+struct MusicModel::AlbumLess
+{
+    AlbumLess(const MusicModel* m) : model(m) {}
+    bool operator()(int a, int b) const { return model->albumLessThan(a, b); }
+    const MusicModel* model;
+};
 
-    MusicModelArtist* artist;
-    MusicModelAlbum* album;
+struct MusicModel::TrackLess
+{
+    TrackLess(const MusicModel* m) : model(m) {}
+    bool operator()(int a, int b) const { return model->trackLessThan(a, b); }
+    const MusicModel* model;
 };
 
-#include "musicmodel.moc"
+template<typename Less>
+static int lowerBound(const QVector<int>& slots, int slot, Less less)
+{
+    int lo = 0, hi = slots.size();
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (less(slots.at(mid), slot))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
 
-static bool trackLessThan(const MusicModelTrack* t1, const MusicModelTrack* t2)
+template<typename Less>
+static int findSlot(const QVector<int>& slots, int slot, Less less)
 {
-    int less = t1->artist->artist.compare(t2->artist->artist);
-    if (less)
-        return less < 0;
+    const int pos = lowerBound(slots, slot, less);
+    if (pos < slots.size() && slots.at(pos) == slot)
+        return pos;
+    return -1;
+}
 
-    less = t1->album->album.compare(t2->album->album);
-    if (less)
-        return less < 0;
+// The first four UTF-16 units packed big endian, which orders the same way
+// QString::compare() does for everything that differs in those units
+static quint64 collationKey(const QString& str)
+{
+    quint64 key = 0;
+    const int len = qMin(str.size(), 4);
+    for (int i = 0; i < 4; ++i)
+        key = (key << 16) | (i < len ? str.at(i).unicode() : 0);
+    return key;
+}
 
-    if (t1->trackno != t2->trackno)
-        return t1->trackno < t2->trackno;
-    return t1->track < t2->track;
+template<typename T>
+static int allocateSlot(QVector<T>& records, QVector<int>& free)
+{
+    if (!free.isEmpty()) {
+        const int slot = free.last();
+        free.remove(free.size() - 1);
+        return slot;
+    }
+    records.append(T());
+    return records.size() - 1;
 }
 
 MusicModel::MusicModel(QObject *parent)
-    : QAbstractTableModel(parent), m_artist(0), m_album(0), m_artistEmpty(false), m_albumEmpty(false)
+    : QAbstractTableModel(parent), m_artist(-1), m_album(-1), m_artistEmpty(false), m_albumEmpty(false),
+      m_currentArtist(new MusicModelArtist(this)), m_currentAlbum(new MusicModelAlbum(this))
 {
     connect(MediaLibrary::instance(), SIGNAL(artist(Artist)), this, SLOT(updateArtist(Artist)));
+    connect(MediaLibrary::instance(), SIGNAL(library(LibrarySnapshot)), this, SLOT(setLibrary(LibrarySnapshot)));
     connect(MediaLibrary::instance(), SIGNAL(trackRemoved(int)), this, SLOT(removeTrack(int)));
+    connect(MediaLibrary::instance(), SIGNAL(tracksRemoved(QList<int>)), this, SLOT(removeTracks(QList<int>)));
     connect(MediaLibrary::instance(), SIGNAL(cleared()), this, SLOT(clearData()));
-    MediaLibrary::instance()->readLibrary();
+    // Shares the read with the other models
+    LibrarySnapshot library;
+    if (MediaLibrary::instance()->requestLibrary(&library))
+        setLibrary(library);
 
     QHash<int, QByteArray> roles;
     roles[Qt::UserRole + 1] = "musicitem";
@@ -108,394 +149,554 @@ MusicModel::MusicModel(QObject *parent)
 
 MusicModel::~MusicModel()
 {
-    qDeleteAll(m_artists);
-    qDeleteAll(m_albums);
-    qDeleteAll(m_tracks);
 }
 
-void MusicModel::clearData()
+int MusicModel::intern(const QString &str)
 {
-    qDeleteAll(m_artists);
-    m_artists.clear();
-    qDeleteAll(m_albums);
-    m_albums.clear();
-    qDeleteAll(m_tracks);
-    m_tracks.clear();
+    QHash<QString, int>::ConstIterator it = m_stringIds.find(str);
+    if (it != m_stringIds.end())
+        return it.value();
+
+    m_strings.append(str);
+    m_keys.append(collationKey(str));
+    m_stringIds.insert(str, m_strings.size() - 1);
+    return m_strings.size() - 1;
+}
 
-    m_tracksFile.clear();
-    m_tracksPos.clear();
-    m_artist = 0;
-    m_album = 0;
-    m_artistEmpty = m_albumEmpty = false;
+int MusicModel::compareStrings(int a, int b) const
+{
+    if (a == b)
+        return 0;
 
-    reset();
+    const quint64 keya = m_keys.at(a), keyb = m_keys.at(b);
+    if (keya != keyb)
+        return keya < keyb ? -1 : 1;
+    return m_strings.at(a).compare(m_strings.at(b));
 }
 
-void MusicModel::updateArtist(const Artist &artist)
+bool MusicModel::artistLessThan(int a, int b) const
 {
-    bool insertArtist = (!m_artist && !m_album);
-    bool insertAlbum = (m_artist && !m_album);
-    bool insertTrack = (m_artist && m_album);
+    const ArtistRecord& ra = m_artists.at(a);
+    const ArtistRecord& rb = m_artists.at(b);
+    const int less = compareStrings(ra.name, rb.name);
+    if (less)
+        return less < 0;
+    return ra.id < rb.id;
+}
 
-    bool inserted = false;
-    bool shouldReset = false;
+bool MusicModel::albumLessThan(int a, int b) const
+{
+    const AlbumRecord& ra = m_albums.at(a);
+    const AlbumRecord& rb = m_albums.at(b);
+    const int less = compareStrings(ra.name, rb.name);
+    if (less)
+        return less < 0;
+    return ra.id < rb.id;
+}
 
-    MusicModelArtist* currentArtist;
-    if (!m_artists.contains(artist.id)) {
-        currentArtist = new MusicModelArtist;
-        m_artists[artist.id] = currentArtist;
+bool MusicModel::trackLessThan(int a, int b) const
+{
+    // Sort by artist, album, track number, track (in that order)
+    const TrackRecord& ta = m_tracks.at(a);
+    const TrackRecord& tb = m_tracks.at(b);
 
-        if (insertArtist) {
-            beginInsertRows(QModelIndex(), m_artists.size(), m_artists.size());
-            inserted = true;
-        }
-    } else {
-        currentArtist = m_artists[artist.id];
-        shouldReset = true;
-    }
+    int less = compareStrings(m_artists.at(ta.artist).name, m_artists.at(tb.artist).name);
+    if (less)
+        return less < 0;
 
-    currentArtist->id = artist.id;
-    currentArtist->artist = artist.name;
+    less = compareStrings(m_albums.at(ta.album).name, m_albums.at(tb.album).name);
+    if (less)
+        return less < 0;
 
-    if (inserted && insertArtist)
-        endInsertRows();
+    if (ta.trackno != tb.trackno)
+        return ta.trackno < tb.trackno;
 
-    MusicModelAlbum* currentAlbum;
-    MusicModelTrack* currentTrack;
+    less = compareStrings(ta.name, tb.name);
+    if (less)
+        return less < 0;
 
-    int albumsOldSize = currentArtist->albums.size();
-    int albumsInserted = 0;
-    foreach(const Album& album, artist.albums) {
-        if (!currentArtist->albums.contains(album.id)) {
-            currentAlbum = new MusicModelAlbum;
-            currentArtist->albums[album.id] = currentAlbum;
-            // Assume the album is not in m_albums either
-            m_albums[album.id] = currentAlbum;
-            ++albumsInserted;
-        } else {
-            currentAlbum = currentArtist->albums[album.id];
-            shouldReset = true;
-        }
+    return ta.id < tb.id;
+}
 
-        currentAlbum->id = album.id;
-        currentAlbum->album = album.name;
-        currentAlbum->artist = currentArtist;
+MusicModel::View MusicModel::view() const
+{
+    if (m_artist < 0 && !m_artistEmpty)
+        return ArtistView;
+    if (m_artist >= 0 && m_album < 0 && !m_albumEmpty)
+        return AlbumView;
+    return TrackView;
+}
 
-        foreach(const Track& track, album.tracks) {
-            if (!currentAlbum->tracks.contains(track.id)) {
-                currentTrack = new MusicModelTrack;
-                currentAlbum->tracks[track.id] = currentTrack;
-                currentArtist->tracks[track.id] = currentTrack;
-                m_tracks[track.id] = currentTrack;
-            } else
-                currentTrack = currentAlbum->tracks[track.id];
-
-            currentTrack->id = track.id;
-            currentTrack->track = track.name;
-            currentTrack->filename = track.filename;
-            currentTrack->trackno = track.trackno;
-            currentTrack->duration = track.duration;
-            currentTrack->artist = currentArtist;
-            currentTrack->album = currentAlbum;
-        }
+int MusicModel::allEntry() const
+{
+    return view() == TrackView ? 0 : 1;
+}
 
-        if (insertTrack && m_album->id == currentAlbum->id && !album.tracks.isEmpty()) {
-            buildTracks();
-            shouldReset = true;
-        }
+bool MusicModel::inView(View kind, int slot) const
+{
+    if (view() != kind)
+        return false;
+
+    switch (kind) {
+    case ArtistView:
+        return true;
+    case AlbumView:
+        return m_albums.at(slot).id >= 0 && m_albums.at(slot).artist == m_artist;
+    case TrackView:
+        if (m_tracks.at(slot).id < 0)
+            return false;
+        if (m_album >= 0)
+            return m_tracks.at(slot).album == m_album;
+        if (m_artist >= 0)
+            return m_tracks.at(slot).artist == m_artist;
+        return m_artistEmpty;
     }
+    return false;
+}
 
-    if (shouldReset)
-        reset();
-    else if (insertAlbum && m_artist->id == currentArtist->id && albumsInserted > 0) {
-        beginInsertRows(QModelIndex(), albumsOldSize, albumsOldSize + albumsInserted - 1);
-        endInsertRows();
+int MusicModel::rowOf(View kind, int slot) const
+{
+    switch (kind) {
+    case ArtistView:
+        return findSlot(m_rows, slot, ArtistLess(this));
+    case AlbumView:
+        return findSlot(m_rows, slot, AlbumLess(this));
+    case TrackView:
+        return findSlot(m_rows, slot, TrackLess(this));
     }
+    return -1;
+}
+
+void MusicModel::insertRow(View kind, int slot)
+{
+    if (!inView(kind, slot))
+        return;
 
-    if (!shouldReset && !insertTrack) {
-        emit layoutAboutToBeChanged();
-        emit layoutChanged();
+    int row = 0;
+    switch (kind) {
+    case ArtistView:
+        row = lowerBound(m_rows, slot, ArtistLess(this));
+        break;
+    case AlbumView:
+        row = lowerBound(m_rows, slot, AlbumLess(this));
+        break;
+    case TrackView:
+        row = lowerBound(m_rows, slot, TrackLess(this));
+        break;
     }
+
+    const int all = allEntry();
+    beginInsertRows(QModelIndex(), row + all, row + all);
+    m_rows.insert(row, slot);
+    endInsertRows();
 }
 
-void MusicModel::removeTrack(int trackid)
+void MusicModel::removeRow(View kind, int slot)
 {
-    bool removeArtist = (!m_artist && !m_album);
-    bool removeAlbum = (m_artist && !m_album);
-    bool removeTrack = (m_artist && m_album);
-
-    // Test and remove track
-    QHash<int, MusicModelTrack*>::iterator tit = m_tracks.find(trackid);
-    if (tit == m_tracks.end())
+    if (view() != kind)
         return;
 
-    MusicModelTrack* track = tit.value();
+    const int row = rowOf(kind, slot);
+    if (row < 0)
+        return;
 
-    if (removeTrack) {
-        int trackIdx = m_tracksPos.indexOf(track);
-        if (trackIdx >= 0) {
-            beginRemoveRows(QModelIndex(), trackIdx, trackIdx);
+    const int all = allEntry();
+    beginRemoveRows(QModelIndex(), row + all, row + all);
+    m_rows.remove(row);
+    endRemoveRows();
+}
 
-            m_tracksPos.removeAt(trackIdx);
-            QHash<QString, MusicModelTrack*>::iterator fit = m_tracksFile.find(track->filename);
-            if (fit != m_tracksFile.end())
-                m_tracksFile.erase(fit);
+void MusicModel::buildRows()
+{
+    m_rows.clear();
+
+    switch (view()) {
+    case ArtistView:
+        m_rows = m_artistOrder;
+        break;
+    case AlbumView:
+        for (int slot = 0; slot < m_albums.size(); ++slot) {
+            if (inView(AlbumView, slot))
+                m_rows.append(slot);
+        }
+        qSort(m_rows.begin(), m_rows.end(), AlbumLess(this));
+        break;
+    case TrackView:
+        if (m_artist < 0) {
+            m_rows = m_trackOrder;
+        } else {
+            foreach(int slot, m_trackOrder) {
+                if (inView(TrackView, slot))
+                    m_rows.append(slot);
+            }
         }
+        break;
     }
+}
 
-    m_tracks.erase(tit);
+void MusicModel::updateCurrent()
+{
+    if (m_artist >= 0) {
+        m_currentArtist->id = m_artists.at(m_artist).id;
+        m_currentArtist->artist = m_strings.at(m_artists.at(m_artist).name);
+    } else {
+        m_currentArtist->id = -1;
+        m_currentArtist->artist.clear();
+    }
 
-    // Remove track from album
-    MusicModelAlbum* album = track->album;
-    tit = album->tracks.find(trackid);
-    if (tit == album->tracks.end())
-        return;
+    if (m_album >= 0) {
+        m_currentAlbum->id = m_albums.at(m_album).id;
+        m_currentAlbum->album = m_strings.at(m_albums.at(m_album).name);
+    } else {
+        m_currentAlbum->id = -1;
+        m_currentAlbum->album.clear();
+    }
+}
 
-    album->tracks.erase(tit);
+void MusicModel::clearData()
+{
+    m_strings.clear();
+    m_keys.clear();
+    m_stringIds.clear();
 
-    // Remove track from artist
-    MusicModelArtist* artist = album->artist;
-    tit = artist->tracks.find(trackid);
-    if (tit == artist->tracks.end())
-        return;
+    m_artists.clear();
+    m_albums.clear();
+    m_tracks.clear();
+    m_freeArtists.clear();
+    m_freeAlbums.clear();
+    m_freeTracks.clear();
 
-    artist->tracks.erase(tit);
+    m_artistSlots.clear();
+    m_albumSlots.clear();
+    m_trackSlots.clear();
+    m_trackFiles.clear();
 
-    if (removeTrack)
-        endRemoveRows();
+    m_artistOrder.clear();
+    m_trackOrder.clear();
+    m_rows.clear();
 
-    // Check if this was the last track of the album
-    if (!album->tracks.isEmpty()) {
-        // This should never be the currently played track so I'm not considering that here.
-        delete track;
-        return;
+    m_artist = m_album = -1;
+    m_artistEmpty = m_albumEmpty = false;
+    updateCurrent();
+
+    reset();
+}
+
+void MusicModel::setLibrary(const LibrarySnapshot &library)
+{
+    clearData();
+
+    // The snapshot rows become the slots as they are
+    const int artists = library.artistCount();
+    const int albums = library.albumCount();
+    const int tracks = library.trackCount();
+
+    m_artists.resize(artists);
+    m_albums.resize(albums);
+    m_tracks.resize(tracks);
+    m_artistSlots.reserve(artists);
+    m_albumSlots.reserve(albums);
+    m_trackSlots.reserve(tracks);
+    m_trackFiles.reserve(tracks);
+    m_strings.reserve(artists + albums + tracks * 2);
+    m_keys.reserve(artists + albums + tracks * 2);
+
+    for (int i = 0; i < artists; ++i) {
+        const LibrarySnapshot::ArtistRecord& record = library.artist(i);
+        ArtistRecord& artist = m_artists[i];
+        artist.id = record.id;
+        artist.name = intern(library.string(record.name));
+        artist.albums = 0;
+        m_artistSlots.insert(artist.id, i);
     }
 
-    // Test and remove album
-    QHash<int, MusicModelAlbum*>::iterator alit = m_albums.find(album->id);
-    if (alit == m_albums.end())
-        return;
+    for (int i = 0; i < albums; ++i) {
+        const LibrarySnapshot::AlbumRecord& record = library.album(i);
+        AlbumRecord& album = m_albums[i];
+        album.id = record.id;
+        album.artist = record.artist;
+        album.name = intern(library.string(record.name));
+        album.tracks = 0;
+        ++m_artists[album.artist].albums;
+        m_albumSlots.insert(album.id, i);
+    }
 
-    if (removeAlbum) {
-        int albumIdx = m_albums.values().indexOf(album);
-        if (albumIdx >= 0)
-            beginRemoveRows(QModelIndex(), albumIdx, albumIdx);
+    for (int i = 0; i < tracks; ++i) {
+        const LibrarySnapshot::TrackRecord& record = library.track(i);
+        TrackRecord& track = m_tracks[i];
+        track.id = record.id;
+        track.artist = record.artist;
+        track.album = record.album;
+        track.trackno = record.trackno;
+        track.duration = record.duration;
+        track.name = intern(library.string(record.name));
+        track.filename = intern(library.string(record.filename));
+        ++m_albums[track.album].tracks;
+        m_trackSlots.insert(track.id, i);
+        m_trackFiles.insert(m_strings.at(track.filename), i);
     }
 
-    m_albums.erase(alit);
+    m_artistOrder.resize(artists);
+    for (int i = 0; i < artists; ++i)
+        m_artistOrder[i] = i;
+    qSort(m_artistOrder.begin(), m_artistOrder.end(), ArtistLess(this));
 
-    // Remove album from artist
-    alit = artist->albums.find(album->id);
-    if (alit == artist->albums.end())
-        return;
+    m_trackOrder.resize(tracks);
+    for (int i = 0; i < tracks; ++i)
+        m_trackOrder[i] = i;
+    qSort(m_trackOrder.begin(), m_trackOrder.end(), TrackLess(this));
 
-    artist->albums.erase(alit);
+    buildRows();
+    reset();
+}
 
-    if (removeAlbum)
-        endRemoveRows();
+int MusicModel::addArtist(int id, const QString &name)
+{
+    // Names never change for an id, the library dedupes on them
+    QHash<int, int>::ConstIterator it = m_artistSlots.find(id);
+    if (it != m_artistSlots.end())
+        return it.value();
+
+    const int slot = allocateSlot(m_artists, m_freeArtists);
+    ArtistRecord& artist = m_artists[slot];
+    artist.id = id;
+    artist.name = intern(name);
+    artist.albums = 0;
+    m_artistSlots.insert(id, slot);
+
+    m_artistOrder.insert(lowerBound(m_artistOrder, slot, ArtistLess(this)), slot);
+    insertRow(ArtistView, slot);
+    return slot;
+}
 
-    // Check if this was the last album of the artist
-    if (!artist->albums.isEmpty() && !artist->tracks.isEmpty()) {
-        delete track;
-        if (album == m_album)
-            setCurrentAlbumId(-1);
-        delete album;
-        return;
+int MusicModel::addAlbum(int id, int artist, const QString &name)
+{
+    QHash<int, int>::ConstIterator it = m_albumSlots.find(id);
+    if (it != m_albumSlots.end())
+        return it.value();
+
+    const int slot = allocateSlot(m_albums, m_freeAlbums);
+    AlbumRecord& album = m_albums[slot];
+    album.id = id;
+    album.artist = artist;
+    album.name = intern(name);
+    album.tracks = 0;
+    m_albumSlots.insert(id, slot);
+    ++m_artists[artist].albums;
+
+    insertRow(AlbumView, slot);
+    return slot;
+}
+
+int MusicModel::addTrack(const Track &track, int artist, int album)
+{
+    const int name = intern(track.name);
+    const int filename = intern(track.filename);
+
+    int slot;
+    QHash<int, int>::ConstIterator it = m_trackSlots.find(track.id);
+    if (it != m_trackSlots.end()) {
+        slot = it.value();
+        TrackRecord& record = m_tracks[slot];
+        if (record.artist == artist && record.album == album && record.name == name && record.trackno == track.trackno) {
+            // Same place in every order, update in place
+            if (record.filename != filename) {
+                m_trackFiles.remove(m_strings.at(record.filename));
+                m_trackFiles.insert(track.filename, slot);
+                record.filename = filename;
+            }
+            record.duration = track.duration;
+
+            if (view() == TrackView) {
+                const int row = rowOf(TrackView, slot);
+                if (row >= 0)
+                    emit dataChanged(index(row, 0), index(row, 2));
+            }
+            return slot;
+        }
+
+        // Hold on to the new album in case this was its only track
+        ++m_albums[album].tracks;
+        removeTrackSlot(slot);
+        --m_albums[album].tracks;
     }
 
-    // Test and remove artist
-    QHash<int, MusicModelArtist*>::iterator arit = m_artists.find(artist->id);
-    if (arit == m_artists.end())
-        return;
+    slot = allocateSlot(m_tracks, m_freeTracks);
+    TrackRecord& record = m_tracks[slot];
+    record.id = track.id;
+    record.artist = artist;
+    record.album = album;
+    record.trackno = track.trackno;
+    record.duration = track.duration;
+    record.name = name;
+    record.filename = filename;
+    m_trackSlots.insert(track.id, slot);
+    m_trackFiles.insert(track.filename, slot);
+    ++m_albums[album].tracks;
+
+    m_trackOrder.insert(lowerBound(m_trackOrder, slot, TrackLess(this)), slot);
+    insertRow(TrackView, slot);
+    return slot;
+}
 
-    if (removeArtist) {
-        int artistIdx = m_artists.values().indexOf(artist);
-        if (artistIdx >= 0)
-            beginRemoveRows(QModelIndex(), artistIdx, artistIdx);
+void MusicModel::updateArtist(const Artist &artist)
+{
+    const int artistSlot = addArtist(artist.id, artist.name);
+
+    foreach(const Album& album, artist.albums) {
+        const int albumSlot = addAlbum(album.id, artistSlot, album.name);
+
+        foreach(const Track& track, album.tracks) {
+            addTrack(track, artistSlot, albumSlot);
+        }
+    }
+}
+
+void MusicModel::removeTracks(const QList<int> &trackids)
+{
+    foreach(int trackid, trackids) {
+        removeTrack(trackid);
     }
+}
+
+void MusicModel::removeTrack(int trackid)
+{
+    QHash<int, int>::ConstIterator it = m_trackSlots.find(trackid);
+    if (it == m_trackSlots.end())
+        return;
+
+    removeTrackSlot(it.value());
+}
 
-    m_artists.erase(arit);
+void MusicModel::removeTrackSlot(int slot)
+{
+    removeRow(TrackView, slot);
 
-    if (removeArtist)
-        endRemoveRows();
+    const int pos = findSlot(m_trackOrder, slot, TrackLess(this));
+    if (pos >= 0)
+        m_trackOrder.remove(pos);
 
-    delete track;
-    if (artist == m_artist)
-        setCurrentArtistId(-1);
-    else if (album == m_album)
+    TrackRecord& track = m_tracks[slot];
+    QHash<QString, int>::Iterator file = m_trackFiles.find(m_strings.at(track.filename));
+    if (file != m_trackFiles.end() && file.value() == slot)
+        m_trackFiles.erase(file);
+    m_trackSlots.remove(track.id);
+
+    const int album = track.album;
+    track.id = -1;
+    m_freeTracks.append(slot);
+
+    if (--m_albums[album].tracks == 0)
+        removeAlbumSlot(album);
+}
+
+void MusicModel::removeAlbumSlot(int slot)
+{
+    removeRow(AlbumView, slot);
+
+    AlbumRecord& album = m_albums[slot];
+    m_albumSlots.remove(album.id);
+
+    const int artist = album.artist;
+    album.id = -1;
+    m_freeAlbums.append(slot);
+
+    if (slot == m_album)
         setCurrentAlbumId(-1);
-    delete album;
-    delete artist;
+
+    if (--m_artists[artist].albums == 0)
+        removeArtistSlot(artist);
+}
+
+void MusicModel::removeArtistSlot(int slot)
+{
+    removeRow(ArtistView, slot);
+
+    const int pos = findSlot(m_artistOrder, slot, ArtistLess(this));
+    if (pos >= 0)
+        m_artistOrder.remove(pos);
+
+    ArtistRecord& artist = m_artists[slot];
+    m_artistSlots.remove(artist.id);
+    artist.id = -1;
+    m_freeArtists.append(slot);
+
+    if (slot == m_artist)
+        setCurrentArtistId(-1);
 }
 
 MusicModelArtist* MusicModel::currentArtist() const
 {
-    return m_artist;
+    return m_artist >= 0 ? m_currentArtist : 0;
 }
 
 int MusicModel::currentArtistId() const
 {
-    if (m_artist)
-        return m_artist->id;
+    if (m_artist >= 0)
+        return m_artists.at(m_artist).id;
     return m_artistEmpty ? 0 : -1;
 }
 
 void MusicModel::setCurrentArtistId(int artist)
 {
-    MusicModelArtist* oldartist = m_artist;
-    MusicModelAlbum* oldalbum = m_album;
-    bool oldEmpty = m_artistEmpty;
-
-    m_tracksPos.clear();
-    m_tracksFile.clear();
+    const int oldartist = m_artist;
+    const int oldalbum = m_album;
+    const bool oldArtistEmpty = m_artistEmpty;
+    const bool oldAlbumEmpty = m_albumEmpty;
 
     if (artist > 0) {
         m_artistEmpty = false;
-        if (m_artists.contains(artist))
-            m_artist = m_artists[artist];
-        else
-            m_artist = 0;
+        m_artist = m_artistSlots.value(artist, -1);
     } else {
         m_artistEmpty = (artist == 0);
-        m_artist = 0;
+        m_artist = -1;
     }
     m_albumEmpty = false;
-    m_album = 0;
+    m_album = -1;
 
-    if (m_artistEmpty)
-        buildTracks();
+    if (m_artist == oldartist && m_album == oldalbum && m_artistEmpty == oldArtistEmpty && m_albumEmpty == oldAlbumEmpty)
+        return;
 
-    if (m_artist != oldartist || m_album != oldalbum || m_artistEmpty != oldEmpty)
-        reset();
+    buildRows();
+    updateCurrent();
+    reset();
 }
 
 MusicModelAlbum* MusicModel::currentAlbum() const
 {
-    return m_album;
+    return m_album >= 0 ? m_currentAlbum : 0;
 }
 
 int MusicModel::currentAlbumId() const
 {
-    if (m_album)
-        return m_album->id;
+    if (m_album >= 0)
+        return m_albums.at(m_album).id;
     return m_albumEmpty ? 0 : -1;
 }
 
 void MusicModel::setCurrentAlbumId(int album)
 {
-    if (m_artist == 0)
+    if (m_artist < 0)
         return;
 
-    MusicModelAlbum* oldalbum = m_album;
-    bool oldEmpty = m_albumEmpty;
-
-    m_tracksPos.clear();
-    m_tracksFile.clear();
+    const int oldalbum = m_album;
+    const bool oldEmpty = m_albumEmpty;
 
     if (album > 0) {
         m_albumEmpty = false;
-        if (m_artist->albums.contains(album)) {
-            m_album = m_artist->albums[album];
-
-            buildTracks();
-            reset();
-            oldalbum = m_album; // prevent the reset() further down in this function
-        } else
-            m_album = 0;
+        const int slot = m_albumSlots.value(album, -1);
+        m_album = (slot >= 0 && m_albums.at(slot).artist == m_artist) ? slot : -1;
     } else {
         m_albumEmpty = (album == 0);
-        m_album = 0;
+        m_album = -1;
     }
 
-    if (m_albumEmpty)
-        buildTracks();
-
-    if (m_album != oldalbum || m_albumEmpty != oldEmpty)
-        reset();
-}
-
-void MusicModel::buildTracks()
-{
-    if (!m_artist && !m_artistEmpty)
+    if (m_album == oldalbum && m_albumEmpty == oldEmpty)
         return;
-    if (!m_album && !m_albumEmpty && !m_artistEmpty)
-        return;
-
-    QHash<int, MusicModelTrack*>::ConstIterator it;
-    QHash<int, MusicModelTrack*>::ConstIterator itend;
-    if (m_album) {
-        it = m_album->tracks.begin();
-        itend = m_album->tracks.end();
-    } else if (m_artist) {
-        it = m_artist->tracks.begin();
-        itend = m_artist->tracks.end();
-    } else {
-        it = m_tracks.begin();
-        itend = m_tracks.end();
-    }
-
-    m_tracksPos.clear();
-    m_tracksFile.clear();
-
-    while (it != itend) {
-        m_tracksPos.append(*it);
-        m_tracksFile[(*it)->filename] = *it;
 
-        ++it;
-    }
-
-    // Sort by artist, album, track number, track (in that order)
-    qSort(m_tracksPos.begin(), m_tracksPos.end(), trackLessThan);
-
-    // Initialize the pos(ition) variable
-    int pos = 0;
-    foreach(MusicModelTrack* track, m_tracksPos) {
-        track->pos = pos++;
-    }
-}
-
-QVariant MusicModel::musicData(const QModelIndex &index, int role, bool hasAllEntry) const
-{
-    QVariant ret;
-
-    // ### This is not really optimal.
-    // ### Better to use keep both a hashmap and a list and keep them synchronized probably
-
-    int row = index.row() - (hasAllEntry ? 1 : 0);
-
-    if (role == Qt::DisplayRole) {
-        if (!m_artist && !m_artistEmpty) {
-            QList<MusicModelArtist*> artists = m_artists.values();
-
-            if (row < artists.size()) {
-                if (index.column() == 0)
-                    ret = artists.at(row)->artist;
-                else if (index.column() == 1)
-                    ret = artists.at(row)->id;
-            }
-
-            return ret;
-        } else if (m_artist && !m_album && !m_albumEmpty) {
-            QList<MusicModelAlbum*> albums = m_artist->albums.values();
-
-            if (row < albums.size()) {
-                if (index.column() == 0)
-                    ret = albums.at(row)->album;
-                else if (index.column() == 1)
-                    ret = albums.at(row)->id;
-            }
-            return ret;
-        } else {
-            if (row < m_tracksPos.size()) {
-                if (index.column() == 0)
-                    ret = m_tracksPos.at(row)->track;
-                else if (index.column() == 1)
-                    ret = m_tracksPos.at(row)->id;
-            }
-            return ret;
-         }
-    }
-    return ret;
+    buildRows();
+    updateCurrent();
+    reset();
 }
 
 int MusicModel::columnCount(const QModelIndex &parent) const
@@ -509,17 +710,14 @@ int MusicModel::rowCount(const QModelIndex &parent) const
 {
     if (parent != QModelIndex())
         return 0;
-    if (!m_artist && !m_artistEmpty)
-        return m_artists.size() + 1;
-    else if (m_artist && !m_album && !m_albumEmpty)
-        return m_artist->albums.size() + 1;
-    return m_tracksPos.size();
+    return m_rows.size() + allEntry();
 }
 
 QVariant MusicModel::data(const QModelIndex &index, int role) const
 {
-    bool hasAllEntry = ((!m_artist && !m_artistEmpty) || (m_artist && !m_album && !m_albumEmpty));
-    if (hasAllEntry && index.row() == 0) {
+    const View current = view();
+    const int all = (current == TrackView) ? 0 : 1;
+    if (all && index.row() == 0) {
         QVariant ret;
 
         if (role == Qt::DisplayRole || role == Qt::UserRole + 1) {
@@ -533,16 +731,41 @@ QVariant MusicModel::data(const QModelIndex &index, int role) const
         return ret;
     }
 
-    if (role < Qt::UserRole)
-        return musicData(index, role, hasAllEntry);
-
     if (role == Qt::UserRole + 3)
         return index.row();
 
-    int col = role - Qt::UserRole - 1;
-    QModelIndex idx = this->index(index.row(), col);
-
-    return musicData(idx, Qt::DisplayRole, hasAllEntry);
+    int column = index.column();
+    if (role == Qt::UserRole + 1 || role == Qt::UserRole + 2)
+        column = role - Qt::UserRole - 1;
+    else if (role != Qt::DisplayRole)
+        return QVariant();
+
+    const int row = index.row() - all;
+    if (row < 0 || row >= m_rows.size())
+        return QVariant();
+
+    const int slot = m_rows.at(row);
+    switch (current) {
+    case ArtistView:
+        if (column == 0)
+            return m_strings.at(m_artists.at(slot).name);
+        else if (column == 1)
+            return m_artists.at(slot).id;
+        break;
+    case AlbumView:
+        if (column == 0)
+            return m_strings.at(m_albums.at(slot).name);
+        else if (column == 1)
+            return m_albums.at(slot).id;
+        break;
+    case TrackView:
+        if (column == 0)
+            return m_strings.at(m_tracks.at(slot).name);
+        else if (column == 1)
+            return m_tracks.at(slot).id;
+        break;
+    }
+    return QVariant();
 }
 
 QVariant MusicModel::headerData(int section, Qt::Orientation orientation, int role) const
@@ -552,30 +775,31 @@ QVariant MusicModel::headerData(int section, Qt::Orientation orientation, int ro
 
 QString MusicModel::filenameById(int id) const
 {
-    if (!m_tracks.contains(id))
+    QHash<int, int>::ConstIterator it = m_trackSlots.find(id);
+    if (it == m_trackSlots.end())
         return QString();
 
-    return m_tracks.value(id)->filename;
+    return m_strings.at(m_tracks.at(it.value()).filename);
 }
 
 QString MusicModel::filenameByPosition(int position) const
 {
-    if (position < 0 || position >= m_tracksPos.size())
+    if (view() != TrackView || position < 0 || position >= m_rows.size())
         return QString();
 
-    return m_tracksPos.at(position)->filename;
+    return m_strings.at(m_tracks.at(m_rows.at(position)).filename);
 }
 
 int MusicModel::positionFromFilename(const QString &filename) const
 {
-    if (filename.isEmpty())
+    if (filename.isEmpty() || view() != TrackView)
         return -1;
 
-    QHash<QString, MusicModelTrack*>::ConstIterator it = m_tracksFile.find(filename);
-    if (it == m_tracksFile.end())
+    QHash<QString, int>::ConstIterator it = m_trackFiles.find(filename);
+    if (it == m_trackFiles.end())
         return -1;
 
-    return it.value()->pos;
+    return rowOf(TrackView, it.value());
 }
 
 int MusicModel::durationFromFilename(const QString &filename) const
@@ -583,11 +807,11 @@ int MusicModel::durationFromFilename(const QString &filename) const
     if (filename.isEmpty())
         return -1;
 
-    QHash<QString, MusicModelTrack*>::ConstIterator it = m_tracksFile.find(filename);
-    if (it == m_tracksFile.end())
+    QHash<QString, int>::ConstIterator it = m_trackFiles.find(filename);
+    if (it == m_trackFiles.end())
         return 0;
 
-    return it.value()->duration;
+    return m_tracks.at(it.value()).duration;
 }
 
 QString MusicModel::artistnameFromFilename(const QString &filename) const
@@ -595,11 +819,11 @@ QString MusicModel::artistnameFromFilename(const QString &filename) const
     if (filename.isEmpty())
         return QString();
 
-    QHash<QString, MusicModelTrack*>::ConstIterator it = m_tracksFile.find(filename);
-    if (it == m_tracksFile.end())
+    QHash<QString, int>::ConstIterator it = m_trackFiles.find(filename);
+    if (it == m_trackFiles.end())
         return QString();
 
-    return it.value()->artist->artist;
+    return m_strings.at(m_artists.at(m_tracks.at(it.value()).artist).name);
 }
 
 QString MusicModel::albumnameFromFilename(const QString &filename) const
@@ -607,11 +831,11 @@ QString MusicModel::albumnameFromFilename(const QString &filename) const
     if (filename.isEmpty())
         return QString();
 
-    QHash<QString, MusicModelTrack*>::ConstIterator it = m_tracksFile.find(filename);
-    if (it == m_tracksFile.end())
+    QHash<QString, int>::ConstIterator it = m_trackFiles.find(filename);
+    if (it == m_trackFiles.end())
         return QString();
 
-    return it.value()->album->album;
+    return m_strings.at(m_albums.at(m_tracks.at(it.value()).album).name);
 }
 
 QString MusicModel::tracknameFromFilename(const QString &filename) const
@@ -619,14 +843,14 @@ QString MusicModel::tracknameFromFilename(const QString &filename) const
     if (filename.isEmpty())
         return QString();
 
-    QHash<QString, MusicModelTrack*>::ConstIterator it = m_tracksFile.find(filename);
-    if (it == m_tracksFile.end())
+    QHash<QString, int>::ConstIterator it = m_trackFiles.find(filename);
+    if (it == m_trackFiles.end())
         return QString();
 
-    return it.value()->track;
+    return m_strings.at(m_tracks.at(it.value()).name);
 }
 
 int MusicModel::trackCount() const
 {
-    return m_tracksPos.size();
+    return view() == TrackView ? m_rows.size() : 0;
 }
@@ -22,10 +22,11 @@
 #include "medialibrary.h"
 #include <QAbstractTableModel>
 #include <QList>
+#include <QVector>
+#include <QHash>
 
 class MusicModelArtist;
 class MusicModelAlbum;
-class MusicModelTrack;
 
 class MusicModel : public QAbstractTableModel
 {
@@ -63,26 +64,102 @@ public:
 
 private slots:
     void updateArtist(const Artist& artist);
+    void setLibrary(const LibrarySnapshot& library);
     void removeTrack(int trackid);
+    void removeTracks(const QList<int>& trackids);
     void clearData();
 
 private:
-    QVariant musicData(const QModelIndex& index, int role, bool hasAllEntry) const;
-
-    void buildTracks();
+    // Records live in slot vectors and refer to each other by slot, names
+    // are indices into the interned string table
+    struct ArtistRecord
+    {
+        int id;
+        int name;
+        int albums;
+    };
+
+    struct AlbumRecord
+    {
+        int id;
+        int artist;
+        int name;
+        int tracks;
+    };
+
+    struct TrackRecord
+    {
+        int id;
+        int artist;
+        int album;
+        int trackno;
+        int duration;
+        int name;
+        int filename;
+    };
+
+    enum View { ArtistView, AlbumView, TrackView };
+
+    struct ArtistLess;
+    struct AlbumLess;
+    struct TrackLess;
+
+    View view() const;
+    int allEntry() const;
+
+    int intern(const QString& str);
+    int compareStrings(int a, int b) const;
+
+    int addArtist(int id, const QString& name);
+    int addAlbum(int id, int artist, const QString& name);
+    int addTrack(const Track& track, int artist, int album);
+
+    void removeTrackSlot(int slot);
+    void removeAlbumSlot(int slot);
+    void removeArtistSlot(int slot);
+
+    bool artistLessThan(int a, int b) const;
+    bool albumLessThan(int a, int b) const;
+    bool trackLessThan(int a, int b) const;
+
+    bool inView(View view, int slot) const;
+    void insertRow(View view, int slot);
+    void removeRow(View view, int slot);
+    int rowOf(View view, int slot) const;
+
+    void buildRows();
+    void updateCurrent();
 
 private:
-    MusicModelArtist* m_artist;
-    MusicModelAlbum* m_album;
+    QVector<QString> m_strings;
+    QVector<quint64> m_keys;
+    QHash<QString, int> m_stringIds;
+
+    QVector<ArtistRecord> m_artists;
+    QVector<AlbumRecord> m_albums;
+    QVector<TrackRecord> m_tracks;
+    QVector<int> m_freeArtists, m_freeAlbums, m_freeTracks;
+
+    // id to slot
+    QHash<int, int> m_artistSlots;
+    QHash<int, int> m_albumSlots;
+    QHash<int, int> m_trackSlots;
+    QHash<QString, int> m_trackFiles;
+
+    // Slots in display order
+    QVector<int> m_artistOrder;
+    QVector<int> m_trackOrder;
+
+    // Slots shown by the current view
+    QVector<int> m_rows;
+
+    int m_artist;
+    int m_album;
     bool m_artistEmpty;
     bool m_albumEmpty;
 
-    QHash<int, MusicModelArtist*> m_artists;
-    QHash<int, MusicModelAlbum*> m_albums;
-    QHash<int, MusicModelTrack*> m_tracks;
-
-    QHash<QString, MusicModelTrack*> m_tracksFile;
-    QList<MusicModelTrack*> m_tracksPos;
+    MusicModelArtist* m_currentArtist;
+    MusicModelAlbum* m_currentAlbum;
 };
 
 #endif // MUSICMODEL_H
@@ -50,6 +50,21 @@ Rectangle {
         return h + ":" + m + "." + s
     }
 
+    function updateDuration(filename) {
+        var duration = musicModel.durationFromFilename(filename)
+        if (duration === 0)
+            durationText.text = ""
+        else
+            durationText.text = msToString(duration)
+    }
+
+    function filenameAfter(filename) {
+        var cur = musicModel.positionFromFilename(filename)
+        if (cur !== -1 && cur + 1 < musicModel.trackCount())
+            return musicModel.filenameByPosition(cur + 1)
+        return ""
+    }
+
     function playFile(filename) {
         if (filename === "")
             return
@@ -57,12 +72,10 @@ Rectangle {
         audioPlayer.audioDevice = audioDevice
         audioPlayer.filename = filename
         audioPlayer.play()
+        // Prepared on the source play() just opened
+        audioPlayer.nextFilename = filenameAfter(filename)
 
-        var duration = musicModel.durationFromFilename(filename)
-        if (duration === 0)
-            durationText.text = ""
-        else
-            durationText.text = msToString(duration)
+        updateDuration(filename)
     }
 
     function pauseOrPlayFile(filename) {
@@ -75,9 +88,9 @@ Rectangle {
     }
 
     function playNext() {
-        var cur = musicModel.positionFromFilename(audioPlayer.filename)
-        if (cur !== -1 && cur + 1 < musicModel.trackCount()) {
-            playFile(musicModel.filenameByPosition(cur + 1))
+        var next = filenameAfter(audioPlayer.filename)
+        if (next !== "") {
+            playFile(next)
             return true
         }
         audioPlayer.filename = ""
@@ -149,6 +162,15 @@ Rectangle {
         onPositionChanged: {
             positionText.text = msToString(position)
         }
+
+        onTrackChanged: {
+            audioPlayer.nextFilename = filenameAfter(audioPlayer.filename)
+            updateDuration(audioPlayer.filename)
+
+            var cur = musicModel.positionFromFilename(audioPlayer.filename)
+            if (cur !== -1)
+                list.currentIndex = cur
+        }
     }
 
     MediaModel {
@@ -174,7 +196,9 @@ Rectangle {
         Button { id: stopButton; image: "icons/stop.svg"; anchors.top: playButton.bottom; onClicked: { audioPlayer.stop() } }
         Button { id: prevButton; image: "icons/skip-backward.svg"; anchors.top: stopButton.bottom; onClicked: { playPrevious() } }
         Button { id: nextButton; image: "icons/skip-forward.svg"; anchors.top: prevButton.bottom; onClicked: { playNext() } }
-        Button { id: mediaButton; text: "m"; anchors.top: nextButton.bottom; onClicked: { toggleMediaList() } }
+        Button { id: seekBackButton; image: "icons/seek-backward.svg"; anchors.top: nextButton.bottom; onClicked: { audioPlayer.seek(audioPlayer.position - 10000) } }
+        Button { id: seekForwardButton; image: "icons/seek-forward.svg"; anchors.top: seekBackButton.bottom; onClicked: { audioPlayer.seek(audioPlayer.position + 10000) } }
+        Button { id: mediaButton; text: "m"; anchors.top: seekForwardButton.bottom; onClicked: { toggleMediaList() } }
         Button { id: plusButton; text: "+"; anchors.top: parent.top; opacity: 0; onClicked: { addMediaItem() } }
         Button { id: minusButton; text: "-"; anchors.top: plusButton.bottom; opacity: 0; onClicked: { removeMediaItem() } }
         Button { id: refreshButton; text: "r"; anchors.top: minusButton.bottom; opacity: 0; onClicked: { refreshMediaList() } }
@@ -201,6 +225,8 @@ Rectangle {
                     PropertyAnimation { target: stopButton; property: "opacity"; from: 1; to: 0; duration: 200 }
                     PropertyAnimation { target: prevButton; property: "opacity"; from: 1; to: 0; duration: 200 }
                     PropertyAnimation { target: nextButton; property: "opacity"; from: 1; to: 0; duration: 200 }
+                    PropertyAnimation { target: seekBackButton; property: "opacity"; from: 1; to: 0; duration: 200 }
+                    PropertyAnimation { target: seekForwardButton; property: "opacity"; from: 1; to: 0; duration: 200 }
                     PropertyAnimation { target: plusButton; property: "opacity"; from: 0; to: 1; duration: 200 }
                     PropertyAnimation { target: minusButton; property: "opacity"; from: 0; to: 1; duration: 200 }
                     PropertyAnimation { target: refreshButton; property: "opacity"; from: 0; to: 1; duration: 200 }
@@ -214,6 +240,8 @@ Rectangle {
                     PropertyAnimation { target: stopButton; property: "opacity"; from: 0; to: 1; duration: 200 }
                     PropertyAnimation { target: prevButton; property: "opacity"; from: 0; to: 1; duration: 200 }
                     PropertyAnimation { target: nextButton; property: "opacity"; from: 0; to: 1; duration: 200 }
+                    PropertyAnimation { target: seekBackButton; property: "opacity"; from: 0; to: 1; duration: 200 }
+                    PropertyAnimation { target: seekForwardButton; property: "opacity"; from: 0; to: 1; duration: 200 }
                     PropertyAnimation { target: plusButton; property: "opacity"; from: 1; to: 0; duration: 200 }
                     PropertyAnimation { target: minusButton; property: "opacity"; from: 1; to: 0; duration: 200 }
                     PropertyAnimation { target: refreshButton; property: "opacity"; from: 1; to: 0; duration: 200 }
@@ -0,0 +1,347 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "s3cache.h"
+#include "awsconfig.h"
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QDir>
+#include <QDebug>
+
+#define S3_CACHE_BUDGET (Q_INT64_C(2048) * 1024 * 1024)
+#define S3_CACHE_MAGIC 0x4843334f // "O3CH"
+#define S3_CACHE_VERSION 1
+
+S3Cache* S3Cache::s_inst = 0;
+
+// ETags come quoted from both the listing and the object headers
+static QByteArray normalizeEtag(const QByteArray& etag)
+{
+    QByteArray e = etag.trimmed();
+    if (e.size() >= 2 && e.startsWith('"') && e.endsWith('"'))
+        e = e.mid(1, e.size() - 2);
+    return e;
+}
+
+static qint64 now()
+{
+    return QDateTime::currentMSecsSinceEpoch();
+}
+
+S3Cache::S3Cache(const QString &directory)
+    : m_directory(directory), m_budget(S3_CACHE_BUDGET), m_total(0)
+{
+    QDir().mkpath(m_directory);
+    load();
+}
+
+void S3Cache::init(const QString &directory)
+{
+    if (!s_inst)
+        s_inst = new S3Cache(directory);
+}
+
+S3Cache* S3Cache::instance()
+{
+    return s_inst;
+}
+
+void S3Cache::setBudget(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_budget = bytes;
+    evict(QString());
+}
+
+qint64 S3Cache::budget() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_budget;
+}
+
+QString S3Cache::nameFor(const QString &key) const
+{
+    const QByteArray id = QByteArray(AwsConfig::bucket()) + '/' + key.toUtf8();
+    return QString::fromLatin1(QCryptographicHash::hash(id, QCryptographicHash::Sha1).toHex());
+}
+
+QString S3Cache::dataPath(const QString &name) const
+{
+    return m_directory + QLatin1Char('/') + name + QLatin1String(".data");
+}
+
+QString S3Cache::metaPath(const QString &name) const
+{
+    return m_directory + QLatin1Char('/') + name + QLatin1String(".meta");
+}
+
+void S3Cache::load()
+{
+    QDir dir(m_directory);
+    const QStringList metas = dir.entryList(QStringList() << QLatin1String("*.meta"), QDir::Files);
+    foreach(const QString& meta, metas) {
+        const QString name = meta.left(meta.size() - 5);
+
+        QFile file(metaPath(name));
+        if (!file.open(QFile::ReadOnly))
+            continue;
+
+        QDataStream stream(&file);
+        quint32 magic, version;
+        stream >> magic >> version;
+
+        Entry entry;
+        quint32 count;
+        stream >> entry.key >> entry.etag >> entry.size >> entry.used >> count;
+        entry.bytes = 0;
+        for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+            qint64 start, end;
+            stream >> start >> end;
+            entry.ranges.insert(start, end);
+            entry.bytes += end - start;
+        }
+
+        if (magic != S3_CACHE_MAGIC || version != S3_CACHE_VERSION
+            || stream.status() != QDataStream::Ok || !QFile::exists(dataPath(name))) {
+            file.close();
+            QFile::remove(metaPath(name));
+            QFile::remove(dataPath(name));
+            continue;
+        }
+
+        m_entries.insert(name, entry);
+        m_total += entry.bytes;
+    }
+
+    qDebug() << "s3 cache has" << m_entries.size() << "objects," << m_total << "bytes";
+}
+
+bool S3Cache::save(const QString &name, const Entry &entry)
+{
+    QFile file(metaPath(name));
+    if (!file.open(QFile::WriteOnly | QFile::Truncate))
+        return false;
+
+    QDataStream stream(&file);
+    stream << quint32(S3_CACHE_MAGIC) << quint32(S3_CACHE_VERSION);
+    stream << entry.key << entry.etag << entry.size << entry.used << quint32(entry.ranges.size());
+
+    QMap<qint64, qint64>::ConstIterator it = entry.ranges.begin();
+    QMap<qint64, qint64>::ConstIterator itend = entry.ranges.end();
+    while (it != itend) {
+        stream << it.key() << it.value();
+        ++it;
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+void S3Cache::remove(const QString &name)
+{
+    QHash<QString, Entry>::Iterator it = m_entries.find(name);
+    if (it == m_entries.end())
+        return;
+
+    m_total -= it.value().bytes;
+    m_entries.erase(it);
+
+    // A reader that has the data file mapped keeps its pages
+    QFile::remove(metaPath(name));
+    QFile::remove(dataPath(name));
+}
+
+void S3Cache::evict(const QString &keep)
+{
+    while (m_total > m_budget) {
+        QString oldest;
+        qint64 used = 0;
+
+        QHash<QString, Entry>::ConstIterator it = m_entries.begin();
+        QHash<QString, Entry>::ConstIterator itend = m_entries.end();
+        while (it != itend) {
+            if (it.key() != keep && (oldest.isEmpty() || it.value().used < used)) {
+                oldest = it.key();
+                used = it.value().used;
+            }
+            ++it;
+        }
+        if (oldest.isEmpty())
+            break;
+
+        remove(oldest);
+    }
+}
+
+void S3Cache::addRange(Entry &entry, qint64 start, qint64 end)
+{
+    // Merge with every range that overlaps or touches [start, end)
+    QMap<qint64, qint64>::Iterator it = entry.ranges.upperBound(start);
+    if (it != entry.ranges.begin()) {
+        --it;
+        if (it.value() < start)
+            ++it;
+    }
+
+    while (it != entry.ranges.end() && it.key() <= end) {
+        start = qMin(start, it.key());
+        end = qMax(end, it.value());
+        entry.bytes -= it.value() - it.key();
+        it = entry.ranges.erase(it);
+    }
+
+    entry.ranges.insert(start, end);
+    entry.bytes += end - start;
+}
+
+QString S3Cache::completeFile(const QString &key)
+{
+    QMutexLocker locker(&m_mutex);
+
+    const QString name = nameFor(key);
+    QHash<QString, Entry>::Iterator it = m_entries.find(name);
+    if (it == m_entries.end() || it.value().bytes != it.value().size)
+        return QString();
+
+    it.value().used = now();
+    save(name, it.value());
+    return dataPath(name);
+}
+
+bool S3Cache::lookup(const QString &key, qint64 *size, QByteArray *etag)
+{
+    QMutexLocker locker(&m_mutex);
+
+    QHash<QString, Entry>::Iterator it = m_entries.find(nameFor(key));
+    if (it == m_entries.end())
+        return false;
+
+    it.value().used = now();
+    if (size)
+        *size = it.value().size;
+    if (etag)
+        *etag = it.value().etag;
+    return true;
+}
+
+bool S3Cache::begin(const QString &key, const QByteArray &etag, qint64 size)
+{
+    QMutexLocker locker(&m_mutex);
+
+    const QString name = nameFor(key);
+    const QByteArray tag = normalizeEtag(etag);
+
+    bool kept = true;
+    QHash<QString, Entry>::Iterator it = m_entries.find(name);
+    if (it != m_entries.end()) {
+        if (it.value().etag == tag && it.value().size == size) {
+            it.value().used = now();
+            return true;
+        }
+        remove(name);
+        kept = false;
+    }
+
+    // The data file is sized up front and stays sparse until filled in
+    QFile data(dataPath(name));
+    if (!data.open(QFile::WriteOnly | QFile::Truncate) || !data.resize(size))
+        return kept;
+
+    Entry entry;
+    entry.key = key;
+    entry.etag = tag;
+    entry.size = size;
+    entry.used = now();
+    entry.bytes = 0;
+    m_entries.insert(name, entry);
+    save(name, entry);
+
+    return kept;
+}
+
+void S3Cache::write(const QString &key, qint64 offset, const QByteArray &data)
+{
+    if (data.isEmpty())
+        return;
+
+    QMutexLocker locker(&m_mutex);
+
+    const QString name = nameFor(key);
+    QHash<QString, Entry>::Iterator it = m_entries.find(name);
+    if (it == m_entries.end() || offset + data.size() > it.value().size)
+        return;
+
+    QFile file(dataPath(name));
+    if (!file.open(QFile::ReadWrite) || !file.seek(offset) || file.write(data) != data.size())
+        return;
+    file.close();
+
+    const qint64 before = it.value().bytes;
+    addRange(it.value(), offset, offset + data.size());
+    it.value().used = now();
+    m_total += it.value().bytes - before;
+    save(name, it.value());
+
+    evict(name);
+}
+
+qint64 S3Cache::cached(const QString &key, qint64 offset, qint64 *next)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (next)
+        *next = -1;
+
+    QHash<QString, Entry>::ConstIterator it = m_entries.find(nameFor(key));
+    if (it == m_entries.end())
+        return 0;
+
+    const QMap<qint64, qint64>& ranges = it.value().ranges;
+    QMap<qint64, qint64>::ConstIterator range = ranges.upperBound(offset);
+    if (next && range != ranges.end())
+        *next = range.key();
+    if (range == ranges.begin())
+        return 0;
+
+    --range;
+    return qMax<qint64>(0, range.value() - offset);
+}
+
+QByteArray S3Cache::read(const QString &key, qint64 offset, qint64 length)
+{
+    QMutexLocker locker(&m_mutex);
+
+    QFile file(dataPath(nameFor(key)));
+    if (!file.open(QFile::ReadOnly) || !file.seek(offset))
+        return QByteArray();
+    return file.read(length);
+}
+
+void S3Cache::invalidate(const QString &key, const QByteArray &etag)
+{
+    QMutexLocker locker(&m_mutex);
+
+    const QString name = nameFor(key);
+    QHash<QString, Entry>::ConstIterator it = m_entries.find(name);
+    if (it == m_entries.end())
+        return;
+    if (!etag.isEmpty() && it.value().etag == normalizeEtag(etag))
+        return;
+
+    remove(name);
+}
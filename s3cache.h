@@ -0,0 +1,91 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef S3CACHE_H
+#define S3CACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+
+// Disk cache of S3 objects under a size budget. Each object is a sparse
+// data file named after a hash of bucket and key, with the ETag it was
+// fetched at and the byte ranges that are present kept next to it. Least
+// recently used objects are evicted first. All functions are thread safe.
+class S3Cache
+{
+public:
+    static void init(const QString& directory);
+    static S3Cache* instance();
+
+    void setBudget(qint64 bytes);
+    qint64 budget() const;
+
+    // The data file of an object that is cached in full, empty otherwise
+    QString completeFile(const QString& key);
+    bool lookup(const QString& key, qint64* size, QByteArray* etag);
+
+    // Starts caching an object, returns false if bytes cached for another
+    // ETag had to be dropped
+    bool begin(const QString& key, const QByteArray& etag, qint64 size);
+    void write(const QString& key, qint64 offset, const QByteArray& data);
+
+    // Cached bytes from offset on, next is set to the start of the
+    // following cached range or -1
+    qint64 cached(const QString& key, qint64 offset, qint64* next = 0);
+    QByteArray read(const QString& key, qint64 offset, qint64 length);
+
+    // Drops the object unless it was cached at etag
+    void invalidate(const QString& key, const QByteArray& etag = QByteArray());
+
+private:
+    struct Entry
+    {
+        QString key;
+        QByteArray etag;
+        qint64 size;
+        qint64 used; // ms since epoch
+        qint64 bytes;
+        QMap<qint64, qint64> ranges; // start to end, exclusive
+    };
+
+    S3Cache(const QString& directory);
+
+    QString nameFor(const QString& key) const;
+    QString dataPath(const QString& name) const;
+    QString metaPath(const QString& name) const;
+
+    void load();
+    bool save(const QString& name, const Entry& entry);
+    void remove(const QString& name);
+    void evict(const QString& keep);
+    static void addRange(Entry& entry, qint64 start, qint64 end);
+
+private:
+    static S3Cache* s_inst;
+
+    QString m_directory;
+    qint64 m_budget;
+    qint64 m_total;
+    QHash<QString, Entry> m_entries; // by name
+    mutable QMutex m_mutex;
+};
+
+#endif // S3CACHE_H
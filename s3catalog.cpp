@@ -0,0 +1,426 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "s3catalog.h"
+#include "mediawriter.h"
+#include "awsconfig.h"
+#include "s3cache.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QUrl>
+#include <QElapsedTimer>
+#include <QDebug>
+
+#define S3_CATALOG_CONNECTION "s3catalog"
+
+S3Catalog::S3Catalog(QObject *parent)
+    : IOJob(parent), m_writer(0), m_lister(0)
+{
+}
+
+S3Catalog::~S3Catalog()
+{
+    if (m_lister) {
+        // Still listing on its own thread, it cleans up after itself
+        m_lister->disconnect(this);
+        connect(m_lister, SIGNAL(finished()), m_lister, SLOT(deleteLater()));
+        m_lister->stop();
+    }
+    delete m_writer;
+}
+
+void S3Catalog::load()
+{
+    QMetaObject::invokeMethod(this, "loadCatalog");
+}
+
+void S3Catalog::open()
+{
+    // One catalog per bucket, next to the file library's database
+    m_database = QSqlDatabase::addDatabase("QSQLITE", QLatin1String(S3_CATALOG_CONNECTION));
+    m_database.setDatabaseName(QLatin1String("s3-") + QString::fromUtf8(AwsConfig::bucket()) + QLatin1String(".db"));
+    m_database.open();
+
+    QStringList tables = m_database.tables();
+    if (!tables.contains(QLatin1String("artists"))
+        || !tables.contains(QLatin1String("albums"))
+        || !tables.contains(QLatin1String("tracks")))
+        MediaWriter::createTables(m_database);
+    if (!tables.contains(QLatin1String("files")))
+        MediaWriter::createFilesTable(m_database);
+    if (!tables.contains(QLatin1String("meta"))) {
+        MediaWriter::createRevisionTable(m_database);
+        QFile::remove(snapshotPath());
+    }
+
+    MediaWriter::configure(m_database);
+    MediaWriter::createIndices(m_database);
+
+    m_writer = new MediaWriter(m_database);
+
+    m_selectPrefix = QSqlQuery(m_database);
+    m_selectPrefix.prepare("select files.path, files.size, files.mtime, files.hash from files where files.path >= ? and files.path < ?");
+    m_deleteFile = QSqlQuery(m_database);
+    m_deleteFile.prepare("delete from files where files.path = ?");
+    m_deleteTrack = QSqlQuery(m_database);
+    m_deleteTrack.prepare("delete from tracks where tracks.id = ?");
+    m_selectAlbumArtist = QSqlQuery(m_database);
+    m_selectAlbumArtist.prepare("select albums.artistid from albums where albums.id = ?");
+    m_deleteAlbum = QSqlQuery(m_database);
+    m_deleteAlbum.prepare("delete from albums where albums.id = ? and not exists (select 1 from tracks where tracks.albumid = albums.id)");
+    m_deleteArtist = QSqlQuery(m_database);
+    m_deleteArtist.prepare("delete from artists where artists.id = ? and not exists (select 1 from albums where albums.artistid = artists.id)");
+}
+
+QString S3Catalog::snapshotPath() const
+{
+    QFileInfo info(m_database.databaseName());
+    return info.absoluteDir().filePath(info.completeBaseName() + QLatin1String(".library"));
+}
+
+void S3Catalog::loadCatalog()
+{
+    if (!m_writer)
+        open();
+
+    const quint64 revision = MediaWriter::revision(m_database);
+    const QString path = snapshotPath();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    LibrarySnapshot snapshot = LibrarySnapshot::load(path, revision);
+    if (snapshot.isNull()) {
+        snapshot = MediaWriter::buildSnapshot(m_database, revision);
+        snapshot.save(path);
+    }
+    qDebug() << "s3 catalog of" << snapshot.trackCount() << "tracks ready in" << timer.elapsed() << "ms";
+
+    emit library(snapshot);
+
+    // Cover images have no track, they are only known from the files table
+    QList<QByteArray> keys;
+    QSqlQuery query(m_database);
+    query.setForwardOnly(true);
+    if (query.exec(QLatin1String("select files.path from files"))) {
+        while (query.next())
+            keys.append(query.value(0).toString().toUtf8());
+    }
+    findAlbumArt(keys);
+
+    if (!m_lister)
+        sync();
+}
+
+// Lists every prefix again, the cache only saves the database writes and
+// the signals for objects whose size, date and ETag are unchanged
+void S3Catalog::sync()
+{
+    m_unseen.clear();
+
+    QSqlQuery query(m_database);
+    query.setForwardOnly(true);
+    if (query.exec(QLatin1String("select files.path from files"))) {
+        while (query.next()) {
+            const QByteArray key = query.value(0).toString().toUtf8();
+            const int slash = key.indexOf('/');
+            if (slash > 0)
+                m_unseen.insert(key.left(slash + 1));
+        }
+    }
+
+    // The listing waits on the network on a lane of its own, what it finds
+    // comes back here for the database
+    m_lister = new S3Lister;
+    connect(m_lister, SIGNAL(started()), this, SLOT(listerStarted()));
+    connect(m_lister, SIGNAL(finished()), this, SLOT(listerFinished()));
+    connect(m_lister, SIGNAL(prefixListed(QByteArray, S3Objects)), this, SLOT(prefixListed(QByteArray, S3Objects)));
+    connect(m_lister, SIGNAL(complete(bool)), this, SLOT(listComplete(bool)));
+    IO::instance()->startJob(m_lister);
+}
+
+void S3Catalog::listerStarted()
+{
+    if (sender() != m_lister)
+        return;
+
+    m_lister->start();
+}
+
+void S3Catalog::listerFinished()
+{
+    IOJob* job = qobject_cast<IOJob*>(sender());
+    if (job)
+        job->deleteLater();
+
+    // Dropped before it got to run
+    if (job && job == m_lister) {
+        m_lister = 0;
+        m_unseen.clear();
+        emit synced(false);
+    }
+}
+
+static bool parseTrack(Track* track, const QString& artist, const QString& album, const QString& trackname)
+{
+    int ext = trackname.lastIndexOf(QLatin1Char('.'));
+    if (ext == -1)
+        return false;
+
+    QStringList parts = trackname.left(ext).split(QLatin1Char('_'));
+    if (parts.size() != 3)
+        return false;
+
+    bool ok;
+    track->trackno = parts.at(0).toInt(&ok);
+    if (!ok)
+        return false;
+    track->duration = parts.at(2).toInt(&ok);
+    if (!ok)
+        return false;
+    QString name = parts.at(1);
+    name.replace(QLatin1Char('~'), QLatin1Char('/'));
+    track->name = name;
+    track->filename = artist + "/" + album + "/" + trackname;
+    return true;
+}
+
+static QStringList splitKey(const QByteArray& key)
+{
+    QStringList items;
+    foreach(const QByteArray& item, key.split('/')) {
+        items.append(QUrl::fromPercentEncoding(item));
+    }
+    return items;
+}
+
+// The key as S3Reader and the cache know it
+static QString decodedKey(const QByteArray& key)
+{
+    return splitKey(key).join(QLatin1String("/"));
+}
+
+void S3Catalog::prefixListed(const QByteArray &prefix, const S3Objects &objects)
+{
+    // Loose objects at the top level are not part of the library
+    if (prefix.isEmpty())
+        return;
+
+    m_unseen.remove(prefix);
+
+    // The cached objects under the prefix, '0' sorts right after '/'
+    QHash<QByteArray, CachedObject> cached;
+    m_selectPrefix.bindValue(0, QString::fromUtf8(prefix));
+    m_selectPrefix.bindValue(1, QString::fromUtf8(prefix.left(prefix.size() - 1) + '0'));
+    if (m_selectPrefix.exec()) {
+        while (m_selectPrefix.next()) {
+            CachedObject object;
+            object.size = m_selectPrefix.value(1).toLongLong();
+            object.lastModified = m_selectPrefix.value(2).toLongLong();
+            object.etag = m_selectPrefix.value(3).toByteArray();
+            cached.insert(m_selectPrefix.value(0).toString().toUtf8(), object);
+        }
+    }
+    m_selectPrefix.finish();
+
+    QHash<int, Artist> changed;
+    QList<int> removed;
+    QSet<int> albums;
+    QList<QByteArray> keys;
+
+    m_writer->begin();
+
+    foreach(const S3Object& object, objects) {
+        keys.append(object.key);
+
+        QHash<QByteArray, CachedObject>::Iterator it = cached.find(object.key);
+        if (it != cached.end()) {
+            const bool same = it.value().size == object.size
+                              && it.value().lastModified == object.lastModified
+                              && it.value().etag == object.etag;
+            cached.erase(it);
+            if (same)
+                continue;
+
+            S3Cache::instance()->invalidate(decodedKey(object.key), object.etag);
+        }
+
+        addObject(object, changed, removed, albums);
+    }
+
+    QHash<QByteArray, CachedObject>::ConstIterator gone = cached.begin();
+    while (gone != cached.end()) {
+        removeObject(gone.key(), removed, albums);
+        ++gone;
+    }
+    removeEmptyAlbums(albums);
+
+    m_writer->commit();
+
+    if (!removed.isEmpty())
+        emit tracksRemoved(removed);
+    foreach(const Artist& a, changed) {
+        emit artist(a);
+    }
+    findAlbumArt(keys);
+}
+
+void S3Catalog::addObject(const S3Object &object, QHash<int, Artist> &changed, QList<int> &removed, QSet<int> &albums)
+{
+    m_writer->setFile(QString::fromUtf8(object.key), object.size, static_cast<uint>(object.lastModified), 0, object.etag);
+
+    const QStringList items = splitKey(object.key);
+    if (items.size() != 3)
+        return;
+
+    const QString& artistname = items.at(0);
+    const QString& albumname = items.at(1);
+    if (!MediaLibrary::instance()->mimeType(items.at(2)).startsWith("audio/"))
+        return;
+
+    Track track;
+    if (!parseTrack(&track, artistname, albumname, items.at(2)))
+        return;
+
+    const int artistid = m_writer->addArtist(artistname);
+    const int albumid = m_writer->addAlbum(artistid, albumname);
+    if (artistid == -1 || albumid == -1)
+        return;
+
+    int oldalbumid;
+    track.id = m_writer->trackForFile(track.filename, &oldalbumid);
+    if (track.id == -1) {
+        track.id = m_writer->addTrack(artistid, albumid, track.name, track.filename, track.trackno, track.duration);
+        if (track.id == -1)
+            return;
+    } else {
+        m_writer->updateTrack(track.id, artistid, albumid, track.name, track.trackno, track.duration);
+        if (oldalbumid != albumid) {
+            removed.append(track.id);
+            albums.insert(oldalbumid);
+        }
+    }
+
+    Artist& a = changed[artistid];
+    a.id = artistid;
+    a.name = artistname;
+    Album& al = a.albums[albumid];
+    al.id = albumid;
+    al.name = albumname;
+    al.tracks[track.id] = track;
+}
+
+void S3Catalog::removeObject(const QByteArray &key, QList<int> &removed, QSet<int> &albums)
+{
+    m_deleteFile.bindValue(0, QString::fromUtf8(key));
+    m_deleteFile.exec();
+
+    S3Cache::instance()->invalidate(decodedKey(key));
+
+    const QStringList items = splitKey(key);
+    if (items.size() != 3)
+        return;
+
+    int albumid;
+    const int trackid = m_writer->trackForFile(items.join(QLatin1String("/")), &albumid);
+    if (trackid == -1)
+        return;
+
+    m_deleteTrack.bindValue(0, trackid);
+    m_deleteTrack.exec();
+
+    removed.append(trackid);
+    albums.insert(albumid);
+}
+
+void S3Catalog::removeEmptyAlbums(const QSet<int> &albums)
+{
+    QSet<int> artists;
+    foreach(int albumid, albums) {
+        m_selectAlbumArtist.bindValue(0, albumid);
+        if (m_selectAlbumArtist.exec() && m_selectAlbumArtist.next())
+            artists.insert(m_selectAlbumArtist.value(0).toInt());
+        m_selectAlbumArtist.finish();
+
+        m_deleteAlbum.bindValue(0, albumid);
+        m_deleteAlbum.exec();
+    }
+    foreach(int artistid, artists) {
+        m_deleteArtist.bindValue(0, artistid);
+        m_deleteArtist.exec();
+    }
+}
+
+void S3Catalog::findAlbumArt(const QList<QByteArray> &keys)
+{
+    // An image named folder.* wins, any other image otherwise
+    QHash<QString, QString> art;
+    foreach(const QByteArray& key, keys) {
+        const QStringList items = splitKey(key);
+        if (items.size() != 3)
+            continue;
+        if (!MediaLibrary::instance()->mimeType(items.at(2)).startsWith("image/"))
+            continue;
+
+        const QString album = (items.at(0) + QLatin1Char('/') + items.at(1)).toLower();
+        if (!art.contains(album) || items.at(2).toLower().startsWith(QLatin1String("folder")))
+            art[album] = items.join(QLatin1String("/"));
+    }
+
+    if (art.isEmpty())
+        return;
+    emit albumArt(art.keys(), art.values());
+}
+
+void S3Catalog::listComplete(bool ok)
+{
+    QList<int> removed;
+
+    // Whole prefixes that are gone from the bucket, only trusted after a full listing
+    if (ok && !m_unseen.isEmpty()) {
+        QSet<int> albums;
+        QList<QByteArray> keys;
+
+        m_writer->begin();
+        foreach(const QByteArray& prefix, m_unseen) {
+            m_selectPrefix.bindValue(0, QString::fromUtf8(prefix));
+            m_selectPrefix.bindValue(1, QString::fromUtf8(prefix.left(prefix.size() - 1) + '0'));
+            if (m_selectPrefix.exec()) {
+                while (m_selectPrefix.next())
+                    keys.append(m_selectPrefix.value(0).toString().toUtf8());
+            }
+            m_selectPrefix.finish();
+        }
+        foreach(const QByteArray& key, keys) {
+            removeObject(key, removed, albums);
+        }
+        removeEmptyAlbums(albums);
+        m_writer->commit();
+    }
+    m_unseen.clear();
+
+    if (!removed.isEmpty())
+        emit tracksRemoved(removed);
+
+    // Deleted once it has finished
+    m_lister->stop();
+    m_lister = 0;
+
+    emit synced(ok);
+}
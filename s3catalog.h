@@ -0,0 +1,93 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef S3CATALOG_H
+#define S3CATALOG_H
+
+#include "io.h"
+#include "medialibrary.h"
+#include "s3lister.h"
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QSet>
+
+class MediaWriter;
+
+// The bucket's catalog kept in the same SQLite schema as the file library,
+// with each object's key, size, LastModified and ETag in the files table.
+// load() serves the cached library right away and then lists the bucket
+// in the background, writing and emitting only the objects that changed.
+// The listing itself is always the whole bucket, S3 has no way to list
+// only what changed since a point in time.
+class S3Catalog : public IOJob
+{
+    Q_OBJECT
+public:
+    S3Catalog(QObject* parent = 0);
+    ~S3Catalog();
+
+    void load();
+
+signals:
+    void library(const LibrarySnapshot& library);
+    void artist(const Artist& artist);
+    void tracksRemoved(const QList<int>& trackids);
+    // Lower case "artist/album" and the key of its cover image
+    void albumArt(const QStringList& albums, const QStringList& keys);
+    void synced(bool ok);
+
+private slots:
+    void prefixListed(const QByteArray& prefix, const S3Objects& objects);
+    void listComplete(bool ok);
+    void listerStarted();
+    void listerFinished();
+
+private:
+    struct CachedObject
+    {
+        qint64 size;
+        qint64 lastModified;
+        QByteArray etag;
+    };
+
+    Q_INVOKABLE void loadCatalog();
+
+    void open();
+    void sync();
+    QString snapshotPath() const;
+
+    void addObject(const S3Object& object, QHash<int, Artist>& changed, QList<int>& removed, QSet<int>& albums);
+    void removeObject(const QByteArray& key, QList<int>& removed, QSet<int>& albums);
+    void removeEmptyAlbums(const QSet<int>& albums);
+    void findAlbumArt(const QList<QByteArray>& keys);
+
+private:
+    QSqlDatabase m_database;
+    MediaWriter* m_writer;
+    S3Lister* m_lister;
+
+    // Top level prefixes in the cache not seen by the running listing
+    QSet<QByteArray> m_unseen;
+
+    QSqlQuery m_selectPrefix;
+    QSqlQuery m_deleteFile, m_deleteTrack;
+    QSqlQuery m_selectAlbumArtist, m_deleteAlbum, m_deleteArtist;
+};
+
+#endif // S3CATALOG_H
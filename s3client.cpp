@@ -0,0 +1,107 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "s3client.h"
+#include "awsconfig.h"
+#include <libs3.h>
+#include <QNetworkAccessManager>
+#include <QThreadStorage>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QLocale>
+#include <QDebug>
+
+static QThreadStorage<QNetworkAccessManager*> s_managers;
+
+QNetworkAccessManager* S3Client::manager()
+{
+    // Deleted by QThreadStorage when the thread goes away
+    if (!s_managers.hasLocalData())
+        s_managers.setLocalData(new QNetworkAccessManager);
+    return s_managers.localData();
+}
+
+QUrl S3Client::signedUrl(const QString &key)
+{
+    S3BucketContext context;
+    context.accessKeyId = AwsConfig::accessKey();
+    context.secretAccessKey = AwsConfig::secretKey();
+    context.bucketName = AwsConfig::bucket();
+    context.protocol = S3ProtocolHTTPS;
+    context.uriStyle = S3UriStyleVirtualHost;
+
+    char query[S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE];
+
+    const QByteArray encoded = QUrl::toPercentEncoding(key, "/_");
+    S3Status status = S3_generate_authenticated_query_string(query, &context, encoded.constData(), -1, 0);
+    if (status != S3StatusOK) {
+        qDebug() << "error when generating query string for" << encoded << "," << status;
+        return QUrl();
+    }
+
+    QUrl url;
+    url.setEncodedUrl(query, QUrl::TolerantMode);
+    return url;
+}
+
+QByteArray S3Client::hmacSha1(const QByteArray &key, const QByteArray &message)
+{
+    const int blockSize = 64;
+
+    QByteArray k = key;
+    if (k.size() > blockSize)
+        k = QCryptographicHash::hash(k, QCryptographicHash::Sha1);
+    k = k.leftJustified(blockSize, '\0');
+
+    QByteArray inner(blockSize, 0x36), outer(blockSize, 0x5c);
+    for (int i = 0; i < blockSize; ++i) {
+        inner[i] = inner.at(i) ^ k.at(i);
+        outer[i] = outer.at(i) ^ k.at(i);
+    }
+
+    return QCryptographicHash::hash(outer + QCryptographicHash::hash(inner + message, QCryptographicHash::Sha1),
+                                    QCryptographicHash::Sha1);
+}
+
+QNetworkRequest S3Client::signedRequest(const QByteArray &verb, const QByteArray &key,
+                                        const QByteArray &subresource, const QByteArray &contentType)
+{
+    const QByteArray bucket(AwsConfig::bucket());
+    const QByteArray path = QUrl::toPercentEncoding(QString::fromLatin1(key), "/");
+    const QByteArray date = QLocale::c().toString(QDateTime::currentDateTime().toUTC(),
+                                                  QLatin1String("ddd, dd MMM yyyy hh:mm:ss")).toLatin1() + " GMT";
+
+    QByteArray resource = '/' + bucket + '/' + path;
+    if (!subresource.isEmpty())
+        resource += '?' + subresource;
+
+    // Signature version 2, the same scheme libs3 signs with
+    const QByteArray toSign = verb + '\n' + '\n' + contentType + '\n' + date + '\n' + resource;
+    const QByteArray signature = hmacSha1(QByteArray(AwsConfig::secretKey()), toSign).toBase64();
+
+    QUrl url;
+    url.setEncodedUrl("https://" + bucket + ".s3.amazonaws.com/" + path
+                      + (subresource.isEmpty() ? QByteArray() : '?' + subresource), QUrl::StrictMode);
+
+    QNetworkRequest request(url);
+    request.setRawHeader("Date", date);
+    request.setRawHeader("Authorization", "AWS " + QByteArray(AwsConfig::accessKey()) + ':' + signature);
+    if (!contentType.isEmpty())
+        request.setHeader(QNetworkRequest::ContentTypeHeader, contentType);
+    return request;
+}
@@ -0,0 +1,51 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef S3CLIENT_H
+#define S3CLIENT_H
+
+#include <QString>
+#include <QUrl>
+#include <QByteArray>
+#include <QNetworkRequest>
+
+class QNetworkAccessManager;
+
+// All S3 GETs go through one long lived QNetworkAccessManager per thread,
+// so connections are kept alive and reused from one object to the next
+// instead of paying for a new TLS handshake each time.
+class S3Client
+{
+public:
+    static QNetworkAccessManager* manager();
+
+    // A signed GET url for key, which is given unencoded
+    static QUrl signedUrl(const QString& key);
+
+    // A request with an Authorization header for the REST calls libs3 has
+    // no function for, such as multipart uploads. The key is given as
+    // stored, that is with the percent encoding the updater applies to its
+    // parts, subresource is for example "uploads" or "uploadId=...".
+    static QNetworkRequest signedRequest(const QByteArray& verb, const QByteArray& key,
+                                         const QByteArray& subresource = QByteArray(),
+                                         const QByteArray& contentType = QByteArray());
+
+    static QByteArray hmacSha1(const QByteArray& key, const QByteArray& message);
+};
+
+#endif // S3CLIENT_H
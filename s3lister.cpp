@@ -0,0 +1,246 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "s3lister.h"
+#include "awsconfig.h"
+#include <QDebug>
+
+#define S3_LIST_CONCURRENCY 8
+#define S3_LIST_MAXKEYS 1000
+#define S3_LIST_RETRIES 3
+#define S3_LIST_POLL_INTERVAL 10 // ms between runs of the request context at most
+
+struct S3Lister::Request
+{
+    S3Lister* lister;
+
+    QByteArray prefix;
+    QByteArray delimiter;
+    QByteArray marker;
+
+    bool truncated;
+    QByteArray nextmarker;
+    S3Status status;
+    int retries;
+
+    // Collected over every page, the counts are where the current page starts
+    S3Objects objects;
+    QList<QByteArray> prefixes;
+    int pageObjects;
+    int pagePrefixes;
+};
+
+static S3Status listPropertiesCallback(const S3ResponseProperties* properties, void* callbackData)
+{
+    Q_UNUSED(properties)
+    Q_UNUSED(callbackData)
+
+    return S3StatusOK;
+}
+
+S3Status listCallback(int isTruncated, const char* nextmarker, int contentsCount, const S3ListBucketContent* contents,
+                      int commonPrefixesCount, const char** commonPrefixes, void* callbackData)
+{
+    S3Lister::Request* request = reinterpret_cast<S3Lister::Request*>(callbackData);
+
+    for (int i = 0; i < contentsCount; ++i) {
+        S3Object object;
+        object.key = QByteArray(contents[i].key);
+        object.size = contents[i].size;
+        object.lastModified = contents[i].lastModified;
+        object.etag = QByteArray(contents[i].eTag);
+        request->objects.append(object);
+        request->nextmarker = object.key;
+    }
+    for (int i = 0; i < commonPrefixesCount; ++i) {
+        request->prefixes.append(QByteArray(commonPrefixes[i]));
+        request->nextmarker = request->prefixes.last();
+    }
+
+    // S3 only sends NextMarker when a delimiter is used, the last key
+    // seen is the marker otherwise
+    request->truncated = isTruncated;
+    if (isTruncated && nextmarker && *nextmarker)
+        request->nextmarker = QByteArray(nextmarker);
+
+    return S3StatusOK;
+}
+
+void listCompleteCallback(S3Status status, const S3ErrorDetails* errorDetails, void* callbackData)
+{
+    if (errorDetails && errorDetails->message)
+        qDebug() << "s3 list error" << errorDetails->message;
+
+    S3Lister::Request* request = reinterpret_cast<S3Lister::Request*>(callbackData);
+    request->status = status;
+
+    // Requests are not added to the context from within its own run
+    request->lister->m_done.append(request);
+}
+
+S3Lister::S3Lister(QObject *parent)
+    : IOJob(parent), m_requests(0), m_active(0), m_concurrency(S3_LIST_CONCURRENCY), m_failed(false), m_poll(this)
+{
+    m_context.accessKeyId = AwsConfig::accessKey();
+    m_context.secretAccessKey = AwsConfig::secretKey();
+    m_context.bucketName = AwsConfig::bucket();
+    m_context.protocol = S3ProtocolHTTPS;
+    m_context.uriStyle = S3UriStyleVirtualHost;
+
+    m_handler.responseHandler.propertiesCallback = listPropertiesCallback;
+    m_handler.responseHandler.completeCallback = listCompleteCallback;
+    m_handler.listBucketCallback = listCallback;
+
+    m_poll.setSingleShot(true);
+    connect(&m_poll, SIGNAL(timeout()), this, SLOT(poll()));
+}
+
+S3Lister::~S3Lister()
+{
+    // Aborts whatever is still running, the complete callbacks land in m_done
+    if (m_requests)
+        S3_destroy_request_context(m_requests);
+
+    qDeleteAll(m_queued);
+    qDeleteAll(m_done);
+}
+
+IOJob::Lane S3Lister::lane() const
+{
+    return Network;
+}
+
+void S3Lister::setConcurrency(int requests)
+{
+    m_concurrency = qMax(1, requests);
+}
+
+void S3Lister::start()
+{
+    QMetaObject::invokeMethod(this, "startJob");
+}
+
+void S3Lister::startJob()
+{
+    if (!m_requests) {
+        S3Status status = S3_create_request_context(&m_requests);
+        if (status != S3StatusOK) {
+            qDebug() << "unable to create s3 request context," << S3_get_status_name(status);
+            m_requests = 0;
+            emit complete(false);
+            return;
+        }
+    }
+
+    queue(QByteArray(), "/");
+}
+
+void S3Lister::queue(const QByteArray &prefix, const QByteArray &delimiter)
+{
+    Request* request = new Request;
+    request->lister = this;
+    request->prefix = prefix;
+    request->delimiter = delimiter;
+    request->truncated = false;
+    request->status = S3StatusOK;
+    request->retries = 0;
+
+    if (m_active < m_concurrency)
+        issue(request);
+    else
+        m_queued.append(request);
+}
+
+void S3Lister::issue(Request *request)
+{
+    ++m_active;
+
+    request->truncated = false;
+    request->status = S3StatusOK;
+    request->pageObjects = request->objects.size();
+    request->pagePrefixes = request->prefixes.size();
+
+    S3_list_bucket(&m_context,
+                   request->prefix.isEmpty() ? 0 : request->prefix.constData(),
+                   request->marker.isEmpty() ? 0 : request->marker.constData(),
+                   request->delimiter.isEmpty() ? 0 : request->delimiter.constData(),
+                   S3_LIST_MAXKEYS, m_requests, &m_handler, request);
+
+    if (!m_poll.isActive())
+        m_poll.start(0);
+}
+
+void S3Lister::requestDone(Request *request)
+{
+    --m_active;
+
+    if (request->status != S3StatusOK) {
+        if (S3_status_is_retryable(request->status) && request->retries < S3_LIST_RETRIES) {
+            ++request->retries;
+            qDebug() << "retrying s3 list of" << request->prefix << S3_get_status_name(request->status);
+            // What the failed attempt got of this page comes again
+            request->objects.erase(request->objects.begin() + request->pageObjects, request->objects.end());
+            request->prefixes.erase(request->prefixes.begin() + request->pagePrefixes, request->prefixes.end());
+            issue(request);
+            return;
+        }
+
+        qDebug() << "s3 list of" << request->prefix << "failed," << S3_get_status_name(request->status);
+        m_failed = true;
+        delete request;
+        return;
+    }
+
+    if (request->truncated) {
+        request->marker = request->nextmarker;
+        issue(request);
+        return;
+    }
+
+    foreach(const QByteArray& prefix, request->prefixes) {
+        queue(prefix, QByteArray());
+    }
+
+    if (!request->objects.isEmpty() || !request->prefix.isEmpty())
+        emit prefixListed(request->prefix, request->objects);
+
+    delete request;
+}
+
+void S3Lister::poll()
+{
+    int remaining = 0;
+    S3Status status = S3_runonce_request_context(m_requests, &remaining);
+    if (status != S3StatusOK)
+        qDebug() << "s3 request context failed," << S3_get_status_name(status);
+
+    while (!m_done.isEmpty())
+        requestDone(m_done.takeFirst());
+
+    while (!m_queued.isEmpty() && m_active < m_concurrency)
+        issue(m_queued.takeFirst());
+
+    if (m_active > 0) {
+        // curl reports -1 when it has no timeout of its own
+        const int timeout = static_cast<int>(S3_get_request_context_timeout(m_requests));
+        m_poll.start(timeout < 0 ? S3_LIST_POLL_INTERVAL : qBound(1, timeout, S3_LIST_POLL_INTERVAL));
+    } else if (m_queued.isEmpty()) {
+        m_poll.stop();
+        emit complete(!m_failed);
+    }
+}
@@ -0,0 +1,92 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef S3LISTER_H
+#define S3LISTER_H
+
+#include "io.h"
+#include <libs3.h>
+#include <QByteArray>
+#include <QList>
+#include <QTimer>
+#include <QMetaType>
+
+struct S3Object
+{
+    QByteArray key;
+    qint64 size;
+    qint64 lastModified;
+    QByteArray etag;
+};
+
+typedef QList<S3Object> S3Objects;
+
+Q_DECLARE_METATYPE(S3Objects)
+
+// Lists the bucket without blocking, driving libs3 requests through a
+// request context from the IO thread. The top level is listed with a '/'
+// delimiter and each prefix found is then listed on its own, several at
+// a time, so artists can be handed out as their prefix completes.
+class S3Lister : public IOJob
+{
+    Q_OBJECT
+public:
+    S3Lister(QObject* parent = 0);
+    ~S3Lister();
+
+    Lane lane() const;
+
+    void setConcurrency(int requests);
+
+    void start();
+
+signals:
+    // Every object under prefix, the top level objects come with an empty prefix
+    void prefixListed(const QByteArray& prefix, const S3Objects& objects);
+    void complete(bool ok);
+
+private slots:
+    void poll();
+
+private:
+    struct Request;
+
+    Q_INVOKABLE void startJob();
+
+    void queue(const QByteArray& prefix, const QByteArray& delimiter);
+    void issue(Request* request);
+    void requestDone(Request* request);
+
+    friend S3Status listCallback(int, const char*, int, const S3ListBucketContent*, int, const char**, void*);
+    friend void listCompleteCallback(S3Status, const S3ErrorDetails*, void*);
+
+private:
+    S3BucketContext m_context;
+    S3ListBucketHandler m_handler;
+    S3RequestContext* m_requests;
+
+    QList<Request*> m_queued;
+    QList<Request*> m_done;
+    int m_active;
+    int m_concurrency;
+    bool m_failed;
+
+    QTimer m_poll;
+};
+
+#endif // S3LISTER_H
@@ -19,18 +19,38 @@
 #include "s3reader.h"
 #include "io.h"
 #include "buffer.h"
-#include "awsconfig.h"
-#include <libs3.h>
+#include "s3cache.h"
+#include "s3client.h"
 #include <QUrl>
-#include <QNetworkAccessManager>
 #include <QNetworkRequest>
 #include <QNetworkReply>
 #include <QSslError>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QDebug>
 
 #define S3_MIN_BUFFER_SIZE (8192 * 10)
 #define S3_READ_SIZE (8192 * 50)
+#define S3_CHUNK_SIZE 16384
+#define S3_POOL_SIZE 64
+#define S3_REPLY_BUFFER_SIZE (256 * 1024) // unread bytes a reply holds before TCP pushes back
+
+#define S3_SEGMENT_SIZE (512 * 1024) // until the first segment has been measured
+#define S3_MIN_SEGMENT_SIZE (256 * 1024)
+#define S3_MAX_SEGMENT_SIZE (4 * 1024 * 1024)
+#define S3_LATENCY_FACTOR 8 // a segment takes this many round trips to transfer
+#define S3_PREFETCH_LIMIT (32 * 1024 * 1024) // requested ahead of the read position
+#define S3_START_CONNECTIONS 2
+#define S3_MAX_CONNECTIONS 6 // QNetworkAccessManager's limit per host
+#define S3_CONNECTION_GAIN 1.1
+#define S3_SEGMENT_RETRIES 3
+#define S3_MONITOR_INTERVAL 500
+#define S3_STALL_TIMEOUT 3000
+#define S3_SLOW_FACTOR 4
+#define S3_RATE_WEIGHT 0.25
+
+static BufferPool s_networkPool(S3_CHUNK_SIZE, S3_POOL_SIZE);
 
 class S3ReaderJob : public IOJob
 {
@@ -39,7 +59,11 @@ public:
     S3ReaderJob(QObject* parent = 0);
     ~S3ReaderJob();
 
+    Lane lane() const;
+
     void setFilename(const QString& m_filename);
+    // Byte offset to start at, requested with a Range header
+    void setPosition(qint64 position);
 
     void readMore();
     void start();
@@ -47,54 +71,120 @@ public:
     void pause();
     void resume();
 
+protected:
+    void stopping();
+
 signals:
     void data(QByteArray* data);
     void atEnd();
     void starving();
 
 private slots:
+    void replyMetaData();
     void replyFinished();
     void replyData();
     void replyError(QNetworkReply::NetworkError errorType);
     void replySslErrors(const QList<QSslError>& errors);
+    void monitor();
 
 private:
     enum State { Reading, Paused } m_state;
 
+    // One ranged GET, kept in offset order until it has been handed out
+    struct Segment
+    {
+        qint64 offset;
+        qint64 length;
+        QByteArray data;
+        int consumed;
+        bool complete;
+        bool cached; // read from the disk cache
+
+        QNetworkReply* reply;
+        int retries;
+        qint64 requested; // ms on m_clock
+        qint64 firstByte;
+        qint64 lastProgress;
+    };
+
     Q_INVOKABLE void startJob();
     Q_INVOKABLE void readMoreData();
     Q_INVOKABLE void setState(int state); // ### Should really use State here
 
 private:
-    void readData();
-    void startStreaming();
+    void schedule();
+    Segment* createSegment(qint64 length);
+    void request(Segment* segment);
+    void readReply(Segment* segment);
+    void cancel(Segment* segment);
+    void deliver();
+    void measure(Segment* segment);
+    qint64 segmentSize() const;
+    int activeSegments() const;
 
 private:
-    S3BucketContext* m_context;
-    QNetworkAccessManager* m_manager;
-    QNetworkReply* m_reply;
+    QUrl m_url;
     QString m_filename;
-    bool m_replyFinished;
     int m_toread;
-    qint64 m_position;
+    qint64 m_position; // next byte to hand out
+    qint64 m_next; // next byte not yet requested
+    qint64 m_size; // -1 until the first response
+    bool m_validated; // the cached bytes match the object's ETag
+
+    QList<Segment*> m_segments;
+    QHash<QNetworkReply*, Segment*> m_replies;
+
+    // Adaptive sizing, per connection rate in bytes/ms and time to first byte in ms
+    int m_connections;
+    double m_rate;
+    double m_latency;
+    qint64 m_received;
+    qint64 m_lastReceived;
+    double m_bestAggregate;
+
+    QElapsedTimer m_clock;
+    QTimer m_monitor;
+    bool m_failed;
+    bool m_atEnd;
 };
 
 #include "s3reader.moc"
 
 S3ReaderJob::S3ReaderJob(QObject *parent)
-    : IOJob(parent), m_state(Reading), m_manager(0), m_reply(0), m_replyFinished(false), m_toread(0), m_position(0)
+    : IOJob(parent), m_state(Reading), m_toread(0), m_position(0), m_next(0), m_size(-1), m_validated(false),
+      m_connections(S3_START_CONNECTIONS), m_rate(0), m_latency(0), m_received(0), m_lastReceived(0),
+      m_bestAggregate(0), m_monitor(this), m_failed(false), m_atEnd(false)
 {
-    m_context = (S3BucketContext*)malloc(sizeof(S3BucketContext));
-    m_context->accessKeyId = AwsConfig::accessKey();
-    m_context->secretAccessKey = AwsConfig::secretKey();
-    m_context->bucketName = AwsConfig::bucket();
-    m_context->protocol = S3ProtocolHTTPS;
-    m_context->uriStyle = S3UriStyleVirtualHost;
+    m_monitor.setInterval(S3_MONITOR_INTERVAL);
+    connect(&m_monitor, SIGNAL(timeout()), this, SLOT(monitor()));
 }
 
 S3ReaderJob::~S3ReaderJob()
 {
-    free(m_context);
+    // The replies are gone by now, see stopping()
+    qDeleteAll(m_segments);
+}
+
+void S3ReaderJob::stopping()
+{
+    // A seek or a track change stops the job with segments in flight. The
+    // replies belong to this thread's network manager and their signals
+    // are still on the way here, so they are let go of before the job
+    // moves back to its origin thread. What did arrive of unfinished
+    // segments is still worth keeping.
+    m_monitor.stop();
+    foreach(Segment* segment, m_segments) {
+        cancel(segment);
+        if (!segment->cached && !segment->complete && m_validated)
+            S3Cache::instance()->write(m_filename, segment->offset, segment->data);
+        delete segment;
+    }
+    m_segments.clear();
+}
+
+IOJob::Lane S3ReaderJob::lane() const
+{
+    return Network;
 }
 
 void S3ReaderJob::setFilename(const QString &fn)
@@ -102,6 +192,12 @@ void S3ReaderJob::setFilename(const QString &fn)
     m_filename = fn;
 }
 
+void S3ReaderJob::setPosition(qint64 position)
+{
+    m_position = position;
+    m_next = position;
+}
+
 void S3ReaderJob::start()
 {
     QMetaObject::invokeMethod(this, "startJob");
@@ -127,13 +223,23 @@ void S3ReaderJob::setState(int state)
 
     qDebug() << "s3 state changed to" << m_state;
 
-    switch(m_state) {
+    // Pausing leaves the replies unread, once their read buffers are full
+    // TCP flow control holds the streams where they are. Nothing is
+    // aborted, so resuming carries on over the same connections.
+    switch (m_state) {
     case Paused:
-        m_reply->abort();
+        m_monitor.stop();
         break;
     case Reading:
         m_toread = 0;
-        startJob();
+        foreach(Segment* segment, m_segments) {
+            if (segment->reply) {
+                segment->lastProgress = m_clock.elapsed();
+                readReply(segment);
+            }
+        }
+        schedule();
+        deliver();
         break;
     }
 }
@@ -145,99 +251,357 @@ void S3ReaderJob::readMore()
 
 void S3ReaderJob::startJob()
 {
-    if (!m_manager) {
-        m_manager = new QNetworkAccessManager(this);
-        connect(m_manager, SIGNAL(destroyed()), this, SLOT(stop()));
+    // Every segment is a GET of the same signed url with its own Range
+    m_url = S3Client::signedUrl(m_filename);
+    if (!m_url.isValid()) {
+        stop();
+        return;
     }
+    m_clock.start();
 
-    char query[S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE];
+    // A partly cached object has its size known, otherwise it is not
+    // known until the first response
+    qint64 size;
+    if (S3Cache::instance()->lookup(m_filename, &size, 0))
+        m_size = size;
 
-    QByteArray key = QUrl::toPercentEncoding(m_filename, "/_");
-    S3Status status = S3_generate_authenticated_query_string(query, m_context, key.constData(), -1, 0);
-    if (status != S3StatusOK) {
-        qDebug() << "error when generating query string for" << key << "," << status;
-        stop();
+    schedule();
+}
+
+qint64 S3ReaderJob::segmentSize() const
+{
+    if (m_rate <= 0)
+        return S3_SEGMENT_SIZE;
+
+    // Long enough that the request latency is a small part of each segment
+    const qint64 size = static_cast<qint64>(m_rate * m_latency * S3_LATENCY_FACTOR);
+    return qBound<qint64>(S3_MIN_SEGMENT_SIZE, size, S3_MAX_SEGMENT_SIZE);
+}
+
+int S3ReaderJob::activeSegments() const
+{
+    return m_replies.size();
+}
+
+S3ReaderJob::Segment* S3ReaderJob::createSegment(qint64 length)
+{
+    Segment* segment = new Segment;
+    segment->offset = m_next;
+    segment->length = length;
+    segment->consumed = 0;
+    segment->complete = false;
+    segment->cached = false;
+    segment->reply = 0;
+    segment->retries = 0;
+
+    m_next += length;
+    m_segments.append(segment);
+    return segment;
+}
+
+void S3ReaderJob::schedule()
+{
+    if (m_failed)
         return;
-    }
 
-    QUrl url;
-    url.setEncodedUrl(query, QUrl::TolerantMode);
+    S3Cache* cache = S3Cache::instance();
+
+    while ((m_size == -1 ? m_segments.isEmpty() : m_next < m_size)
+           && m_next - m_position < S3_PREFETCH_LIMIT) {
+        // Cached ranges cost no connection, only the gaps are requested
+        qint64 next = -1;
+        const qint64 cached = (m_size == -1) ? 0 : cache->cached(m_filename, m_next, &next);
+        if (cached > 0) {
+            Segment* segment = createSegment(qMin<qint64>(cached, S3_MAX_SEGMENT_SIZE));
+            segment->data = cache->read(m_filename, segment->offset, segment->length);
+            segment->length = segment->data.size();
+            segment->complete = true;
+            segment->cached = true;
+            if (segment->length == 0) {
+                // Gone from the cache in the meantime, fetch it instead
+                m_segments.removeLast();
+                m_next = segment->offset;
+                delete segment;
+                cache->invalidate(m_filename);
+            }
+            continue;
+        }
+
+        if (m_state == Paused || activeSegments() >= (m_size == -1 ? 1 : m_connections))
+            break;
+
+        qint64 length = segmentSize();
+        if (m_size != -1)
+            length = qMin(length, m_size - m_next);
+        if (next != -1)
+            length = qMin(length, next - m_next);
 
-    QNetworkRequest req(url);
-    if (m_position > 0) {
-        qDebug() << "s3 resuming at" << m_position;
-        req.setRawHeader("Range", "bytes=" + QByteArray::number(m_position) + "-");
+        Segment* segment = createSegment(length);
+        segment->data.reserve(length);
+        request(segment);
     }
 
-    qDebug() << "s3 making request";
-    m_reply = m_manager->get(req);
-    m_reply->setReadBufferSize(S3_MIN_BUFFER_SIZE);
-    connect(m_reply, SIGNAL(finished()), this, SLOT(replyFinished()));
-    connect(m_reply, SIGNAL(readyRead()), this, SLOT(replyData()));
-    connect(m_reply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(replyError(QNetworkReply::NetworkError)));
-    connect(m_reply, SIGNAL(sslErrors(QList<QSslError>)), this, SLOT(replySslErrors(QList<QSslError>)));
+    if (!m_replies.isEmpty() && !m_monitor.isActive() && m_state == Reading)
+        m_monitor.start();
 }
 
-void S3ReaderJob::replyFinished()
+void S3ReaderJob::request(Segment *segment)
 {
-    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
-    if (m_state == Paused || reply != m_reply) {
-        if (reply)
-            reply->deleteLater();
+    // A retried segment only asks for what it is still missing
+    const qint64 from = segment->offset + segment->data.size();
+    const qint64 to = segment->offset + segment->length - 1;
+
+    QNetworkRequest req(m_url);
+    req.setRawHeader("Range", "bytes=" + QByteArray::number(from) + "-" + QByteArray::number(to));
 
-        qDebug() << "s3 reply was finished (after pausing)";
+    segment->reply = S3Client::manager()->get(req);
+    segment->reply->setReadBufferSize(S3_REPLY_BUFFER_SIZE);
+    segment->requested = m_clock.elapsed();
+    segment->firstByte = -1;
+    segment->lastProgress = segment->requested;
+    m_replies.insert(segment->reply, segment);
 
-        if (m_reply == reply)
-            m_reply = 0;
+    connect(segment->reply, SIGNAL(metaDataChanged()), this, SLOT(replyMetaData()));
+    connect(segment->reply, SIGNAL(finished()), this, SLOT(replyFinished()));
+    connect(segment->reply, SIGNAL(readyRead()), this, SLOT(replyData()));
+    connect(segment->reply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(replyError(QNetworkReply::NetworkError)));
+    connect(segment->reply, SIGNAL(sslErrors(QList<QSslError>)), this, SLOT(replySslErrors(QList<QSslError>)));
+}
+
+void S3ReaderJob::cancel(Segment *segment)
+{
+    if (!segment->reply)
         return;
+
+    m_replies.remove(segment->reply);
+    segment->reply->disconnect(this);
+    segment->reply->abort();
+    segment->reply->deleteLater();
+    segment->reply = 0;
+}
+
+void S3ReaderJob::replyMetaData()
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    if (!reply || m_validated)
+        return;
+
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status != 200 && status != 206 && status != 416)
+        return;
+
+    // "bytes 0-524287/4718592", or "bytes */4718592" for a range past the end
+    qint64 size = -1;
+    const QByteArray range = reply->rawHeader("Content-Range");
+    const int slash = range.lastIndexOf('/');
+    if (slash != -1) {
+        bool ok;
+        size = range.mid(slash + 1).toLongLong(&ok);
+        if (!ok)
+            size = -1;
+    } else if (status == 200) {
+        size = reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
     }
+    if (size == -1)
+        return;
 
-    m_replyFinished = true;
+    m_validated = true;
+
+    // Cached bytes from another version of the object can not be used
+    if (!S3Cache::instance()->begin(m_filename, reply->rawHeader("ETag"), size)) {
+        qDebug() << "s3 cache of" << m_filename << "was stale";
+        foreach(Segment* segment, m_segments) {
+            if (!segment->cached || segment->consumed > 0)
+                continue;
+            segment->data.clear();
+            segment->complete = false;
+            segment->cached = false;
+            request(segment);
+        }
+    }
 
-    if (m_reply->bytesAvailable() == 0 || m_reply->error() != QNetworkReply::NoError) {
-        qDebug() << "s3 reader finished";
+    if (size == m_size)
+        return;
 
-        m_replyFinished = false;
+    m_size = size;
+    qDebug() << "s3 object is" << m_size << "bytes";
 
-        emit atEnd();
-        m_reply->deleteLater();
-        m_manager->deleteLater();
+    Segment* first = m_replies.value(reply);
+    if (first && first->offset + first->length > m_size) {
+        m_next = qMax(first->offset, m_size);
+        first->length = m_next - first->offset;
     }
+    schedule();
+}
+
+void S3ReaderJob::replyData()
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    Segment* segment = m_replies.value(reply);
+    if (!segment || m_state == Paused)
+        return;
+
+    readReply(segment);
+    if (segment != m_segments.first())
+        return;
+
+    if (m_toread == 0)
+        emit starving();
+    else
+        deliver();
 }
 
-void S3ReaderJob::readData()
+void S3ReaderJob::readReply(Segment *segment)
 {
-    QByteArray* d = new QByteArray(m_reply->read(m_toread));
-    if (d->isEmpty()) {
-        if (m_replyFinished && m_reply->bytesAvailable() == 0) {
-            qDebug() << "s3 reader finished";
+    const QByteArray bytes = segment->reply->readAll();
+    if (bytes.isEmpty())
+        return;
+
+    const int room = static_cast<int>(segment->length - segment->data.size());
+    segment->data.append(bytes.constData(), qMin(bytes.size(), room));
 
-            m_replyFinished = false;
+    const qint64 now = m_clock.elapsed();
+    if (segment->firstByte == -1)
+        segment->firstByte = now;
+    segment->lastProgress = now;
+    m_received += bytes.size();
+}
 
-            emit atEnd();
-            m_reply->deleteLater();
-            m_manager->deleteLater();
+void S3ReaderJob::replyFinished()
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    Segment* segment = m_replies.value(reply);
+    if (!segment)
+        return;
+
+    readReply(segment);
+
+    m_replies.remove(reply);
+    segment->reply = 0;
+    reply->deleteLater();
+
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status == 416) {
+        // Nothing at or past the offset
+        segment->length = segment->data.size();
+        segment->complete = true;
+    } else if (reply->error() == QNetworkReply::NoError && segment->data.size() >= segment->length) {
+        segment->complete = true;
+        measure(segment);
+        if (m_validated)
+            S3Cache::instance()->write(m_filename, segment->offset, segment->data);
+    } else if (segment->retries < S3_SEGMENT_RETRIES) {
+        ++segment->retries;
+        qDebug() << "s3 segment at" << segment->offset << "incomplete, retrying";
+        request(segment);
+        return;
+    } else {
+        qDebug() << "s3 segment at" << segment->offset << "failed";
+        m_failed = true;
+        segment->length = segment->data.size();
+        segment->complete = true;
+
+        // Nothing past the gap can be handed out
+        while (m_segments.last() != segment) {
+            Segment* dropped = m_segments.takeLast();
+            cancel(dropped);
+            delete dropped;
         }
+        m_next = segment->offset + segment->length;
+    }
+
+    if (m_replies.isEmpty())
+        m_monitor.stop();
+
+    schedule();
+    deliver();
+}
 
-        delete d;
+void S3ReaderJob::measure(Segment *segment)
+{
+    if (segment->firstByte == -1)
         return;
+
+    const double latency = segment->firstByte - segment->requested;
+    const double transfer = qMax<qint64>(1, m_clock.elapsed() - segment->firstByte);
+    const double rate = segment->length / transfer;
+
+    if (m_rate <= 0) {
+        m_rate = rate;
+        m_latency = latency;
+    } else {
+        m_rate += (rate - m_rate) * S3_RATE_WEIGHT;
+        m_latency += (latency - m_latency) * S3_RATE_WEIGHT;
     }
+}
 
-    //qDebug() << "s3 read" << d->size() << "bytes";
+void S3ReaderJob::monitor()
+{
+    const qint64 now = m_clock.elapsed();
+
+    // Another connection stays as long as it raises the total rate
+    const double aggregate = double(m_received - m_lastReceived) / S3_MONITOR_INTERVAL;
+    m_lastReceived = m_received;
+    if (activeSegments() >= m_connections && aggregate > m_bestAggregate * S3_CONNECTION_GAIN) {
+        m_bestAggregate = aggregate;
+        if (m_connections < S3_MAX_CONNECTIONS) {
+            ++m_connections;
+            qDebug() << "s3 reader using" << m_connections << "connections at" << aggregate << "bytes/ms";
+        }
+    }
 
-    m_toread -= d->size();
-    emit data(d);
+    // A stalled segment, or a head segment far slower than the others,
+    // is requested again from where it got to
+    foreach(Segment* segment, m_segments) {
+        if (!segment->reply)
+            continue;
+
+        bool restart = now - segment->lastProgress > S3_STALL_TIMEOUT;
+        if (!restart && segment == m_segments.first() && segment->firstByte != -1 && m_rate > 0) {
+            const qint64 elapsed = now - segment->firstByte;
+            const double rate = double(segment->data.size()) / qMax<qint64>(1, elapsed);
+            restart = elapsed > S3_STALL_TIMEOUT && rate < m_rate / S3_SLOW_FACTOR;
+        }
+        if (!restart)
+            continue;
 
-    m_position += d->size();
+        qDebug() << "s3 segment at" << segment->offset << "is slow, requesting again";
+        cancel(segment);
+        request(segment);
+    }
+}
 
-    if (m_replyFinished && m_reply->bytesAvailable() == 0) {
-        qDebug() << "s3 reader finished";
+void S3ReaderJob::deliver()
+{
+    while (m_state == Reading && m_toread > 0 && !m_segments.isEmpty()) {
+        Segment* head = m_segments.first();
+        const int available = head->data.size() - head->consumed;
+        if (available == 0) {
+            if (!head->complete)
+                break;
+            m_segments.removeFirst();
+            delete head;
+            schedule();
+            continue;
+        }
 
-        m_replyFinished = false;
+        QByteArray* d = s_networkPool.acquire();
+        const int n = qMin(qMin(d->size(), available), m_toread);
+        memcpy(d->data(), head->data.constData() + head->consumed, n);
+        d->resize(n);
+
+        head->consumed += n;
+        m_toread -= n;
+        m_position += n;
+        emit data(d);
+    }
 
+    const bool done = (m_size != -1 && m_position >= m_size) || (m_failed && m_segments.isEmpty());
+    if (done && !m_atEnd && m_replies.isEmpty()) {
+        qDebug() << "s3 reader finished";
+        m_atEnd = true;
         emit atEnd();
-        m_reply->deleteLater();
-        m_manager->deleteLater();
+        stop();
     }
 }
 
@@ -247,23 +611,12 @@ void S3ReaderJob::readMoreData()
         return;
 
     m_toread += S3_READ_SIZE;
-    if (m_reply)
-        readData();
-}
-
-void S3ReaderJob::replyData()
-{
-    if (m_toread == 0) {
-        emit starving();
-        return;
-    }
-
-    readData();
+    deliver();
 }
 
 void S3ReaderJob::replyError(QNetworkReply::NetworkError errorType)
 {
-    if (errorType == QNetworkReply::OperationCanceledError) // This is expected when pausing
+    if (errorType == QNetworkReply::OperationCanceledError)
         return;
     qDebug() << "reply error" << errorType;
 }
@@ -276,7 +629,7 @@ void S3ReaderJob::replySslErrors(const QList<QSslError>& errors)
 }
 
 S3Reader::S3Reader(QObject *parent)
-    : AudioReader(parent), m_reader(0), m_atend(false), m_requestedData(false)
+    : AudioReader(parent), m_buffer(&s_networkPool), m_reader(0), m_atend(false), m_requestedData(false)
 {
     connect(IO::instance(), SIGNAL(error(QString)), this, SLOT(ioError(QString)));
 }
@@ -339,31 +692,55 @@ bool S3Reader::open(OpenMode mode)
     if (isOpen())
         close();
 
+    startReader(0);
+
+    return AudioReader::open(mode);
+}
+
+bool S3Reader::canRestart() const
+{
+    return isOpen();
+}
+
+bool S3Reader::restartAt(qint64 pos)
+{
+    if (!isOpen() || pos < 0)
+        return false;
+
+    m_buffer.clear();
+    if (m_reader) {
+        m_reader->stop();
+        m_reader = 0;
+    }
+
+    startReader(pos);
+    return true;
+}
+
+void S3Reader::startReader(qint64 offset)
+{
     m_atend = false;
+    m_requestedData = false;
 
     S3ReaderJob* job = new S3ReaderJob;
     job->setFilename(m_filename);
+    job->setPosition(offset);
+    job->setPriority(IOJob::CriticalPriority);
 
     connect(job, SIGNAL(started()), this, SLOT(jobStarted()));
     connect(job, SIGNAL(finished()), this, SLOT(jobFinished()));
 
     IO::instance()->startJob(job);
     m_reader = job;
-
-    return AudioReader::open(mode);
 }
 
 qint64 S3Reader::readData(char *data, qint64 maxlen)
 {
-    if (m_atend && m_buffer.isEmpty()) {
-        close();
+    // Stays open at the end so that it can be restarted
+    if (m_atend && m_buffer.isEmpty())
         return 0;
-    }
 
-    QByteArray dt = m_buffer.read(maxlen);
-
-    if (!dt.isEmpty())
-        memcpy(data, dt.constData(), dt.size());
+    int read = m_buffer.readInto(data, static_cast<int>(qMin<qint64>(maxlen, m_buffer.size())));
 
     if (!m_requestedData && m_buffer.size() < S3_MIN_BUFFER_SIZE && m_reader) {
         qDebug() << "s3 buffer low, requesting more";
@@ -371,7 +748,7 @@ qint64 S3Reader::readData(char *data, qint64 maxlen)
         m_requestedData = true;
     }
 
-    return dt.size();
+    return read;
 }
 
 qint64 S3Reader::writeData(const char *data, qint64 len)
@@ -384,6 +761,10 @@ qint64 S3Reader::writeData(const char *data, qint64 len)
 
 void S3Reader::jobStarted()
 {
+    // A job replaced by a seek before it got going
+    if (sender() != m_reader)
+        return;
+
     connect(m_reader, SIGNAL(data(QByteArray*)), this, SLOT(readerData(QByteArray*)));
     connect(m_reader, SIGNAL(atEnd()), this, SLOT(readerAtEnd()));
     connect(m_reader, SIGNAL(starving()), this, SLOT(readerStarving()));
@@ -413,7 +794,7 @@ void S3Reader::readerData(QByteArray *data)
 {
     QObject* from = sender();
     if (from && from != m_reader) {
-        delete data;
+        s_networkPool.release(data);
         return;
     }
 
@@ -421,6 +802,8 @@ void S3Reader::readerData(QByteArray *data)
 
     if (m_requestedData && (m_buffer.size() * 2) > S3_MIN_BUFFER_SIZE)
         m_requestedData = false;
+
+    emit readyRead();
 }
 
 void S3Reader::readerAtEnd()
@@ -430,6 +813,7 @@ void S3Reader::readerAtEnd()
         return;
 
     m_atend = true;
+    emit readyRead();
 }
 
 void S3Reader::ioError(const QString &message)
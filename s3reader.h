@@ -45,6 +45,9 @@ public:
     void pause();
     void resume();
 
+    bool canRestart() const;
+    bool restartAt(qint64 pos);
+
 protected:
     qint64 readData(char *data, qint64 maxlen);
     qint64 writeData(const char *data, qint64 len);
@@ -58,6 +61,9 @@ private slots:
     void readerAtEnd();
     void readerStarving();
 
+private:
+    void startReader(qint64 offset);
+
 private:
     QString m_filename;
     Buffer m_buffer;
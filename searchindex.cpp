@@ -0,0 +1,318 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "searchindex.h"
+#include <QStringList>
+#include <QSet>
+#include <QtAlgorithms>
+
+#define SEARCH_FUZZY_RATIO 2 // a fuzzy match shares at least 1/n of the trigrams
+#define SEARCH_FUZZY_POSTINGS 20000 // trigrams more common than this are skipped when fuzzy
+
+static bool matchLessThan(const SearchIndex::Match& m1, const SearchIndex::Match& m2)
+{
+    if (m1.score != m2.score)
+        return m1.score > m2.score;
+    return m1.id < m2.id;
+}
+
+// Keeps the limit best matches in order, most candidates are turned away
+// by the comparison with the last one
+static void keepBest(QVector<SearchIndex::Match>& best, const SearchIndex::Match& match, int limit)
+{
+    if (best.size() == limit && !matchLessThan(match, best.last()))
+        return;
+
+    best.insert(qUpperBound(best.begin(), best.end(), match, matchLessThan), match);
+    if (best.size() > limit)
+        best.resize(limit);
+}
+
+SearchIndex::SearchIndex()
+    : m_removed(0)
+{
+}
+
+void SearchIndex::clear()
+{
+    m_ids.clear();
+    m_texts.clear();
+    m_documents.clear();
+    m_postings.clear();
+    m_removed = 0;
+}
+
+void SearchIndex::reserve(int documents)
+{
+    m_ids.reserve(documents);
+    m_texts.reserve(documents);
+    m_documents.reserve(documents);
+}
+
+QString SearchIndex::normalize(const QString &text)
+{
+    // Case and accents are ignored, anything that is not a letter or a
+    // digit separates words
+    const QString decomposed = text.normalized(QString::NormalizationForm_KD).toCaseFolded();
+
+    QString out;
+    out.reserve(decomposed.size() + 1);
+    bool space = true;
+    foreach(const QChar& ch, decomposed) {
+        if (ch.isLetterOrNumber()) {
+            if (space)
+                out.append(QLatin1Char(' '));
+            out.append(ch);
+            space = false;
+        } else if (ch.category() != QChar::Mark_NonSpacing) {
+            space = true;
+        }
+    }
+    return out;
+}
+
+void SearchIndex::trigrams(const QString &word, QVector<Trigram> &out)
+{
+    // word comes with its leading space
+    for (int i = 0; i + 2 < word.size(); ++i) {
+        out.append((Trigram(word.at(i).unicode()) << 32)
+                   | (Trigram(word.at(i + 1).unicode()) << 16)
+                   | Trigram(word.at(i + 2).unicode()));
+    }
+}
+
+SearchIndex::Trigram SearchIndex::head(const QString &word)
+{
+    // word comes with its leading space. Normalized text has no nul, so
+    // this never collides with a real trigram.
+    return (Trigram(word.at(0).unicode()) << 32) | (Trigram(word.at(1).unicode()) << 16);
+}
+
+void SearchIndex::insert(int id, const QString &artist, const QString &album, const QString &title)
+{
+    remove(id);
+
+    const QString text = normalize(artist) + normalize(album) + normalize(title);
+    const int doc = m_ids.size();
+    m_ids.append(id);
+    m_texts.append(text);
+    m_documents.insert(id, doc);
+
+    QVector<Trigram> grams;
+    const QStringList words = text.split(QLatin1Char(' '), QString::SkipEmptyParts);
+    foreach(const QString& word, words) {
+        const QString bounded = QLatin1Char(' ') + word;
+        grams.append(head(bounded));
+        trigrams(bounded, grams);
+    }
+
+    // Documents only ever get appended, so the postings stay sorted
+    foreach(Trigram gram, grams) {
+        QVector<int>& posting = m_postings[gram];
+        if (posting.isEmpty() || posting.last() != doc)
+            posting.append(doc);
+    }
+}
+
+void SearchIndex::remove(int id)
+{
+    QHash<int, int>::Iterator it = m_documents.find(id);
+    if (it == m_documents.end())
+        return;
+
+    m_ids[it.value()] = -1;
+    m_texts[it.value()].clear();
+    m_documents.erase(it);
+
+    if (++m_removed > 1024 && m_removed > m_ids.size() / 2)
+        compact();
+}
+
+bool SearchIndex::contains(int id) const
+{
+    return m_documents.contains(id);
+}
+
+int SearchIndex::size() const
+{
+    return m_documents.size();
+}
+
+void SearchIndex::compact()
+{
+    const QVector<int> ids = m_ids;
+    const QVector<QString> texts = m_texts;
+
+    m_ids.clear();
+    m_texts.clear();
+    m_documents.clear();
+    m_postings.clear();
+    m_removed = 0;
+
+    // Re-adding the normalized text as one field gives the same words
+    for (int doc = 0; doc < ids.size(); ++doc) {
+        if (ids.at(doc) != -1)
+            insert(ids.at(doc), texts.at(doc), QString(), QString());
+    }
+}
+
+QVector<int> SearchIndex::candidates(const QString &word) const
+{
+    QVector<Trigram> grams;
+    const QString bounded = QLatin1Char(' ') + word;
+    if (word.size() < 2)
+        grams.append(head(bounded));
+    else
+        trigrams(bounded, grams);
+
+    // Intersect starting with the rarest trigram
+    QVector<const QVector<int>*> postings;
+    foreach(Trigram gram, grams) {
+        QHash<Trigram, QVector<int> >::ConstIterator it = m_postings.find(gram);
+        if (it == m_postings.end())
+            return QVector<int>();
+        postings.append(&it.value());
+    }
+    if (postings.isEmpty())
+        return QVector<int>();
+
+    int rarest = 0;
+    for (int i = 1; i < postings.size(); ++i) {
+        if (postings.at(i)->size() < postings.at(rarest)->size())
+            rarest = i;
+    }
+
+    QVector<int> result = *postings.at(rarest);
+    for (int i = 0; i < postings.size() && !result.isEmpty(); ++i) {
+        if (i == rarest)
+            continue;
+
+        const QVector<int>& other = *postings.at(i);
+        QVector<int> merged;
+        merged.reserve(result.size());
+        int a = 0, b = 0;
+        while (a < result.size() && b < other.size()) {
+            if (result.at(a) < other.at(b))
+                ++a;
+            else if (other.at(b) < result.at(a))
+                ++b;
+            else {
+                merged.append(result.at(a));
+                ++a;
+                ++b;
+            }
+        }
+        result = merged;
+    }
+    return result;
+}
+
+bool SearchIndex::matchesPrefix(int doc, const QStringList &words) const
+{
+    const QString& text = m_texts.at(doc);
+    foreach(const QString& word, words) {
+        if (!text.contains(QLatin1Char(' ') + word))
+            return false;
+    }
+    return true;
+}
+
+QVector<SearchIndex::Match> SearchIndex::search(const QString &query, int limit) const
+{
+    QVector<Match> matches;
+
+    const QStringList words = normalize(query).split(QLatin1Char(' '), QString::SkipEmptyParts);
+    if (words.isEmpty() || limit <= 0)
+        return matches;
+
+    // Prefix pass, the longest word narrows things down the most
+    QString longest;
+    foreach(const QString& word, words) {
+        if (word.size() > longest.size())
+            longest = word;
+    }
+
+    // One and two letter words are looked up by their first letter or
+    // their leading trigram, a lone word of that size needs no checking
+    const QVector<int> docs = candidates(longest);
+    const bool exact = words.size() == 1 && longest.size() <= 2;
+
+    // Whole words beat prefixes
+    QStringList bounded, whole;
+    foreach(const QString& word, words) {
+        bounded.append(QLatin1Char(' ') + word);
+        whole.append(bounded.last() + QLatin1Char(' '));
+    }
+
+    int found = 0;
+    foreach(int doc, docs) {
+        if (m_ids.at(doc) == -1 || (!exact && !matchesPrefix(doc, words)))
+            continue;
+
+        const QString& text = m_texts.at(doc);
+        Match match;
+        match.id = m_ids.at(doc);
+        match.score = 1000;
+        for (int i = 0; i < words.size(); ++i) {
+            if (text.contains(whole.at(i)) || text.endsWith(bounded.at(i)))
+                match.score += 10;
+        }
+        keepBest(matches, match, limit);
+        ++found;
+    }
+
+    // Fuzzy pass, documents sharing enough of the query's trigrams. It only
+    // runs when every prefix match is in matches.
+    if (found < limit && longest.size() >= 3) {
+        QSet<int> prefixed;
+        foreach(const Match& match, matches) {
+            prefixed.insert(match.id);
+        }
+
+        QVector<Trigram> grams;
+        foreach(const QString& word, words) {
+            trigrams(QLatin1Char(' ') + word, grams);
+        }
+
+        QHash<int, int> hits;
+        foreach(Trigram gram, grams) {
+            QHash<Trigram, QVector<int> >::ConstIterator it = m_postings.find(gram);
+            if (it == m_postings.end() || it.value().size() > SEARCH_FUZZY_POSTINGS)
+                continue;
+            foreach(int doc, it.value()) {
+                ++hits[doc];
+            }
+        }
+
+        const int needed = qMax(2, grams.size() / SEARCH_FUZZY_RATIO);
+        QHash<int, int>::ConstIterator it = hits.begin();
+        QHash<int, int>::ConstIterator itend = hits.end();
+        while (it != itend) {
+            const int id = m_ids.at(it.key());
+            if (it.value() >= needed && id != -1 && !prefixed.contains(id)) {
+                Match match;
+                match.id = id;
+                match.score = (it.value() * 100) / grams.size();
+                keepBest(matches, match, limit);
+            }
+            ++it;
+        }
+    }
+
+    return matches;
+}
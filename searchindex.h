@@ -0,0 +1,73 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+
+// Trigram index over the words of artist, album and track names. Words
+// are indexed with a leading boundary so that short prefixes can be
+// looked up too, and their first letter on its own for one letter
+// queries. A query matches words by prefix first, then falls back to
+// documents sharing most of the query's trigrams.
+// bench/searchindex measures it on a large library.
+class SearchIndex
+{
+public:
+    struct Match
+    {
+        int id;
+        int score;
+    };
+
+    SearchIndex();
+
+    void clear();
+    void reserve(int documents);
+
+    void insert(int id, const QString& artist, const QString& album, const QString& title);
+    void remove(int id);
+    bool contains(int id) const;
+    int size() const;
+
+    QVector<Match> search(const QString& query, int limit) const;
+
+    static QString normalize(const QString& text);
+
+private:
+    typedef quint64 Trigram;
+
+    static void trigrams(const QString& word, QVector<Trigram>& out);
+    static Trigram head(const QString& word);
+    void compact();
+
+    bool matchesPrefix(int doc, const QStringList& words) const;
+    QVector<int> candidates(const QString& word) const;
+
+private:
+    QVector<int> m_ids; // document to id, -1 once removed
+    QVector<QString> m_texts; // " word word word"
+    QHash<int, int> m_documents; // id to document
+    QHash<Trigram, QVector<int> > m_postings; // sorted documents
+    int m_removed;
+};
+
+#endif // SEARCHINDEX_H
@@ -0,0 +1,234 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "searchmodel.h"
+#include <QElapsedTimer>
+#include <QDebug>
+
+#define SEARCH_DEFAULT_LIMIT 200
+#define SEARCH_REFRESH_INTERVAL 250 // coalesces library updates during a scan
+#define SEARCH_SLOW_MS 10
+
+SearchModel::SearchModel(QObject *parent)
+    : QAbstractListModel(parent), m_limit(SEARCH_DEFAULT_LIMIT), m_refresh(this)
+{
+    m_refresh.setSingleShot(true);
+    m_refresh.setInterval(SEARCH_REFRESH_INTERVAL);
+    connect(&m_refresh, SIGNAL(timeout()), this, SLOT(search()));
+
+    connect(MediaLibrary::instance(), SIGNAL(artist(Artist)), this, SLOT(updateArtist(Artist)));
+    connect(MediaLibrary::instance(), SIGNAL(library(LibrarySnapshot)), this, SLOT(setLibrary(LibrarySnapshot)));
+    connect(MediaLibrary::instance(), SIGNAL(trackRemoved(int)), this, SLOT(removeTrack(int)));
+    connect(MediaLibrary::instance(), SIGNAL(tracksRemoved(QList<int>)), this, SLOT(removeTracks(QList<int>)));
+    connect(MediaLibrary::instance(), SIGNAL(cleared()), this, SLOT(clearData()));
+    // Shares the read with the other models
+    LibrarySnapshot library;
+    if (MediaLibrary::instance()->requestLibrary(&library))
+        setLibrary(library);
+
+    QHash<int, QByteArray> roles;
+    roles[Qt::UserRole + 1] = "trackid";
+    roles[Qt::UserRole + 2] = "title";
+    roles[Qt::UserRole + 3] = "artist";
+    roles[Qt::UserRole + 4] = "album";
+    roles[Qt::UserRole + 5] = "filename";
+    setRoleNames(roles);
+}
+
+SearchModel::~SearchModel()
+{
+}
+
+QString SearchModel::query() const
+{
+    return m_query;
+}
+
+void SearchModel::setQuery(const QString &query)
+{
+    if (query == m_query)
+        return;
+
+    m_query = query;
+    search();
+    emit queryChanged();
+}
+
+int SearchModel::limit() const
+{
+    return m_limit;
+}
+
+void SearchModel::setLimit(int limit)
+{
+    if (limit == m_limit)
+        return;
+
+    m_limit = limit;
+    scheduleSearch();
+}
+
+int SearchModel::count() const
+{
+    return m_results.size();
+}
+
+void SearchModel::setLibrary(const LibrarySnapshot &library)
+{
+    m_index.clear();
+    m_entries.clear();
+
+    const int tracks = library.trackCount();
+    m_index.reserve(tracks);
+    m_entries.reserve(tracks);
+
+    for (int i = 0; i < tracks; ++i) {
+        const LibrarySnapshot::TrackRecord& track = library.track(i);
+
+        Entry entry;
+        entry.artist = library.string(library.artist(track.artist).name);
+        entry.album = library.string(library.album(track.album).name);
+        entry.title = library.string(track.name);
+        entry.filename = library.string(track.filename);
+
+        m_index.insert(track.id, entry.artist, entry.album, entry.title);
+        m_entries.insert(track.id, entry);
+    }
+
+    search();
+}
+
+void SearchModel::updateArtist(const Artist &artist)
+{
+    QHash<int, Album>::ConstIterator album = artist.albums.begin();
+    QHash<int, Album>::ConstIterator albumend = artist.albums.end();
+    while (album != albumend) {
+        QHash<int, Track>::ConstIterator track = album.value().tracks.begin();
+        QHash<int, Track>::ConstIterator trackend = album.value().tracks.end();
+        while (track != trackend) {
+            Entry entry;
+            entry.artist = artist.name;
+            entry.album = album.value().name;
+            entry.title = track.value().name;
+            entry.filename = track.value().filename;
+
+            m_index.insert(track.value().id, entry.artist, entry.album, entry.title);
+            m_entries.insert(track.value().id, entry);
+            ++track;
+        }
+        ++album;
+    }
+
+    scheduleSearch();
+}
+
+void SearchModel::removeTrack(int trackid)
+{
+    m_index.remove(trackid);
+    m_entries.remove(trackid);
+    scheduleSearch();
+}
+
+void SearchModel::removeTracks(const QList<int> &trackids)
+{
+    foreach(int trackid, trackids) {
+        m_index.remove(trackid);
+        m_entries.remove(trackid);
+    }
+    scheduleSearch();
+}
+
+void SearchModel::clearData()
+{
+    m_index.clear();
+    m_entries.clear();
+    search();
+}
+
+void SearchModel::scheduleSearch()
+{
+    if (!m_query.isEmpty() && !m_refresh.isActive())
+        m_refresh.start();
+}
+
+void SearchModel::search()
+{
+    m_refresh.stop();
+
+    const int previous = m_results.size();
+    m_results.clear();
+
+    if (!m_query.isEmpty()) {
+        QElapsedTimer timer;
+        timer.start();
+
+        const QVector<SearchIndex::Match> matches = m_index.search(m_query, m_limit);
+        m_results.reserve(matches.size());
+        foreach(const SearchIndex::Match& match, matches) {
+            m_results.append(match.id);
+        }
+
+        if (timer.elapsed() > SEARCH_SLOW_MS)
+            qDebug() << "search for" << m_query << "took" << timer.elapsed() << "ms over" << m_index.size() << "tracks";
+    }
+
+    reset();
+    if (m_results.size() != previous)
+        emit countChanged();
+}
+
+QVariant SearchModel::data(const QModelIndex &index, int role) const
+{
+    if (index.row() < 0 || index.row() >= m_results.size())
+        return QVariant();
+
+    const int trackid = m_results.at(index.row());
+    if (role == Qt::UserRole + 1)
+        return trackid;
+
+    QHash<int, Entry>::ConstIterator it = m_entries.find(trackid);
+    if (it == m_entries.end())
+        return QVariant();
+
+    switch (role) {
+    case Qt::DisplayRole:
+    case Qt::UserRole + 2:
+        return it.value().title;
+    case Qt::UserRole + 3:
+        return it.value().artist;
+    case Qt::UserRole + 4:
+        return it.value().album;
+    case Qt::UserRole + 5:
+        return it.value().filename;
+    }
+    return QVariant();
+}
+
+int SearchModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return m_results.size();
+}
+
+QString SearchModel::filenameByPosition(int position) const
+{
+    if (position < 0 || position >= m_results.size())
+        return QString();
+    return m_entries.value(m_results.at(position)).filename;
+}
@@ -0,0 +1,84 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SEARCHMODEL_H
+#define SEARCHMODEL_H
+
+#include "medialibrary.h"
+#include "searchindex.h"
+#include <QAbstractListModel>
+#include <QTimer>
+
+class SearchModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+    Q_PROPERTY(QString query READ query WRITE setQuery NOTIFY queryChanged)
+    Q_PROPERTY(int limit READ limit WRITE setLimit)
+    Q_PROPERTY(int count READ count NOTIFY countChanged)
+public:
+    SearchModel(QObject *parent = 0);
+    ~SearchModel();
+
+    QString query() const;
+    void setQuery(const QString& query);
+
+    int limit() const;
+    void setLimit(int limit);
+
+    int count() const;
+
+    QVariant data(const QModelIndex& index, int role) const;
+    int rowCount(const QModelIndex& parent) const;
+
+    Q_INVOKABLE QString filenameByPosition(int position) const;
+
+signals:
+    void queryChanged();
+    void countChanged();
+
+private slots:
+    void updateArtist(const Artist& artist);
+    void setLibrary(const LibrarySnapshot& library);
+    void removeTrack(int trackid);
+    void removeTracks(const QList<int>& trackids);
+    void clearData();
+    void search();
+
+private:
+    struct Entry
+    {
+        QString artist;
+        QString album;
+        QString title;
+        QString filename;
+    };
+
+    void scheduleSearch();
+
+private:
+    SearchIndex m_index;
+    QHash<int, Entry> m_entries;
+
+    QString m_query;
+    int m_limit;
+    QVector<int> m_results;
+    QTimer m_refresh;
+};
+
+#endif // SEARCHMODEL_H
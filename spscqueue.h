@@ -0,0 +1,109 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <QAtomicInt>
+#include <QVector>
+
+// Lock-free bounded queue for exactly one producer thread and one consumer thread.
+// One slot is kept free to tell a full queue from an empty one.
+template<typename T>
+class SpscQueue
+{
+public:
+    SpscQueue(int capacity = 0);
+
+    // Only valid while neither side is using the queue
+    void reset(int capacity);
+
+    int capacity() const;
+    int size() const;
+    bool isEmpty() const;
+
+    bool push(const T& value); // producer
+    bool pop(T* value); // consumer
+
+private:
+    QVector<T> m_items;
+    QAtomicInt m_head; // next slot to pop, written by the consumer
+    QAtomicInt m_tail; // next slot to push, written by the producer
+};
+
+template<typename T>
+SpscQueue<T>::SpscQueue(int capacity)
+    : m_head(0), m_tail(0)
+{
+    reset(capacity);
+}
+
+template<typename T>
+void SpscQueue<T>::reset(int capacity)
+{
+    m_items.fill(T(), capacity + 1);
+    m_head.fetchAndStoreOrdered(0);
+    m_tail.fetchAndStoreOrdered(0);
+}
+
+template<typename T>
+int SpscQueue<T>::capacity() const
+{
+    return m_items.size() - 1;
+}
+
+template<typename T>
+int SpscQueue<T>::size() const
+{
+    const int head = const_cast<QAtomicInt&>(m_head).fetchAndAddAcquire(0);
+    const int tail = const_cast<QAtomicInt&>(m_tail).fetchAndAddAcquire(0);
+    return (tail >= head) ? (tail - head) : (tail + m_items.size() - head);
+}
+
+template<typename T>
+bool SpscQueue<T>::isEmpty() const
+{
+    return size() == 0;
+}
+
+template<typename T>
+bool SpscQueue<T>::push(const T& value)
+{
+    const int tail = m_tail;
+    const int next = (tail + 1) % m_items.size();
+    if (next == m_head.fetchAndAddAcquire(0))
+        return false;
+
+    m_items[tail] = value;
+    m_tail.fetchAndStoreRelease(next);
+    return true;
+}
+
+template<typename T>
+bool SpscQueue<T>::pop(T* value)
+{
+    const int head = m_head;
+    if (head == m_tail.fetchAndAddAcquire(0))
+        return false;
+
+    *value = m_items.at(head);
+    m_head.fetchAndStoreRelease((head + 1) % m_items.size());
+    return true;
+}
+
+#endif // SPSCQUEUE_H
@@ -25,6 +25,7 @@
 #include <QVariant>
 
 class MediaJob;
+class MediaScanner;
 
 class Tag
 {
@@ -48,6 +49,7 @@ public:
     QHash<QString, QVariant> m_data;
 
     friend class MediaJob;
+    friend class MediaScanner;
 };
 
 Q_DECLARE_METATYPE(Tag)
@@ -18,8 +18,10 @@
 
 #include "updater.h"
 #include "awsconfig.h"
+#include <libs3.h>
 #include <QApplication>
 #include <QFileDialog>
+#include <QStringList>
 
 int main(int argc, char** argv)
 {
@@ -28,12 +30,40 @@ int main(int argc, char** argv)
     if (!AwsConfig::init())
         return 1;
 
-    QString dir = QFileDialog::getExistingDirectory();
+    // updater [--sync] [--delete] [--dry-run] [directory]
+    bool sync = false, remove = false, dryRun = false;
+    QString dir;
+    QStringList args = app.arguments();
+    args.removeFirst();
+    foreach(const QString& arg, args) {
+        if (arg == QLatin1String("--sync"))
+            sync = true;
+        else if (arg == QLatin1String("--delete"))
+            remove = true;
+        else if (arg == QLatin1String("--dry-run"))
+            dryRun = true;
+        else
+            dir = arg;
+    }
+
+    if (dir.isEmpty())
+        dir = QFileDialog::getExistingDirectory();
     if (dir.isEmpty())
         return 0;
 
-    Updater updater;
-    updater.update(dir);
+    S3_initialize(NULL, S3_INIT_ALL);
+
+    int ret;
+    {
+        Updater updater;
+        updater.setSync(sync);
+        updater.setDeleteRemoved(remove);
+        updater.setDryRun(dryRun);
+        updater.update(dir);
+
+        ret = app.exec();
+    }
 
-    return app.exec();
+    S3_deinitialize();
+    return ret;
 }
@@ -0,0 +1,465 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "s3upload.h"
+#include "s3client.h"
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QXmlStreamReader>
+#include <QCryptographicHash>
+#include <QSettings>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QStringList>
+#include <QFile>
+#include <QDir>
+#include <QTimer>
+#include <QDebug>
+
+#define S3_MULTIPART_THRESHOLD (16 * 1024 * 1024)
+#define S3_PART_SIZE (8 * 1024 * 1024)
+#define S3_PARTS_IN_FLIGHT 2
+#define S3_UPLOAD_RETRIES 3
+#define S3_RETRY_DELAY 1000
+#define S3_STATE_FILE ".player-uploads"
+
+static inline QString stateFile()
+{
+    return QDir::homePath() + QLatin1String("/" S3_STATE_FILE);
+}
+
+static inline QString stateGroup(const QByteArray& key)
+{
+    return QString::fromLatin1(QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex());
+}
+
+S3Upload::S3Upload(const QByteArray &key, const QString &filename, const QByteArray &contentType, QObject *parent)
+    : QObject(parent), m_key(key), m_filename(filename), m_contentType(contentType),
+      m_size(0), m_mtime(0), m_retries(0), m_failed(false), m_partCount(0)
+{
+    QFileInfo info(filename);
+    m_size = info.size();
+    m_mtime = info.lastModified().toTime_t();
+}
+
+S3Upload::S3Upload(const QByteArray &key, const QByteArray &data, const QByteArray &contentType, QObject *parent)
+    : QObject(parent), m_key(key), m_data(data), m_contentType(contentType),
+      m_size(data.size()), m_mtime(0), m_retries(0), m_failed(false), m_partCount(0)
+{
+}
+
+S3Upload::~S3Upload()
+{
+    QHash<QNetworkReply*, qint64>::const_iterator it = m_sent.begin();
+    const QHash<QNetworkReply*, qint64>::const_iterator end = m_sent.end();
+    while (it != end) {
+        it.key()->disconnect(this);
+        it.key()->abort();
+        it.key()->deleteLater();
+        ++it;
+    }
+}
+
+QByteArray S3Upload::key() const
+{
+    return m_key;
+}
+
+qint64 S3Upload::size() const
+{
+    return m_size;
+}
+
+bool S3Upload::isMultipart() const
+{
+    return partSize(m_size) > 0;
+}
+
+qint64 S3Upload::partSize(qint64 size)
+{
+    return size >= S3_MULTIPART_THRESHOLD ? S3_PART_SIZE : 0;
+}
+
+void S3Upload::start()
+{
+    if (!isMultipart()) {
+        put();
+        return;
+    }
+
+    m_partCount = (m_size + S3_PART_SIZE - 1) / S3_PART_SIZE;
+    loadState();
+    if (m_uploadId.isEmpty()) {
+        initiate();
+        return;
+    }
+
+    qDebug() << "resuming" << m_key << m_etags.size() << "of" << m_partCount << "parts";
+    qint64 resumed = 0;
+    foreach(int part, m_etags.keys())
+        resumed += partLength(part);
+    emit progress(resumed);
+
+    queueParts();
+    sendParts();
+}
+
+QByteArray S3Upload::readPart(qint64 offset, qint64 length) const
+{
+    if (m_filename.isEmpty())
+        return m_data.mid(offset, length);
+
+    QFile file(m_filename);
+    if (!file.open(QFile::ReadOnly) || !file.seek(offset))
+        return QByteArray();
+    return file.read(length);
+}
+
+qint64 S3Upload::partLength(int part) const
+{
+    return qMin<qint64>(S3_PART_SIZE, m_size - qint64(part - 1) * S3_PART_SIZE);
+}
+
+QNetworkReply* S3Upload::track(QNetworkReply *reply)
+{
+    m_sent[reply] = 0;
+    connect(reply, SIGNAL(uploadProgress(qint64,qint64)), this, SLOT(uploadProgress(qint64,qint64)));
+    return reply;
+}
+
+void S3Upload::untrack(QNetworkReply *reply, qint64 length, bool ok)
+{
+    // Settle the progress reported for this request, either up to the full
+    // length or back to zero so that the retry can count it again
+    const qint64 sent = m_sent.take(reply);
+    if (ok) {
+        if (length > sent)
+            emit progress(length - sent);
+    } else if (sent > 0) {
+        emit progress(-sent);
+    }
+    reply->deleteLater();
+}
+
+void S3Upload::uploadProgress(qint64 sent, qint64 total)
+{
+    Q_UNUSED(total)
+
+    QHash<QNetworkReply*, qint64>::iterator it = m_sent.find(qobject_cast<QNetworkReply*>(sender()));
+    if (it == m_sent.end() || sent <= it.value())
+        return;
+    emit progress(sent - it.value());
+    it.value() = sent;
+}
+
+bool S3Upload::retry(QNetworkReply *reply, int &retries)
+{
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    const bool retryable = (status == 0 || status >= 500
+                            || (status == 400 && reply->readAll().contains("<Code>RequestTimeout</Code>")));
+    if (!retryable || retries >= S3_UPLOAD_RETRIES)
+        return false;
+    ++retries;
+    return true;
+}
+
+void S3Upload::put()
+{
+    const QByteArray body = readPart(0, m_size);
+    if (body.size() != m_size) {
+        qWarning() << "unable to read" << m_filename;
+        done(false);
+        return;
+    }
+
+    QNetworkRequest request = S3Client::signedRequest("PUT", m_key, QByteArray(), m_contentType);
+    QNetworkReply* reply = track(S3Client::manager()->put(request, body));
+    connect(reply, SIGNAL(finished()), this, SLOT(putFinished()));
+}
+
+void S3Upload::putFinished()
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    const bool ok = (reply->error() == QNetworkReply::NoError);
+    untrack(reply, m_size, ok);
+    if (ok) {
+        done(true);
+        return;
+    }
+
+    qWarning() << "put failed" << m_key << reply->errorString();
+    if (retry(reply, m_retries))
+        QTimer::singleShot(S3_RETRY_DELAY * m_retries, this, SLOT(put()));
+    else
+        done(false);
+}
+
+void S3Upload::initiate()
+{
+    QNetworkRequest request = S3Client::signedRequest("POST", m_key, "uploads", m_contentType);
+    QNetworkReply* reply = S3Client::manager()->post(request, QByteArray());
+    connect(reply, SIGNAL(finished()), this, SLOT(initiateFinished()));
+}
+
+void S3Upload::initiateFinished()
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    reply->deleteLater();
+
+    if (reply->error() != QNetworkReply::NoError) {
+        qWarning() << "unable to start upload" << m_key << reply->errorString();
+        if (retry(reply, m_retries))
+            QTimer::singleShot(S3_RETRY_DELAY * m_retries, this, SLOT(initiate()));
+        else
+            done(false);
+        return;
+    }
+
+    QXmlStreamReader xml(reply->readAll());
+    while (!xml.atEnd()) {
+        if (xml.readNext() == QXmlStreamReader::StartElement && xml.name() == QLatin1String("UploadId")) {
+            m_uploadId = xml.readElementText().toLatin1();
+            break;
+        }
+    }
+    if (m_uploadId.isEmpty()) {
+        qWarning() << "no upload id for" << m_key;
+        done(false);
+        return;
+    }
+
+    m_etags.clear();
+    m_partRetries.clear();
+    saveState();
+
+    queueParts();
+    sendParts();
+}
+
+void S3Upload::queueParts()
+{
+    m_pending.clear();
+    for (int part = 1; part <= m_partCount; ++part) {
+        if (!m_etags.contains(part))
+            m_pending.append(part);
+    }
+}
+
+void S3Upload::sendParts()
+{
+    if (m_failed)
+        return;
+
+    while (m_parts.size() < S3_PARTS_IN_FLIGHT && !m_pending.isEmpty()) {
+        const int part = m_pending.takeFirst();
+        const qint64 length = partLength(part);
+        const QByteArray body = readPart(qint64(part - 1) * S3_PART_SIZE, length);
+        if (body.size() != length) {
+            qWarning() << "unable to read" << m_filename;
+            fail();
+            return;
+        }
+
+        const QByteArray subresource = "partNumber=" + QByteArray::number(part) + "&uploadId=" + m_uploadId;
+        QNetworkRequest request = S3Client::signedRequest("PUT", m_key, subresource);
+        QNetworkReply* reply = track(S3Client::manager()->put(request, body));
+        connect(reply, SIGNAL(finished()), this, SLOT(partFinished()));
+        m_parts[reply] = part;
+    }
+
+    if (m_parts.isEmpty() && m_etags.size() == m_partCount)
+        complete();
+}
+
+void S3Upload::partFinished()
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    const int part = m_parts.take(reply);
+    const bool ok = (reply->error() == QNetworkReply::NoError);
+    untrack(reply, partLength(part), ok);
+
+    if (ok) {
+        m_etags[part] = reply->rawHeader("ETag");
+        saveState();
+        sendParts();
+        return;
+    }
+
+    qWarning() << "part" << part << "of" << m_key << "failed" << reply->errorString();
+    if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 404) {
+        // The upload has expired or was aborted since it was saved
+        restart();
+        return;
+    }
+    if (!retry(reply, m_partRetries[part])) {
+        fail();
+        return;
+    }
+    m_pending.append(part);
+    QTimer::singleShot(S3_RETRY_DELAY * m_partRetries.value(part), this, SLOT(sendParts()));
+}
+
+void S3Upload::restart()
+{
+    QHash<QNetworkReply*, int>::const_iterator it = m_parts.begin();
+    const QHash<QNetworkReply*, int>::const_iterator end = m_parts.end();
+    while (it != end) {
+        it.key()->disconnect(this);
+        it.key()->abort();
+        untrack(it.key(), 0, false);
+        ++it;
+    }
+    m_parts.clear();
+
+    qint64 lost = 0;
+    foreach(int part, m_etags.keys())
+        lost += partLength(part);
+    emit progress(-lost);
+
+    clearState();
+    m_uploadId.clear();
+    m_etags.clear();
+    m_pending.clear();
+
+    if (++m_retries > S3_UPLOAD_RETRIES)
+        done(false);
+    else
+        initiate();
+}
+
+void S3Upload::complete()
+{
+    QByteArray body("<CompleteMultipartUpload>");
+    QMap<int, QByteArray>::const_iterator it = m_etags.begin();
+    const QMap<int, QByteArray>::const_iterator end = m_etags.end();
+    while (it != end) {
+        body += "<Part><PartNumber>" + QByteArray::number(it.key()) + "</PartNumber>"
+                "<ETag>" + it.value() + "</ETag></Part>";
+        ++it;
+    }
+    body += "</CompleteMultipartUpload>";
+
+    QNetworkRequest request = S3Client::signedRequest("POST", m_key, "uploadId=" + m_uploadId, "application/xml");
+    QNetworkReply* reply = S3Client::manager()->post(request, body);
+    connect(reply, SIGNAL(finished()), this, SLOT(completeFinished()));
+}
+
+void S3Upload::completeFinished()
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    reply->deleteLater();
+
+    if (reply->error() == QNetworkReply::NoError) {
+        // S3 may report a failure in the body of a 200 response
+        const QByteArray result = reply->readAll();
+        if (!result.contains("<Error>")) {
+            clearState();
+            done(true);
+            return;
+        }
+        qWarning() << "unable to complete upload" << m_key << result;
+        if (++m_retries > S3_UPLOAD_RETRIES) {
+            fail();
+            return;
+        }
+    } else {
+        qWarning() << "unable to complete upload" << m_key << reply->errorString();
+        if (!retry(reply, m_retries)) {
+            fail();
+            return;
+        }
+    }
+    QTimer::singleShot(S3_RETRY_DELAY * m_retries, this, SLOT(complete()));
+}
+
+void S3Upload::fail()
+{
+    // The state on disk is kept so that the next run can resume
+    m_failed = true;
+    QHash<QNetworkReply*, int>::const_iterator it = m_parts.begin();
+    const QHash<QNetworkReply*, int>::const_iterator end = m_parts.end();
+    while (it != end) {
+        it.key()->disconnect(this);
+        it.key()->abort();
+        untrack(it.key(), 0, false);
+        ++it;
+    }
+    m_parts.clear();
+    done(false);
+}
+
+void S3Upload::done(bool ok)
+{
+    emit finished(ok);
+}
+
+void S3Upload::loadState()
+{
+    QSettings settings(stateFile(), QSettings::IniFormat);
+    settings.beginGroup(stateGroup(m_key));
+    if (!settings.contains(QLatin1String("uploadId")))
+        return;
+
+    if (settings.value(QLatin1String("file")).toString() != m_filename
+        || settings.value(QLatin1String("size")).toLongLong() != m_size
+        || settings.value(QLatin1String("mtime")).toUInt() != m_mtime) {
+        // The file changed since, throw away what was uploaded of it
+        const QByteArray stale = settings.value(QLatin1String("uploadId")).toByteArray();
+        QNetworkRequest request = S3Client::signedRequest("DELETE", m_key, "uploadId=" + stale);
+        QNetworkReply* reply = S3Client::manager()->deleteResource(request);
+        connect(reply, SIGNAL(finished()), reply, SLOT(deleteLater()));
+
+        settings.remove(QString());
+        return;
+    }
+
+    m_uploadId = settings.value(QLatin1String("uploadId")).toByteArray();
+    foreach(const QString& entry, settings.value(QLatin1String("parts")).toStringList()) {
+        const int colon = entry.indexOf(QLatin1Char(':'));
+        if (colon == -1)
+            continue;
+        const int part = entry.left(colon).toInt();
+        if (part >= 1 && part <= m_partCount)
+            m_etags[part] = entry.mid(colon + 1).toLatin1();
+    }
+}
+
+void S3Upload::saveState()
+{
+    QStringList parts;
+    QMap<int, QByteArray>::const_iterator it = m_etags.begin();
+    const QMap<int, QByteArray>::const_iterator end = m_etags.end();
+    while (it != end) {
+        parts.append(QString::number(it.key()) + QLatin1Char(':') + QString::fromLatin1(it.value()));
+        ++it;
+    }
+
+    QSettings settings(stateFile(), QSettings::IniFormat);
+    settings.beginGroup(stateGroup(m_key));
+    settings.setValue(QLatin1String("file"), m_filename);
+    settings.setValue(QLatin1String("size"), m_size);
+    settings.setValue(QLatin1String("mtime"), m_mtime);
+    settings.setValue(QLatin1String("uploadId"), m_uploadId);
+    settings.setValue(QLatin1String("parts"), parts);
+}
+
+void S3Upload::clearState()
+{
+    QSettings settings(stateFile(), QSettings::IniFormat);
+    settings.remove(stateGroup(m_key));
+}
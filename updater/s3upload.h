@@ -0,0 +1,103 @@
+/*
+    Ornament - A cross plaform audio player
+    Copyright (C) 2011  Jan Erik Hanssen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef S3UPLOAD_H
+#define S3UPLOAD_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+#include <QHash>
+#include <QMap>
+#include <QList>
+
+class QNetworkReply;
+
+// Uploads one object. Small objects are sent with a single PUT, large ones
+// as a multipart upload where each part is retried on its own and the
+// upload id and finished parts are kept on disk so an interrupted run
+// picks up where it left off.
+class S3Upload : public QObject
+{
+    Q_OBJECT
+public:
+    S3Upload(const QByteArray& key, const QString& filename, const QByteArray& contentType, QObject* parent = 0);
+    S3Upload(const QByteArray& key, const QByteArray& data, const QByteArray& contentType, QObject* parent = 0);
+    ~S3Upload();
+
+    QByteArray key() const;
+    qint64 size() const;
+    bool isMultipart() const;
+
+    // The part size an object of size bytes is uploaded with, 0 for a single PUT
+    static qint64 partSize(qint64 size);
+
+public slots:
+    void start();
+
+signals:
+    // bytes is the change in bytes sent, negative when a request is retried
+    void progress(qint64 bytes);
+    void finished(bool ok);
+
+private slots:
+    void put();
+    void putFinished();
+    void initiate();
+    void initiateFinished();
+    void sendParts();
+    void partFinished();
+    void complete();
+    void completeFinished();
+    void uploadProgress(qint64 sent, qint64 total);
+
+private:
+    QByteArray readPart(qint64 offset, qint64 length) const;
+    qint64 partLength(int part) const;
+    void queueParts();
+    void restart();
+    void fail();
+    void done(bool ok);
+    bool retry(QNetworkReply* reply, int& retries);
+
+    QNetworkReply* track(QNetworkReply* reply);
+    void untrack(QNetworkReply* reply, qint64 length, bool ok);
+
+    void loadState();
+    void saveState();
+    void clearState();
+
+    QByteArray m_key;
+    QString m_filename;
+    QByteArray m_data;
+    QByteArray m_contentType;
+    qint64 m_size;
+    uint m_mtime;
+    int m_retries;
+    bool m_failed;
+
+    QByteArray m_uploadId;
+    int m_partCount;
+    QMap<int, QByteArray> m_etags;
+    QList<int> m_pending;
+    QHash<int, int> m_partRetries;
+    QHash<QNetworkReply*, int> m_parts;
+    QHash<QNetworkReply*, qint64> m_sent;
+};
+
+#endif // S3UPLOAD_H
@@ -17,13 +17,18 @@
 */
 
 #include "updater.h"
+#include "s3upload.h"
 #include "trackduration.h"
 #include "tag.h"
-#include "awsconfig.h"
-#include "libs3.h"
-#include <QTimer>
+#include "s3client.h"
 #include <QApplication>
-#include <QTemporaryFile>
+#include <QRunnable>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QCryptographicHash>
+#include <QTextStream>
+#include <QBuffer>
+#include <QFile>
 #include <QDir>
 #include <QLabel>
 #include <QProgressBar>
@@ -32,6 +37,11 @@
 #include <QUrl>
 #include <QDebug>
 
+#define UPDATER_WALK_BATCH 64
+#define UPDATER_UPLOADS 6
+#define UPDATER_BACKLOG 64
+#define UPDATER_HASH_WINDOW (8 * 1024 * 1024)
+
 class Progress : public QWidget
 {
 public:
@@ -60,7 +70,174 @@ Progress::Progress(QWidget *parent)
     vbox->addLayout(hbox);
 }
 
-static QByteArray mimeType(const QString &filename)
+class TagTask : public QRunnable
+{
+public:
+    TagTask(const QString& filename, QObject* receiver);
+
+    void run();
+
+private:
+    QString m_filename;
+    QObject* m_receiver;
+};
+
+TagTask::TagTask(const QString &filename, QObject *receiver)
+    : m_filename(filename), m_receiver(receiver)
+{
+}
+
+void TagTask::run()
+{
+    UpdateTrack track;
+    track.filename = m_filename;
+
+    Tag tag(m_filename);
+    track.artist = tag.data("artist").toString();
+    track.album = tag.data("album").toString();
+    track.title = tag.data("title").toString();
+    track.trackno = tag.data("track").toInt();
+    track.artwork = tag.data("picture0").value<QImage>();
+    track.duration = 0;
+    if (Updater::mimeType(m_filename) == "audio/mp3")
+        track.duration = TrackDuration::duration(QFileInfo(m_filename));
+
+    QMetaObject::invokeMethod(m_receiver, "trackRead", Qt::QueuedConnection, Q_ARG(UpdateTrack, track));
+}
+
+// Computes the MD5 of a file and, when it is large enough to be uploaded in
+// parts, the ETag S3 gives a multipart upload: the MD5 of the part MD5s
+class HashTask : public QRunnable
+{
+public:
+    HashTask(const QByteArray& key, const QString& filename, QObject* receiver);
+
+    void run();
+
+private:
+    QByteArray m_key;
+    QString m_filename;
+    QObject* m_receiver;
+};
+
+HashTask::HashTask(const QByteArray &key, const QString &filename, QObject *receiver)
+    : m_key(key), m_filename(filename), m_receiver(receiver)
+{
+}
+
+void HashTask::run()
+{
+    QByteArray md5, multipart;
+
+    QFile file(m_filename);
+    if (file.open(QFile::ReadOnly)) {
+        const qint64 size = file.size();
+        const qint64 partSize = S3Upload::partSize(size);
+        const qint64 window = partSize ? partSize : UPDATER_HASH_WINDOW;
+
+        QCryptographicHash whole(QCryptographicHash::Md5);
+        QByteArray parts;
+        int partCount = 0;
+        bool ok = true;
+
+        for (qint64 offset = 0; offset < size && ok; offset += window) {
+            const qint64 length = qMin(window, size - offset);
+
+            // Map a window at a time to keep the address space in check on
+            // 32 bit systems, reading is the fallback where mapping fails
+            QByteArray chunk;
+            const char* data;
+            uchar* mapped = file.map(offset, length);
+            if (mapped) {
+                data = reinterpret_cast<const char*>(mapped);
+            } else {
+                if (!file.seek(offset))
+                    chunk.clear();
+                else
+                    chunk = file.read(length);
+                if (chunk.size() != length) {
+                    ok = false;
+                    break;
+                }
+                data = chunk.constData();
+            }
+
+            whole.addData(data, length);
+            if (partSize) {
+                parts += QCryptographicHash::hash(QByteArray::fromRawData(data, length), QCryptographicHash::Md5);
+                ++partCount;
+            }
+
+            if (mapped)
+                file.unmap(mapped);
+        }
+
+        if (ok) {
+            md5 = whole.result().toHex();
+            if (partSize)
+                multipart = QCryptographicHash::hash(parts, QCryptographicHash::Md5).toHex() + '-' + QByteArray::number(partCount);
+        }
+    }
+
+    QMetaObject::invokeMethod(m_receiver, "fileHashed", Qt::QueuedConnection,
+                              Q_ARG(QByteArray, m_key), Q_ARG(QByteArray, md5), Q_ARG(QByteArray, multipart));
+}
+
+UpdateWalker::UpdateWalker(const QString &path, QObject *parent)
+    : QThread(parent), m_path(path)
+{
+}
+
+void UpdateWalker::run()
+{
+    QStringList batch;
+    qint64 size = 0;
+    walk(m_path, batch, size);
+    if (!batch.isEmpty())
+        emit found(batch, size);
+}
+
+void UpdateWalker::walk(const QString &path, QStringList &batch, qint64 &size)
+{
+    QDir dir(path);
+
+    QList<QFileInfo> list = dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot | QDir::Readable);
+    foreach(const QFileInfo& info, list) {
+        if (info.isDir())
+            walk(info.absoluteFilePath(), batch, size);
+        else if (info.isFile()) {
+            if (Updater::mimeType(info.absoluteFilePath()).startsWith("audio/")) {
+                batch.append(info.absoluteFilePath());
+                size += info.size();
+                if (batch.size() >= UPDATER_WALK_BATCH) {
+                    emit found(batch, size);
+                    batch.clear();
+                    size = 0;
+                }
+            }
+        }
+    }
+}
+
+Updater::Updater(QObject *parent)
+    : QObject(parent), m_sync(false), m_deleteRemoved(false), m_dryRun(false), m_walker(0), m_reading(0),
+      m_lister(0), m_listed(false), m_deletesQueued(false), m_deleting(0),
+      m_totalSize(0), m_sent(0), m_fileCount(0), m_filesDone(0), m_failed(0), m_progress(new Progress)
+{
+    qRegisterMetaType<UpdateTrack>("UpdateTrack");
+
+    m_progress->show();
+}
+
+Updater::~Updater()
+{
+    m_workers.waitForDone();
+    if (m_walker)
+        m_walker->wait();
+    delete m_progress;
+}
+
+QByteArray Updater::mimeType(const QString &filename)
 {
     if (filename.isEmpty())
         return QByteArray();
@@ -79,198 +256,390 @@ static QByteArray mimeType(const QString &filename)
     return QByteArray();
 }
 
-static int dataCallback(int bufferSize, char* buffer, void* callbackData)
+static inline QByteArray encodeFilename(int trackno, const QString& track, int duration, const QString& ext)
+{
+    QString tracknoslash = track;
+    tracknoslash.replace(QLatin1Char('/'), QLatin1Char('~'));
+    QByteArray t = QUrl::toPercentEncoding(tracknoslash);
+    return QByteArray::number(trackno) + '_' + t + '_' + QByteArray::number(duration) + '.' + ext.toLatin1();
+}
+
+QByteArray Updater::trackKey(const UpdateTrack &track)
 {
-    Updater* updater = (Updater*)callbackData;
-    int read = updater->readFromCurrent(bufferSize, buffer);
-    updater->updateProgress(read);
+    return QUrl::toPercentEncoding(track.artist) + "/" + QUrl::toPercentEncoding(track.album) + "/"
+            + encodeFilename(track.trackno, track.title, track.duration, QFileInfo(track.filename).suffix());
+}
 
-    //qDebug() << "read" << updater->currentPosition() << "of" << updater->currentSize() << "from" << updater->currentFilename();
+QByteArray Updater::trackStem(const QByteArray &key)
+{
+    // artist/album/trackno_title_duration.ext, the title may contain '_'
+    const int slash = key.lastIndexOf('/');
+    const int dot = key.lastIndexOf('.');
+    const int underscore = key.lastIndexOf('_', dot);
+    if (key.count('/') != 2 || dot < slash || underscore <= slash || underscore + 1 >= dot)
+        return key;
+
+    for (int i = underscore + 1; i < dot; ++i) {
+        if (key.at(i) < '0' || key.at(i) > '9')
+            return key;
+    }
+    return key.left(underscore) + key.mid(dot);
+}
 
-    return read;
+void Updater::setSync(bool sync)
+{
+    m_sync = sync;
 }
 
-static void completeCallback(S3Status status, const S3ErrorDetails* errorDetails, void* callbackData)
+void Updater::setDeleteRemoved(bool remove)
 {
-    Q_UNUSED(callbackData)
+    m_deleteRemoved = remove;
+    if (remove)
+        m_sync = true;
+}
 
-    qDebug() << "complete" << status;
+void Updater::setDryRun(bool dryRun)
+{
+    m_dryRun = dryRun;
+    if (dryRun)
+        m_sync = true;
+}
 
-    if (errorDetails) {
-        if (errorDetails->message)
-            qDebug() << errorDetails->message;
-        if (errorDetails->resource)
-            qDebug() << errorDetails->resource;
-        if (errorDetails->furtherDetails)
-            qDebug() << errorDetails->furtherDetails;
+void Updater::update(const QString &path)
+{
+    if (m_sync) {
+        // The bucket is listed once while the tags are being read, the
+        // tracks read before it completes wait for it in m_unresolved
+        m_lister = new S3Lister(this);
+        connect(m_lister, SIGNAL(prefixListed(QByteArray,S3Objects)), this, SLOT(remoteListed(QByteArray,S3Objects)));
+        connect(m_lister, SIGNAL(complete(bool)), this, SLOT(listComplete(bool)));
+        m_lister->start();
     }
+
+    m_walker = new UpdateWalker(path, this);
+    connect(m_walker, SIGNAL(found(QStringList,qint64)), this, SLOT(filesFound(QStringList,qint64)));
+    connect(m_walker, SIGNAL(finished()), this, SLOT(walkFinished()));
+    m_walker->start();
 }
 
-static S3Status propertiesCallback(const S3ResponseProperties* properties, void* callbackData)
+void Updater::filesFound(const QStringList &files, qint64 size)
 {
-    Q_UNUSED(properties)
-    Q_UNUSED(callbackData)
+    m_files += files;
+    m_fileCount += files.size();
+    m_totalSize += size;
+    updateProgress();
 
-    return S3StatusOK;
+    readTags();
 }
 
-Updater::Updater(QObject *parent)
-    : QObject(parent), m_totalsize(0), m_writingArtwork(false), m_current(0), m_progress(new Progress)
+void Updater::walkFinished()
 {
-    m_progress->show();
+    m_walker->deleteLater();
+    m_walker = 0;
+
+    finishIfDone();
 }
 
-Updater::~Updater()
+void Updater::readTags()
 {
-    delete m_progress;
+    // Only read ahead as far as the uploads can keep up with, the tags of a
+    // large collection would otherwise pile up in memory
+    const int readers = m_workers.maxThreadCount();
+    while (!m_files.isEmpty() && m_reading < readers
+           && m_reading + m_unresolved.size() + m_hashing.size() + m_uploads.size() < UPDATER_BACKLOG) {
+        ++m_reading;
+        m_workers.start(new TagTask(m_files.takeFirst(), this));
+    }
 }
 
-void Updater::updateProgress(int read)
+void Updater::trackRead(const UpdateTrack &track)
 {
-    if (!m_writingArtwork) {
-        static int total = 0;
-        total += read;
-        m_progress->totalProgress->setValue(total);
+    --m_reading;
+
+    Pending pending;
+    pending.key = trackKey(track);
+    pending.filename = track.filename;
+    pending.contentType = mimeType(track.filename);
+    pending.size = QFileInfo(track.filename).size();
+    queueTransfer(pending);
+
+    const QString album = track.artist + QLatin1Char('/') + track.album;
+    if (!track.artwork.isNull() && !m_artworkWritten.contains(album)) {
+        m_artworkWritten.insert(album);
+
+        QByteArray png;
+        QBuffer buffer(&png);
+        buffer.open(QBuffer::WriteOnly);
+        track.artwork.save(&buffer, "PNG");
+
+        Pending artwork;
+        artwork.key = pending.key.left(pending.key.lastIndexOf('/') + 1) + "Folder.png";
+        artwork.data = png;
+        artwork.contentType = "image/png";
+        artwork.size = png.size();
+        m_totalSize += artwork.size;
+        ++m_fileCount;
+        queueTransfer(artwork);
     }
-    m_progress->fileProgress->setValue(m_current->pos());
-    QApplication::processEvents();
+
+    readTags();
+    finishIfDone();
 }
 
-void Updater::updateProgressName(const QString &artist, const QString &album, const QString &track)
+void Updater::queueTransfer(const Pending &pending)
 {
-    m_progress->fileProgress->setMaximum(m_current->size());
-    m_progress->fileProgress->setValue(0);
+    m_local.insert(pending.key);
+    if (!m_sync) {
+        transfer(pending, m_new);
+        return;
+    }
 
-    m_progress->fileNameLabel->setText(track);
-    m_progress->topLevelWidget()->setWindowTitle(artist + " / " + album);
+    m_artists.insert(pending.key.left(pending.key.indexOf('/')));
+    m_unresolved.append(pending);
+    if (m_listed)
+        resolve();
 }
 
-void Updater::update(const QString &path)
+void Updater::remoteListed(const QByteArray &prefix, const S3Objects &objects)
 {
-    m_path = path;
-    QTimer::singleShot(0, this, SLOT(startUpdate()));
+    Q_UNUSED(prefix)
+
+    foreach(const S3Object& object, objects) {
+        S3Object& remote = m_remote[object.key];
+        remote = object;
+        remote.etag.replace('"', QByteArray());
+
+        const QByteArray stem = trackStem(object.key);
+        if (stem != object.key)
+            m_remoteStems.insert(stem, object.key);
+    }
 }
 
-static inline QByteArray encodeFilename(int trackno, const QString& track, int duration, const QString& ext)
+void Updater::listComplete(bool ok)
 {
-    QString tracknoslash = track;
-    tracknoslash.replace(QLatin1Char('/'), QLatin1Char('~'));
-    QByteArray t = QUrl::toPercentEncoding(tracknoslash);
-    return QByteArray::number(trackno) + '_' + t + '_' + QByteArray::number(duration) + '.' + ext.toLatin1();
+    m_lister->deleteLater();
+    m_lister = 0;
+
+    if (!ok) {
+        // Without the full listing a sync would upload too much and delete
+        // too little, give up before anything is changed
+        qWarning() << "unable to list the bucket";
+        m_failed = m_fileCount;
+        report();
+        qApp->quit();
+        return;
+    }
+
+    m_listed = true;
+    resolve();
+    finishIfDone();
 }
 
-void Updater::startUpdate()
-{
-    updateDirectory(m_path);
-
-    m_progress->totalProgress->setMaximum(m_totalsize);
-
-    S3BucketContext* context = (S3BucketContext*)malloc(sizeof(S3BucketContext));
-    context->accessKeyId = AwsConfig::accessKey();
-    context->secretAccessKey = AwsConfig::secretKey();
-    context->bucketName = AwsConfig::bucket();
-    context->protocol = S3ProtocolHTTPS;
-    context->uriStyle = S3UriStyleVirtualHost;
-
-    int trackno, duration;
-    QString album, artist, track;
-    QImage artwork;
-    QSet<QString> artworkWritten;
-
-    QByteArray mime;
-    foreach(const QFileInfo& info, m_update) {
-        mime = mimeType(info.absoluteFilePath());
-        if (mime.startsWith("audio/")) {
-            Tag tag(info.absoluteFilePath());
-            artist = tag.data("artist").toString();
-            album = tag.data("album").toString();
-            track = tag.data("title").toString();
-            trackno = tag.data("track").toInt();
-            artwork = tag.data("picture0").value<QImage>();
-            duration = 0;
-            if (mime == "audio/mp3")
-                duration = TrackDuration::duration(info);
-
-            //qDebug() << "updating" << info.absoluteFilePath() << artist << album << track << trackno << artwork.size() << duration;
-            m_current = new QFile;
-            m_current->setFileName(info.absoluteFilePath());
-            if (m_current->open(QFile::ReadOnly)) {
-                updateProgressName(artist, album, track);
-
-                QByteArray key = QUrl::toPercentEncoding(artist) + "/" + QUrl::toPercentEncoding(album) + "/" + encodeFilename(trackno, track, duration, info.suffix());
-                S3PutObjectHandler objectHandler;
-                objectHandler.responseHandler.completeCallback = completeCallback;
-                objectHandler.responseHandler.propertiesCallback = propertiesCallback;
-                objectHandler.putObjectDataCallback = dataCallback;
-                S3_put_object(context, key.constData(), m_current->size(), 0, 0, &objectHandler, this);
-            }
-            delete m_current;
-
-            if (!artworkWritten.contains(artist + "/" + album) && !artwork.isNull()) {
-                artworkWritten.insert(artist + "/" + album);
-                m_current = new QTemporaryFile("playerartwork");
-                if (static_cast<QTemporaryFile*>(m_current)->open()) {
-                    m_writingArtwork = true;
-                    QString fn = m_current->fileName();
-                    int lastSlash = fn.lastIndexOf(QLatin1Char('/'));
-                    if (lastSlash != -1)
-                        fn = fn.mid(lastSlash + 1);
-                    updateProgressName(artist, album, fn);
-
-                    artwork.save(m_current, "PNG");
-                    m_current->seek(0);
-
-                    S3PutObjectHandler objectHandler;
-                    objectHandler.responseHandler.completeCallback = completeCallback;
-                    objectHandler.responseHandler.propertiesCallback = propertiesCallback;
-                    objectHandler.putObjectDataCallback = dataCallback;
-                    QByteArray key = QUrl::toPercentEncoding(artist) + "/" + QUrl::toPercentEncoding(album) + "/Folder.png";
-                    S3_put_object(context, key.constData(), m_current->size(), 0, 0, &objectHandler, this);
-                    m_writingArtwork = false;
-                }
-                delete m_current;
-            }
+void Updater::resolve()
+{
+    while (!m_unresolved.isEmpty()) {
+        Pending pending = m_unresolved.takeFirst();
+
+        // Uploaded with a duration from an earlier scan, the same content is
+        // left where it is and a new one replaces it
+        QHash<QByteArray, S3Object>::const_iterator remote = m_remote.find(pending.key);
+        if (remote == m_remote.end()) {
+            const QByteArray stem = trackStem(pending.key);
+            if (stem != pending.key)
+                remote = m_remote.find(m_remoteStems.value(stem));
+        }
+        if (remote != m_remote.end())
+            pending.remote = remote.key();
+
+        if (remote == m_remote.end()) {
+            transfer(pending, m_new);
+        } else if (remote.value().size != pending.size) {
+            transfer(pending, m_changed);
+        } else if (pending.filename.isEmpty()) {
+            if (QCryptographicHash::hash(pending.data, QCryptographicHash::Md5).toHex() == remote.value().etag)
+                skip(pending);
+            else
+                transfer(pending, m_changed);
+        } else {
+            // Same size, only the content can tell
+            m_hashing.insert(pending.key, pending);
+            m_workers.start(new HashTask(pending.key, pending.filename, this));
         }
     }
+}
 
-    free(context);
+void Updater::fileHashed(const QByteArray &key, const QByteArray &md5, const QByteArray &multipartEtag)
+{
+    const Pending pending = m_hashing.take(key);
+    const QByteArray etag = m_remote.value(pending.remote).etag;
+
+    if (md5.isEmpty()) {
+        // Whatever is stored for it stays, it is all there is of the file
+        qWarning() << "unable to read" << pending.filename;
+        m_local.insert(pending.remote);
+        ++m_failed;
+        ++m_filesDone;
+        updateProgress();
+    } else if (etag == md5 || (!multipartEtag.isEmpty() && etag == multipartEtag)) {
+        skip(pending);
+    } else {
+        transfer(pending, m_changed);
+    }
 
-    qApp->quit();
+    readTags();
+    finishIfDone();
 }
 
-int Updater::readFromCurrent(int bufferSize, char *buffer)
+void Updater::transfer(const Pending &pending, Count &count)
 {
-    return m_current->read(buffer, bufferSize);
+    count.add(pending.size);
+
+    if (m_dryRun) {
+        qDebug() << "would upload" << QUrl::fromPercentEncoding(pending.key) << pending.size << "bytes";
+        m_sent += pending.size;
+        ++m_filesDone;
+        updateProgress();
+        return;
+    }
+
+    if (!pending.remote.isEmpty() && pending.remote != pending.key)
+        m_replacing.insert(pending.key, pending.remote);
+    if (pending.filename.isEmpty())
+        queueUpload(new S3Upload(pending.key, pending.data, pending.contentType, this));
+    else
+        queueUpload(new S3Upload(pending.key, pending.filename, pending.contentType, this));
 }
 
-QString Updater::currentFilename() const
+void Updater::skip(const Pending &pending)
 {
-    return m_current->fileName();
+    // Kept by --delete under the key it already has
+    m_local.insert(pending.remote);
+    m_unchanged.add(pending.size);
+    m_sent += pending.size;
+    ++m_filesDone;
+    updateProgress();
 }
 
-qint64 Updater::currentPosition() const
+void Updater::queueUpload(S3Upload *upload)
 {
-    return m_current->pos();
+    connect(upload, SIGNAL(progress(qint64)), this, SLOT(uploadProgress(qint64)));
+    connect(upload, SIGNAL(finished(bool)), this, SLOT(uploadFinished(bool)));
+    m_uploads.append(upload);
+
+    startUploads();
 }
 
-qint64 Updater::currentSize() const
+void Updater::startUploads()
 {
-    return m_current->size();
+    while (!m_uploads.isEmpty() && m_active.size() < UPDATER_UPLOADS) {
+        S3Upload* upload = m_uploads.takeFirst();
+        m_active.insert(upload);
+        m_progress->fileNameLabel->setText(QUrl::fromPercentEncoding(upload->key()));
+        upload->start();
+    }
 }
 
-void Updater::updateDirectory(const QString &path)
+void Updater::uploadProgress(qint64 bytes)
 {
-    QDir dir(path);
+    m_sent += bytes;
+    updateProgress();
+}
 
-    QList<QFileInfo> list = dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot | QDir::Readable);
-    foreach(const QFileInfo& info, list) {
-        if (info.isDir())
-            updateDirectory(info.absoluteFilePath());
-        else if (info.isFile()) {
-            if (!mimeType(info.absoluteFilePath()).isEmpty()) {
-                m_totalsize += info.size();
-                m_update.append(info);
+void Updater::uploadFinished(bool ok)
+{
+    S3Upload* upload = static_cast<S3Upload*>(sender());
+    m_active.remove(upload);
+    upload->deleteLater();
+
+    ++m_filesDone;
+    const QByteArray replaced = m_replacing.take(upload->key());
+    if (!ok) {
+        // --delete must not remove the copy the upload was meant to replace
+        qWarning() << "failed to upload" << QUrl::fromPercentEncoding(upload->key());
+        if (!replaced.isEmpty())
+            m_local.insert(replaced);
+        ++m_failed;
+    }
+    updateProgress();
+
+    startUploads();
+    readTags();
+    finishIfDone();
+}
+
+void Updater::removeDeleted()
+{
+    // Only artists that exist locally are considered, syncing a part of the
+    // collection must not remove the rest of it
+    QHash<QByteArray, S3Object>::const_iterator it = m_remote.begin();
+    const QHash<QByteArray, S3Object>::const_iterator end = m_remote.end();
+    while (it != end) {
+        const QByteArray& key = it.key();
+        if (key.count('/') == 2 && !m_local.contains(key) && m_artists.contains(key.left(key.indexOf('/')))) {
+            m_removed.add(it.value().size);
+            if (m_dryRun) {
+                qDebug() << "would delete" << QUrl::fromPercentEncoding(key);
+            } else {
+                QNetworkReply* reply = S3Client::manager()->deleteResource(S3Client::signedRequest("DELETE", key));
+                connect(reply, SIGNAL(finished()), this, SLOT(deleteFinished()));
+                ++m_deleting;
             }
         }
+        ++it;
+    }
+}
+
+void Updater::deleteFinished()
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    reply->deleteLater();
+    if (reply->error() != QNetworkReply::NoError) {
+        qWarning() << "failed to delete" << reply->url() << reply->errorString();
+        ++m_failed;
+    }
+
+    --m_deleting;
+    finishIfDone();
+}
+
+void Updater::updateProgress()
+{
+    // In KB, a collection in bytes does not fit the progress bar's int
+    m_progress->totalProgress->setMaximum(m_totalSize / 1024);
+    m_progress->totalProgress->setValue(m_sent / 1024);
+    m_progress->fileProgress->setMaximum(m_fileCount);
+    m_progress->fileProgress->setValue(m_filesDone);
+}
+
+void Updater::finishIfDone()
+{
+    if (m_walker || !m_files.isEmpty() || m_reading || (m_sync && !m_listed)
+        || !m_unresolved.isEmpty() || !m_hashing.isEmpty()
+        || !m_uploads.isEmpty() || !m_active.isEmpty() || m_deleting)
+        return;
+
+    if (m_deleteRemoved && !m_deletesQueued) {
+        m_deletesQueued = true;
+        removeDeleted();
+        if (m_deleting)
+            return;
+    }
+
+    report();
+    qApp->quit();
+}
+
+void Updater::report()
+{
+    QTextStream out(stdout);
+    if (m_sync) {
+        out << "new:       " << m_new.files << " files, " << m_new.bytes << " bytes\n";
+        out << "changed:   " << m_changed.files << " files, " << m_changed.bytes << " bytes\n";
+        out << "unchanged: " << m_unchanged.files << " files, " << m_unchanged.bytes << " bytes\n";
+        if (m_deleteRemoved)
+            out << (m_dryRun ? "to delete: " : "deleted:   ") << m_removed.files << " files, " << m_removed.bytes << " bytes\n";
     }
+    out << (m_dryRun ? "would transfer " : "transferred ") << m_new.bytes + m_changed.bytes << " bytes\n";
+    if (m_failed)
+        out << m_failed << " failed\n";
 }
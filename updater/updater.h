@@ -19,11 +19,51 @@
 #ifndef UPDATER_H
 #define UPDATER_H
 
+#include "s3lister.h"
 #include <QObject>
+#include <QThread>
+#include <QThreadPool>
+#include <QStringList>
+#include <QImage>
 #include <QList>
-#include <QFileInfo>
+#include <QHash>
+#include <QSet>
+#include <QMetaType>
 
 class Progress;
+class S3Upload;
+
+struct UpdateTrack
+{
+    QString filename;
+    QString artist;
+    QString album;
+    QString title;
+    int trackno;
+    int duration;
+    QImage artwork;
+};
+
+Q_DECLARE_METATYPE(UpdateTrack)
+
+// Walks the directory tree off the GUI thread, handing out files in batches
+class UpdateWalker : public QThread
+{
+    Q_OBJECT
+public:
+    UpdateWalker(const QString& path, QObject* parent = 0);
+
+signals:
+    void found(const QStringList& files, qint64 size);
+
+protected:
+    void run();
+
+private:
+    void walk(const QString& path, QStringList& batch, qint64& size);
+
+    QString m_path;
+};
 
 class Updater : public QObject
 {
@@ -32,28 +72,100 @@ public:
     Updater(QObject *parent = 0);
     ~Updater();
 
-    void update(const QString& path);
-
-    int readFromCurrent(int bufferSize, char* buffer);
-    QString currentFilename() const;
+    // Only upload objects that are missing from the bucket or differ from it
+    void setSync(bool sync);
+    // Delete objects under the artists being synced that no longer exist locally
+    void setDeleteRemoved(bool remove);
+    // Report what a sync would transfer and delete without doing it
+    void setDryRun(bool dryRun);
 
-    qint64 currentPosition() const;
-    qint64 currentSize() const;
+    void update(const QString& path);
 
-    void updateProgress(int read);
-    void updateProgressName(const QString& artist, const QString& album, const QString& track);
+    static QByteArray mimeType(const QString& filename);
+    static QByteArray trackKey(const UpdateTrack& track);
+    // The key without the duration, durations from different scans of the
+    // same file need not agree
+    static QByteArray trackStem(const QByteArray& key);
 
 private slots:
-    void startUpdate();
-    void updateDirectory(const QString& path);
+    void filesFound(const QStringList& files, qint64 size);
+    void walkFinished();
+    void trackRead(const UpdateTrack& track);
+    void remoteListed(const QByteArray& prefix, const S3Objects& objects);
+    void listComplete(bool ok);
+    void fileHashed(const QByteArray& key, const QByteArray& md5, const QByteArray& multipartEtag);
+    void uploadProgress(qint64 bytes);
+    void uploadFinished(bool ok);
+    void deleteFinished();
 
 private:
-    QString m_path;
-    QList<QFileInfo> m_update;
-    quint64 m_totalsize;
-
-    bool m_writingArtwork;
-    QFile* m_current;
+    struct Pending
+    {
+        QByteArray key;
+        // The object it is compared with, key or one that only differs in the duration
+        QByteArray remote;
+        QString filename;
+        QByteArray data;
+        QByteArray contentType;
+        qint64 size;
+    };
+
+    struct Count
+    {
+        Count() : files(0), bytes(0) {}
+        void add(qint64 size) { ++files; bytes += size; }
+
+        int files;
+        quint64 bytes;
+    };
+
+    void readTags();
+    void queueTransfer(const Pending& pending);
+    void resolve();
+    void transfer(const Pending& pending, Count& count);
+    void skip(const Pending& pending);
+    void queueUpload(S3Upload* upload);
+    void startUploads();
+    void removeDeleted();
+    void finishIfDone();
+    void updateProgress();
+    void report();
+
+    bool m_sync;
+    bool m_deleteRemoved;
+    bool m_dryRun;
+
+    UpdateWalker* m_walker;
+    QThreadPool m_workers;
+    QStringList m_files;
+    int m_reading;
+    QList<S3Upload*> m_uploads;
+    QSet<S3Upload*> m_active;
+    QSet<QString> m_artworkWritten;
+
+    S3Lister* m_lister;
+    bool m_listed;
+    QHash<QByteArray, S3Object> m_remote;
+    QHash<QByteArray, QByteArray> m_remoteStems;
+    QList<Pending> m_unresolved;
+    QHash<QByteArray, Pending> m_hashing;
+    QSet<QByteArray> m_local;
+    // Uploads replacing an object under another key, by the key uploaded to
+    QHash<QByteArray, QByteArray> m_replacing;
+    QSet<QByteArray> m_artists;
+    bool m_deletesQueued;
+    int m_deleting;
+
+    Count m_new;
+    Count m_changed;
+    Count m_unchanged;
+    Count m_removed;
+
+    quint64 m_totalSize;
+    quint64 m_sent;
+    int m_fileCount;
+    int m_filesDone;
+    int m_failed;
 
     Progress* m_progress;
 };
@@ -4,6 +4,7 @@
 
 TEMPLATE = app
 TARGET = 
+QT += network
 DEPENDPATH += .
 INCLUDEPATH += . .. ../libs3/inc
 
@@ -13,12 +14,22 @@ mac {
 }
 
 # Input
-SOURCES += main.cpp ../tag.cpp ../awsconfig.cpp \
+SOURCES += main.cpp ../tag.cpp ../awsconfig.cpp ../s3client.cpp \
+    ../io.cpp ../s3lister.cpp \
+    ../frameindex.cpp \
+    ../codecs/mad/xing_mad.cpp \
+    ../codecs/mad/probe_mad.cpp \
     updater.cpp \
-    trackduration.cpp
-HEADERS += ../tag.h ../awsconfig.h \
+    trackduration.cpp \
+    s3upload.cpp
+HEADERS += ../tag.h ../awsconfig.h ../s3client.h \
+    ../io.h ../s3lister.h \
+    ../frameindex.h \
+    ../codecs/mad/xing_mad.h \
+    ../codecs/mad/probe_mad.h \
     updater.h \
-    trackduration.h
+    trackduration.h \
+    s3upload.h
 
 DEFINES += BUILDING_UPDATER
 